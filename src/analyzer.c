@@ -4,18 +4,32 @@
 
 
 #include "analyzer.h"
+#include "backend.h"
+#include "catalog.h"
+#include "device.h"
+#include "directory.h"
 #include "globals.h"
+#include "inode.h"
 #include "inode_queue.h"
 #include "log.h"
+#include "thrd_ctrl.h"
 #include "utils.h"
 
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 
+#define ANALYZE_BATCH   32             // Directory inodes taken off the queue at once
+#define ANALYZE_WAIT_MS 100            // Time to wait for inodes before looking at the scanners again
+#define DIR_LEAF_OFFSET ( 1ULL << 35 ) // Byte offset of the first leaf block of a long form directory
+#define SB_FTYPE_V4     0x0200         // Directory entries have a file type (add_flags, v4)
+#define SB_FTYPE_V5     0x0001         // Directory entries have a file type (rw_inco_flags, v5)
+
+
 static int init_analyze_data( analyze_data_t* analyze_data, uint32_t thrd_num, char const* dev_str,
                               xfs_sb_t* sb_data, uint32_t ag_num ) {
 	RETURN_INT_IF_NULL( analyze_data );
@@ -39,13 +53,102 @@ static int init_analyze_data( analyze_data_t* analyze_data, uint32_t thrd_num, c
 }
 
 
+/// @internal Read all data blocks of the long form directory @a in into @a dir
+static int read_long_dir( xfs_in_t const* in, xfs_dir_t* dir, int fd, uint8_t* buf ) {
+	xfs_sb_t const* sb        = &superblocks[in->ag_num];
+	uint32_t        dir_fsbs  = 1U << sb->log2_dir_blk_ag;
+	size_t          dir_size  = ( size_t )sb_block_size * dir_fsbs;
+	uint64_t        leaf_fsb  = DIR_LEAF_OFFSET >> sb->log2_block_size;
+	bool            has_ftype = ( 5 == ( sb->fs_version & 0xf ) )
+	                          ? ( sb->rw_inco_flags & SB_FTYPE_V5 )
+	                          : ( sb->add_flags & SB_FTYPE_V4 );
+	uint32_t        count     = in->d_exts ? in->d_exts->count : 0;
+	xfs_ex_t        ex;
+
+	for ( uint32_t i = 0; i < count; ++i ) {
+		xfs_ex_at( in->d_exts, i, &ex );
+
+		// Only the data blocks hold names, the leaf and free index blocks follow them
+		for ( uint64_t b = 0; ( ( b + dir_fsbs ) <= ex.length ) && ( ( ex.offset + b ) < leaf_fsb ); b += dir_fsbs ) {
+			uint64_t pos = 0;
+
+			if ( !fsb_to_pos( ex.block + b, dir_fsbs, &pos ) ) {
+				log_debug( "Directory %llu: block %llu is not on the device", in->inode_id, ex.block + b );
+				continue;
+			}
+			if ( ( ssize_t )dir_size != src_pread( fd, buf, dir_size, pos, IO_PROBE ) ) {
+				log_error( "Directory %llu: Unable to read %zu bytes at 0x%08llx: %m [%d]",
+				           in->inode_id, dir_size, pos, errno );
+				return -1;
+			}
+			// Blocks of deleted directories might be re-used already
+			if ( -1 == xfs_read_block_dir( dir, buf, dir_size, has_ftype, false ) ) {
+				log_debug( "Directory %llu: block %llu is no directory data block", in->inode_id, ex.block + b );
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/** @internal Look up the entries of directory @a in in the inode catalog
+  *
+  * While @a may_retry is set, directories that name deleted inodes which
+  * were not found, yet, are left alone and 1 is returned. The scanners of
+  * other AGs might still find them. Otherwise the directory is counted.
+  * @return 0 if done, 1 to retry later, -1 on error.
+**/
+static int analyze_dir( analyze_data_t* data, xfs_in_t* in, int fd, uint8_t* buf, bool may_retry ) {
+	xfs_dir_t dir;
+	uint64_t  files   = 0;
+	uint64_t  missing = 0;
+	int       res     = 0;
+
+	memset( &dir, 0, sizeof( xfs_dir_t ) );
+
+	if ( -1 == xfs_map_in( in, fd ) )
+		return -1;
+
+	if ( ST_LOCAL == in->data_fork_type ) {
+		uint8_t const* loc = in->data ? in->data->d_loc_data : NULL;
+		res = loc ? xfs_read_packed_dir( &dir, loc, false ) : -1;
+	} else
+		res = read_long_dir( in, &dir, fd, buf );
+
+	for ( xfs_entry_t const* entry = dir.root; ( 0 == res ) && entry; entry = entry->next ) {
+		uint8_t ftype = cat_find( entry->address );
+
+		if ( ftype && ( FT_DIR != ftype ) )
+			++files;
+		else if ( !ftype && entry->is_deleted )
+			++missing;
+	}
+	xfs_free_dir( &dir );
+
+	if ( -1 == res )
+		return -1;
+	if ( missing && may_retry )
+		return 1;
+
+	data->found_dirent++;
+	data->found_files += files;
+
+	return 0;
+}
+
+
 int analyzer( void* analyze_data ) {
 	RETURN_INT_IF_NULL( analyze_data );
 
-	uint8_t*        buf  = NULL;
-	analyze_data_t* data = ( analyze_data_t* )analyze_data;
-	int             fd   = -1;
-	int             res  = -1;
+	xfs_in_t*       batch[ANALYZE_BATCH];
+	uint8_t*        buf       = NULL;
+	analyze_data_t* data      = ( analyze_data_t* )analyze_data;
+	int             fd        = -1;
+	int             res       = -1;
+	xfs_in_t**      retry     = NULL;
+	size_t          retry_cnt = 0;
+	size_t          retry_max = 0;
 
 
 	// Sleep until signaled to start
@@ -61,25 +164,73 @@ int analyzer( void* analyze_data ) {
 		goto cleanup;
 	data->is_running = true;
 
-	// First we need a buffer:
-	buf = malloc( sb_block_size );
+	// First we need a buffer, long form directory blocks can span several file system blocks:
+	size_t buf_size = ( size_t )sb_block_size << data->sb_data->log2_dir_blk_ag;
+	buf = malloc( buf_size );
 	if ( NULL == buf ) {
-		log_critical( "Unable to allocate %lu bytes for block buffer!", sb_block_size );
+		log_critical( "Unable to allocate %zu bytes for block buffer!", buf_size );
 		goto cleanup;
 	}
 
 	// Let's open the device, then.
-	fd  = open( data->device, O_RDONLY | O_NOFOLLOW );
+	fd  = src_open( data->device, O_NOFOLLOW );
 	if ( -1 == fd ) {
 		log_error( "[Thread %lu] Can not open %s for reading: %m [%d]",
 		           data->thread_num, data->device, errno );
 		goto cleanup;
 	}
 
+	/* On rotational sources, the analyzer works on what the last scan found. Otherwise
+	 * it waits for more, until the scanners of all AG groups are finished. Directories
+	 * naming deleted inodes that are not found yet are put aside until then. */
+	while ( !data->do_stop ) {
+		bool   is_last   = ( ( false == data->is_shackled ) || !src_is_ssd ) && ( 0 == scanner_running() );
+		bool   may_retry = data->is_shackled && src_is_ssd;
+		size_t count     = dir_in_pop_batch( batch, ANALYZE_BATCH, ANALYZE_WAIT_MS );
+
+		if ( ( 0 == count ) && is_last )
+			break;
+
+		for ( size_t i = 0; i < count; ++i ) {
+			if ( data->do_stop ) {
+				xfs_free_in( &batch[i] );
+				continue;
+			}
+
+			if ( ( retry_cnt == retry_max ) && may_retry ) {
+				size_t     new_max = retry_max ? retry_max * 2 : 64;
+				xfs_in_t** tmp     = realloc( retry, new_max * sizeof( xfs_in_t* ) );
+				if ( tmp ) {
+					retry     = tmp;
+					retry_max = new_max;
+				} else
+					// Not being able to wait only costs what the other AGs find
+					log_warning( "Unable to grow the directory retry list to %zu entries", new_max );
+			}
+
+			if ( 1 == analyze_dir( data, batch[i], fd, buf, may_retry && ( retry_cnt < retry_max ) ) ) {
+				retry[retry_cnt++] = TAKE_PTR( batch[i] );
+				continue;
+			}
+			++data->analyzed;
+			xfs_free_in( &batch[i] );
+		}
+	}
+
+	// All scanners are done, so whatever was put aside is as complete as it gets
+	for ( size_t i = 0; !data->do_stop && ( i < retry_cnt ); ++i ) {
+		analyze_dir( data, retry[i], fd, buf, false );
+		++data->analyzed;
+	}
+
 	// We are here? All is well, then
 	res = 0;
 
 cleanup:
+	for ( size_t i = 0; i < retry_cnt; ++i )
+		xfs_free_in( &retry[i] );
+	if ( retry )
+		free( retry );
 	if ( fd > -1 )
 		close( fd );
 	if ( buf )
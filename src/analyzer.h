@@ -13,15 +13,15 @@
 /// @brief Thread control struct
 typedef struct _analyze_data {
 	uint32_t            ag_num;       //!< Number of the Allocation Group this thread shall handle
-	_Atomic( uint64_t ) analyzed;     //!< Increased by the thread, questioned by main
+	_Atomic( uint64_t ) analyzed;     //!< Directory inodes worked on, questioned by main
 	char const*         device;       //!< Pointer to the device string. No copy, is never changed.
 	_Atomic( bool )     do_start;     //!< Initialized with false, set to true when the thread may run.
 	_Atomic( bool )     do_stop;      //!< Initialized with false, set to true when the thread shall break off
-	_Atomic( uint64_t ) found_dirent; //!< Increased by the thread, questioned by main
-	_Atomic( uint64_t ) found_files;  //!< Increased by the thread, questioned by main
+	_Atomic( uint64_t ) found_dirent; //!< Directories whose entries could be read, questioned by main
+	_Atomic( uint64_t ) found_files;  //!< Directory entries naming a found file inode, questioned by main
 	_Atomic( bool )     is_finished;  //!< Initialized with false, set to true when the thread is finished.
 	_Atomic( bool )     is_running;   //!< Set to true when woken up, and to false when stopping
-	_Atomic( bool )     is_shackled;  //!< Re-enqueue incomplete directory inodes, scanners aren't finished.
+	_Atomic( bool )     is_shackled;  //!< Hold back directories naming deleted inodes not found yet, scanners aren't finished.
 	xfs_sb_t*           sb_data;      //!< The Superblock data this thread shall use
 	mtx_t               sleep_lock;   //!< Used for conditional sleeping until signaled
 	int32_t             thread_num;   //!< Number of the thread for logging
@@ -0,0 +1,252 @@
+/*******************************************************************************
+ * backend.c : Device backends below all reads from the source device
+ ******************************************************************************/
+
+
+#include "backend.h"
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+
+#define SIM_MAX_CHANNELS 32
+
+
+/// @brief The operations a device backend provides
+typedef struct _src_backend {
+	char const* name;                                                 //!< For messages
+	int     ( *open  )( char const* path, int flags );                //!< Like open()
+	ssize_t ( *pread )( int fd, void* buf, size_t len, off_t offset ); //!< Like pread(), offset is absolute
+} src_backend_t;
+
+
+/// @brief Latency model of a simulated device, all times in microseconds
+typedef struct _sim_model {
+	char const* name;        //!< Name used with sim_set_model()
+	uint32_t    channels;    //!< Requests the device serves in parallel
+	uint32_t    queue_depth; //!< Reported as nr_requests in the device profile
+	bool        rotational;  //!< Reported in the device profile
+	double      cmd_us;      //!< Fixed cost of every request
+	double      track_us;    //!< Shortest seek, 0 for flash
+	double      stroke_us;   //!< Seek over the whole device
+	double      rotation_us; //!< Average rotational delay after a seek
+	double      mib_s;       //!< Bandwidth of the bus all channels share
+} sim_model_t;
+
+
+static sim_model_t const sim_models[] = {
+	// name    chan  depth  rot    cmd    track  stroke  rotation  MiB/s
+	{ "hdd",     1,    32, true,  100., 1000., 15000., 4170.,  180. },
+	{ "ssd",     8,    32, false,  90.,    0.,     0.,    0.,  530. },
+	{ "nvme",   32,  1023, false,  20.,    0.,     0.,    0., 3200. },
+	{ "net",     8,   128, false, 500.,    0.,     0.,    0.,  110. },
+	{ NULL,      0,     0, false,   0.,    0.,     0.,    0.,    0. }
+};
+
+
+static int     posix_open( char const* path, int flags );
+static ssize_t posix_pread( int fd, void* buf, size_t len, off_t offset );
+static int     sim_open( char const* path, int flags );
+static ssize_t sim_pread( int fd, void* buf, size_t len, off_t offset );
+
+
+static src_backend_t const posix_backend = { "posix",     posix_open, posix_pread };
+static src_backend_t const sim_backend   = { "simulator", sim_open,   sim_pread };
+static src_backend_t const* backend      = &posix_backend;
+
+
+// State of the simulated device, all times are in simulated microseconds
+static double               sim_bus_free                    = 0.;
+static double               sim_chan_free[SIM_MAX_CHANNELS] = { 0. };
+static _Thread_local double sim_clock                       = 0.;    //!< When the last read of this thread was done
+static _Thread_local bool   sim_known                       = false; //!< True once this thread is counted in sim_threads
+static off_t                sim_head                        = 0;
+static mtx_t                sim_lock;
+static stat_t               sim_stat                        = STAT_INIT( "simulator" );
+static sim_model_t const*   sim_model                       = NULL;
+static uint64_t             sim_bytes                       = 0;
+static uint64_t             sim_reads                       = 0;
+static off_t                sim_size                        = 0;
+static uint32_t             sim_threads                     = 0;
+static double               sim_wall                        = 0.;
+
+
+/// @internal The default backend, reading the device directly
+static int posix_open( char const* path, int flags ) {
+	return open( path, O_RDONLY | flags );
+}
+
+
+/// @internal The default backend, reading the device directly
+static ssize_t posix_pread( int fd, void* buf, size_t len, off_t offset ) {
+	return pread( fd, buf, len, offset );
+}
+
+
+/// @internal Open the image and learn its size for the seek model
+static int sim_open( char const* path, int flags ) {
+	int fd = posix_open( path, flags );
+
+	if ( fd > -1 ) {
+		off_t size = lseek( fd, 0, SEEK_END );
+		stat_lock( &sim_stat, &sim_lock );
+		if ( size > sim_size )
+			sim_size = size;
+		mtx_unlock( &sim_lock );
+	}
+
+	return fd;
+}
+
+
+/** @internal Read from the image and charge what the simulated device would need
+  *
+  * Each thread has its own clock, as it waits for its reads. A read starts
+  * when its thread issues it and the first channel is free. After the
+  * command and seek time, it waits for the shared bus, then transfers.
+  * The simulated wall time is the end of the last transfer.
+  *
+  * Reads are charged in the order their threads get the lock, not in the
+  * order of their simulated issue times. So when threads read at the same
+  * time, the result depends on the real scheduling and varies a little
+  * between runs. Only reads that never overlap give reproducible numbers.
+**/
+static ssize_t sim_pread( int fd, void* buf, size_t len, off_t offset ) {
+	ssize_t res = posix_pread( fd, buf, len, offset );
+
+	// Failed reads cost nothing, the caller handles them anyway.
+	if ( res < 1 )
+		return res;
+
+	stat_lock( &sim_stat, &sim_lock );
+
+	if ( !sim_known ) {
+		sim_known = true;
+		++sim_threads;
+	}
+
+	uint32_t chan = 0;
+	for ( uint32_t i = 1; i < sim_model->channels; ++i ) {
+		if ( sim_chan_free[i] < sim_chan_free[chan] )
+			chan = i;
+	}
+
+	double start = sim_clock > sim_chan_free[chan] ? sim_clock : sim_chan_free[chan];
+	double cost  = sim_model->cmd_us;
+
+	// A rotating disk has to move its head, unless the read continues the last one
+	if ( sim_model->track_us && ( offset != sim_head ) ) {
+		double dist = ( double )( offset > sim_head ? offset - sim_head : sim_head - offset )
+		            / ( double )( sim_size ? sim_size : 1 );
+		cost += sim_model->track_us + ( ( sim_model->stroke_us - sim_model->track_us ) * dist ) + sim_model->rotation_us;
+	}
+
+	double xfer = ( start + cost ) > sim_bus_free ? start + cost : sim_bus_free;
+	double done = xfer + ( ( double )res / ( sim_model->mib_s * 1.048576 ) );
+
+	sim_bus_free        = done;
+	sim_chan_free[chan] = done;
+	sim_clock           = done;
+	sim_head            = offset + res;
+	sim_bytes          += res;
+	++sim_reads;
+	if ( done > sim_wall )
+		sim_wall = done;
+
+	mtx_unlock( &sim_lock );
+
+	return res;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int src_open( char const* path, int flags ) {
+	RETURN_INT_IF_NULL( path );
+	return backend->open( path, flags );
+}
+
+
+ssize_t src_pread( int fd, void* buf, size_t len, off_t offset, e_io_purpose purpose ) {
+	if ( !trace_is_active() )
+		return backend->pread( fd, buf, len, offset + ( off_t )src_offset );
+
+	uint64_t start = stat_now_ns();
+	ssize_t  res   = backend->pread( fd, buf, len, offset + ( off_t )src_offset );
+	trace_record( offset, len, res, purpose, start );
+
+	return res;
+}
+
+
+bool sim_apply_profile( dev_profile_t* profile ) {
+	if ( ( NULL == sim_model ) || ( NULL == profile ) )
+		return false;
+
+	char ident[sizeof( profile->ident )];
+	memcpy( ident, profile->ident, sizeof( ident ) );
+
+	memset( profile, 0, sizeof( dev_profile_t ) );
+	snprintf( profile->name,  sizeof( profile->name ),  "sim-%s", sim_model->name );
+	memcpy( profile->ident, ident, sizeof( ident ) );
+	profile->is_known      = true;
+	profile->logical_block = 512;
+	profile->nr_requests   = sim_model->queue_depth;
+	profile->numa_node     = -1;
+	profile->rotational    = sim_model->rotational;
+
+	log_info( "Simulating %s: %u channel(s), queue depth %u, %s",
+	          sim_model->name, sim_model->channels, sim_model->queue_depth,
+	          sim_model->rotational ? "rotating" : "not rotating" );
+
+	return true;
+}
+
+
+void sim_report( void ) {
+	if ( NULL == sim_model )
+		return;
+
+	double secs = sim_wall / 1e6;
+
+	log_info( "Simulated %s: %lu reads, %s in %.3f s simulated wall time (%.1f MiB/s)",
+	          sim_model->name, sim_reads, get_human_size( sim_bytes ), secs,
+	          secs > 0. ? ( ( double )sim_bytes / ( 1024. * 1024. ) ) / secs : 0. );
+	if ( sim_threads > 1 )
+		log_info( " -> %u threads read, concurrent reads are charged in the order they came, which varies between runs",
+		          sim_threads );
+}
+
+
+int sim_set_model( char const* model ) {
+	RETURN_INT_IF_NULL( model );
+
+	for ( int i = 0; sim_models[i].name; ++i ) {
+		if ( 0 == strcmp( model, sim_models[i].name ) ) {
+			if ( ( NULL == sim_model ) && ( thrd_success != mtx_init( &sim_lock, mtx_plain ) ) ) {
+				log_critical( "Unable to initialize the simulator lock: %m [%d]", errno );
+				return -1;
+			}
+			sim_model = &sim_models[i];
+			backend   = &sim_backend;
+			log_debug( "Device backend is now the %s (%s)", backend->name, sim_model->name );
+			return 0;
+		}
+	}
+
+	log_error( "Unknown device model \"%s\", use hdd, ssd, nvme or net", model );
+
+	return -1;
+}
@@ -0,0 +1,90 @@
+#ifndef PWX_XFS_UNDELETE_SRC_BACKEND_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_BACKEND_H_INCLUDED 1
+#pragma once
+
+
+#include "topology.h"
+
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+/// @brief enum of the reasons to read from the source device, recorded in I/O traces
+typedef enum _io_purpose {
+	IO_OTHER      = 0, //!< Anything not listed below
+	IO_SUPERBLOCK = 1, //!< Reading the superblocks
+	IO_SCAN       = 2, //!< The scanner reading its windows
+	IO_PROBE      = 3, //!< Probing blocks while restoring or checking inodes
+	IO_JOURNAL    = 4, //!< Reading the journal
+	IO_WATCH      = 5, //!< Watch mode reading AGIs, inode B+trees and directory blocks
+	IO_RESTORE    = 6, //!< Writers reading the data of the files they restore
+	IO_PURPOSES   = 7  //!< Number of purposes, not a purpose
+} e_io_purpose;
+
+
+/** @brief Open the source device through the active backend
+  *
+  * With the default backend, this is a plain open(). The simulator opens
+  * the image the same way, but remembers its size for the seek model.
+  * Either way the result is a real file descriptor, to be closed with close().
+  *
+  * @param[in] path   Path to the source device or image
+  * @param[in] flags  Flags for open(), O_RDONLY is always added
+  * @return The file descriptor, or -1 on error, exactly like open()
+**/
+int src_open( char const* path, int flags );
+
+
+/** @brief Read from the source device, honoring the file system offset
+  *
+  * All reads from the source device must go through this function, so that
+  * a file system found at an offset inside a raw disk (see `src_offset`)
+  * can be used transparently, and so that the simulator and the tracer
+  * see every read.
+  *
+  * @param[in]  fd      File descriptor of the opened source device
+  * @param[out] buf     Buffer to read into
+  * @param[in]  len     Number of bytes to read
+  * @param[in]  offset  Byte offset relative to the start of the file system
+  * @param[in]  purpose Why the read is done, one of e_io_purpose
+  * @return The number of bytes read, or -1 on error, exactly like pread()
+**/
+ssize_t src_pread( int fd, void* buf, size_t len, off_t offset, e_io_purpose purpose );
+
+
+/** @brief Replace the device profile with the one of the simulated device
+  *
+  * Nothing happens if no simulator is active. Otherwise the thread layout
+  * is decided as if the simulated device was really there.
+  *
+  * @param[out] profile  The profile to overwrite
+  * @return true if @a profile now describes the simulated device.
+**/
+bool sim_apply_profile( dev_profile_t* profile );
+
+
+/// @brief Log the simulated wall time and the number of reads, if a simulator is active
+void sim_report( void );
+
+
+/** @brief Serve the source from its image, charging the latency of a simulated device
+  *
+  * Known models are:
+  *  - "hdd"  : A 7200 rpm disk, with seeks growing with the distance
+  *  - "ssd"  : A SATA SSD with a few parallel channels and a narrow bus
+  *  - "nvme" : An NVMe SSD with many channels and little latency
+  *  - "net"  : A network disk with a high round trip time on 1 GbE
+  *
+  * Reads are still done on the image, so results are real. Only the time
+  * the device would have needed is calculated, see sim_report().
+  * The simulated time is only reproducible if no two threads read at the
+  * same time, see sim_pread().
+  *
+  * @param[in] model  Name of the model to use
+  * @return 0 on success, -1 if the model is unknown.
+**/
+int sim_set_model( char const* model );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_BACKEND_H_INCLUDED
@@ -0,0 +1,338 @@
+/*******************************************************************************
+ * batch.c : Recovery of many volumes at once, within global resource limits
+ ******************************************************************************/
+
+
+#include "batch.h"
+#include "log.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <threads.h>
+#include <unistd.h>
+
+
+#define BATCH_KEY_LEN 32         // Enough for any block device name or "major:minor"
+#define BATCH_POLL_MS 500        // How often the memory of the workers is checked
+#define BATCH_PARTIAL ".partial" // Suffix of the output of workers that were killed
+
+
+/// @brief One volume to recover in batch mode
+typedef struct _batch_job {
+	char* device;              //!< Path to the source device
+	char  disk[BATCH_KEY_LEN]; //!< Name of the physical disk the source resides on
+	char* output;              //!< Path to the output directory
+	pid_t pid;                 //!< Process ID of the worker, 0 if not started, -1 if finished
+	int   status;              //!< Exit status of the worker
+} batch_job_t;
+
+
+/** @internal Move the output of a killed worker out of the way
+  *
+  * A worker killed by a signal leaves files behind that may be cut short.
+  * They are kept, as they can still be worth something, but the directory is
+  * renamed to "<output dir>.partial", so it is never taken for a full recovery.
+**/
+static void mark_partial( batch_job_t const* job ) {
+	char        partial[PATH_MAX] = { 0x0 };
+	struct stat st;
+
+	if ( stat( job->output, &st ) )
+		return; // The worker did not get as far as creating it
+
+	snprintf( partial, PATH_MAX, "%s%s", job->output, BATCH_PARTIAL );
+	errno = EEXIST; // rename() would silently replace an empty directory
+	if ( !stat( partial, &st ) || rename( job->output, partial ) )
+		log_error( "Unable to rename %s to %s, its content is incomplete: %m [%d]", job->output, partial, errno );
+	else
+		log_warning( "The incomplete output of %s is in %s", job->device, partial );
+}
+
+
+/** @internal Find the name of the physical disk @a path resides on
+  *
+  * For block devices the device itself is looked up, for image files the device
+  * they are stored on. Partitions are resolved to the disk they belong to.
+  * If the sysfs lookup fails, "major:minor" is used as the key.
+**/
+static void get_disk_key( char const* path, char* key ) {
+	struct stat st;
+	char        sys_path[PATH_MAX] = { 0x0 };
+	char        real[PATH_MAX]     = { 0x0 };
+
+	if ( stat( path, &st ) ) {
+		// Let the worker report this properly. Unknown devices share one key.
+		snprintf( key, BATCH_KEY_LEN, "unknown" );
+		return;
+	}
+
+	dev_t dev = S_ISBLK( st.st_mode ) ? st.st_rdev : st.st_dev;
+	snprintf( key, BATCH_KEY_LEN, "%u:%u", major( dev ), minor( dev ) );
+	snprintf( sys_path, PATH_MAX, "/sys/dev/block/%s", key );
+
+	if ( NULL == realpath( sys_path, real ) )
+		return;
+
+	// A partition has a "partition" file, and its parent directory is the disk
+	size_t len = strlen( real );
+	if ( ( len + 11 ) < PATH_MAX ) {
+		strcat( real, "/partition" );
+		if ( exists( real, 'f' ) ) {
+			real[len] = 0x0;
+			dirname( real );
+		} else
+			real[len] = 0x0;
+	}
+
+	snprintf( key, BATCH_KEY_LEN, "%s", basename( real ) );
+}
+
+
+/// @internal Resident set size of process @a pid in bytes, 0 if it is unknown
+static uint64_t get_rss( pid_t pid ) {
+	char     path[32] = { 0x0 };
+	uint64_t pages    = 0;
+	uint64_t resident = 0;
+
+	snprintf( path, sizeof( path ), "/proc/%d/statm", ( int )pid );
+	FILE* statm = fopen( path, "r" );
+	if ( NULL == statm )
+		return 0;
+	if ( 2 != fscanf( statm, "%lu %lu", &pages, &resident ) )
+		resident = 0;
+	fclose( statm );
+
+	return resident * ( uint64_t )sysconf( _SC_PAGESIZE );
+}
+
+
+/// @internal Read the job list, returns the number of jobs or -1 on error
+static int read_jobs( char const* list_file, batch_job_t** jobs ) {
+	FILE*  list    = fopen( list_file, "r" );
+	char*  line    = NULL;
+	size_t cap     = 0;
+	int    count   = 0;
+	int    lineno  = 0;
+
+	if ( NULL == list ) {
+		log_error( "Can not open %s for reading: %m [%d]", list_file, errno );
+		return -1;
+	}
+
+	*jobs = NULL;
+
+	while ( -1 != getline( &line, &cap, list ) ) {
+		char* save   = NULL;
+		char* device = strtok_r( line, " \t\r\n", &save );
+		char* output = device ? strtok_r( NULL, " \t\r\n", &save ) : NULL;
+
+		++lineno;
+		if ( ( NULL == device ) || ( '#' == device[0] ) )
+			continue;
+		if ( NULL == output ) {
+			log_error( "%s:%d: No output directory for %s", list_file, lineno, device );
+			continue;
+		}
+
+		batch_job_t* new_jobs = realloc( *jobs, ( count + 1 ) * sizeof( batch_job_t ) );
+		if ( NULL == new_jobs ) {
+			log_critical( "Unable to allocate %zu bytes for batch jobs! %m [%d]",
+			              ( count + 1 ) * sizeof( batch_job_t ), errno );
+			for ( int i = 0; i < count; ++i ) {
+				FREE_PTR( ( *jobs )[i].device );
+				FREE_PTR( ( *jobs )[i].output );
+			}
+			FREE_PTR( *jobs );
+			count = -1;
+			break;
+		}
+		*jobs = new_jobs;
+
+		batch_job_t* job = &( *jobs )[count++];
+		memset( job, 0, sizeof( batch_job_t ) );
+		job->device = strdup( device );
+		job->output = strdup( output );
+		get_disk_key( device, job->disk );
+	}
+
+	FREE_PTR( line );
+	fclose( list );
+
+	return count;
+}
+
+
+/// @internal Fork and exec one worker, returns its PID or -1 on error
+static pid_t start_worker( batch_job_t const* job, uint32_t thr_share ) {
+	pid_t pid = fork();
+
+	if ( pid ) {
+		if ( -1 == pid )
+			log_error( "Unable to fork worker for %s: %m [%d]", job->device, errno );
+		return pid;
+	}
+
+	// === Child from here on ===
+	char  log_path[PATH_MAX] = { 0x0 };
+	char  thr_str[16]        = { 0x0 };
+	char* argv[6]            = { "xfs_undelete", NULL };
+	int   argc               = 1;
+
+	if ( thr_share ) {
+		snprintf( thr_str, 16, "%u", thr_share );
+		argv[argc++] = "-t";
+		argv[argc++] = thr_str;
+	}
+	argv[argc++] = job->device;
+	argv[argc++] = job->output;
+	argv[argc]   = NULL;
+
+	snprintf( log_path, PATH_MAX, "%s.log", job->output );
+	int fd = open( log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd > -1 ) {
+		dup2( fd, STDOUT_FILENO );
+		dup2( fd, STDERR_FILENO );
+		close( fd );
+	} else
+		log_warning( "Unable to open %s, worker output goes to the console: %m [%d]", log_path, errno );
+
+	execv( "/proc/self/exe", argv );
+
+	log_critical( "Unable to start worker for %s: %m [%d]", job->device, errno );
+	_exit( EXIT_FAILURE );
+}
+
+
+int run_batch( char const* list_file, batch_limits_t const* limits ) {
+	RETURN_INT_IF_NULL( list_file );
+	RETURN_INT_IF_NULL( limits );
+
+	batch_job_t* jobs     = NULL;
+	int          count    = read_jobs( list_file, &jobs );
+	int          failed   = 0;
+	int          finished = 0;
+	uint32_t     max_jobs = limits->max_jobs ? limits->max_jobs : 1;
+	uint32_t     per_disk = limits->per_disk ? limits->per_disk : 1;
+	uint32_t     running  = 0;
+
+	if ( count < 1 ) {
+		if ( 0 == count )
+			log_error( "No jobs found in %s", list_file );
+		count = 0;
+		failed = 1;
+		goto cleanup;
+	}
+
+	// Every worker gets its even share, so all running workers together stay within budget
+	uint64_t mem_share = limits->mem_total / max_jobs;
+	uint32_t thr_share = limits->thr_total / max_jobs;
+	if ( limits->thr_total && !thr_share )
+		thr_share = 1;
+
+	struct timespec poll = { .tv_nsec = BATCH_POLL_MS * 1000000L };
+
+	log_info( "Batch: %d volumes, %u at once, %u per disk", count, max_jobs, per_disk );
+	if ( mem_share )
+		log_info( " -> memory per worker : %s", get_human_size( mem_share ) );
+	if ( thr_share )
+		log_info( " -> threads per worker: %u", thr_share );
+
+	while ( finished < count ) {
+		// Start whatever fits into the limits
+		for ( int i = 0; ( i < count ) && ( running < max_jobs ); ++i ) {
+			if ( jobs[i].pid )
+				continue;
+
+			uint32_t on_disk = 0;
+			for ( int j = 0; j < count; ++j ) {
+				if ( ( jobs[j].pid > 0 ) && !strcmp( jobs[i].disk, jobs[j].disk ) )
+					++on_disk;
+			}
+			if ( on_disk >= per_disk )
+				continue;
+
+			jobs[i].pid = start_worker( &jobs[i], thr_share );
+			if ( -1 == jobs[i].pid ) {
+				jobs[i].status = EXIT_FAILURE;
+				++failed;
+				++finished;
+				continue;
+			}
+
+			log_status( "Started %s -> %s (disk %s) [pid %d]",
+			            jobs[i].device, jobs[i].output, jobs[i].disk, jobs[i].pid );
+			++running;
+		}
+
+		if ( 0 == running )
+			break; // Only possible if all remaining workers failed to start
+
+		// Wait for any worker to finish. With a memory budget, check the workers while waiting.
+		int   status = 0;
+		pid_t pid    = waitpid( -1, &status, mem_share ? WNOHANG : 0 );
+		if ( 0 == pid ) {
+			for ( int i = 0; i < count; ++i ) {
+				uint64_t rss = jobs[i].pid > 0 ? get_rss( jobs[i].pid ) : 0;
+				if ( rss > mem_share ) {
+					log_error( "Worker for %s uses %s, more than its share, stopping it",
+					           jobs[i].device, get_human_size( rss ) );
+					kill( jobs[i].pid, SIGTERM );
+				}
+			}
+			thrd_sleep( &poll, NULL );
+			continue;
+		}
+		if ( -1 == pid ) {
+			if ( EINTR == errno )
+				continue;
+			log_critical( "Waiting for workers failed: %m [%d]", errno );
+			failed = 1;
+			break;
+		}
+
+		for ( int i = 0; i < count; ++i ) {
+			if ( pid != jobs[i].pid )
+				continue;
+
+			jobs[i].pid    = -1;
+			jobs[i].status = WIFEXITED( status ) ? WEXITSTATUS( status ) : EXIT_FAILURE;
+			--running;
+			++finished;
+
+			if ( EXIT_SUCCESS == jobs[i].status )
+				log_status( "Finished %s -> %s", jobs[i].device, jobs[i].output );
+			else {
+				++failed;
+				if ( WIFSIGNALED( status ) ) {
+					log_error( "Worker for %s was killed by signal %d", jobs[i].device, WTERMSIG( status ) );
+					mark_partial( &jobs[i] );
+				} else
+					log_error( "Worker for %s failed, see %s.log", jobs[i].device, jobs[i].output );
+			}
+			break;
+		}
+	}
+
+	log_info( "Batch finished: %d/%d volumes recovered", count - failed, count );
+
+cleanup:
+	for ( int i = 0; i < count; ++i ) {
+		FREE_PTR( jobs[i].device );
+		FREE_PTR( jobs[i].output );
+	}
+	FREE_PTR( jobs );
+
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef PWX_XFS_UNDELETE_SRC_BATCH_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_BATCH_H_INCLUDED 1
+#pragma once
+
+
+#include <stdint.h>
+
+
+/// @brief The global limits a batch run has to obey
+typedef struct _batch_limits {
+	uint32_t max_jobs;   //!< Maximum number of volumes recovered at the same time
+	uint32_t per_disk;   //!< Maximum number of volumes read from one physical disk at the same time
+	uint64_t mem_total;  //!< Total memory budget in bytes, 0 for no limit
+	uint32_t thr_total;  //!< Total thread budget, 0 for no limit
+} batch_limits_t;
+
+
+/** @brief Recover a list of volumes concurrently
+  *
+  * The file @a list_file holds one job per line, consisting of the source
+  * device and the output directory, separated by white space. Empty lines
+  * and lines starting with '#' are ignored.
+  *
+  * As the recovery works on global state, every job runs in a worker
+  * process of its own. The supervisor starts a new worker only if neither
+  * the global job limit, nor the limit for the physical disk the source
+  * resides on, is exceeded. The memory and thread budgets are split evenly
+  * between the maximum number of concurrent jobs. The thread share is
+  * handed to each worker as its thread cap. The memory share is compared
+  * with the resident set size of each worker twice a second, and a
+  * worker that grows beyond it is stopped. An address space limit would
+  * count thread stacks and mappings, too, and hit workers far too early.
+  *
+  * The output of every worker is written into "<output dir>.log".
+  * If a worker is killed, by the memory check or anything else, its output
+  * directory is renamed to "<output dir>.partial", as its last files may be
+  * incomplete. An existing directory of that name is not overwritten.
+  *
+  * @param[in] list_file  Path to the list of jobs
+  * @param[in] limits     The limits to enforce
+  * @return 0 if all jobs succeeded, -1 otherwise.
+**/
+int run_batch( char const* list_file, batch_limits_t const* limits );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_BATCH_H_INCLUDED
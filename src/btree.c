@@ -3,14 +3,20 @@
  ******************************************************************************/
 
 
+#include "backend.h"
 #include "btree.h"
+#include "device.h"
 #include "file_type.h"
 #include "globals.h"
 #include "log.h"
+#include "stats.h"
 #include "utils.h"
 
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <threads.h>
 
 
 int is_btree_block( uint8_t const* data ) {
@@ -29,3 +35,365 @@ int is_btree_block( uint8_t const* data ) {
 
 	return 0;
 }
+
+
+#define BT_CACHE_SETS 256                // Sets of the shared node cache
+#define BT_CACHE_WAYS 4                  // Nodes per set, the least recently used one goes
+#define BT_HDR_V4     24                 // Bytes of a BMAP block header
+#define BT_HDR_V5     72                 // Bytes of a BMA3 block header
+#define BT_NULL_BLOCK 0xffffffffffffffff // Sibling pointer of the first and last block of a level
+#define BT_READ_MAX   ( 1024 * 1024 )    // Neighbouring blocks are read together up to this many bytes
+
+
+/// @brief One node in the shared cache
+typedef struct _bt_slot {
+	uint64_t fs_blk; //!< File system block number of the node
+	uint64_t used;   //!< Cache tick of the last hit, 0 if the slot is empty
+} bt_slot_t;
+
+
+/// @brief A block to read, sorted by position
+typedef struct _bt_want {
+	uint64_t pos; //!< Byte position on the device
+	size_t   idx; //!< Index of the block in the level
+} bt_want_t;
+
+
+static bt_slot_t bt_slots[BT_CACHE_SETS * BT_CACHE_WAYS];
+static uint8_t*  bt_data     = NULL; //!< The cached blocks, allocated on first use
+static uint64_t  bt_tick     = 0;
+static uint64_t  bt_hits     = 0;
+static uint64_t  bt_misses   = 0;
+static mtx_t     bt_lock;
+static once_flag bt_once     = ONCE_FLAG_INIT;
+static stat_t    bt_stat     = STAT_INIT( "btree cache" );
+
+
+/// @internal Set up the cache lock, called once
+static void bt_init( void ) {
+	if ( thrd_success != mtx_init( &bt_lock, mtx_plain ) )
+		log_critical( "%s", "Unable to initialize the btree cache lock!" );
+}
+
+
+/// @internal First slot of the set @a fs_blk belongs to
+static bt_slot_t* bt_set( uint64_t fs_blk ) {
+	// Neighbouring blocks should not share a set
+	uint64_t set = ( fs_blk * 0x9e3779b97f4a7c15ULL ) >> 56;
+	return &bt_slots[( set % BT_CACHE_SETS ) * BT_CACHE_WAYS];
+}
+
+
+/// @internal Copy the node @a fs_blk into @a buf, returns true on a hit
+static bool bt_cache_get( uint64_t fs_blk, uint8_t* buf ) {
+	bool       found = false;
+	bt_slot_t* set   = bt_set( fs_blk );
+
+	stat_lock( &bt_stat, &bt_lock );
+	for ( int w = 0; bt_data && ( w < BT_CACHE_WAYS ); ++w ) {
+		if ( set[w].used && ( set[w].fs_blk == fs_blk ) ) {
+			set[w].used = ++bt_tick;
+			memcpy( buf, bt_data + ( ( size_t )( set - bt_slots + w ) * sb_block_size ), sb_block_size );
+			found = true;
+			break;
+		}
+	}
+	if ( found )
+		++bt_hits;
+	else
+		++bt_misses;
+	mtx_unlock( &bt_lock );
+
+	return found;
+}
+
+
+/// @internal Put a copy of the node @a fs_blk into the cache
+static void bt_cache_put( uint64_t fs_blk, uint8_t const* buf ) {
+	bt_slot_t* set    = bt_set( fs_blk );
+	bt_slot_t* victim = set;
+
+	stat_lock( &bt_stat, &bt_lock );
+	if ( NULL == bt_data ) {
+		bt_data = malloc( ( size_t )BT_CACHE_SETS * BT_CACHE_WAYS * sb_block_size );
+		if ( NULL == bt_data ) {
+			log_warning( "Unable to allocate the btree cache, nodes are not cached: %m [%d]", errno );
+			goto unlock;
+		}
+	}
+
+	for ( int w = 0; w < BT_CACHE_WAYS; ++w ) {
+		if ( set[w].used && ( set[w].fs_blk == fs_blk ) )
+			goto unlock; // Another thread was faster
+		if ( set[w].used < victim->used )
+			victim = &set[w];
+	}
+
+	victim->fs_blk = fs_blk;
+	victim->used   = ++bt_tick;
+	memcpy( bt_data + ( ( size_t )( victim - bt_slots ) * sb_block_size ), buf, sb_block_size );
+
+unlock:
+	mtx_unlock( &bt_lock );
+}
+
+
+/// @internal qsort() helper ordering wanted blocks by position
+static int bt_cmp_want( void const* a, void const* b ) {
+	uint64_t pos_a = ( ( bt_want_t const* )a )->pos;
+	uint64_t pos_b = ( ( bt_want_t const* )b )->pos;
+
+	return ( pos_a > pos_b ) - ( pos_a < pos_b );
+}
+
+
+/// @internal Read the @a count blocks @a blks into @a buf, from the cache or with as few reads as possible
+static int bt_read_level( int fd, uint64_t const* blks, size_t count, uint8_t* buf ) {
+	bt_want_t* want  = calloc( count, sizeof( bt_want_t ) );
+	size_t     max_n = BT_READ_MAX / sb_block_size;
+	uint8_t*   run   = malloc( ( max_n ? max_n : 1 ) * sb_block_size );
+	size_t     wants = 0;
+	int        res   = -1;
+
+	if ( ( NULL == want ) || ( NULL == run ) ) {
+		log_critical( "Unable to allocate buffers to read %zu btree nodes!", count );
+		goto cleanup;
+	}
+	if ( 0 == max_n )
+		max_n = 1;
+
+	for ( size_t i = 0; i < count; ++i ) {
+		uint64_t pos = 0;
+		if ( !fsb_to_pos( blks[i], 1, &pos ) ) {
+			log_error( "btree node %zu points to block %llu outside the file system", i, blks[i] );
+			goto cleanup;
+		}
+		if ( !bt_cache_get( blks[i], buf + ( i * sb_block_size ) ) ) {
+			want[wants].pos = pos;
+			want[wants].idx = i;
+			++wants;
+		}
+	}
+
+	// Blocks that follow each other on the device are read at once
+	qsort( want, wants, sizeof( bt_want_t ), bt_cmp_want );
+	for ( size_t first = 0, n = 0; first < wants; first += n ) {
+		for ( n = 1; ( ( first + n ) < wants ) && ( n < max_n )
+		          && ( want[first + n].pos == ( want[first].pos + ( n * sb_block_size ) ) ); ++n ) { }
+
+		ssize_t len = n * sb_block_size;
+		if ( len != src_pread( fd, run, len, want[first].pos, IO_PROBE ) ) {
+			log_error( "Unable to read %zu btree nodes at 0x%08llx: %m [%d]", n, want[first].pos, errno );
+			goto cleanup;
+		}
+		for ( size_t i = 0; i < n; ++i ) {
+			size_t idx = want[first + i].idx;
+			memcpy( buf + ( idx * sb_block_size ), run + ( i * sb_block_size ), sb_block_size );
+			bt_cache_put( blks[idx], run + ( i * sb_block_size ) );
+		}
+	}
+
+	res = 0;
+
+cleanup:
+	FREE_PTR( want );
+	FREE_PTR( run );
+
+	return res;
+}
+
+
+/// @internal Decode and check the header of the block @a fs_blk, which must be on @a level
+static int bt_read_node( btree_node_t* node, uint8_t const* data, uint64_t fs_blk, uint16_t level,
+                         xfs_in_t const* in, bool is_v5 ) {
+	size_t   hdr_size = is_v5 ? BT_HDR_V5 : BT_HDR_V4;
+	uint16_t max_recs = ( sb_block_size - hdr_size ) / 16;
+
+	if ( memcmp( data, is_v5 ? XFS_B3_MAGIC : XFS_BT_MAGIC, 4 ) ) {
+		log_error( "inode %llu: btree block %llu has a wrong magic 0x%02x%02x%02x%02x",
+		           in->inode_id, fs_blk, data[0], data[1], data[2], data[3] );
+		return -1;
+	}
+
+	node->level    = get_flip16u( data,  4 );
+	node->num_recs = get_flip16u( data,  6 );
+	node->leftsib  = get_flip64u( data,  8 );
+	node->rightsib = get_flip64u( data, 16 );
+
+	if ( node->level != level ) {
+		log_error( "inode %llu: btree block %llu is on level %hu instead of %hu",
+		           in->inode_id, fs_blk, node->level, level );
+		return -1;
+	}
+	if ( ( 0 == node->num_recs ) || ( node->num_recs > max_recs ) ) {
+		log_error( "inode %llu: btree block %llu has %hu/%hu records",
+		           in->inode_id, fs_blk, node->num_recs, max_recs );
+		return -1;
+	}
+
+	if ( is_v5 ) {
+		xfs_sb_t const* sb    = &superblocks[0];
+		uint64_t        pos   = 0;
+		uint64_t        owner = get_flip64u( data, 56 );
+
+		fsb_to_pos( fs_blk, 1, &pos );
+		if ( ( get_flip64u( data, 24 ) != ( pos >> 9 ) )
+		  || ( memcmp( data + 40, sb->UUID, 16 ) && memcmp( data + 40, sb->inco_UUID, 16 ) )
+		  || ( in->inode_id && ( owner != in->inode_id ) ) ) {
+			log_error( "inode %llu: btree block %llu belongs to inode %llu or another file system",
+			           in->inode_id, fs_blk, owner );
+			return -1;
+		}
+	}
+
+	if ( level ) {
+		node->node_keys = data + hdr_size;
+		node->node_ptrs = data + hdr_size + ( max_recs * 8 );
+		node->extents   = NULL;
+	} else {
+		node->node_keys = NULL;
+		node->node_ptrs = NULL;
+		node->extents   = data + hdr_size;
+	}
+
+	return 0;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void bt_cache_release( void ) {
+	call_once( &bt_once, bt_init );
+
+	mtx_lock( &bt_lock );
+	if ( bt_hits || bt_misses ) {
+		log_debug( "btree cache: %lu hits, %lu misses", bt_hits, bt_misses );
+	}
+	FREE_PTR( bt_data );
+	memset( bt_slots, 0, sizeof( bt_slots ) );
+	bt_tick   = 0;
+	bt_hits   = 0;
+	bt_misses = 0;
+	mtx_unlock( &bt_lock );
+}
+
+
+int bt_check_root( uint8_t const* data, size_t fork_size, btree_root_t* root ) {
+	RETURN_INT_IF_NULL( data );
+
+	btree_root_t bt_root;
+
+	if ( fork_size < 20 )
+		return -1;
+
+	bt_root.level     = get_flip16u( data, 0 );
+	bt_root.num_recs  = get_flip16u( data, 2 );
+	bt_root.max_recs  = ( fork_size - 4 ) / 16;
+	bt_root.node_keys = data + 4;
+	bt_root.node_ptrs = data + 4 + ( bt_root.max_recs * 8 );
+
+	if ( ( 0 == bt_root.level ) || ( bt_root.level > BT_MAX_LEVEL )
+	  || ( 0 == bt_root.num_recs ) || ( bt_root.num_recs > bt_root.max_recs ) )
+		return -1;
+
+	if ( root )
+		memcpy( root, &bt_root, sizeof( btree_root_t ) );
+
+	return 0;
+}
+
+
+xfs_ex_vec_t* bt_read_extents( int fd, xfs_in_t const* in, uint8_t const* data, size_t fork_size, bool is_v5 ) {
+	RETURN_NULL_IF_NULL( in );
+	RETURN_NULL_IF_NULL( data );
+
+	btree_root_t  root;
+	btree_node_t* nodes = NULL;
+	xfs_ex_vec_t* vec   = NULL;
+	uint64_t*     blks  = NULL;
+	uint8_t*      buf   = NULL;
+	size_t        count = 0;
+
+	call_once( &bt_once, bt_init );
+
+	if ( -1 == bt_check_root( data, fork_size, &root ) ) {
+		log_error( "inode %llu: Invalid btree root", in->inode_id );
+		return NULL;
+	}
+
+	// The root points to the first level of blocks
+	count = root.num_recs;
+	blks  = malloc( count * sizeof( uint64_t ) );
+	if ( NULL == blks ) {
+		log_critical( "Unable to allocate %zu bytes for btree pointers!", count * sizeof( uint64_t ) );
+		return NULL;
+	}
+	for ( size_t i = 0; i < count; ++i )
+		blks[i] = get_flip64u( root.node_ptrs, i * 8 );
+
+	for ( uint16_t level = root.level; level > 0; --level ) {
+		size_t    next_cnt = 0;
+		uint64_t* next     = NULL;
+
+		buf   = malloc( count * sb_block_size );
+		nodes = malloc( count * sizeof( btree_node_t ) );
+		if ( ( NULL == buf ) || ( NULL == nodes ) ) {
+			log_critical( "Unable to allocate %zu bytes for btree level %hu!",
+			              count * ( sb_block_size + sizeof( btree_node_t ) ), level - 1 );
+			goto error;
+		}
+		if ( -1 == bt_read_level( fd, blks, count, buf ) )
+			goto error;
+
+		// Check all blocks first, and count what the next level holds
+		for ( size_t i = 0; i < count; ++i ) {
+			btree_node_t* node = &nodes[i];
+			if ( -1 == bt_read_node( node, buf + ( i * sb_block_size ), blks[i], level - 1, in, is_v5 ) )
+				goto error;
+			if ( ( node->leftsib  != ( i ? blks[i - 1] : BT_NULL_BLOCK ) )
+			  || ( node->rightsib != ( ( i + 1 ) < count ? blks[i + 1] : BT_NULL_BLOCK ) ) ) {
+				log_error( "inode %llu: btree block %llu has broken sibling pointers", in->inode_id, blks[i] );
+				goto error;
+			}
+			next_cnt += node->num_recs;
+		}
+
+		if ( level > 1 ) {
+			next = malloc( next_cnt * sizeof( uint64_t ) );
+			if ( NULL == next ) {
+				log_critical( "Unable to allocate %zu bytes for btree pointers!", next_cnt * sizeof( uint64_t ) );
+				goto error;
+			}
+		} else if ( NULL == ( vec = xfs_ex_create( NULL, next_cnt ) ) )
+			goto error;
+
+		// Then gather the pointers of the next level, or the extents of the leaves
+		for ( size_t i = 0, n = 0; i < count; ++i ) {
+			btree_node_t const* node = &nodes[i];
+			if ( next ) {
+				for ( uint16_t r = 0; r < node->num_recs; ++r )
+					next[n++] = get_flip64u( node->node_ptrs, r * 8 );
+			} else {
+				memcpy( vec->packed + ( n * XFS_EX_SIZE ), node->extents, ( size_t )node->num_recs * XFS_EX_SIZE );
+				n += node->num_recs;
+			}
+		}
+
+		FREE_PTR( buf );
+		FREE_PTR( nodes );
+		FREE_PTR( blks );
+		blks  = next;
+		count = next_cnt;
+	}
+
+	return vec;
+
+error:
+	FREE_PTR( blks );
+	FREE_PTR( buf );
+	FREE_PTR( nodes );
+	xfs_ex_free( &vec );
+
+	return NULL;
+}
@@ -4,30 +4,76 @@
 
 
 #include "extent.h"
+#include "inode.h"
 
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
+#define BT_MAX_LEVEL 9 // No BMBT of a 64 bit file offset space gets any deeper
+
+
+/// @brief The B+tree root inside an inode fork
 typedef struct _btree_root {
-	uint16_t  level;     //!< Bytes 0-1 : Level of this btree node
-	uint16_t  num_recs;  //!< Bytes 2-3 : Number of records under this node
-	/* The rest is split in the keys/pointer arrays */
-	uint64_t* node_keys; //!< Array of in-file offsets [keys] (of size this->num_recs)
-	uint64_t* node_ptrs; //!< Array of block addresses [ptrs] (of size this->num_recs)
+	uint16_t       level;     //!< Bytes 0-1 : Level of this btree node
+	uint16_t       num_recs;  //!< Bytes 2-3 : Number of records under this node
+	uint16_t       max_recs;  //!< Records the fork has room for, the pointers follow as many keys
+	uint8_t const* node_keys; //!< Big endian in-file offsets [keys] (of size this->num_recs)
+	uint8_t const* node_ptrs; //!< Big endian block addresses [ptrs] (of size this->num_recs)
 } btree_root_t;
 
 
+/// @brief A B+tree node or leaf block, pointing into the block data
 typedef struct _btree_node {
-	/* first 4 bytes: magic code "BMAP" */
-	uint16_t  level;     //!< Bytes  4- 5 : Level of this btree node
-	uint16_t  num_recs;  //!< Bytes  6- 7 : Number of records under this node
-	uint64_t  leftsib;   //!< Bytes  8-15 : Absolute block number of the left sibling
-	uint64_t  rightsib;  //!< Bytes 16-23 : Absolute block number of the richt sibling
-	/* the rest of the block is either split in the keys and the pointer arrays, or an extent list */
-	uint64_t* node_keys; //!< Array of in-file offsets (of size this->num_recs) ; if this is a sub-node
-	uint64_t* node_ptrs; //!< Array of block addresses (of size this->num_recs) ; if this is a sub-node
-	xfs_ex_t* extents;   //!< Array of extents (of size this->num_recs)         ; if this is a leaf
+	/* first 4 bytes: magic code "BMAP", or "BMA3" on v5 file systems */
+	uint16_t       level;     //!< Bytes  4- 5 : Level of this btree node
+	uint16_t       num_recs;  //!< Bytes  6- 7 : Number of records under this node
+	uint64_t       leftsib;   //!< Bytes  8-15 : Absolute block number of the left sibling
+	uint64_t       rightsib;  //!< Bytes 16-23 : Absolute block number of the richt sibling
+	/* v5 blocks add block number, LSN, UUID, owner and CRC, then the rest of the block
+	 * is either split in the keys and the pointer arrays, or an extent list */
+	uint8_t const* node_keys; //!< Big endian in-file offsets (of size this->num_recs) ; if this is a sub-node
+	uint8_t const* node_ptrs; //!< Big endian block addresses (of size this->num_recs) ; if this is a sub-node
+	uint8_t const* extents;   //!< Packed extents (of size this->num_recs)             ; if this is a leaf
 } btree_node_t;
 
+
+/** @brief Free the shared B+tree node cache
+  *
+  * Only call this when all threads are gone.
+**/
+void bt_cache_release( void );
+
+
+/** @brief Check the B+tree root of an inode fork
+  *
+  * @param[in]  data       The fork, starting with the root header
+  * @param[in]  fork_size  Bytes the fork has in the inode
+  * @param[out] root       Receives the decoded root, may be NULL
+  * @return 0 if this looks like a BMBT root, -1 otherwise.
+**/
+int bt_check_root( uint8_t const* data, size_t fork_size, btree_root_t* root );
+
+
+/** @brief Read all extents of a B+tree data fork
+  *
+  * The tree is read level by level. All blocks of a level are sorted and
+  * read with as few reads as possible, or taken from the shared node cache.
+  * Every block must have the right magic, level and record count, and the
+  * sibling pointers must chain the blocks of each level in order. On v5
+  * file systems the block number, UUID and owner are checked, too.
+  *
+  * @param[in] fd         File descriptor of the source device
+  * @param[in] in         The inode the fork belongs to
+  * @param[in] data       The fork, starting with the root header
+  * @param[in] fork_size  Bytes the fork has in the inode
+  * @param[in] is_v5      True if the blocks have the v5 (BMA3) layout
+  * @return A new vector with the extents of all leaves, in file order,
+  *         or NULL on error, which is logged.
+**/
+xfs_ex_vec_t* bt_read_extents( int fd, xfs_in_t const* in, uint8_t const* data, size_t fork_size, bool is_v5 );
+
+
 #endif // PWX_XFS_UNDELETE_SRC_BTREE_H_INCLUDED
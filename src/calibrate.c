@@ -0,0 +1,344 @@
+/*******************************************************************************
+ * calibrate.c : Measure the real read performance of a device and cache it
+ ******************************************************************************/
+
+
+#include "calibrate.h"
+#include "log.h"
+#include "stats.h"
+#include "utils.h"
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <threads.h>
+#include <unistd.h>
+
+
+#define CAL_ALIGN       4096               // Alignment of buffers and offsets for O_DIRECT
+#define CAL_GOOD_ENOUGH 0.9                // Share of the best result that is good enough
+#define CAL_MAX_DEPTH   32                 // Highest queue depth measured
+#define CAL_REGIONS     3                  // Start, middle and end of the device
+#define CAL_RND_MS      250                // Duration of one random read run
+#define CAL_RND_SIZE    4096               // Size of one random read
+#define CAL_SEQ_BYTES   ( 16 * 1024 * 1024 ) // Bytes read per window size and region
+#define CAL_STEPS       6                  // Entries in cal_windows and cal_depths, including the terminating 0
+#define CAL_VERSION     1
+
+
+static uint32_t const cal_windows[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024, 0 };
+static uint32_t const cal_depths[]  = { 1, 2, 4, 8, 16, CAL_MAX_DEPTH, 0 };
+
+
+/// @brief The outcome of a calibration run
+typedef struct _cal_result {
+	uint32_t read_size;  //!< Chosen read window
+	uint32_t readers;    //!< Chosen number of readers
+	double   rnd_iops;   //!< Best random read IOPS
+	double   rnd_lat_us; //!< Random read latency at queue depth 1 in microseconds
+	double   seq_mibs;   //!< Best sequential throughput in MiB/s
+} cal_result_t;
+
+
+/// @brief State of one random reader thread
+typedef struct _cal_reader {
+	uint64_t blocks;   //!< Number of CAL_RND_SIZE blocks on the device
+	int      fd;       //!< The device
+	uint64_t nsecs;    //!< Summed up latency of all reads
+	uint64_t reads;    //!< Number of reads done
+	unsigned seed;     //!< For rand_r()
+	uint64_t until_ns; //!< When to stop
+} cal_reader_t;
+
+
+/// @internal Thread doing random reads until its time is up
+static int rnd_reader( void* arg ) {
+	cal_reader_t* rd  = ( cal_reader_t* )arg;
+	uint8_t*      buf = NULL;
+
+	if ( posix_memalign( ( void** )&buf, CAL_ALIGN, CAL_RND_SIZE ) )
+		return -1;
+
+	while ( stat_now_ns() < rd->until_ns ) {
+		uint64_t blk = ( ( ( uint64_t )rand_r( &rd->seed ) << 31 ) | rand_r( &rd->seed ) ) % rd->blocks;
+		uint64_t t0  = stat_now_ns();
+
+		if ( CAL_RND_SIZE != pread( rd->fd, buf, CAL_RND_SIZE, blk * CAL_RND_SIZE ) )
+			break;
+
+		rd->nsecs += stat_now_ns() - t0;
+		rd->reads++;
+	}
+
+	FREE_PTR( buf );
+
+	return 0;
+}
+
+
+/// @internal Measure random reads with @a depth readers at once
+static int measure_rnd( int fd, uint64_t dev_size, uint32_t depth, double* iops, double* lat_us ) {
+	cal_reader_t readers[CAL_MAX_DEPTH];
+	thrd_t       threads[CAL_MAX_DEPTH];
+	uint32_t     started = 0;
+	uint64_t     until   = stat_now_ns() + ( CAL_RND_MS * 1000000ULL );
+	uint64_t     nsecs   = 0;
+	uint64_t     reads   = 0;
+
+	for ( uint32_t i = 0; i < depth; ++i ) {
+		readers[i] = ( cal_reader_t ) {
+			.blocks = dev_size / CAL_RND_SIZE, .fd = fd, .seed = ( unsigned )( until + i ), .until_ns = until
+		};
+		if ( thrd_success != thrd_create( &threads[i], rnd_reader, &readers[i] ) )
+			break;
+		++started;
+	}
+
+	for ( uint32_t i = 0; i < started; ++i ) {
+		thrd_join( threads[i], NULL );
+		nsecs += readers[i].nsecs;
+		reads += readers[i].reads;
+	}
+
+	if ( ( started < depth ) || ( 0 == reads ) ) {
+		log_error( "Random reads with %u readers failed: %m [%d]", depth, errno );
+		return -1;
+	}
+
+	*iops   = ( double )reads / ( CAL_RND_MS / 1000. );
+	*lat_us = ( double )nsecs / ( double )reads / 1000.;
+
+	return 0;
+}
+
+
+/// @internal Measure sequential reads with windows of @a window bytes
+static int measure_seq( int fd, uint64_t dev_size, uint32_t window, double* mibs ) {
+	uint8_t* buf   = NULL;
+	uint64_t len   = dev_size < CAL_SEQ_BYTES ? dev_size : CAL_SEQ_BYTES;
+	uint64_t total = 0;
+
+	if ( posix_memalign( ( void** )&buf, CAL_ALIGN, window ) ) {
+		log_critical( "Unable to allocate %u bytes for calibration!", window );
+		return -1;
+	}
+
+	uint64_t t0 = stat_now_ns();
+	for ( uint32_t r = 0; r < CAL_REGIONS; ++r ) {
+		uint64_t start = ( ( dev_size - len ) * r / ( CAL_REGIONS - 1 ) ) & ~( ( uint64_t )CAL_ALIGN - 1 );
+
+		for ( uint64_t pos = start; pos < ( start + len ); pos += window ) {
+			size_t  want = ( ( start + len - pos ) < window ) ? start + len - pos : window;
+			ssize_t got  = pread( fd, buf, want, pos );
+			if ( got < 1 ) {
+				log_error( "Sequential read at %llu failed: %m [%d]", pos, errno );
+				FREE_PTR( buf );
+				return -1;
+			}
+			total += got;
+		}
+	}
+	uint64_t elapsed = stat_now_ns() - t0;
+
+	FREE_PTR( buf );
+
+	*mibs = ( ( double )total / ( 1024. * 1024. ) ) / ( ( double )( elapsed ? elapsed : 1 ) / 1e9 );
+
+	return 0;
+}
+
+
+/// @internal Build the path of the cache file for @a path
+static int get_cache_path( char const* path, dev_profile_t const* profile, char* cache, bool create ) {
+	char const* xdg  = getenv( "XDG_CACHE_HOME" );
+	char const* home = getenv( "HOME" );
+	char        dir[PATH_MAX] = { 0x0 };
+	char        key[160]      = { 0x0 };
+	struct stat st;
+
+	if ( !profile->ident[0] || stat( path, &st ) )
+		return -1;
+
+	if ( xdg && xdg[0] )
+		snprintf( dir, PATH_MAX, "%s/xfs_undelete", xdg );
+	else if ( home && home[0] )
+		snprintf( dir, PATH_MAX, "%s/.cache/xfs_undelete", home );
+	else
+		return -1;
+
+	if ( create && mkdirs( dir ) )
+		return -1;
+
+	// An image file is told apart from others on the same device by its inode
+	if ( S_ISBLK( st.st_mode ) )
+		snprintf( key, sizeof( key ), "%s", profile->ident );
+	else
+		snprintf( key, sizeof( key ), "%s-ino%llu", profile->ident, ( unsigned long long )st.st_ino );
+
+	for ( char* c = key; *c; ++c ) {
+		if ( !isalnum( *c ) && ( '-' != *c ) && ( '.' != *c ) )
+			*c = '_';
+	}
+
+	snprintf( cache, PATH_MAX, "%s/%s.profile", dir, key );
+
+	return 0;
+}
+
+
+/// @internal Put a calibration result into a profile
+static void apply_result( dev_profile_t* profile, cal_result_t const* result ) {
+	profile->cal_read_size = result->read_size;
+	profile->cal_readers   = result->readers;
+	profile->rotational    = 1 == result->readers;
+
+	log_info( "Calibrated: read %s at once with %u reader(s); %.1f MiB/s, %.0f IOPS, %.0f us latency",
+	          get_human_size( result->read_size ), result->readers,
+	          result->seq_mibs, result->rnd_iops, result->rnd_lat_us );
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int calibrate_device( char const* path, dev_profile_t* profile ) {
+	RETURN_INT_IF_NULL( path );
+	RETURN_INT_IF_NULL( profile );
+
+	cal_result_t result = { .read_size = cal_windows[0], .readers = 1 };
+	double       iops   = 0., lat_us = 0., mibs = 0.;
+	int          res    = -1;
+	int          fd     = open( path, O_RDONLY | O_NOFOLLOW | O_DIRECT );
+
+	if ( -1 == fd ) {
+		log_warning( "Can not open %s with O_DIRECT, the page cache will skew the calibration", path );
+		fd = open( path, O_RDONLY | O_NOFOLLOW );
+	}
+	if ( -1 == fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", path, errno );
+		return -1;
+	}
+
+	off_t dev_size = lseek( fd, 0, SEEK_END );
+	if ( dev_size < CAL_RND_SIZE ) {
+		log_error( "%s is too small to be calibrated", path );
+		goto cleanup;
+	}
+
+	log_info( "Calibrating %s, this takes a few seconds...", path );
+
+	// --- Sequential throughput per window size ---
+	double window_mibs[CAL_STEPS] = { 0. };
+	for ( int i = 0; cal_windows[i]; ++i ) {
+		if ( -1 == measure_seq( fd, dev_size, cal_windows[i], &mibs ) )
+			goto cleanup;
+		log_debug( "Window %8u: %8.1f MiB/s", cal_windows[i], mibs );
+		window_mibs[i] = mibs;
+		if ( mibs > result.seq_mibs )
+			result.seq_mibs = mibs;
+	}
+	for ( int i = 0; cal_windows[i]; ++i ) {
+		if ( window_mibs[i] >= ( CAL_GOOD_ENOUGH * result.seq_mibs ) ) {
+			result.read_size = cal_windows[i];
+			break;
+		}
+	}
+
+	// --- Random reads per queue depth ---
+	double depth_iops[CAL_STEPS] = { 0. };
+	for ( int i = 0; cal_depths[i]; ++i ) {
+		if ( -1 == measure_rnd( fd, dev_size, cal_depths[i], &iops, &lat_us ) )
+			goto cleanup;
+		log_debug( "Depth %2u: %8.0f IOPS, %8.0f us", cal_depths[i], iops, lat_us );
+		depth_iops[i] = iops;
+		if ( 1 == cal_depths[i] )
+			result.rnd_lat_us = lat_us;
+		if ( iops > result.rnd_iops )
+			result.rnd_iops = iops;
+	}
+	for ( int i = 0; cal_depths[i]; ++i ) {
+		if ( depth_iops[i] >= ( CAL_GOOD_ENOUGH * result.rnd_iops ) ) {
+			result.readers = cal_depths[i];
+			break;
+		}
+	}
+
+	apply_result( profile, &result );
+
+	// --- Store the result for the next time ---
+	char  cache[PATH_MAX] = { 0x0 };
+	FILE* f               = NULL;
+
+	if ( ( -1 == get_cache_path( path, profile, cache, true ) ) || ( NULL == ( f = fopen( cache, "w" ) ) ) ) {
+		log_warning( "Can not store the calibration of %s, it is used for this run only", path );
+		res = 0;
+		goto cleanup;
+	}
+
+	fprintf( f, "version=%d\nread_size=%u\nreaders=%u\nseq_mibs=%.1f\nrnd_iops=%.0f\nrnd_lat_us=%.1f\n",
+	         CAL_VERSION, result.read_size, result.readers, result.seq_mibs, result.rnd_iops, result.rnd_lat_us );
+	fclose( f );
+	log_info( "Calibration stored in %s", cache );
+
+	res = 0;
+
+cleanup:
+	close( fd );
+
+	return res;
+}
+
+
+int calibrate_load( char const* path, dev_profile_t* profile ) {
+	RETURN_INT_IF_NULL( path );
+	RETURN_INT_IF_NULL( profile );
+
+	char         cache[PATH_MAX] = { 0x0 };
+	char         line[128]       = { 0x0 };
+	cal_result_t result          = { 0 };
+	int          version         = 0;
+	FILE*        f               = NULL;
+
+	if ( ( -1 == get_cache_path( path, profile, cache, false ) ) || ( NULL == ( f = fopen( cache, "r" ) ) ) )
+		return 0;
+
+	while ( fgets( line, sizeof( line ), f ) ) {
+		char   name[32] = { 0x0 };
+		double value    = 0.;
+
+		if ( 2 != sscanf( line, "%31[^=]=%lf", name, &value ) )
+			continue;
+
+		if ( 0 == strcmp( "version", name ) )
+			version = ( int )value;
+		else if ( 0 == strcmp( "read_size", name ) )
+			result.read_size = ( uint32_t )value;
+		else if ( 0 == strcmp( "readers", name ) )
+			result.readers = ( uint32_t )value;
+		else if ( 0 == strcmp( "seq_mibs", name ) )
+			result.seq_mibs = value;
+		else if ( 0 == strcmp( "rnd_iops", name ) )
+			result.rnd_iops = value;
+		else if ( 0 == strcmp( "rnd_lat_us", name ) )
+			result.rnd_lat_us = value;
+	}
+	fclose( f );
+
+	if ( ( CAL_VERSION != version )
+	  || ( result.read_size < cal_windows[0] ) || ( result.read_size > ( 16 * 1024 * 1024 ) )
+	  || ( result.readers < 1 ) || ( result.readers > CAL_MAX_DEPTH ) ) {
+		log_warning( "Ignoring invalid calibration in %s, use --calibrate to renew it", cache );
+		return 0;
+	}
+
+	log_info( "Using the calibration in %s", cache );
+	apply_result( profile, &result );
+
+	return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef PWX_XFS_UNDELETE_SRC_CALIBRATE_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_CALIBRATE_H_INCLUDED 1
+#pragma once
+
+
+#include "topology.h"
+
+
+#include <stdbool.h>
+
+
+/** @brief Measure how a device really performs and store the result
+  *
+  * Sequential throughput is measured with several read window sizes in a
+  * few regions of the device. Random read latency and IOPS are measured
+  * with several queue depths. All reads bypass the page cache if possible.
+  *
+  * The smallest window that reaches 90% of the best throughput becomes
+  * `cal_read_size`. The smallest queue depth that reaches 90% of the best
+  * IOPS becomes `cal_readers`. If it is 1, the device does not gain from
+  * parallel reads and is treated like a rotational one.
+  *
+  * The result is stored in the calibration cache, keyed by the identity
+  * of the device, see calibrate_load().
+  *
+  * @param[in]     path     Path to the device or image to measure
+  * @param[in,out] profile  The sysfs profile of @a path, receives the results
+  * @return 0 on success, -1 on failure.
+**/
+int calibrate_device( char const* path, dev_profile_t* profile );
+
+
+/** @brief Apply an earlier calibration of a device, if there is one
+  *
+  * The cache lives in $XDG_CACHE_HOME/xfs_undelete, or ~/.cache/xfs_undelete.
+  * Each device has one file, named after its WWID, serial or UUID. For image
+  * files, the inode number of the image is added.
+  *
+  * @param[in]     path     Path to the device or image
+  * @param[in,out] profile  The sysfs profile of @a path, receives the results
+  * @return 1 if a calibration was applied, 0 if there is none, -1 on failure.
+**/
+int calibrate_load( char const* path, dev_profile_t* profile );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_CALIBRATE_H_INCLUDED
@@ -0,0 +1,172 @@
+/*******************************************************************************
+ * catalog.c : Lock free index of all found inodes by inode number
+ ******************************************************************************/
+
+
+#include "catalog.h"
+#include "globals.h"
+#include "log.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <threads.h>
+
+
+#define CAT_LEAF_BITS 12                       // Inode numbers per leaf, as a power of two
+#define CAT_NODE_BITS 8                        // Children per inner node, as a power of two
+#define CAT_LEAF_SIZE ( 1 << CAT_LEAF_BITS )
+#define CAT_FANOUT    ( 1 << CAT_NODE_BITS )
+
+
+/// @brief Inner node, the children are nodes on the level below, or leaves
+typedef struct _cat_node {
+	_Atomic( void* ) child[CAT_FANOUT];
+} cat_node_t;
+
+
+/// @brief Leaf, one byte per inode number, 0 if the inode was not found
+typedef struct _cat_leaf {
+	atomic_uchar ftype[CAT_LEAF_SIZE];
+} cat_leaf_t;
+
+
+static _Atomic( void* ) cat_root   = NULL;
+static uint32_t         cat_levels = 0; //!< Inner node levels above the leaves
+static uint32_t         cat_bits   = 0; //!< Bits an inode number of this file system can have
+static atomic_ulong     cat_cnt    = 0; //!< Different inodes added
+static atomic_ulong     cat_leaves = 0; //!< Leaves allocated
+static once_flag        cat_once   = ONCE_FLAG_INIT;
+
+
+/// @internal Size the tree for the inode numbers of the file system, called once
+static void cat_init( void ) {
+	xfs_sb_t const* sb      = &superblocks[0];
+	uint32_t        ag_bits = 0;
+
+	while ( ( ag_bits < 32 ) && ( ( 1ULL << ag_bits ) < sb_ag_count ) )
+		++ag_bits;
+
+	cat_bits = ag_bits + sb->log2_ag_size + sb->log2_inode_block;
+	if ( cat_bits > 64 )
+		cat_bits = 64;
+	if ( cat_bits > CAT_LEAF_BITS )
+		cat_levels = ( cat_bits - CAT_LEAF_BITS + CAT_NODE_BITS - 1 ) / CAT_NODE_BITS;
+}
+
+
+/// @internal Get the child in @a slot, creating one of @a size bytes if there is none and @a size is not 0
+static void* cat_child( _Atomic( void* )* slot, size_t size ) {
+	void* child = atomic_load_explicit( slot, memory_order_acquire );
+
+	if ( child || !size )
+		return child;
+
+	void* fresh = calloc( 1, size );
+	if ( NULL == fresh ) {
+		log_critical( "Unable to allocate %zu bytes for the inode catalog: %m [%d]", size, errno );
+		return NULL;
+	}
+
+	if ( atomic_compare_exchange_strong_explicit( slot, &child, fresh,
+	                                              memory_order_acq_rel, memory_order_acquire ) ) {
+		if ( sizeof( cat_leaf_t ) == size )
+			atomic_fetch_add_explicit( &cat_leaves, 1, memory_order_relaxed );
+		return fresh;
+	}
+
+	// Another thread was faster, and child is what it put there
+	free( fresh );
+
+	return child;
+}
+
+
+/// @internal Find the leaf of @a ino, creating the path to it if @a create is set
+static cat_leaf_t* cat_leaf( uint64_t ino, bool create ) {
+	call_once( &cat_once, cat_init );
+
+	if ( ( cat_bits < 64 ) && ( ino >> cat_bits ) )
+		return NULL;
+
+	_Atomic( void* )* slot = &cat_root;
+	for ( uint32_t l = cat_levels; l > 0; --l ) {
+		cat_node_t* node = cat_child( slot, create ? sizeof( cat_node_t ) : 0 );
+		if ( NULL == node )
+			return NULL;
+		slot = &node->child[( ino >> ( CAT_LEAF_BITS + ( ( l - 1 ) * CAT_NODE_BITS ) ) ) & ( CAT_FANOUT - 1 )];
+	}
+
+	return cat_child( slot, create ? sizeof( cat_leaf_t ) : 0 );
+}
+
+
+/// @internal Free a node on @a level and everything below it
+static void cat_free_node( void* node, uint32_t level ) {
+	if ( node && level ) {
+		for ( size_t i = 0; i < CAT_FANOUT; ++i )
+			cat_free_node( atomic_load( &( ( cat_node_t* )node )->child[i] ), level - 1 );
+	}
+	free( node );
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int cat_add( uint64_t ino, uint8_t ftype ) {
+	cat_leaf_t* leaf = cat_leaf( ino, true );
+
+	if ( NULL == leaf ) {
+		if ( ( cat_bits < 64 ) && ( ino >> cat_bits ) )
+			log_error( "Inode number %llu does not fit the file system", ino );
+		return -1;
+	}
+
+	if ( 0 == atomic_exchange_explicit( &leaf->ftype[ino & ( CAT_LEAF_SIZE - 1 )], ftype, memory_order_release ) )
+		atomic_fetch_add_explicit( &cat_cnt, 1, memory_order_relaxed );
+
+	return 0;
+}
+
+
+uint64_t cat_count( void ) {
+	return atomic_load( &cat_cnt );
+}
+
+
+void cat_del( uint64_t ino ) {
+	cat_leaf_t* leaf = cat_leaf( ino, false );
+
+	// Leaves are never freed before cat_free(), a cleared entry is all it takes
+	if ( leaf && atomic_exchange_explicit( &leaf->ftype[ino & ( CAT_LEAF_SIZE - 1 )], 0, memory_order_release ) )
+		atomic_fetch_sub_explicit( &cat_cnt, 1, memory_order_relaxed );
+}
+
+
+uint8_t cat_find( uint64_t ino ) {
+	cat_leaf_t* leaf = cat_leaf( ino, false );
+
+	if ( NULL == leaf )
+		return 0;
+
+	return atomic_load_explicit( &leaf->ftype[ino & ( CAT_LEAF_SIZE - 1 )], memory_order_acquire );
+}
+
+
+void cat_free( void ) {
+	void* root = atomic_exchange( &cat_root, NULL );
+
+	if ( root ) {
+		log_debug( "inode catalog: %lu inodes in %lu leaves, %lu KiB",
+		           atomic_load( &cat_cnt ), atomic_load( &cat_leaves ),
+		           atomic_load( &cat_leaves ) * sizeof( cat_leaf_t ) / 1024 );
+	}
+
+	cat_free_node( root, cat_levels );
+	atomic_store( &cat_cnt,    0 );
+	atomic_store( &cat_leaves, 0 );
+}
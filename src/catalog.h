@@ -0,0 +1,54 @@
+#ifndef PWX_XFS_UNDELETE_SRC_CATALOG_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_CATALOG_H_INCLUDED 1
+#pragma once
+
+
+#include <stdint.h>
+
+
+/** @brief Note down that inode @a ino was found, and what it is
+  *
+  * The catalog is a radix tree keyed by inode number. Its leaves hold one
+  * byte for each of 4096 neighbouring inode numbers. Inodes are allocated
+  * in chunks, so the leaves are dense, and each found inode costs a little
+  * more than one byte. Adding and looking up take no locks, so all threads
+  * can use the catalog at once.
+  *
+  * @param[in] ino    The inode number, see xfs_calc_ino()
+  * @param[in] ftype  The detected file type, an e_file_type, not 0
+  * @return 0 on success, -1 if out of memory or if @a ino can not exist
+  *         on this file system.
+**/
+int cat_add( uint64_t ino, uint8_t ftype );
+
+
+/// @return The number of different inodes in the catalog
+uint64_t cat_count( void );
+
+
+/** @brief Remove inode @a ino from the catalog
+  *
+  * Use this when a found inode is dropped before anybody worked on it.
+  * Removing an inode that is not in the catalog does nothing.
+  *
+  * @param[in] ino  The inode number
+**/
+void cat_del( uint64_t ino );
+
+
+/** @brief Look up an inode number, for example the address of a directory entry
+  *
+  * @param[in] ino  The inode number
+  * @return The file type given to cat_add(), or 0 if the inode was not found.
+**/
+uint8_t cat_find( uint64_t ino );
+
+
+/** @brief Free the catalog
+  *
+  * Only call this when all threads are gone.
+**/
+void cat_free( void );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_CATALOG_H_INCLUDED
@@ -3,7 +3,10 @@
  ******************************************************************************/
 
 
+#include "backend.h"
+#include "calibrate.h"
 #include "device.h"
+#include "globals.h"
 #include "log.h"
 #include "utils.h"
 #include "superblock.h"
@@ -46,11 +49,18 @@ uint32_t  sb_block_size    = 0;    //!< Bytes  4- 7 : Block Size (in bytes)
 xfs_sb_t* superblocks      = NULL; //!< All AGs are loaded in here
 
 // Global disk information
-bool src_is_ssd = false;
-bool tgt_is_ssd = false;
+bool          src_calibrate = false;
+bool          src_is_ssd    = false;
+uint64_t      src_offset    = 0;
+dev_profile_t src_profile   = { .numa_node = -1 };
+bool          tgt_is_ssd    = false;
+dev_profile_t tgt_profile   = { .numa_node = -1 };
 
 // Magic Codes of the different XFS blocks
+uint8_t XFS_B3_MAGIC[4] = { 0x42, 0x4d, 0x41, 0x33 }; // "BMA3" ; B+Tree node or leaf block (v5 file systems)
 uint8_t XFS_BT_MAGIC[4] = { 0x42, 0x4d, 0x41, 0x50 }; // "BMAP" ; B+Tree node or leaf block
+uint8_t XFS_D2B_MAGIC[4] = { 0x58, 0x44, 0x32, 0x42 }; // "XD2B" ; Single block long directory block (v4 file systems)
+uint8_t XFS_D2D_MAGIC[4] = { 0x58, 0x44, 0x32, 0x44 }; // "XD2D" ; Multi block long directory block (v4 file systems)
 uint8_t XFS_DB_MAGIC[4] = { 0x58, 0x44, 0x42, 0x33 }; // "XDB3" ; Single block long directory block
 uint8_t XFS_DD_MAGIC[4] = { 0x58, 0x44, 0x44, 0x33 }; // "XDD3" ; Multi block long directory block
 uint8_t XFS_DT_MAGIC[2] = { 0x3d, 0xf1};              //          Multi block long directory tail (hash) block
@@ -77,6 +87,27 @@ void free_devices( void ) {
 }
 
 
+bool fsb_to_pos( uint64_t fs_blk, uint32_t count, uint64_t* pos ) {
+	RETURN_ZERO_IF_NULL( pos );
+
+	xfs_sb_t const* sb     = &superblocks[0];
+	uint64_t        ag_num = fs_blk >> sb->log2_ag_size;
+	uint64_t        ag_blk = fs_blk & ( ( 1ULL << sb->log2_ag_size ) - 1 );
+
+	if ( ( ag_num >= sb_ag_count ) || ( ( ag_blk + count ) > superblocks[ag_num].ag_size ) )
+		return false;
+
+	*pos = ( ( ag_num * sb->ag_size ) + ag_blk ) * sb_block_size;
+
+	return true;
+}
+
+
+char const* get_target_path( void ) {
+	return target_path;
+}
+
+
 /// @internal
 static int get_ag_base_info() {
 	// Note: We need just the first 92 bytes here, so low-level open/read/close is good to go.
@@ -88,7 +119,7 @@ static int get_ag_base_info() {
 	 * Bytes 88-91 : Number of AGs (normally 0x04)
 	*/
 	uint8_t buf[92] = { 0x0 };
-	int     fd      = open( source_device, O_RDONLY | O_NOFOLLOW );
+	int     fd      = src_open( source_device, O_NOFOLLOW );
 	int     res     = fd;
 
 	if ( -1 == res ) {
@@ -96,7 +127,7 @@ static int get_ag_base_info() {
 		return -1;
 	}
 
-	res = read( fd, buf, 92 );
+	res = src_pread( fd, buf, 92, 0, IO_SUPERBLOCK );
 	close( fd );
 
 	if ( -1 == res ) {
@@ -154,7 +185,7 @@ int scan_superblocks() {
 	}
 
 	// Now we need the source_device to be opened.
-	int fd  = open( source_device, O_RDONLY | O_NOFOLLOW );
+	int fd  = src_open( source_device, O_NOFOLLOW );
 	if ( -1 == fd ) {
 		log_error( "Can not open %s for reading: %m [%d]", source_device, errno );
 		return -1;
@@ -175,45 +206,22 @@ int scan_superblocks() {
 }
 
 
-/// @brief little helper, because we need this twice.
-int is_device_ssd( bool* tgt, char const* dev ) {
-	char        disk_part[6] = { 0x0 };
-	char const* cur_p        = strrchr( dev, '/' );
+/// @internal Fill @a profile and @a is_ssd for @a dev, because we need this twice.
+static int get_device_type( bool* is_ssd, dev_profile_t* profile, char const* dev ) {
+	if ( -1 == get_dev_profile( dev, profile ) )
+		return -1;
 
-	if ( cur_p ) {
-		++cur_p;
-		for ( int i = 0; *cur_p && !isdigit( *cur_p ) && ( i < 5 ); ++i, ++cur_p ) {
-			disk_part[i] = *cur_p;
-		}
-	}
+	*is_ssd = !profile->rotational;
 
-	if ( strlen( disk_part ) ) {
-		char rot_file[40] = { 0x0 };
-		int  written      = snprintf( rot_file, 40, "/sys/block/%s/queue/rotational", disk_part );
-		if ( written < 40 ) {
-			FILE* rot = fopen( rot_file, "r" );
-			char  res = 0x0;
-			if ( rot ) {
-				if ( ( 1 == fread( &res, 1, 1, rot ) ) && ( res == '0' ) )
-					*tgt = true;
-				else
-					*tgt = false;
-				fclose( rot );
-			} else {
-				log_error( "Unable to open %s: %m [%d]", rot_file, errno );
-				return -1;
-			}
-		} else {
-			log_error( "Bug (?) device disk part \"%s\" too large?", disk_part );
-			return -1;
-		}
-	}
+	log_info( "%s is %s: optimal I/O %u, logical block %u, queue depth %u, NUMA node %d",
+	          dev, profile->name, profile->optimal_io, profile->logical_block,
+	          profile->nr_requests, profile->numa_node );
 
 	return 0;
 }
 
 
-int set_source_device( char const* device_path ) {
+int set_source_device( char const* device_path, bool remount_ro ) {
 
 	if ( source_device )
 		free_devices();
@@ -246,7 +254,9 @@ int set_source_device( char const* device_path ) {
 	 */
 	if ( mntDir ) {
 		char* has_rw = strstr( mntOpts, MNTOPT_RW );
-		if ( has_rw ) {
+		if ( has_rw && !remount_ro )
+			log_info( "%s mounted rw at %s, leaving it alone", source_device, mntDir );
+		else if ( has_rw ) {
 			log_info( "%s mounted rw at %s, trying to remount ro...", source_device, mntDir );
 			if ( mount( NULL, mntDir, NULL, MS_REMOUNT | MS_RDONLY, NULL ) ) {
 				log_critical( "Remount ro %s failed, %m (%d)\n", source_device, errno );
@@ -262,11 +272,23 @@ int set_source_device( char const* device_path ) {
 	 * === want to got multi-threaded on a rotational disk! ===
 	 * ========================================================
 	 */
-	if ( -1 == is_device_ssd( &src_is_ssd, source_device ) ) {
+	if ( -1 == get_device_type( &src_is_ssd, &src_profile, source_device ) ) {
 		log_error( "Can not determine whether %s is rotational", source_device );
 		log_warning( " Assuming %s is a spinning disk and going to read single-threaded.", source_device );
 		src_is_ssd = false;
-	} else if ( src_is_ssd )
+	}
+
+	// A calibration, fresh or from an earlier run, knows better than sysfs.
+	int cal_res = src_calibrate ? calibrate_device( source_device, &src_profile )
+	                            : calibrate_load( source_device, &src_profile );
+	if ( ( cal_res > 0 ) || ( src_calibrate && ( 0 == cal_res ) ) )
+		src_is_ssd = !src_profile.rotational;
+
+	// But a simulated device is what the image has to behave like.
+	if ( sim_apply_profile( &src_profile ) )
+		src_is_ssd = !src_profile.rotational;
+
+	if ( src_is_ssd )
 		log_info( "%s seems to be an SSD -> Reading multi-threaded!", source_device );
 	else
 		log_info( "%s assumed to be a rotating disk -> Reading single-threaded", source_device );
@@ -363,7 +385,8 @@ int set_target_path( char const* dir_path ) {
 	 * === want to got multi-threaded on a rotational disk! ===
 	 * ========================================================
 	 */
-	if ( -1 == is_device_ssd( &tgt_is_ssd, target_device ) ) {
+	if ( ( -1 == get_device_type( &tgt_is_ssd, &tgt_profile, target_device ) )
+	  && ( -1 == get_device_type( &tgt_is_ssd, &tgt_profile, full_path ) ) ) {
 		log_error( "Can not determine whether %s is rotational", target_device );
 		log_warning( " Assuming %s is a spinning disk and going to write single-threaded.", target_device );
 		tgt_is_ssd = false;
@@ -3,6 +3,11 @@
 #pragma once
 
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
 /** @brief restore the source device mount status and free the internal paths
   *
   * If the source device was remounted read-only, try to restore the rw state.
@@ -12,6 +17,24 @@
 void free_devices( void );
 
 
+/** @brief Get the byte position of a file system block on the device
+  *
+  * File system block numbers hold the AG number in the bits above
+  * sb->log2_ag_size, and the block in that AG below. On the device the
+  * AGs are only sb->ag_size blocks apart, which is mostly less than that.
+  *
+  * @param[in]  fs_blk  The file system block number
+  * @param[in]  count   Number of blocks from @a fs_blk on that must be in the same AG
+  * @param[out] pos     Receives the byte position of @a fs_blk
+  * @return true on success, false if the blocks are not all inside one AG.
+**/
+bool fsb_to_pos( uint64_t fs_blk, uint32_t count, uint64_t* pos );
+
+
+/// @return The directory recovered files are written into, NULL if it is not set yet
+char const* get_target_path( void );
+
+
 /** @brief scan the superblocks
   *
   * This will scan the superblocks and fill internal data structures.
@@ -25,7 +48,7 @@ int scan_superblocks();
 /** @brief Set the source device name and remount ro
   *
   * If the device exists and if it is mounted, it will be remounted
-  * read-only.
+  * read-only, unless @a remount_ro is false.
   * Further it is checked whether the source device is an SSD, and
   * the global boolean `src_is_ssd` is set accordingly.
   *
@@ -33,9 +56,10 @@ int scan_superblocks();
   * to clean up and remount rw.
   *
   * @param[in] device_path  Full path to the device to work with
+  * @param[in] remount_ro   If false, a rw mounted device is left alone (watch mode)
   * @return 0 on success, -1 on failure.
 **/
-int set_source_device( char const* device_path );
+int set_source_device( char const* device_path, bool remount_ro );
 
 
 /** @brief Set the target directory and check its device
@@ -22,8 +22,9 @@
 
 /** @brief This has to be called before destroying xfs_entry_t instances!
   *
-  * This only clears the "inside". If the instance is malloc'd, you
-  * still have to free() it yourself!
+  * This only clears the "inside". If the instance is from the slab, you
+  * still have to slab_free() it yourself! The name belongs to the arena
+  * of the directory.
   *
   * @param[in,out] entry  Pointer to the entry to free
 **/
@@ -31,12 +32,13 @@ static void xfs_free_entry( xfs_entry_t* entry ) {
 	RETURN_VOID_IF_NULL( entry );
 
 	if ( entry ) {
-		entry->address = 0;
-		FREE_PTR( entry->name );
-		entry->next    = NULL;
-		entry->parent  = NULL;
-		entry->sub     = NULL;
-		entry->type    = FT_INVALID;
+		entry->address    = 0;
+		entry->name       = NULL;
+		entry->next       = NULL;
+		entry->parent     = NULL;
+		entry->sub        = NULL;
+		entry->type       = FT_INVALID;
+		entry->is_deleted = false;
 	}
 }
 
@@ -58,6 +60,7 @@ static int xfs_init_packed_dir( xfs_dir_t* dir, uint8_t const* data, bool log_er
 	dir->parent_address = dir->entries_64bit ? get_flip64u( data, 2 ) : get_flip32u( data, 2 );
 	dir->parent         = NULL;
 	dir->root           = NULL;
+	dir->names          = NULL;
 
 	// Check 1: We can't have more 64bit entries than total entries
 	// --------------------------------------------------------------------
@@ -72,6 +75,9 @@ static int xfs_init_packed_dir( xfs_dir_t* dir, uint8_t const* data, bool log_er
 
 	// Check 2: The parent address must lie on the source drive
 	// --------------------------------------------------------------------
+	if ( 0 == dir->parent_address )
+		// Inode 0 does not exist. This is most likely a data extent at file offset 0.
+		return -1;
 	if ( dir->parent_address > full_disk_size ) {
 		if ( log_error )
 			log_error( "Invalid parent inode address at 0x%x/0x%x!\n"
@@ -104,12 +110,13 @@ static int xfs_read_packed_dir_entry( xfs_entry_t* entry, xfs_dir_t* dir, uint8_
 	RETURN_INT_IF_NULL( data );
 
 	// Do some early initialization. Maybe none will be filled later.
-	entry->address = 0;
-	entry->name    = NULL;
-	entry->next    = NULL;
-	entry->parent  = dir;
-	entry->sub     = NULL;
-	entry->type    = FT_INVALID;
+	entry->address    = 0;
+	entry->name       = NULL;
+	entry->next       = NULL;
+	entry->parent     = dir;
+	entry->sub        = NULL;
+	entry->type       = FT_INVALID;
+	entry->is_deleted = false;
 
 
 	// Check 1: The file name is always a good hint.
@@ -131,7 +138,11 @@ static int xfs_read_packed_dir_entry( xfs_entry_t* entry, xfs_dir_t* dir, uint8_
 	}
 
 	// Well, copy it then...
-	entry->name = strdup( name_buf );
+	char* name = arena_alloc( &dir->names, name_len + 1 );
+	if ( NULL == name )
+		return -1;
+	memcpy( name, name_buf, name_len );
+	entry->name = name;
 
 	// Check 2: The file type, the byte after the name
 	// --------------------------------------------------------------------
@@ -159,7 +170,8 @@ static int xfs_read_packed_dir_entry( xfs_entry_t* entry, xfs_dir_t* dir, uint8_
 	 *       bytes 2-3 : Length of the free space.
 	 * Therefore we check for == 0xffff on the first two bytes, only.
 	 */
-	if ( 0xffff != ( del_part & 0xffff ) ) {
+	entry->is_deleted = ( 0xffff == ( del_part & 0xffff ) );
+	if ( !entry->is_deleted ) {
 		// Okay, this is not marked as deleted. Let's check the address
 		if ( ( 0 == entry->address ) || ( entry->address > full_disk_size ) ) {
 			if ( log_error )
@@ -180,6 +192,55 @@ static int xfs_read_packed_dir_entry( xfs_entry_t* entry, xfs_dir_t* dir, uint8_
 }
 
 
+/** @brief interpret @a data as one entry of a long form directory data block
+  *
+  * @param[out] entry  Pointer to the xfs_entry_t instance to fill
+  * @param[in] dir  Pointer to the xfs_dir_t instance this is a child of
+  * @param[in] data  The entry to unpack, freed entries start with the 0xffff tag
+  * @param[in] room  Bytes left for the entry, its whole free space if freed
+  * @param[in] has_ftype  Set if the entry has a file type byte behind the name
+  * @param[out] ent_len  Receives the size of the entry in the block, 0 if it has no name
+  * @return 0 on success, 1 if there is no usable entry, -1 on failure.
+**/
+static int xfs_read_block_dir_entry( xfs_entry_t* entry, xfs_dir_t* dir, uint8_t const* data,
+                                     size_t room, bool has_ftype, size_t* ent_len ) {
+	bool    is_deleted = ( 0xffff == get_flip16u( data, 0 ) );
+	uint8_t name_len   = get_flip8u( data, 8 );
+	size_t  needed     = 8 + 1 + name_len + ( has_ftype ? 1 : 0 ) + 2;
+
+	// Entries are padded to 8 bytes, the tag is in the last two
+	*ent_len = name_len ? ( needed + 7 ) & ~( size_t )7 : 0;
+	if ( ( 0 == *ent_len ) || ( *ent_len > room ) )
+		return 1;
+
+	char const* name_p    = ( char const* )data + 9;
+	char const* safe_name = get_safe_name( name_p, name_len );
+	if ( strncmp( name_p, safe_name, name_len ) )
+		return 1;
+
+	// The links to itself and its parent are no children
+	if ( ( ( 1 == name_len ) && ( '.' == name_p[0] ) )
+	  || ( ( 2 == name_len ) && ( '.' == name_p[0] ) && ( '.' == name_p[1] ) ) )
+		return 1;
+
+	char* name = arena_alloc( &dir->names, name_len + 1 );
+	if ( NULL == name )
+		return -1;
+	memcpy( name, name_p, name_len );
+
+	// Freed entries lost the upper half of their inode number to the free tag and length
+	entry->address    = is_deleted ? get_flip32u( data, 4 ) : get_flip64u( data, 0 );
+	entry->name = name;
+	entry->next       = NULL;
+	entry->parent     = dir;
+	entry->sub        = NULL;
+	entry->type       = has_ftype ? get_file_type_from_dirent( get_flip8u( data, 9 + name_len ) ) : FT_INVALID;
+	entry->is_deleted = is_deleted;
+
+	return 0;
+}
+
+
 /// ============================================
 /// === Non-static functions implementations ===
 /// ============================================
@@ -193,10 +254,13 @@ void xfs_free_dir( xfs_dir_t* dir ) {
 
 	while ( curr ) {
 		xfs_free_entry( curr );
-		FREE_PTR( curr );
+		slab_free( SLAB_ENTRY, curr );
 		curr = next;
 		next = curr ? curr->next : NULL;
 	}
+	dir->root = NULL;
+
+	arena_free( &dir->names );
 }
 
 
@@ -212,10 +276,99 @@ void xfs_free_dir_recursive( xfs_dir_t* dir ) {
 			FREE_PTR( curr->sub );
 		}
 		xfs_free_entry( curr );
-		FREE_PTR( curr );
+		slab_free( SLAB_ENTRY, curr );
 		curr = next;
 		next = curr ? curr->next : NULL;
 	}
+	dir->root = NULL;
+
+	arena_free( &dir->names );
+}
+
+
+int xfs_read_block_dir( xfs_dir_t* dir, uint8_t const* data, size_t size, bool has_ftype, bool log_error ) {
+	RETURN_INT_IF_NULL( dir );
+	RETURN_INT_IF_NULL( data );
+
+	bool   is_block = false;
+	size_t start    = 0;
+	size_t end      = size;
+
+	// v5 file systems have a larger header with CRC, owner and UUID
+	if ( ( 0 == memcmp( data, XFS_DB_MAGIC, 4 ) ) || ( 0 == memcmp( data, XFS_DD_MAGIC, 4 ) ) ) {
+		is_block = ( 0 == memcmp( data, XFS_DB_MAGIC, 4 ) );
+		start    = 64;
+	} else if ( ( 0 == memcmp( data, XFS_D2B_MAGIC, 4 ) ) || ( 0 == memcmp( data, XFS_D2D_MAGIC, 4 ) ) ) {
+		is_block = ( 0 == memcmp( data, XFS_D2B_MAGIC, 4 ) );
+		start    = 16;
+	} else
+		// Leaf, node and free index blocks hold no names
+		return -1;
+
+	// Single block directories end with their leaf entries and a tail of count and stale
+	if ( is_block ) {
+		uint64_t leaves = get_flip32u( data, size - 8 );
+		if ( ( ( leaves * 8 ) + 8 + start ) > size ) {
+			if ( log_error )
+				log_error( "Directory block claims %llu leaf entries in %zu bytes", leaves, size );
+			return -1;
+		}
+		end = size - 8 - ( leaves * 8 );
+	}
+
+	// Entries are appended, so find the current end of the chain
+	xfs_entry_t* curr = dir->root;
+	while ( curr && curr->next )
+		curr = curr->next;
+
+	for ( size_t offset = start ; ( offset + 16 ) <= end ; ) {
+		uint8_t const* ent     = data + offset;
+		size_t         ent_len = 0;
+		size_t         step    = 0;
+
+		if ( 0xffff == get_flip16u( ent, 0 ) ) {
+			// Free space, maybe an entry was freed here and still holds its name
+			step = get_flip16u( ent, 2 );
+			if ( ( step < 8 ) || ( step % 8 ) || ( ( offset + step ) > end ) ) {
+				if ( log_error )
+					log_error( "Broken free space of %zu bytes at offset %zu", step, offset );
+				return -1;
+			}
+		}
+
+		xfs_entry_t* next = slab_alloc( SLAB_ENTRY );
+		if ( NULL == next ) {
+			log_critical( "Unable to allocate %zu bytes for xfs_entry_t! %m [%d]",
+			              sizeof(xfs_entry_t), errno );
+			return -1;
+		}
+
+		int res = xfs_read_block_dir_entry( next, dir, ent, step ? step : end - offset, has_ftype, &ent_len );
+		if ( 0 == res ) {
+			if ( curr )
+				curr->next = next;
+			else
+				dir->root = next;
+			curr = next;
+		} else
+			slab_free( SLAB_ENTRY, next );
+
+		if ( -1 == res )
+			return -1;
+		if ( 0 == step ) {
+			// A live entry that can not be read leaves no way to find the next one
+			if ( ( 0 == ent_len ) || ( ent_len > ( end - offset ) ) ) {
+				if ( log_error )
+					log_error( "Broken directory entry at offset %zu\n" DUMP_STRIP_FMT,
+					           offset, DUMP_STRIP_DATA( offset, ent ) );
+				return -1;
+			}
+			step = ent_len;
+		}
+		offset += step;
+	} // End of looping through the directory entries
+
+	return 0;
 }
 
 
@@ -232,7 +385,7 @@ int xfs_read_packed_dir( xfs_dir_t* dir, uint8_t const* data, bool log_error ) {
 	xfs_entry_t* next = NULL;
 
 	for ( uint8_t i = 0 ; (0 == res) && (i < dir->entry_count) ; ++i ) {
-		next = malloc( sizeof(xfs_entry_t) );
+		next = slab_alloc( SLAB_ENTRY );
 		if ( NULL == next ) {
 			log_critical( "Unable to allocate %zu bytes for xfs_entry_t! %m [%d]",
 			              sizeof(xfs_entry_t), errno );
@@ -249,7 +402,8 @@ int xfs_read_packed_dir( xfs_dir_t* dir, uint8_t const* data, bool log_error ) {
 				// This is the first entry
 				dir->root = next;
 			curr = next;
-		}
+		} else
+			slab_free( SLAB_ENTRY, next );
 	} // End of looping through the directory entries
 
 	return res;
@@ -4,6 +4,7 @@
 
 
 #include "file_type.h"
+#include "slab.h"
 
 
 #include <stdbool.h>
@@ -23,6 +24,7 @@ typedef struct _xfs_dir {
 	struct _xfs_dir*   parent;         //!< Parent structure, if we've found it.
 	uint64_t           parent_address; //!< Absolute inode address of the parent
 	struct _xfs_entry* root;           //!< Pointer to the first child in this directory
+	arena_t*           names;          //!< Holds the names of all entries
 } xfs_dir_t;
 
 
@@ -39,12 +41,13 @@ typedef struct _xfs_dir {
   * latter case.
 **/
 typedef struct _xfs_entry {
-	uint64_t           address; //!< Absolute inode address of the sub dir or file
-	char const*        name;    //!< Name of the entry or NULL if unknown
-	struct _xfs_entry* next;    //!< Next sibling with the same parent
-	struct _xfs_dir*   parent;  //!< parent directory this entry is part of
-	struct _xfs_dir*   sub;     //!< If this entry is a directory, `sub` points to its structure
-	e_file_type        type;    //!< The file type as noted in the entry
+	uint64_t           address;    //!< Absolute inode address of the sub dir or file
+	char const*        name;       //!< Name of the entry or NULL if unknown
+	struct _xfs_entry* next;       //!< Next sibling with the same parent
+	struct _xfs_dir*   parent;     //!< parent directory this entry is part of
+	struct _xfs_dir*   sub;        //!< If this entry is a directory, `sub` points to its structure
+	e_file_type        type;       //!< The file type as noted in the entry
+	bool               is_deleted; //!< The entry was freed, only the low 32 bits of @a address are left
 } xfs_entry_t;
 
 
@@ -74,6 +77,25 @@ void xfs_free_dir( xfs_dir_t* dir );
 void xfs_free_dir_recursive( xfs_dir_t* dir );
 
 
+/** @brief interpret @a data as a long form directory data block.
+  *
+  * Live entries, and freed entries that still hold their name, are appended
+  * to the entries of @a dir, so all data blocks of one directory can be read
+  * into the same structure. Freed entries only keep the low 32 bits of their
+  * inode number and are marked with xfs_entry_t::is_deleted. The "." and ".."
+  * entries are skipped. Neither xfs_dir_t::entry_count nor
+  * xfs_dir_t::dir_size are changed, they only describe short form dirs.
+  *
+  * @param[in,out] dir  Pointer to the xfs_dir_t instance to add to, zeroed before the first block
+  * @param[in] data  The directory block to unpack
+  * @param[in] size  Size of the directory block in bytes
+  * @param[in] has_ftype  Set if the entries have a file type byte, see superblock feature flags
+  * @param[in] log_error  If set to true, issue an error message if any check fails
+  * @return 0 on success, -1 if @a data is no directory data block or broken.
+**/
+int xfs_read_block_dir( xfs_dir_t* dir, uint8_t const* data, size_t size, bool has_ftype, bool log_error );
+
+
 /** @brief interpret @a data as a short form packed directory.
   *
   * This will fully unpack the directory, but will *not* follow the files and
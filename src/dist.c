@@ -0,0 +1,747 @@
+/*******************************************************************************
+ * dist.c : Split one scan across worker processes on this or other hosts
+ ******************************************************************************/
+
+
+#include "backend.h"
+#include "dist.h"
+#include "globals.h"
+#include "log.h"
+#include "record.h"
+#include "scanner.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define DIST_MAGIC       "XUDM"
+#define DIST_VERSION     1
+#define DIST_HDR_SIZE    12      // magic(4) + type(1) + padding(3) + payload length(4)
+#define DIST_MAX_PAYLOAD 4096    // More than any message needs, including an inode record
+#define DIST_MAX_CONNS   64      // Workers connected at the same time
+#define DIST_RECV_BUF    65536   // Receive buffer per connection
+#define DIST_REC_HDR     12      // ag_num(4) + position(8) in front of every inode record
+#define DIST_STRIPE_BLKS 262144  // Blocks per stripe of work, 1 GiB with 4 KiB blocks
+#define DIST_TIMEOUT     60      // Seconds of silence after which a busy worker is dropped
+#define DIST_TICK_MS     250     // Poll interval of the coordinator and the worker
+#define DIST_PROGRESS    4       // A working worker reports progress every this many ticks
+
+
+/// @brief enum of the message types of the protocol. All numbers are big endian.
+typedef enum _dist_msg_type {
+	DM_HELLO    = 1, //!< Worker -> coordinator: version(4) + UUID(16)
+	DM_WORK     = 2, //!< Coordinator -> worker: stripe(4) + ag_num(4) + first block(8) + block count(8)
+	DM_RECORD   = 3, //!< Worker -> coordinator: ag_num(4) + position(8) + raw inode core
+	DM_PROGRESS = 4, //!< Worker -> coordinator: blocks scanned(8), doubles as heartbeat
+	DM_DONE     = 5, //!< Worker -> coordinator: stripe(4)
+	DM_BYE      = 6  //!< Coordinator -> worker: No more work, or the worker was rejected
+} e_dist_msg_type;
+
+
+/// @brief One stripe of work
+typedef struct _dist_stripe {
+	uint32_t ag_num;      //!< The AG the stripe lies in
+	uint64_t count;       //!< Number of blocks in the stripe
+	uint64_t first;       //!< First absolute block of the stripe
+	bool     is_assigned; //!< True while a worker has it
+	bool     is_done;     //!< True once its records are merged
+} dist_stripe_t;
+
+
+/// @brief One worker connection of the coordinator
+typedef struct _dist_conn {
+	int      fd;        //!< Socket, -1 if the slot is free
+	uint8_t* in;        //!< Receive buffer of DIST_RECV_BUF bytes
+	size_t   in_len;    //!< Number of bytes in @a in
+	bool     is_ready;  //!< True once the HELLO was accepted
+	time_t   last_seen; //!< Time of the last message
+	char     name[64];  //!< Peer address for logging
+	uint8_t* recs;      //!< Records of the current stripe, merged on DONE
+	size_t   recs_cap;  //!< Size of @a recs
+	size_t   recs_len;  //!< Number of bytes in @a recs
+	int64_t  stripe;    //!< Stripe the worker has, -1 if idle
+} dist_conn_t;
+
+
+/// @brief State of the coordinator
+typedef struct _dist_coord {
+	dist_conn_t    conns[DIST_MAX_CONNS]; //!< Worker connections
+	uint64_t       dirs;                  //!< Directories queued
+	uint32_t       done;                  //!< Stripes merged
+	int            fd;                    //!< Local view of the source device
+	uint64_t       files;                 //!< Files queued
+	dist_stripe_t* stripes;               //!< All stripes
+	uint32_t       stripe_count;          //!< Number of stripes
+} dist_coord_t;
+
+
+/// @brief State of a worker
+typedef struct _dist_worker {
+	mtx_t send_lock; //!< The scanner thread and the progress reports share the socket
+	int   sock;      //!< Connection to the coordinator
+} dist_worker_t;
+
+
+/// @internal Write a big endian 32 bit value
+static void put_flip32u( uint8_t* buf, size_t off, uint32_t val ) {
+	val = flip32( val );
+	memcpy( buf + off, &val, 4 );
+}
+
+
+/// @internal Write a big endian 64 bit value
+static void put_flip64u( uint8_t* buf, size_t off, uint64_t val ) {
+	val = flip64( val );
+	memcpy( buf + off, &val, 8 );
+}
+
+
+/// @internal Send all of @a len bytes, returns 0 on success, -1 on error
+static int send_all( int fd, uint8_t const* buf, size_t len ) {
+	while ( len ) {
+		ssize_t w = send( fd, buf, len, MSG_NOSIGNAL );
+		if ( w < 0 ) {
+			if ( EINTR == errno )
+				continue;
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+
+/// @internal Receive exactly @a len bytes, returns 0 on success, -1 on error or EOF
+static int recv_all( int fd, uint8_t* buf, size_t len ) {
+	while ( len ) {
+		ssize_t r = recv( fd, buf, len, 0 );
+		if ( r < 0 ) {
+			if ( EINTR == errno )
+				continue;
+			return -1;
+		}
+		if ( 0 == r )
+			return -1;
+		buf += r;
+		len -= r;
+	}
+	return 0;
+}
+
+
+/// @internal Send one message as one piece
+static int send_msg( int fd, uint8_t type, uint8_t const* payload, uint32_t len ) {
+	uint8_t msg[DIST_HDR_SIZE + DIST_MAX_PAYLOAD] = { 0x0 };
+
+	if ( len > DIST_MAX_PAYLOAD ) {
+		log_critical( "BUG! Message of %u bytes is too large!", len );
+		return -1;
+	}
+
+	memcpy( msg, DIST_MAGIC, 4 );
+	msg[4] = type;
+	put_flip32u( msg, 8, len );
+	if ( len )
+		memcpy( msg + DIST_HDR_SIZE, payload, len );
+
+	return send_all( fd, msg, DIST_HDR_SIZE + len );
+}
+
+
+/// @internal Check a message header, returns the payload length or -1 if it is invalid
+static int64_t check_hdr( uint8_t const* hdr ) {
+	uint32_t len = get_flip32u( hdr, 8 );
+	if ( memcmp( hdr, DIST_MAGIC, 4 ) || ( len > DIST_MAX_PAYLOAD ) )
+		return -1;
+	return len;
+}
+
+
+// =========================================
+// --- Coordinator side of the protocol ---
+// =========================================
+
+
+/// @internal Close a connection. A stripe the worker had goes back into the pool.
+static void drop_conn( dist_coord_t* coord, dist_conn_t* conn, char const* reason ) {
+	if ( conn->stripe > -1 ) {
+		log_warning( "Worker %s %s, stripe %lld goes back into the pool", conn->name, reason, conn->stripe );
+		coord->stripes[conn->stripe].is_assigned = false;
+	} else
+		log_info( "Worker %s %s", conn->name, reason );
+
+	close( conn->fd );
+	FREE_PTR( conn->in );
+	FREE_PTR( conn->recs );
+	memset( conn, 0, sizeof( dist_conn_t ) );
+	conn->fd     = -1;
+	conn->stripe = -1;
+}
+
+
+/// @internal Merge the records of a finished stripe into the inode queues
+static int merge_stripe( dist_coord_t* coord, dist_conn_t* conn ) {
+	size_t rec_size = DIST_REC_HDR + superblocks[0].inode_size;
+
+	for ( size_t off = 0; ( off + rec_size ) <= conn->recs_len; off += rec_size ) {
+		uint8_t const* rec    = conn->recs + off;
+		uint32_t       ag_num = get_flip32u( rec, 0 );
+
+		if ( ag_num >= sb_ag_count )
+			continue;
+		if ( -1 == record_queue_inode( ag_num, get_flip64u( rec, 4 ), rec + DIST_REC_HDR,
+		                               coord->fd, false, &coord->dirs, &coord->files ) )
+			return -1;
+	}
+
+	coord->stripes[conn->stripe].is_done = true;
+	coord->done++;
+
+	log_status( "Stripe %lld (AG %u) done by %s, %u/%u merged; %llu directories, %llu files",
+	            conn->stripe, coord->stripes[conn->stripe].ag_num, conn->name,
+	            coord->done, coord->stripe_count, coord->dirs, coord->files );
+
+	conn->recs_len = 0;
+	conn->stripe   = -1;
+
+	return 0;
+}
+
+
+/// @internal Handle one message, returns 0 on success, -1 to drop the worker, -2 on fatal errors
+static int handle_msg( dist_coord_t* coord, dist_conn_t* conn, uint8_t type, uint8_t const* payload, uint32_t len ) {
+	size_t rec_size = DIST_REC_HDR + superblocks[0].inode_size;
+
+	if ( !conn->is_ready && ( DM_HELLO != type ) )
+		return -1;
+
+	switch ( type ) {
+		case DM_HELLO:
+			if ( ( 20 != len ) || ( DIST_VERSION != get_flip32u( payload, 0 ) ) ) {
+				log_error( "Worker %s speaks an unknown protocol version", conn->name );
+				send_msg( conn->fd, DM_BYE, NULL, 0 );
+				return -1;
+			}
+			if ( memcmp( payload + 4, superblocks[0].UUID, 16 ) ) {
+				log_error( "Worker %s sees a different file system", conn->name );
+				send_msg( conn->fd, DM_BYE, NULL, 0 );
+				return -1;
+			}
+			conn->is_ready = true;
+			log_info( "Worker %s joined", conn->name );
+			break;
+
+		case DM_RECORD:
+			if ( ( conn->stripe < 0 ) || ( len != rec_size ) )
+				return -1;
+			if ( ( conn->recs_len + len ) > conn->recs_cap ) {
+				size_t   new_cap  = conn->recs_cap ? conn->recs_cap * 2 : 256 * rec_size;
+				uint8_t* new_recs = realloc( conn->recs, new_cap );
+				if ( NULL == new_recs ) {
+					log_critical( "Unable to allocate %zu bytes for records of %s! %m [%d]",
+					              new_cap, conn->name, errno );
+					return -2;
+				}
+				conn->recs     = new_recs;
+				conn->recs_cap = new_cap;
+			}
+			memcpy( conn->recs + conn->recs_len, payload, len );
+			conn->recs_len += len;
+			break;
+
+		case DM_PROGRESS:
+			break; // Being here already updated last_seen
+
+		case DM_DONE:
+			if ( ( 4 != len ) || ( conn->stripe < 0 ) || ( ( uint32_t )conn->stripe != get_flip32u( payload, 0 ) ) )
+				return -1;
+			if ( -1 == merge_stripe( coord, conn ) )
+				return -2;
+			break;
+
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/// @internal Read what a worker sent and handle all complete messages
+static int receive_from( dist_coord_t* coord, dist_conn_t* conn ) {
+	ssize_t r = recv( conn->fd, conn->in + conn->in_len, DIST_RECV_BUF - conn->in_len, MSG_DONTWAIT );
+
+	if ( r < 0 )
+		return ( ( EAGAIN == errno ) || ( EWOULDBLOCK == errno ) || ( EINTR == errno ) ) ? 0 : -1;
+	if ( 0 == r )
+		return -1;
+
+	conn->in_len    += r;
+	conn->last_seen  = time( NULL );
+
+	size_t pos = 0;
+	while ( ( pos + DIST_HDR_SIZE ) <= conn->in_len ) {
+		int64_t len = check_hdr( conn->in + pos );
+		if ( len < 0 )
+			return -1;
+		if ( ( pos + DIST_HDR_SIZE + len ) > conn->in_len )
+			break;
+
+		int res = handle_msg( coord, conn, conn->in[pos + 4], conn->in + pos + DIST_HDR_SIZE, len );
+		if ( res < 0 )
+			return res;
+		pos += DIST_HDR_SIZE + len;
+	}
+
+	if ( pos ) {
+		memmove( conn->in, conn->in + pos, conn->in_len - pos );
+		conn->in_len -= pos;
+	}
+
+	return 0;
+}
+
+
+/// @internal Hand a stripe to every idle worker
+static void assign_work( dist_coord_t* coord ) {
+	uint32_t next = 0;
+
+	for ( uint32_t i = 0; i < DIST_MAX_CONNS; ++i ) {
+		dist_conn_t* conn = &coord->conns[i];
+
+		if ( ( conn->fd < 0 ) || !conn->is_ready || ( conn->stripe > -1 ) )
+			continue;
+
+		while ( ( next < coord->stripe_count ) && ( coord->stripes[next].is_assigned || coord->stripes[next].is_done ) )
+			++next;
+		if ( next >= coord->stripe_count )
+			return;
+
+		dist_stripe_t* stripe = &coord->stripes[next];
+		uint8_t        payload[24];
+
+		put_flip32u( payload,  0, next );
+		put_flip32u( payload,  4, stripe->ag_num );
+		put_flip64u( payload,  8, stripe->first );
+		put_flip64u( payload, 16, stripe->count );
+
+		if ( -1 == send_msg( conn->fd, DM_WORK, payload, sizeof( payload ) ) ) {
+			drop_conn( coord, conn, "is gone" );
+			continue;
+		}
+
+		stripe->is_assigned = true;
+		conn->stripe        = next;
+		conn->last_seen     = time( NULL );
+	}
+}
+
+
+/// @internal Open the listening socket
+static int listen_on( uint16_t port ) {
+	struct addrinfo  hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+	struct addrinfo* addrs = NULL;
+	char             port_str[8];
+	int              sock  = -1;
+	int              one   = 1;
+
+	snprintf( port_str, sizeof( port_str ), "%u", port );
+	int r = getaddrinfo( NULL, port_str, &hints, &addrs );
+	if ( r ) {
+		log_error( "Can not resolve port %u: %s", port, gai_strerror( r ) );
+		return -1;
+	}
+
+	for ( struct addrinfo* ai = addrs; ai && ( -1 == sock ); ai = ai->ai_next ) {
+		sock = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if ( -1 == sock )
+			continue;
+		setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+		if ( bind( sock, ai->ai_addr, ai->ai_addrlen ) || listen( sock, DIST_MAX_CONNS ) ) {
+			close( sock );
+			sock = -1;
+		}
+	}
+	freeaddrinfo( addrs );
+
+	if ( -1 == sock )
+		log_error( "Can not listen on port %u: %m [%d]", port, errno );
+
+	return sock;
+}
+
+
+/// @internal Accept a new worker connection
+static void accept_worker( dist_coord_t* coord, int listener ) {
+	struct sockaddr_storage addr;
+	socklen_t               addr_len = sizeof( addr );
+	int                     fd       = accept( listener, ( struct sockaddr* )&addr, &addr_len );
+	dist_conn_t*            conn     = NULL;
+
+	if ( -1 == fd )
+		return;
+
+	for ( uint32_t i = 0; ( NULL == conn ) && ( i < DIST_MAX_CONNS ); ++i ) {
+		if ( coord->conns[i].fd < 0 )
+			conn = &coord->conns[i];
+	}
+
+	if ( ( NULL == conn ) || ( NULL == ( conn->in = malloc( DIST_RECV_BUF ) ) ) ) {
+		log_warning( "%s", "Can not take another worker, rejecting it" );
+		close( fd );
+		return;
+	}
+
+	char host[48] = { 0x0 };
+	char serv[12] = { 0x0 };
+	getnameinfo( ( struct sockaddr* )&addr, addr_len, host, sizeof( host ), serv, sizeof( serv ),
+	             NI_NUMERICHOST | NI_NUMERICSERV );
+	snprintf( conn->name, sizeof( conn->name ), "%s:%s", host, serv );
+
+	// SO_KEEPALIVE lets the kernel notice hosts that vanished without a word
+	int one = 1;
+	setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof( one ) );
+
+	conn->fd        = fd;
+	conn->last_seen = time( NULL );
+}
+
+
+// =====================================
+// --- Worker side of the protocol ---
+// =====================================
+
+
+/// @internal Send a message from the worker, the socket is shared between threads
+static int worker_send( dist_worker_t* worker, uint8_t type, uint8_t const* payload, uint32_t len ) {
+	mtx_lock( &worker->send_lock );
+	int res = send_msg( worker->sock, type, payload, len );
+	mtx_unlock( &worker->send_lock );
+
+	if ( -1 == res )
+		log_error( "Lost the coordinator: %m [%d]", errno );
+
+	return res;
+}
+
+
+/// @internal Scanner sink sending accepted candidates to the coordinator
+static int worker_sink( void* ctx, uint32_t ag_num, uint64_t position, uint8_t const* data ) {
+	uint16_t in_size = superblocks[ag_num].inode_size;
+	uint8_t  payload[DIST_REC_HDR + in_size];
+
+	put_flip32u( payload, 0, ag_num );
+	put_flip64u( payload, 4, position );
+	memcpy( payload + DIST_REC_HDR, data, in_size );
+
+	return worker_send( ( dist_worker_t* )ctx, DM_RECORD, payload, sizeof( payload ) );
+}
+
+
+/// @internal Scan one stripe with the regular scanner, returns 0 on success, -1 on error
+static int scan_stripe( dist_worker_t* worker, char const* device, uint8_t const* payload, uint32_t len ) {
+	if ( 24 != len )
+		return -1;
+
+	uint32_t stripe = get_flip32u( payload, 0 );
+	uint32_t ag_num = get_flip32u( payload, 4 );
+	uint64_t first  = get_flip64u( payload, 8 );
+	uint64_t count  = get_flip64u( payload, 16 );
+
+	if ( ( ag_num >= sb_ag_count )
+	  || ( first < ( ( uint64_t )ag_num * superblocks[ag_num].ag_size ) )
+	  || ( ( first + count ) > ( ( ag_num + 1 ) * ( uint64_t )superblocks[ag_num].ag_size ) ) ) {
+		log_error( "Stripe %u (AG %u, %llu + %llu blocks) is outside of this file system",
+		           stripe, ag_num, first, count );
+		return -1;
+	}
+
+	log_info( "Scanning stripe %u: AG %u, blocks %llu to %llu", stripe, ag_num, first, first + count - 1 );
+
+	scan_data_t data;
+	memset( &data, 0, sizeof( scan_data_t ) );
+	data.ag_num     = ag_num;
+	data.blk_count  = count;
+	data.blk_first  = first;
+	data.device     = device;
+	data.do_start   = true;
+	data.sb_data    = &superblocks[ag_num];
+	data.sink       = worker_sink;
+	data.sink_ctx   = worker;
+	data.thread_num = 1;
+
+	if ( ( thrd_success != mtx_init( &data.sleep_lock, mtx_plain ) )
+	  || ( thrd_success != cnd_init( &data.wakeup_call ) ) ) {
+		log_critical( "%s", "Unable to initialize the scanner locks!" );
+		return -1;
+	}
+
+	thrd_t thread;
+	int    res = -1;
+	if ( thrd_success != thrd_create( &thread, scanner, &data ) ) {
+		log_critical( "%s", "Creation of the scanner thread failed!" );
+		goto cleanup;
+	}
+
+	// Report progress while the scanner works, the coordinator takes it as heartbeat
+	struct timespec tick = { .tv_nsec = DIST_TICK_MS * 1000000L };
+	for ( uint32_t i = 1; !data.is_finished; ++i ) {
+		thrd_sleep( &tick, NULL );
+		if ( i % DIST_PROGRESS )
+			continue;
+
+		uint8_t progress[8];
+		put_flip64u( progress, 0, data.sec_scanned );
+		if ( -1 == worker_send( worker, DM_PROGRESS, progress, sizeof( progress ) ) )
+			data.do_stop = true;
+	}
+	thrd_join( thread, &res );
+
+	if ( ( 0 == res ) && !data.do_stop ) {
+		uint8_t done[4];
+		put_flip32u( done, 0, stripe );
+		res = worker_send( worker, DM_DONE, done, sizeof( done ) );
+		log_info( "Stripe %u done, sent %llu directories and %llu files",
+		          stripe, data.frwrd_dirent, data.frwrd_inodes );
+	} else
+		res = -1;
+
+cleanup:
+	cnd_destroy( &data.wakeup_call );
+	mtx_destroy( &data.sleep_lock );
+
+	return res;
+}
+
+
+/// @internal Connect to "host:port"
+static int connect_to( char const* address ) {
+	char const* colon = strrchr( address, ':' );
+	if ( ( NULL == colon ) || ( colon == address ) || !colon[1] ) {
+		log_error( "\"%s\" is no valid host:port address", address );
+		return -1;
+	}
+
+	struct addrinfo  hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo* addrs = NULL;
+	char*            host  = strndup( address, colon - address );
+	int              sock  = -1;
+
+	if ( NULL == host ) {
+		log_critical( "Unable to copy host name! %m [%d]", errno );
+		return -1;
+	}
+
+	int r = getaddrinfo( host, colon + 1, &hints, &addrs );
+	if ( r ) {
+		log_error( "Can not resolve %s: %s", address, gai_strerror( r ) );
+		FREE_PTR( host );
+		return -1;
+	}
+
+	for ( struct addrinfo* ai = addrs; ai && ( -1 == sock ); ai = ai->ai_next ) {
+		sock = socket( ai->ai_family, ai->ai_socktype, ai->ai_protocol );
+		if ( ( -1 != sock ) && connect( sock, ai->ai_addr, ai->ai_addrlen ) ) {
+			close( sock );
+			sock = -1;
+		}
+	}
+	freeaddrinfo( addrs );
+	FREE_PTR( host );
+
+	if ( -1 == sock )
+		log_error( "Can not connect to %s: %m [%d]", address, errno );
+
+	return sock;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int run_coordinator( char const* device, uint16_t port ) {
+	RETURN_INT_IF_NULL( device );
+
+	dist_coord_t coord;
+	int          listener = -1;
+	int          res      = -1;
+
+	memset( &coord, 0, sizeof( dist_coord_t ) );
+	for ( uint32_t i = 0; i < DIST_MAX_CONNS; ++i ) {
+		coord.conns[i].fd     = -1;
+		coord.conns[i].stripe = -1;
+	}
+
+	// --- Cut the AGs into stripes ---
+	for ( uint32_t i = 0; i < sb_ag_count; ++i )
+		coord.stripe_count += ( superblocks[i].ag_size + DIST_STRIPE_BLKS - 1 ) / DIST_STRIPE_BLKS;
+
+	coord.stripes = calloc( coord.stripe_count, sizeof( dist_stripe_t ) );
+	if ( NULL == coord.stripes ) {
+		log_critical( "Unable to allocate %zu bytes for stripes! %m [%d]",
+		              coord.stripe_count * sizeof( dist_stripe_t ), errno );
+		return -1;
+	}
+
+	for ( uint32_t i = 0, s = 0; i < sb_ag_count; ++i ) {
+		uint64_t ag_start = ( uint64_t )i * superblocks[i].ag_size;
+		for ( uint64_t blk = 0; blk < superblocks[i].ag_size; blk += DIST_STRIPE_BLKS, ++s ) {
+			coord.stripes[s].ag_num = i;
+			coord.stripes[s].first  = ag_start + blk;
+			coord.stripes[s].count  = ( superblocks[i].ag_size - blk ) < DIST_STRIPE_BLKS
+			                        ? superblocks[i].ag_size - blk : DIST_STRIPE_BLKS;
+		}
+	}
+
+	coord.fd = src_open( device, O_NOFOLLOW );
+	if ( -1 == coord.fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		goto cleanup;
+	}
+
+	listener = listen_on( port );
+	if ( -1 == listener )
+		goto cleanup;
+
+	log_info( "Waiting for workers on port %u, %u stripes to scan", port, coord.stripe_count );
+
+	/// === Main Coordination Loop ===
+	/// ==============================
+	while ( coord.done < coord.stripe_count ) {
+		struct pollfd fds[DIST_MAX_CONNS + 1];
+		dist_conn_t*  owner[DIST_MAX_CONNS + 1];
+		nfds_t        nfds = 1;
+
+		fds[0].fd     = listener;
+		fds[0].events = POLLIN;
+		for ( uint32_t i = 0; i < DIST_MAX_CONNS; ++i ) {
+			if ( coord.conns[i].fd < 0 )
+				continue;
+			fds[nfds].fd     = coord.conns[i].fd;
+			fds[nfds].events = POLLIN;
+			owner[nfds++]    = &coord.conns[i];
+		}
+
+		if ( -1 == poll( fds, nfds, DIST_TICK_MS ) ) {
+			if ( EINTR == errno )
+				continue;
+			log_critical( "Polling the workers failed: %m [%d]", errno );
+			goto cleanup;
+		}
+
+		for ( nfds_t i = 1; i < nfds; ++i ) {
+			if ( !fds[i].revents )
+				continue;
+			int r = receive_from( &coord, owner[i] );
+			if ( -2 == r )
+				goto cleanup;
+			if ( -1 == r )
+				drop_conn( &coord, owner[i], "disconnected" );
+		}
+
+		if ( fds[0].revents & POLLIN )
+			accept_worker( &coord, listener );
+
+		// Busy workers must report in regularly, new ones must say hello
+		time_t now = time( NULL );
+		for ( uint32_t i = 0; i < DIST_MAX_CONNS; ++i ) {
+			dist_conn_t* conn = &coord.conns[i];
+			if ( ( conn->fd > -1 ) && ( ( conn->stripe > -1 ) || !conn->is_ready )
+			  && ( ( now - conn->last_seen ) > DIST_TIMEOUT ) )
+				drop_conn( &coord, conn, "timed out" );
+		}
+
+		assign_work( &coord );
+	} // End of Main Coordination Loop
+
+	log_info( "All %u stripes merged: %llu directories, %llu files queued",
+	          coord.stripe_count, coord.dirs, coord.files );
+	res = 0;
+
+cleanup:
+	for ( uint32_t i = 0; i < DIST_MAX_CONNS; ++i ) {
+		if ( coord.conns[i].fd < 0 )
+			continue;
+		send_msg( coord.conns[i].fd, DM_BYE, NULL, 0 );
+		drop_conn( &coord, &coord.conns[i], "dismissed" );
+	}
+	if ( listener > -1 )
+		close( listener );
+	if ( coord.fd > -1 )
+		close( coord.fd );
+	FREE_PTR( coord.stripes );
+
+	return res;
+}
+
+
+int run_worker( char const* device, char const* address ) {
+	RETURN_INT_IF_NULL( device );
+	RETURN_INT_IF_NULL( address );
+
+	dist_worker_t worker;
+	uint8_t       payload[DIST_MAX_PAYLOAD];
+	int           res     = -1;
+	uint32_t      stripes = 0;
+
+	if ( thrd_success != mtx_init( &worker.send_lock, mtx_plain ) ) {
+		log_critical( "%s", "Unable to initialize the send lock!" );
+		return -1;
+	}
+
+	worker.sock = connect_to( address );
+	if ( -1 == worker.sock )
+		goto cleanup;
+
+	// --- Introduce ourselves ---
+	put_flip32u( payload, 0, DIST_VERSION );
+	memcpy( payload + 4, superblocks[0].UUID, 16 );
+	if ( -1 == worker_send( &worker, DM_HELLO, payload, 20 ) )
+		goto cleanup;
+
+	log_info( "Connected to %s, waiting for work", address );
+
+	/// === Main Work Loop ===
+	/// ======================
+	for (;;) {
+		uint8_t hdr[DIST_HDR_SIZE];
+		int64_t len = -1;
+
+		if ( ( -1 == recv_all( worker.sock, hdr, DIST_HDR_SIZE ) )
+		  || ( ( len = check_hdr( hdr ) ) < 0 )
+		  || ( len && ( -1 == recv_all( worker.sock, payload, len ) ) ) ) {
+			log_error( "Lost the coordinator at %s", address );
+			goto cleanup;
+		}
+
+		if ( DM_BYE == hdr[4] )
+			break;
+		if ( DM_WORK != hdr[4] )
+			continue;
+
+		if ( -1 == scan_stripe( &worker, device, payload, len ) )
+			goto cleanup;
+		++stripes;
+	}
+
+	log_info( "Coordinator said goodbye after %u stripes", stripes );
+	res = 0;
+
+cleanup:
+	if ( worker.sock > -1 )
+		close( worker.sock );
+	mtx_destroy( &worker.send_lock );
+
+	return res;
+}
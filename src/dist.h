@@ -0,0 +1,46 @@
+#ifndef PWX_XFS_UNDELETE_SRC_DIST_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_DIST_H_INCLUDED 1
+#pragma once
+
+
+#include <stdint.h>
+
+
+/** @brief Coordinate a scan that is done by remote workers
+  *
+  * The file system is split into stripes of at most DIST_STRIPE_BLKS blocks,
+  * no stripe spans two AGs. Workers connect to @a port and announce the UUID
+  * of the file system they see. Each worker gets one stripe at a time and
+  * streams back the raw inode cores its scanner accepted.
+  *
+  * The records of a stripe are held back until the worker reports the stripe
+  * as done. Only then are they decoded against the local view of the device
+  * and put onto the inode queues. If a worker disconnects or stays silent for
+  * DIST_TIMEOUT seconds, its records are dropped and the stripe is handed to
+  * the next idle worker. So every stripe is merged exactly once.
+  *
+  * The function returns once all stripes are merged. The analyzers and
+  * writers then proceed just like after a local scan.
+  *
+  * @param[in] device  Path to the local view of the source device
+  * @param[in] port    TCP port to listen on
+  * @return 0 on success, -1 on failure.
+**/
+int run_coordinator( char const* device, uint16_t port );
+
+
+/** @brief Work as a scanner for a coordinator
+  *
+  * Connect to the coordinator at @a address, given as "host:port", and scan
+  * the stripes it hands out. The regular scanner() does the work, with the
+  * accepted candidates sent to the coordinator instead of being queued.
+  * Filters given to the worker are applied before anything is sent.
+  *
+  * @param[in] device   Path to the view of the source device this worker has
+  * @param[in] address  "host:port" of the coordinator
+  * @return 0 once the coordinator said goodbye, -1 on failure.
+**/
+int run_worker( char const* device, char const* address );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_DIST_H_INCLUDED
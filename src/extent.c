@@ -8,27 +8,167 @@
 #include "utils.h"
 
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define XFS_EX_MAX_LEN 0x1fffff // Longest extent the 21 length bits can hold
+
+
+/// @internal Load a big endian 64 bit word from anywhere, compilers turn this into one load and a bswap
+static inline uint64_t ex_be64( uint8_t const* data ) {
+	uint64_t val;
+	memcpy( &val, data, 8 );
+	return __builtin_bswap64( val );
+}
+
+
+/// @internal Logical offset of a packed extent, without unpacking the rest
+static uint64_t ex_offset( uint8_t const* data ) {
+	return ( ex_be64( data ) & 0x7fffffffffffffff ) >> 9;
+}
+
+
+/// @internal qsort() helper ordering packed extents by logical offset
+static int ex_cmp_offset( void const* a, void const* b ) {
+	uint64_t offset_a = ex_offset( a );
+	uint64_t offset_b = ex_offset( b );
+
+	return ( offset_a > offset_b ) - ( offset_a < offset_b );
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int xfs_ex_at( xfs_ex_vec_t const* vec, uint32_t idx, xfs_ex_t* ex ) {
+	RETURN_INT_IF_NULL( vec );
+
+	if ( idx >= vec->count )
+		return -1;
+
+	return xfs_read_ex( ex, vec->packed + ( ( size_t )idx * XFS_EX_SIZE ) );
+}
+
+
+xfs_ex_vec_t* xfs_ex_create( uint8_t const* data, uint32_t count ) {
+	size_t        size = sizeof( xfs_ex_vec_t ) + ( ( size_t )count * XFS_EX_SIZE );
+	xfs_ex_vec_t* vec  = malloc( size );
+
+	if ( NULL == vec ) {
+		log_critical( "Unable to allocate %zu bytes for %u extents: %m [%d]", size, count, errno );
+		return NULL;
+	}
+
+	vec->count   = count;
+	vec->padding = 0;
+	if ( data )
+		memcpy( vec->packed, data, ( size_t )count * XFS_EX_SIZE );
+	else
+		memset( vec->packed, 0, ( size_t )count * XFS_EX_SIZE );
+
+	return vec;
+}
+
+
+void xfs_ex_free( xfs_ex_vec_t** vec ) {
+	RETURN_VOID_IF_NULL( vec );
+	FREE_PTR( *vec );
+}
+
+
+uint32_t xfs_ex_merge( xfs_ex_vec_t* vec ) {
+	RETURN_ZERO_IF_NULL( vec );
+
+	if ( vec->count < 2 )
+		return vec->count;
+
+	xfs_ex_t curr;
+	xfs_ex_t next;
+	uint32_t kept = 0;
+
+	xfs_ex_at( vec, 0, &curr );
+	for ( uint32_t i = 1; i < vec->count; ++i ) {
+		xfs_ex_at( vec, i, &next );
+		if ( ( next.is_prealloc == curr.is_prealloc )
+		  && ( next.offset == ( curr.offset + curr.length ) )
+		  && ( next.block  == ( curr.block  + curr.length ) )
+		  && ( ( ( uint64_t )curr.length + next.length ) <= XFS_EX_MAX_LEN ) ) {
+			curr.length += next.length;
+			continue;
+		}
+		xfs_write_ex( vec->packed + ( ( size_t )kept++ * XFS_EX_SIZE ), &curr );
+		curr = next;
+	}
+	xfs_write_ex( vec->packed + ( ( size_t )kept++ * XFS_EX_SIZE ), &curr );
+
+	vec->count = kept;
+
+	return kept;
+}
+
+
 int xfs_read_ex( xfs_ex_t* ex, uint8_t const* data ) {
 	RETURN_INT_IF_NULL( ex );
 	RETURN_INT_IF_NULL( data );
 
-	ex->is_prealloc = data[0] & 0x80; // == b10000000 aka first bit
-	ex->offset      = flip64( ( *( uint64_t* )( data + 0 ) & 0x7ffffffffffffe00 ) >> 9 ); // = Bits 2 to 55
-	// 0b01111111 11111111 11111111 11111111 11111111 11111111 11111110 00000000
-	//   12345678 90123456 78901234 56789012 34567890 12345678 90123456 78901234
-	//             1          2          3          4           5          6
-	//          0        1        2        3        4        5        6        7
-	ex->block       = flip64( ( *( uint64_t* )( data + 6 ) & 0x01ffffffffffffe0 ) >> 5 ); // = Bits 56 to 107
-	// 0b00000001 11111111 11111111 11111111 11111111 11111111 11111111 11100000
-	//   90123456 78901234 56789012 34567890 12345678 90123456 78901234 56789012
-	//    5          6          7          8           9         10         11
-	//          6        7        8        9       10       11       12       13
-	ex->length      = flip32( ( *( uint32_t* )( data + 12 ) & 0x001fffff ) ); // = Bits 108-128
-	// 0b00000000 00011111 11111111 11111111
-	//   78901234 56789012 34567890 12345678
-	//     10         11         12
-	//         12       13       14       15
+	uint64_t hi = ex_be64( data );     // Flag, offset and the upper 9 bits of the block
+	uint64_t lo = ex_be64( data + 8 ); // The lower 43 bits of the block and the length
+
+	ex->is_prealloc = hi >> 63;                                // = Bit 1
+	ex->offset      = ( hi & 0x7fffffffffffffff ) >> 9;        // = Bits 2 to 55
+	ex->block       = ( ( hi & 0x1ff ) << 43 ) | ( lo >> 21 ); // = Bits 56 to 107
+	ex->length      = lo & XFS_EX_MAX_LEN;                     // = Bits 108-128
+
+	return 0;
+}
+
+
+int xfs_read_ex_bulk( uint8_t const* data, size_t count, uint64_t* offset, uint64_t* block,
+                      uint32_t* length, uint8_t* is_prealloc ) {
+	RETURN_INT_IF_NULL( data );
+	RETURN_INT_IF_NULL( offset );
+	RETURN_INT_IF_NULL( block );
+	RETURN_INT_IF_NULL( length );
+	RETURN_INT_IF_NULL( is_prealloc );
+
+	// Same as xfs_read_ex(), but without branches or stores the compiler can not batch
+	for ( size_t i = 0; i < count; ++i ) {
+		uint64_t hi = ex_be64( data + ( i * XFS_EX_SIZE ) );
+		uint64_t lo = ex_be64( data + ( i * XFS_EX_SIZE ) + 8 );
+
+		is_prealloc[i] = hi >> 63;
+		offset[i]      = ( hi & 0x7fffffffffffffff ) >> 9;
+		block[i]       = ( ( hi & 0x1ff ) << 43 ) | ( lo >> 21 );
+		length[i]      = lo & XFS_EX_MAX_LEN;
+	}
 
 	return 0;
 }
 
+
+void xfs_sort_ex_by_offset( xfs_ex_vec_t* vec ) {
+	RETURN_VOID_IF_NULL( vec );
+
+	if ( vec->count > 1 )
+		qsort( vec->packed, vec->count, XFS_EX_SIZE, ex_cmp_offset );
+}
+
+
+int xfs_write_ex( uint8_t* data, xfs_ex_t const* ex ) {
+	RETURN_INT_IF_NULL( data );
+	RETURN_INT_IF_NULL( ex );
+
+	uint64_t hi = ( ( uint64_t )( ex->is_prealloc ? 1 : 0 ) << 63 )
+	            | ( ( ex->offset & 0x3fffffffffffff ) << 9 )
+	            | ( ( ex->block >> 43 ) & 0x1ff );
+	uint64_t lo = ( ex->block << 21 ) | ( ex->length & XFS_EX_MAX_LEN );
+
+	hi = __builtin_bswap64( hi );
+	lo = __builtin_bswap64( lo );
+	memcpy( data,     &hi, 8 );
+	memcpy( data + 8, &lo, 8 );
+
+	return 0;
+}
@@ -7,16 +7,65 @@
 #include <stdint.h>
 
 
+#define XFS_EX_SIZE 16 // Bytes of one packed extent
+
+
 /// @brief each extent information is 16 bytes packed, not-aligned.
 typedef struct _xfs_ex {
 	uint8_t  is_prealloc; //!< Bit    1       : ( 1) Flag – Set if extent is preallocated but not yet written, zero otherwise
 	uint64_t offset;      //!< Bits   2 -  55 : (54) Logical offset from the start of the file
 	uint64_t block;       //!< Bits  56 - 107 : (52) Absolute block address of the start of the extent
 	uint32_t length;      //!< Bits 108 - 128 : (21) Number of blocks in the extent
-	struct _xfs_ex* next; //!< Pointer to the next extent following this
 } xfs_ex_t;
 
 
+/** @brief The extents of one fork in one allocation
+  *
+  * The extents are kept in their packed on-disk form, XFS_EX_SIZE bytes
+  * each, and only unpacked by xfs_ex_at() while iterating.
+**/
+typedef struct _xfs_ex_vec {
+	uint32_t count;    //!< Number of extents in @a packed
+	uint32_t padding;  //!< Keeps @a packed 8 byte aligned
+	uint8_t  packed[]; //!< The packed extents, big endian as on disk
+} xfs_ex_vec_t;
+
+
+/** @brief Unpack extent number @a idx of a vector
+  * @param[in]  vec  The extent vector
+  * @param[in]  idx  Index of the extent
+  * @param[out] ex   The xfs_ex structure to fill
+  * @return 0 on success, -1 if @a idx is out of range.
+**/
+int xfs_ex_at( xfs_ex_vec_t const* vec, uint32_t idx, xfs_ex_t* ex );
+
+
+/** @brief Create an extent vector from @a count packed extents
+  * @param[in] data   The packed extents, or NULL to leave them zeroed for the caller to fill
+  * @param[in] count  Number of extents
+  * @return Pointer to the new vector, or NULL if out of memory.
+**/
+xfs_ex_vec_t* xfs_ex_create( uint8_t const* data, uint32_t count );
+
+
+/** @brief Free an extent vector
+  * @param[in,out] vec  The vector to free, *vec is set to NULL
+**/
+void xfs_ex_free( xfs_ex_vec_t** vec );
+
+
+/** @brief Merge neighbouring extents that continue each other
+  *
+  * Two extents are merged if the second starts where the first ends, both
+  * logically and physically, and both have the same preallocation flag.
+  * Sort the vector first to catch neighbours that are not stored in order.
+  *
+  * @param[in,out] vec  The extent vector
+  * @return The number of extents left.
+**/
+uint32_t xfs_ex_merge( xfs_ex_vec_t* vec );
+
+
 /** @brief unpack a 16 bytes extent into its components
   * @param[out] ex    The xfs_ex structure to fill
   * @param[in]  data  The data to read
@@ -25,4 +74,36 @@ typedef struct _xfs_ex {
 int xfs_read_ex( xfs_ex_t* ex, uint8_t const* data );
 
 
+/** @brief unpack @a count packed extents into one array per component
+  *
+  * This is the fast way to unpack whole forks and B+tree leaves. The loop
+  * has no branches and writes each component into its own array, so the
+  * compiler can vectorize the byte swapping and masking.
+  *
+  * @param[in]  data         The packed extents, XFS_EX_SIZE bytes each
+  * @param[in]  count        Number of extents to unpack
+  * @param[out] offset       Receives the logical offsets, room for @a count
+  * @param[out] block        Receives the block addresses, room for @a count
+  * @param[out] length       Receives the lengths in blocks, room for @a count
+  * @param[out] is_prealloc  Receives the preallocation flags, room for @a count
+  * @return 0 on success, -1 one otherwise.
+**/
+int xfs_read_ex_bulk( uint8_t const* data, size_t count, uint64_t* offset, uint64_t* block,
+                      uint32_t* length, uint8_t* is_prealloc );
+
+
+/** @brief Sort the extents of a vector by their logical offset
+  * @param[in,out] vec  The extent vector
+**/
+void xfs_sort_ex_by_offset( xfs_ex_vec_t* vec );
+
+
+/** @brief pack an extent into its 16 bytes on-disk form
+  * @param[out] data  The 16 bytes to write
+  * @param[in]  ex    The extent to pack
+  * @return 0 on success, -1 one otherwise.
+**/
+int xfs_write_ex( uint8_t* data, xfs_ex_t const* ex );
+
+
 #endif // PWX_XFS_UNDELETE_SRC_EXTENT_H_INCLUDED
@@ -0,0 +1,224 @@
+/*******************************************************************************
+ * filter.c : Predicate filters evaluated on raw inode data
+ ******************************************************************************/
+
+
+#include "filter.h"
+#include "globals.h"
+#include "inode.h"
+#include "log.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define FILTER_MAX_OPS 16 // Every option adds at most two operations
+
+
+/// @brief enum of the comparisons a filter operation can do
+typedef enum _filter_cmp {
+	FC_EQ      = 0, //!< Value must be equal
+	FC_GE      = 1, //!< Value must be greater or equal
+	FC_LE      = 2, //!< Value must be lower or equal
+	FC_MIN_EXT = 3  //!< Count of data fork extents must be greater or equal (offset and width unused)
+} e_filter_cmp;
+
+
+/// @brief One operation of the predicate program
+typedef struct _filter_op {
+	uint8_t  offset;  //!< Offset of the value in the raw inode
+	uint8_t  width;   //!< Width of the value in bytes (1, 2 or 4)
+	uint8_t  cmp;     //!< One of e_filter_cmp
+	bool     is_time; //!< The value is a timestamp, decoded with xfs_get_in_time()
+	uint32_t value;   //!< The value to compare with
+} filter_op_t;
+
+
+/// @brief Description of a known filter option
+typedef struct _filter_def {
+	char const* name;    //!< Name of the option
+	uint8_t     offset;  //!< Offset of the value in the raw inode
+	uint8_t     width;   //!< Width of the value in bytes
+	uint8_t     cmp;     //!< One of e_filter_cmp
+	bool        is_time; //!< If true, the value may be relative to now
+} filter_def_t;
+
+
+static filter_def_t const filter_defs[] = {
+	{ "--uid",            8, 4, FC_EQ,      false },
+	{ "--gid",           12, 4, FC_EQ,      false },
+	{ "--mtime-from",    40, 4, FC_GE,      true  },
+	{ "--mtime-to",      40, 4, FC_LE,      true  },
+	{ "--ctime-from",    48, 4, FC_GE,      true  },
+	{ "--ctime-to",      48, 4, FC_LE,      true  },
+	{ "--project",       20, 2, FC_EQ,      false }, // Low half, the high half is added at 22
+	{ "--inode-version",  4, 1, FC_EQ,      false },
+	{ "--min-extents",    0, 0, FC_MIN_EXT, false },
+	{ NULL,               0, 0, FC_EQ,      false }
+};
+
+static filter_op_t filter_ops[FILTER_MAX_OPS];
+static uint32_t    filter_count = 0;
+
+
+/// @internal Parse a time value, either absolute or relative like "-7d"
+static int parse_time( char const* value, uint32_t* result ) {
+	char*   end = NULL;
+	int64_t val = strtoll( value, &end, 10 );
+
+	if ( ( end == value ) || ( ( '-' == value[0] ) && ( 0 == *end ) ) )
+		return -1;
+
+	if ( '-' == value[0] ) {
+		int64_t unit = 0;
+		switch ( *end ) {
+			case 's': unit = 1;     break;
+			case 'm': unit = 60;    break;
+			case 'h': unit = 3600;  break;
+			case 'd': unit = 86400; break;
+			default:
+				return -1;
+		}
+		val = ( int64_t )time( NULL ) + ( val * unit );
+	} else if ( *end )
+		return -1;
+
+	if ( ( val < 0 ) || ( val > UINT32_MAX ) )
+		return -1;
+
+	*result = ( uint32_t )val;
+	return 0;
+}
+
+
+/// @internal Count the non-empty extent records at the start of the data fork
+static uint32_t count_extents( xfs_sb_t const* sb, uint8_t const* data, uint32_t enough ) {
+	size_t   start = data[4] > 2 ? DATA_START_V3 : DATA_START_V1;
+	uint32_t count = 0;
+
+	// The extent count is zeroed on delete, but the records stay.
+	for ( size_t pos = start; ( count < enough ) && ( ( pos + 16 ) <= sb->inode_size ); pos += 16 ) {
+		if ( is_data_empty( data + pos, 16 ) )
+			break;
+		++count;
+	}
+
+	return count;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int filter_add( char const* name, char const* value ) {
+	RETURN_INT_IF_NULL( name );
+
+	filter_def_t const* def = NULL;
+	for ( int i = 0; filter_defs[i].name && !def; ++i ) {
+		if ( 0 == strcmp( name, filter_defs[i].name ) )
+			def = &filter_defs[i];
+	}
+
+	if ( NULL == def )
+		return 0;
+
+	if ( NULL == value ) {
+		log_error( "%s option needs a value!", name );
+		return -1;
+	}
+
+	if ( ( filter_count + 2 ) > FILTER_MAX_OPS ) {
+		log_error( "Too many filters, %s %s ignored", name, value );
+		return -1;
+	}
+
+	uint32_t val = 0;
+	if ( def->is_time ) {
+		if ( -1 == parse_time( value, &val ) ) {
+			log_error( "%s: \"%s\" is no valid time", name, value );
+			return -1;
+		}
+	} else {
+		char*    end = NULL;
+		uint64_t v   = strtoull( value, &end, 10 );
+		if ( ( end == value ) || *end || ( v > UINT32_MAX ) ) {
+			log_error( "%s: \"%s\" is no valid number", name, value );
+			return -1;
+		}
+		val = ( uint32_t )v;
+	}
+
+	filter_op_t* op = &filter_ops[filter_count++];
+	op->offset  = def->offset;
+	op->width   = def->width;
+	op->cmp     = def->cmp;
+	op->is_time = def->is_time;
+	op->value   = def->width == 2 ? val & 0xffff : val;
+
+	// The project ID is split in two halves
+	if ( 0 == strcmp( "--project", name ) ) {
+		op          = &filter_ops[filter_count++];
+		op->offset  = 22;
+		op->width   = 2;
+		op->cmp     = FC_EQ;
+		op->is_time = false;
+		op->value   = val >> 16;
+	}
+
+	return 1;
+}
+
+
+bool filter_is_set( void ) {
+	return filter_count > 0;
+}
+
+
+bool filter_match( xfs_sb_t const* sb, uint8_t const* data ) {
+	for ( uint32_t i = 0; i < filter_count; ++i ) {
+		filter_op_t const* op  = &filter_ops[i];
+		int64_t            val = 0;
+
+		// Timestamps are signed, or 64 bit wide on bigtime inodes
+		if ( op->is_time )
+			val = xfs_get_in_time( data, op->offset, NULL );
+		else switch ( op->width ) {
+			case 1:
+				val = get_flip8u( data, op->offset );
+				break;
+			case 2:
+				val = get_flip16u( data, op->offset );
+				break;
+			case 4:
+				val = get_flip32u( data, op->offset );
+				break;
+			default:
+				break;
+		}
+
+		switch ( op->cmp ) {
+			case FC_EQ:
+				if ( val != ( int64_t )op->value )
+					return false;
+				break;
+			case FC_GE:
+				if ( val < ( int64_t )op->value )
+					return false;
+				break;
+			case FC_LE:
+				if ( val > ( int64_t )op->value )
+					return false;
+				break;
+			case FC_MIN_EXT:
+				if ( count_extents( sb, data, op->value ) < op->value )
+					return false;
+				break;
+		}
+	}
+
+	return true;
+}
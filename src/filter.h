@@ -0,0 +1,57 @@
+#ifndef PWX_XFS_UNDELETE_SRC_FILTER_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_FILTER_H_INCLUDED 1
+#pragma once
+
+
+#include "superblock.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** @brief Add a filter to the predicate program
+  *
+  * Known filters and their values are:
+  *   --uid <id>           : Owner UID equals <id>
+  *   --gid <id>           : Owner GID equals <id>
+  *   --ctime-from <time>  : ctime is not before <time>
+  *   --ctime-to <time>    : ctime is not after <time>
+  *   --mtime-from <time>  : mtime is not before <time>
+  *   --mtime-to <time>    : mtime is not after <time>
+  *   --project <id>       : Project ID equals <id>
+  *   --inode-version <v>  : Inode version equals <v>
+  *   --min-extents <n>    : The data fork holds at least <n> extents
+  *
+  * A <time> is either seconds since the epoch, or relative to now like
+  * "-7d" or "-12h".
+  *
+  * This must be called before any scanner is started.
+  *
+  * @param[in] name   The filter option, including the leading dashes
+  * @param[in] value  The value for the filter
+  * @return 1 if the filter was added, 0 if @a name is no filter option, -1 on error.
+**/
+int filter_add( char const* name, char const* value );
+
+
+/** @brief Check whether any filter is set
+  * @return true if at least one filter is set.
+**/
+bool filter_is_set( void );
+
+
+/** @brief Run the predicate program on the raw bytes of an inode
+  *
+  * No decoding is done. All values are compared on the big-endian
+  * on-disk data directly, so this is cheap enough to be used on every
+  * candidate in the scanning loop.
+  *
+  * @param[in] sb    The superblock of the AG the inode belongs to
+  * @param[in] data  Pointer to the raw inode, must have sb->inode_size bytes
+  * @return true if all filters match or none is set, false otherwise.
+**/
+bool filter_match( xfs_sb_t const* sb, uint8_t const* data );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_FILTER_H_INCLUDED
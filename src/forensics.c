@@ -3,6 +3,7 @@
  ******************************************************************************/
 
 
+#include "backend.h"
 #include "device.h"
 #include "directory.h"
 #include "forensics.h"
@@ -113,6 +114,9 @@ bool is_valid_inode( xfs_sb_t const* sb, uint8_t const* data ) {
 }
 
 
+#define RESTORE_STRIPS_MAX ( ( 2048 - 0x64 ) / 16 ) // Strips of the largest v1/v2 inode literal area
+
+
 typedef enum _recover_part {
 	RP_DATA = 1, //!< Right after the core, extents or the B-Tree root of the data are located
 	RP_GAP,      //!< There is (or might be) a zeroed gap between data and xattr
@@ -121,13 +125,14 @@ typedef enum _recover_part {
 } e_recover_part;
 
 
-int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int fd ) {
+int restore_inode( xfs_in_t* in, xfs_in_cold_t* cold, uint16_t inode_size, uint8_t const* data, int fd ) {
 	RETURN_INT_IF_NULL( in   );
+	RETURN_INT_IF_NULL( cold );
 	RETURN_INT_IF_NULL( data );
 
-	size_t         start  = in->version > 2 ? DATA_START_V3 : DATA_START_V1;
+	size_t         start  = cold->version > 2 ? DATA_START_V3 : DATA_START_V1;
 	e_recover_part e_part = RP_DATA;
-	size_t   strips       = ( inode_size - start ) / 16;
+	size_t   strips       = inode_size > start ? ( inode_size - start ) / 16 : 0;
 	uint64_t file_size    = 0; // <-- (ZEROED on delete)
 	uint64_t file_blocks  = 0; // <-- (ZEROED on delete)
 	uint32_t ext_used     = 0; // <-- (ZEROED on delete)
@@ -135,6 +140,15 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 	bool     d_is_extent  = false;
 	bool     x_is_extent  = false;
 
+	// Check 3 looks at every strip as an extent, so they are all unpacked at once
+	uint64_t ex_offset[RESTORE_STRIPS_MAX];
+	uint64_t ex_block[RESTORE_STRIPS_MAX];
+	uint32_t ex_length[RESTORE_STRIPS_MAX];
+	uint8_t  ex_prealloc[RESTORE_STRIPS_MAX];
+	if ( strips > RESTORE_STRIPS_MAX )
+		strips = RESTORE_STRIPS_MAX;
+	xfs_read_ex_bulk( data + start, strips, ex_offset, ex_block, ex_length, ex_prealloc );
+
 	for ( size_t i = 0, offset = start           ;
 	      ( RP_END != e_part ) && ( i < strips ) ;
 	      ++i, offset += 16                      ) {
@@ -165,6 +179,7 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 			is_directory       = true;
 			in->ftype          = FT_DIR;
 			in->data_fork_type = ST_LOCAL;
+			in->file_size      = dir_size; // The size was zeroed, but the local data must be mapped
 
 			// Fast forward, so we don't get to analyze strips we already know.
 			i += (size_t)(dir_size / 16) - ( dir_size % 16 ? 0 : 1);
@@ -174,7 +189,7 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 			 *    (45 / 16) - ( 45 % 16 ? 0 : 1 ) => 2[.8125] - ( 13 ? 0 : 1 ) => 2 - 0 = 2
 			 * Thus forwarding to strip 2
 			 */
-			offset = i * 16;
+			offset = start + ( i * 16 );
 			e_part = RP_GAP;
 
 			continue;
@@ -190,22 +205,22 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 		 *       such a case there are no means to detect the switch
 		 *       from data to xattr otherwise.
 		 */
-		xfs_ex_t test_ex;
-		xfs_read_ex( &test_ex, strip );
-		if ( test_ex.block && test_ex.length
-		  && ( ( test_ex.block + test_ex.length ) < full_disk_blocks ) ) {
+		uint64_t ex_blk = ex_block[i];
+		uint32_t ex_len = ex_length[i];
+		uint64_t ex_pos = 0;
+		if ( ex_blk && ex_len && fsb_to_pos( ex_blk, ex_len, &ex_pos ) ) {
 			if ( is_directory && ( in->data_fork_type == ST_LOCAL ) ) {
 				// Must be XATTR extents
-				x_is_extent        = true;
-				in->xattr_off      = ( offset - start ) / 8;
-				in->xattr_type_flg = ST_EXTENTS;
-				e_part             = RP_XATTR; // Still need to count!
-				in->num_xattr_exts = 1;
+				x_is_extent          = true;
+				cold->xattr_off      = ( offset - start ) / 8;
+				cold->xattr_type_flg = ST_EXTENTS;
+				e_part               = RP_XATTR; // Still need to count!
+				cold->num_xattr_exts = 1;
 				continue;
 			}
 			// In any other case this is not that clear...
 			uint8_t buf[32] = { 0x0 };
-			ssize_t res     = pread( fd, buf, 32, test_ex.block * sb_block_size );
+			ssize_t res     = src_pread( fd, buf, 32, ex_pos, IO_PROBE );
 			if ( res > -1 ) {
 				if ( is_directory_block( buf ) ) {
 					// Alright, this case is clear.
@@ -218,13 +233,13 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 				// If we are here, there is no reason to not assume this
 				// to be a regular data/xatrr extent
 				if ( RP_XATTR == e_part ) {
-					in->num_xattr_exts++;
+					cold->num_xattr_exts++;
 					continue;
 				}
 				if ( ext_used ) {
 					ext_used++;
-					file_blocks += test_ex.length;
-					file_size   += sb_block_size * test_ex.length;
+					file_blocks += ex_len;
+					file_size   += sb_block_size * ex_len;
 					continue;
 				}
 				// Ok. So being here means that we are looking at the very first
@@ -234,11 +249,11 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 				// extent. Then it is either xattr or data.
 				if ( is_xattr_head( buf, inode_size - offset, NULL, NULL, NULL, false ) ) {
 					// Thankfully we can check that.
-					x_is_extent        = true;
-					e_part             = RP_XATTR;
-					in->num_xattr_exts = 1;
-					in->xattr_off      = ( offset - start ) / 8;
-					in->xattr_type_flg = ST_EXTENTS;
+					x_is_extent          = true;
+					e_part               = RP_XATTR;
+					cold->num_xattr_exts = 1;
+					cold->xattr_off      = ( offset - start ) / 8;
+					cold->xattr_type_flg = ST_EXTENTS;
 					continue;
 				}
 
@@ -246,16 +261,16 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 				d_is_extent        = true;
 				e_part             = RP_DATA;
 				ext_used           = 1;
-				file_blocks        = test_ex.length;
-				file_size          = sb_block_size * test_ex.length;
+				file_blocks        = ex_len;
+				file_size          = sb_block_size * ex_len;
 				in->ftype          = FT_FILE;
 				in->data_fork_type = ST_EXTENTS;
 				continue;
 			} // End of having read 10 bytes to check
 
 			// Ouch... being here means the data is corrupted...
-			log_debug( "Unable to read extent from 0x%08x: %m [%d]",
-			           test_ex.block * sb_block_size, errno );
+			log_debug( "Unable to read extent from 0x%08llx: %m [%d]",
+			           ex_pos, errno );
 			return -1;
 		} // End of checking extents
 
@@ -268,21 +283,29 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 		// Check 5: See whether this might be an XATTR local block
 		// ------------------------------------------------------------
 		if ( !x_is_extent ) {
-			xattr_t* xattr_test = NULL;
-			size_t x_off      = 0;
-			for ( ; ( x_off < 16 ) && ( NULL == xattr_test ) ; x_off += 8 )
+			xfs_in_data_t* in_data    = NULL;
+			xattr_t*       xattr_test = NULL;
+			size_t         x_off      = 0;
+			for ( ; ( x_off < 16 ) && ( NULL == xattr_test ) ; x_off += 8 ) {
 				// Note: Local xattrs always have an offset that is dividable by 8
-				xattr_test = unpack_xattr_data( strip + x_off,
+				// Only inodes with xattrs get a data part, so check the head first
+				if ( !is_xattr_head( strip + x_off, inode_size - ( offset + x_off ),
+				                     NULL, NULL, NULL, false ) )
+					continue;
+				if ( NULL == ( in_data = xfs_get_in_data( in ) ) )
+					return -1;
+				xattr_test = unpack_xattr_data( &in_data->arena, strip + x_off,
 				                                inode_size - ( offset + x_off ),
 				                                false );
+			}
 
 			if ( xattr_test ) {
 				// This is obviously just fine like that.
-				in->xattr_type_flg = ST_LOCAL;
-				in->num_xattr_exts = 0;
-				in->xattr_root     = xattr_test; // *yay* got it!
-				in->xattr_off      = ( offset + x_off - start ) / 8;
-				e_part             = RP_END; // Finished!
+				cold->xattr_type_flg = ST_LOCAL;
+				cold->num_xattr_exts = 0;
+				in_data->xattr_root  = xattr_test; // *yay* got it!
+				cold->xattr_off      = ( offset + x_off - start ) / 8;
+				e_part               = RP_END; // Finished!
 				continue;
 			}
 		}
@@ -309,9 +332,9 @@ int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int f
 
 	if ( file_blocks && file_size ) {
 		// Data extents are easily transfered
-		in->file_blocks    = file_blocks;
-		in->file_size      = file_size;
-		in->ext_used       = ext_used;
+		cold->file_blocks = file_blocks;
+		in->file_size     = file_size;
+		cold->ext_used    = ext_used;
 		return 0;
 	} else if ( is_directory )
 		// Also in order
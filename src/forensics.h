@@ -42,12 +42,13 @@ bool is_valid_inode( xfs_sb_t const* sb, uint8_t const* data );
 /** @brief Try to recover information about an deleted inode
   *
   * @param[in,out] in  The inode structure to use and complete
+  * @param[in,out] cold  The decoded cold fields, the recovered xattr and extent figures are put here
   * @param[in] inode_size  Size of the inode
   * @param[in] data  Pointer to the data to analyze, must have at least @a inode_size bytes
   * @param[in] fd  File descriptor to read from the source device
   * @return 0 on success, -1 on failure.
 **/
-int restore_inode( xfs_in_t* in, uint16_t inode_size, uint8_t const* data, int fd );
+int restore_inode( xfs_in_t* in, xfs_in_cold_t* cold, uint16_t inode_size, uint8_t const* data, int fd );
 
 
 #endif // PWX_XFS_UNDELETE_SRC_FORENSICS_H_INCLUDED
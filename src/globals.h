@@ -7,6 +7,7 @@
 #include "scanner.h"
 #include "writer.h"
 #include "superblock.h"
+#include "topology.h"
 
 
 #include <stdbool.h>
@@ -19,11 +20,17 @@ extern uint64_t  full_disk_blocks; //!< fsb_ag_count * sb_ag_size
 extern uint64_t  full_disk_size;   //!< full_disk_blocks * sb_block_size
 extern uint32_t  sb_ag_count;      //!< Number of allocation groups
 extern uint32_t  sb_block_size;    //!< Size of the file system sectors
+extern bool      src_calibrate;    //!< If true, the source device is calibrated before use
 extern bool      src_is_ssd;       //!< If true, we can read multi-threaded
+extern uint64_t  src_offset;       //!< Byte offset of the file system on the source device
 extern uint64_t  start_block;      //!< The scanner thread(s) will skip all blocks up to this
 extern xfs_sb_t* superblocks;      //!< All AGs are loaded in here
 extern bool      tgt_is_ssd;       //!< If true, we can write multi-threaded
 
+// Topology of the source and target devices
+extern dev_profile_t src_profile; //!< Sizes the scanner reads and the number of scanners
+extern dev_profile_t tgt_profile; //!< Filled for the target, informational for now
+
 // Progress and thread control values
 extern uint32_t        ag_scanned;  //!< Every joined scanner thread raises this by one (defined in thrd_ctrl.c)
 extern analyze_data_t* analyze_data;
@@ -31,7 +38,10 @@ extern scan_data_t*    scan_data;
 extern write_data_t*   write_data;
 
 // Magic Codes of the different XFS blocks
+extern uint8_t XFS_B3_MAGIC[4]; //!< B+Tree Node/Leaf magic (v5 file systems)
 extern uint8_t XFS_BT_MAGIC[4]; //!< B+Tree Node/Leaf magic
+extern uint8_t XFS_D2B_MAGIC[4]; //!< Single block long directory block (v4 file systems)
+extern uint8_t XFS_D2D_MAGIC[4]; //!< Multi block long directory block (v4 file systems)
 extern uint8_t XFS_DB_MAGIC[4]; //!< Single block long directory block
 extern uint8_t XFS_DD_MAGIC[4]; //!< Multi block long directory block
 extern uint8_t XFS_DT_MAGIC[2]; //!< Multi block long directory tail (hash) block
@@ -0,0 +1,247 @@
+/*******************************************************************************
+ * hunter.c : Hunting for XFS file systems on disks with lost partition tables
+ ******************************************************************************/
+
+
+#include "globals.h"
+#include "hunter.h"
+#include "log.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define HUNT_SECTOR   512               // Superblocks are always sector aligned
+#define HUNT_WINDOW   ( 8 * 1024 * 1024 ) // Bytes read at once while hunting
+#define HUNT_SB_SIZE  272               // Bytes of a superblock we look at
+#define HUNT_MAX_SECS 4                 // Maximum number of secondary superblocks to verify
+
+
+/// @brief A file system UUID, to remember which file systems were already found
+typedef uint8_t hunt_uuid_t[16];
+
+
+/// @brief The few superblock values needed to validate a candidate
+typedef struct _hunt_sb {
+	uint32_t block_size;   //!< Bytes  4- 7 : Block Size (in bytes)
+	uint64_t total_blocks; //!< Bytes  8-15 : Total blocks in file system
+	uint8_t  UUID[16];     //!< Bytes 32-47 : UUID
+	uint32_t ag_size;      //!< Bytes 84-87 : AG size (in blocks)
+	uint32_t ag_count;     //!< Bytes 88-91 : Number of AGs
+	uint16_t sector_size;  //!< Bytes 102-103 : Sector size
+	char     fs_name[13];  //!< Bytes 108-119 : File system name (if set)
+} hunt_sb_t;
+
+
+/// @internal return true if @a x is a power of 2 between @a min and @a max
+static bool is_pow2_between( uint64_t x, uint64_t min, uint64_t max ) {
+	return ( x >= min ) && ( x <= max ) && ( 0 == ( x & ( x - 1 ) ) );
+}
+
+
+/// @internal Read the values of a candidate superblock and check whether they make sense
+static bool parse_candidate( uint8_t const* buf, hunt_sb_t* sb ) {
+	if ( memcmp( buf, XFS_SB_MAGIC, 4 ) )
+		return false;
+
+	sb->block_size   = get_flip32u( buf,   4 );
+	sb->total_blocks = get_flip64u( buf,   8 );
+	sb->ag_size      = get_flip32u( buf,  84 );
+	sb->ag_count     = get_flip32u( buf,  88 );
+	sb->sector_size  = get_flip16u( buf, 102 );
+	memcpy( sb->UUID,    buf +  32, 16 );
+	memset( sb->fs_name, 0,         13 );
+	memcpy( sb->fs_name, buf + 108, 12 );
+
+	return is_pow2_between( sb->block_size,  512, 65536 )
+	    && is_pow2_between( sb->sector_size, 512, 32768 )
+	    && sb->ag_size && sb->ag_count && sb->total_blocks
+	    && ( sb->total_blocks <= ( uint64_t )sb->ag_count * sb->ag_size );
+}
+
+
+/** @internal Verify the secondary superblocks of a candidate
+  * Secondaries beyond the end of the disk fail the candidate, unless the image
+  * is known to be truncated. Then the remaining ones can not be checked.
+  * @return The number of verified secondary superblocks, -1 if any of them does not match.
+**/
+static int validate_candidate( int fd, uint64_t offset, uint64_t disk_size, hunt_sb_t const* sb, bool is_truncated ) {
+	uint8_t  buf[HUNT_SB_SIZE];
+	uint64_t ag_bytes = ( uint64_t )sb->ag_size * sb->block_size;
+	uint32_t to_check[HUNT_MAX_SECS] = { 1, 2, sb->ag_count / 2, sb->ag_count - 1 };
+	uint32_t last     = 0;
+	int      verified = 0;
+
+	for ( int i = 0; i < HUNT_MAX_SECS; ++i ) {
+		uint32_t ag = to_check[i];
+
+		// Skip the primary, AGs that do not exist, and duplicates
+		if ( ( ag <= last ) || ( ag >= sb->ag_count ) )
+			continue;
+		last = ag;
+
+		uint64_t pos = offset + ( ag * ag_bytes );
+		if ( pos + HUNT_SB_SIZE > disk_size ) {
+			if ( is_truncated )
+				break; // The rest of the file system is missing from the image
+			return -1;
+		}
+
+		hunt_sb_t sec;
+		if ( ( HUNT_SB_SIZE != pread( fd, buf, HUNT_SB_SIZE, pos ) )
+		  || !parse_candidate( buf, &sec )
+		  || memcmp( sec.UUID, sb->UUID, 16 )
+		  || ( sec.block_size != sb->block_size )
+		  || ( sec.ag_size    != sb->ag_size )
+		  || ( sec.ag_count   != sb->ag_count ) )
+			return -1;
+
+		++verified;
+	}
+
+	return verified;
+}
+
+
+/// @internal return true if @a uuid is in the list of @a count @a seen UUIDs
+static bool is_uuid_seen( hunt_uuid_t const* seen, int count, uint8_t const* uuid ) {
+	for ( int i = 0; i < count; ++i ) {
+		if ( 0 == memcmp( seen[i], uuid, 16 ) )
+			return true;
+	}
+	return false;
+}
+
+
+int hunt_filesystems( char const* device, uint64_t* first, bool is_truncated ) {
+	RETURN_INT_IF_NULL( device );
+
+	uint8_t*     buf        = NULL;
+	int          fd         = open( device, O_RDONLY | O_NOFOLLOW );
+	int          found      = 0;
+	uint32_t     magic      = 0;
+	hunt_uuid_t* seen       = NULL; // UUIDs of the file systems found so far
+	uint64_t     skip_until = 0;
+
+	if ( -1 == fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		return -1;
+	}
+
+	off_t disk_size = lseek( fd, 0, SEEK_END );
+	if ( disk_size < HUNT_SECTOR ) {
+		log_error( "Unable to determine the size of %s: %m [%d]", device, errno );
+		close( fd );
+		return -1;
+	}
+
+	if ( posix_memalign( ( void** )&buf, 4096, HUNT_WINDOW ) ) {
+		log_critical( "Unable to allocate %d bytes for hunting buffer!", HUNT_WINDOW );
+		close( fd );
+		return -1;
+	}
+
+	posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+	memcpy( &magic, XFS_SB_MAGIC, 4 );
+	log_info( "Hunting for XFS superblocks on %s (%s) ...", device, get_human_size( disk_size ) );
+
+	for ( uint64_t pos = 0; pos < ( uint64_t )disk_size; ) {
+		ssize_t got = pread( fd, buf, HUNT_WINDOW, pos );
+		if ( got < HUNT_SECTOR ) {
+			if ( got < 0 )
+				log_error( "Read error at 0x%llx: %m [%d]", pos, errno );
+			break;
+		}
+
+		/* The magic sits at the start of a sector, so this is a strided search.
+		 * Building a 64 bit hit mask without branches per 64 sectors keeps this
+		 * at memory speed, and lets the compiler vectorize the comparisons. */
+		size_t sectors = got / HUNT_SECTOR;
+		for ( size_t s = 0; s < sectors; s += 64 ) {
+			size_t          n    = ( sectors - s ) > 64 ? 64 : sectors - s;
+			uint32_t const* word = ( uint32_t const* )( buf + ( s * HUNT_SECTOR ) );
+			uint64_t        mask = 0;
+
+			for ( size_t i = 0; i < n; ++i )
+				mask |= ( uint64_t )( word[i * ( HUNT_SECTOR / 4 )] == magic ) << i;
+
+			while ( mask ) {
+				size_t   i    = __builtin_ctzll( mask );
+				uint64_t cand = pos + ( ( s + i ) * HUNT_SECTOR );
+				hunt_sb_t sb;
+
+				mask &= mask - 1;
+
+				// Secondary superblocks of file systems already found are skipped
+				if ( ( cand < skip_until ) || !parse_candidate( buf + ( ( s + i ) * HUNT_SECTOR ), &sb ) )
+					continue;
+
+				/* The scan goes upwards, so the first hit of a UUID is the lowest offset.
+				 * Any later hit is a secondary superblock of a file system already found,
+				 * that skip_until could not catch, and must not be reported again. */
+				if ( is_uuid_seen( ( hunt_uuid_t const* )seen, found, sb.UUID ) ) {
+					log_debug( "Candidate at 0x%llx is a secondary of a known file system", cand );
+					continue;
+				}
+
+				if ( !is_truncated && ( cand + ( sb.total_blocks * sb.block_size ) > ( uint64_t )disk_size ) ) {
+					log_debug( "Candidate at 0x%llx does not fit on the disk", cand );
+					continue;
+				}
+
+				int verified = validate_candidate( fd, cand, disk_size, &sb, is_truncated );
+				if ( -1 == verified ) {
+					log_debug( "Candidate at 0x%llx failed validation", cand );
+					continue;
+				}
+				if ( ( 0 == verified ) && ( sb.ag_count > 1 ) ) {
+					log_debug( "Candidate at 0x%llx has no reachable secondary superblock", cand );
+					continue;
+				}
+
+				char uuid_str[37] = { 0x0 };
+				format_uuid_str( uuid_str, sb.UUID );
+				log_status( "Found XFS at byte offset %llu (sector %llu)", cand, cand / HUNT_SECTOR );
+				log_status( " ==> UUID %s, name \"%s\"", uuid_str, sb.fs_name[0] ? sb.fs_name : "(none set)" );
+				log_status( " ==> %u AGs of %u blocks with %u bytes, %s; %d secondaries verified",
+				            sb.ag_count, sb.ag_size, sb.block_size,
+				            get_human_size( sb.total_blocks * sb.block_size ), verified );
+
+				hunt_uuid_t* grown = realloc( seen, ( found + 1 ) * sizeof( *seen ) );
+				if ( NULL == grown ) {
+					log_critical( "Unable to allocate %zu bytes for the found UUIDs!", ( found + 1 ) * sizeof( *seen ) );
+					break;
+				}
+				seen = grown;
+				memcpy( seen[found], sb.UUID, 16 );
+
+				if ( first && ( 0 == found ) )
+					*first = cand;
+				++found;
+				skip_until = cand + ( sb.total_blocks * sb.block_size );
+			}
+		}
+
+		pos += ( uint64_t )sectors * HUNT_SECTOR;
+		if ( skip_until > pos )
+			pos = skip_until - ( skip_until % HUNT_SECTOR );
+
+		show_progress( "Hunting: %6.2f%% scanned, %d file system%s found",
+		               ( double )( pos > ( uint64_t )disk_size ? ( uint64_t )disk_size : pos ) / ( double )disk_size * 100.,
+		               found, 1 == found ? "" : "s" );
+	}
+
+	log_info( "Hunt finished, %d file system%s found", found, 1 == found ? "" : "s" );
+
+	close( fd );
+	FREE_PTR( buf );
+	FREE_PTR( seen );
+
+	return found;
+}
@@ -0,0 +1,30 @@
+#ifndef PWX_XFS_UNDELETE_SRC_HUNTER_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_HUNTER_H_INCLUDED 1
+#pragma once
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** @brief Hunt for XFS file systems on a raw disk
+  *
+  * The whole of @a device is searched for the `XFSB` superblock magic at
+  * sector (512 bytes) granularity. Every candidate is cross-validated by
+  * checking its secondary superblocks at `ag_size * block_size` strides.
+  * Each validated file system is reported with its byte offset, and the
+  * search continues behind its end. A UUID is only reported once, at its
+  * lowest offset, so stray secondaries are no phantom file systems.
+  *
+  * Candidates that do not fit on @a device, or whose last AG can not be
+  * checked, are rejected unless @a is_truncated is set.
+  *
+  * @param[in]  device        Path to the raw disk to search
+  * @param[out] first         If not NULL, receives the byte offset of the first file system found
+  * @param[in]  is_truncated  Accept file systems that extend beyond the end of @a device
+  * @return The number of file systems found, or -1 on failure.
+**/
+int hunt_filesystems( char const* device, uint64_t* first, bool is_truncated );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_HUNTER_H_INCLUDED
@@ -1,8 +1,11 @@
 /*******************************************************************************
- * xfs_in.c : Functions to work with inode representations of struct xfs_in
+ * inode.c : Functions to work with inode representations of struct xfs_in
  ******************************************************************************/
 
 
+#include "backend.h"
+#include "btree.h"
+#include "catalog.h"
 #include "device.h"
 #include "forensics.h"
 #include "globals.h"
@@ -20,9 +23,17 @@ size_t DATA_START_V1 = 0x64;
 size_t DATA_START_V3 = 0xB0;
 
 
-static int build_data_map( xfs_in_t* in, uint8_t const* data ) {
-	size_t start = in->version > 2 ? DATA_START_V3 : DATA_START_V1;
-	size_t end   = in->xattr_off ? start + ( in->xattr_off * 8 ) : in->sb->inode_size;
+#define IN_SIZE_MAX 2048 // Largest inode XFS allows
+
+
+// Queued inodes must stay in one cache line, anything else goes into xfs_in_cold_t or xfs_in_data_t
+_Static_assert( sizeof( xfs_in_t ) <= 64, "xfs_in_t must not grow beyond 64 bytes" );
+
+
+/// @internal Check the data fork of @a in and build its map if @a do_map is set, B+tree blocks are read from @a fd
+static int build_data_map( xfs_in_t* in, xfs_in_cold_t const* cold, uint8_t const* data, int fd, bool do_map ) {
+	size_t start = cold->version > 2 ? DATA_START_V3 : DATA_START_V1;
+	size_t end   = cold->xattr_off ? start + ( cold->xattr_off * 8 ) : superblocks[in->ag_num].inode_size;
 
 	if ( ST_DEV == in->data_fork_type ) {
 		log_error( "Special device data forks (0x%02x) are not supported.\n" DUMP_STRIP_FMT,
@@ -35,54 +46,43 @@ static int build_data_map( xfs_in_t* in, uint8_t const* data ) {
 			log_error( "Local data block ends out of bounds at byte %zu/%zu", last, end );
 			return -1;
 		}
-
-		// Create the buffer
-		in->d_loc_data = malloc( in->file_size );
-		if ( NULL == in->d_loc_data ) {
-			log_critical( "Unable to allocate %zu bytes for local data block!",
-			              in->file_size );
+		if ( !do_map )
+			return 0;
+
+		// Create the buffer, failures are logged already
+		xfs_in_data_t* in_data = xfs_get_in_data( in );
+		if ( in_data )
+			in_data->d_loc_data = arena_alloc( &in_data->arena, in->file_size );
+		if ( ( NULL == in_data ) || ( NULL == in_data->d_loc_data ) )
 			return -1;
-		}
 
-		memcpy( in->d_loc_data, data + start, in->file_size );
+		memcpy( in_data->d_loc_data, data + start, in->file_size );
 	} else if ( ST_EXTENTS == in->data_fork_type ) {
-		xfs_ex_t* curr  = NULL;
-		xfs_ex_t* next  = NULL;
-		size_t  first = 0; // first byte to read;
-		size_t  last  = 0; // last byte to read
-
-		for ( size_t i = 0; i < in->ext_used; ++i ) {
-			// First check the end of the reading. Don't overshoot!
-			first = start + ( 16 * i );
-			last  = first + 15;
-			if ( last >= end ) {
-				log_error( "Data extent %zu ends out of bounds at byte %zu/%zu",
-				           i, last, end );
-				return -1;
-			}
-
-			// Then allocate another extent structure
-			next = calloc( 1, sizeof( xfs_ex_t ) );
-			if ( NULL == next ) {
-				log_critical( "Unable to allocate %lu bytes for data extent!",
-				              sizeof( xfs_ex_t ) );
-				return -1;
-			}
-
-			// Can it be read? (Should. Only errors are bugs if either is NULL)
-			if ( -1 == xfs_read_ex( next, data + first ) )
-				return -1;
-
-			// Set root or extent chain
-			if ( curr )
-				curr->next = next;
-			else
-				in->d_ext_root = next;
-			curr = next;
-			next = NULL;
+		// Check the end of the last extent. Don't overshoot!
+		size_t last = start + ( XFS_EX_SIZE * ( size_t )cold->ext_used ) - 1;
+		if ( cold->ext_used && ( last >= end ) ) {
+			log_error( "Data extent %zu ends out of bounds at byte %zu/%zu",
+			           ( end - start ) / XFS_EX_SIZE, last, end );
+			return -1;
 		}
+
+		// The packed extents are taken as they are, failures are logged already
+		if ( do_map && cold->ext_used
+		  && ( NULL == ( in->d_exts = xfs_ex_create( data + start, cold->ext_used ) ) ) )
+			return -1;
 	} else if ( ST_BTREE == in->data_fork_type ) {
-		/// @todo Implement B-Tree reading
+		// Only the root is in the inode, the rest of the tree is read from the device
+		if ( -1 == bt_check_root( data + start, end - start, NULL ) ) {
+			log_error( "Ignoring inode %llu with an invalid btree root!", in->inode_id );
+			return -1;
+		}
+		if ( !do_map )
+			return 0;
+		if ( NULL == ( in->d_exts = bt_read_extents( fd, in, data + start, end - start, cold->version > 2 ) ) )
+			return -1; // Already told what's wrong
+		if ( cold->ext_used && ( in->d_exts->count != cold->ext_used ) ) {
+			log_warning( "inode %llu: btree holds %u of %u extents", in->inode_id, in->d_exts->count, cold->ext_used );
+		}
 	} else {
 		log_error( "Ignoring inode %llu with unknown data fork type 0x%02x!",
 		           in->inode_id, in->data_fork_type );
@@ -93,76 +93,141 @@ static int build_data_map( xfs_in_t* in, uint8_t const* data ) {
 }
 
 
-static void build_xattr_map( xfs_in_t* in, uint8_t const* data ) {
-	size_t start = ( in->xattr_off * 8 ) + in->version > 2 ? DATA_START_V3 : DATA_START_V1;
-	size_t end   = in->sb->inode_size;
+/// @internal Build the xattr map of @a in, broken xattrs are logged and ignored
+static void build_xattr_map( xfs_in_t* in, xfs_in_cold_t const* cold, uint8_t const* data ) {
+	size_t         start   = ( cold->xattr_off * 8 ) + ( cold->version > 2 ? DATA_START_V3 : DATA_START_V1 );
+	size_t         end     = superblocks[in->ag_num].inode_size;
+	xfs_in_data_t* in_data = NULL;
 
-	if ( ST_DEV == in->xattr_type_flg ) {
-		log_error( "Special device xattr forks (0x%02x) are not supported.", in->xattr_type_flg );
+	// Only inodes that really have xattrs get a data part for them
+	if ( ( ( ST_LOCAL == cold->xattr_type_flg ) || ( ( ST_EXTENTS == cold->xattr_type_flg ) && cold->num_xattr_exts ) )
+	  && ( NULL == ( in_data = xfs_get_in_data( in ) ) ) )
+		return;
+
+	if ( ST_DEV == cold->xattr_type_flg ) {
+		log_error( "Special device xattr forks (0x%02x) are not supported.", cold->xattr_type_flg );
 		log_info( " ==> Ignoring extended attributes for inode %llu!", in->inode_id );
 		return;
-	} else if ( ST_LOCAL == in->xattr_type_flg ) {
+	} else if ( ST_LOCAL == cold->xattr_type_flg ) {
 		// Just unpack the xattr data, all errors are logged there, anayway
-		if ( NULL == in->xattr_root )
-			in->xattr_root = unpack_xattr_data( data + start, in->sb->inode_size - start, true );
+		if ( NULL == in_data->xattr_root )
+			in_data->xattr_root = unpack_xattr_data( &in_data->arena, data + start, end - start, true );
 		// Errors have been logged already
-	} else if ( ST_EXTENTS == in->xattr_type_flg ) {
-		xfs_ex_t* curr  = NULL;
-		xfs_ex_t* next  = NULL;
-		size_t  first = 0; // first byte to read;
-		size_t  last  = 0; // last byte to read
-
-		for ( size_t i = 0; i < in->ext_used; ++i ) {
-			// First check the end of the reading. Don't overshoot!
-			first = start + ( 16 * i );
-			last  = first + 15;
-			if ( last >= end ) {
-				log_error( "inode %llu: xattr extent %zu ends out of bounds at byte %zu/%zu",
-				           in->inode_id, i, last, end );
-				return;
-			}
-
-			// Then allocate another extent structure
-			next = calloc( 1, sizeof( xfs_ex_t ) );
-			if ( NULL == next ) {
-				log_critical( "Unable to allocate %lu bytes for xattr extent!",
-				              sizeof( xfs_ex_t ) );
-				return;
-			}
-
-			// Can it be read? (Should. Only errors are bugs if either is NULL)
-			if ( -1 == xfs_read_ex( next, data + first ) )
-				return;
-
-			// Set root or extent chain
-			if ( curr )
-				curr->next = next;
-			else
-				in->x_ext_root = next;
-			curr = next;
-			next = NULL;
+	} else if ( ST_EXTENTS == cold->xattr_type_flg ) {
+		// Check the end of the last extent. Don't overshoot!
+		size_t last = start + ( XFS_EX_SIZE * ( size_t )cold->num_xattr_exts ) - 1;
+		if ( cold->num_xattr_exts && ( last >= end ) ) {
+			log_error( "inode %llu: xattr extent %zu ends out of bounds at byte %zu/%zu",
+			           in->inode_id, ( end - start ) / XFS_EX_SIZE, last, end );
+			return;
 		}
-	} else if ( ST_BTREE == in->xattr_type_flg ) {
+
+		// Failures are logged already
+		if ( cold->num_xattr_exts )
+			in_data->x_exts = xfs_ex_create( data + start, cold->num_xattr_exts );
+	} else if ( ST_BTREE == cold->xattr_type_flg ) {
 		/* Can they even exist? */
-		log_error( "xattr btrees (0x%02x) are not supported.", in->xattr_type_flg );
+		log_error( "xattr btrees (0x%02x) are not supported.", cold->xattr_type_flg );
 		log_info( " ==> Ignoring extended attributes for inode %llu!", in->inode_id );
 		return;
 	} else {
-		log_error( "Ignoring xattrs with unknown fork type 0x%02x!", in->xattr_type_flg );
+		log_error( "Ignoring xattrs with unknown fork type 0x%02x!", cold->xattr_type_flg );
 		log_info( " ==> Ignoring extended attributes for inode %llu!", in->inode_id );
 		return;
 	}
 }
 
 
+/// @internal Decode the raw inode @a data into @a in, the maps are only built if @a do_map is set
+static int decode_in( xfs_in_t* in, uint8_t const* data, int fd, bool do_map ) {
+	xfs_in_cold_t   cold;
+	xfs_sb_t const* sb = &superblocks[in->ag_num];
+
+	// Check magic first
+	if ( memcmp( data, XFS_IN_MAGIC, 2 ) ) {
+		log_error( "Wrong magic: 0x%02x%02x instead of 0x%02x%02x",
+		           data[0], data[1], XFS_IN_MAGIC[0], XFS_IN_MAGIC[1] );
+		return -1;
+	}
+
+	// As the magic is correct, check whether this is a deleted inode or a directory
+	bool is_deleted   = is_deleted_inode( data ) > 0 ? true : false;
+	bool is_directory = is_directory_block(data) > 0 ? true : false;
+	if ( !(is_deleted || is_directory || in->is_logged || in->is_captured) )
+		// Uninteresting for us, unless this is a logged image from the journal
+		return -1;
+
+	// Everything that is not kept is only needed while decoding
+	xfs_decode_in_cold( &cold, data );
+
+	// The inode number follows from the position, v3 inodes also store it
+	in->inode_id = xfs_calc_ino( in->ag_num, in->pos );
+	if ( ( cold.version > 2 ) && ( in->inode_id != get_flip64u( data, 152 ) ) ) {
+		log_debug( "Inode %llu at 0x%08llx claims to be inode %llu",
+		           in->inode_id, in->pos, get_flip64u( data, 152 ) );
+	}
+
+
+	// Check the UUID
+	if ( ( cold.version > 2 ) && memcmp( sb->UUID, cold.sb_UUID, 16 ) ) {
+		char in_uuid_str[37] = { 0x0 };
+		char sb_uuid_str[37] = { 0x0 };
+		format_uuid_str( in_uuid_str, cold.sb_UUID );
+		format_uuid_str( sb_uuid_str, sb->UUID );
+		log_error( "Inode %llu UUID mismatch:", in->inode_id );
+		log_error( "Device UUID: %s", sb_uuid_str );
+		log_error( "Inode UUID : %s", in_uuid_str );
+		return -1; // skip this!
+	}
+
+	// Now just copy/flip the data for recovery
+	in->data_fork_type  = get_flip8u(  data,   5 ); // <-- (FORCED 2 on delete)
+	in->file_size       = get_flip64u( data,  56 ); // <-- (ZEROED on delete)
+
+	// Try to recover data fork type, extents used/B-Tree root
+	// and where the extended attributes start, if they are local.
+	if ( is_deleted ) {
+		if ( -1 == restore_inode( in, &cold, sb->inode_size, data, fd ) )
+			// Completely fubar!
+			return -1;
+	} else if ( is_directory )
+		// So as this is a directory, note it down
+		in->ftype = FT_DIR;
+	else
+		// A live image from the journal still knows its type
+		in->ftype = get_file_type( ( cold.type_mode & 0xf000 ) >> 12 );
+
+	// Now read the rest of the inode data
+	in->ctime_ep        = ( uint32_t )xfs_get_in_time( data, 48, &in->ctime_ns );
+	if ( !in->is_logged )
+		in->lsn         = cold.last_log_seq;
+
+	// Handle file/directory storage (local, extents or btree)
+	if ( -1 == build_data_map( in, &cold, data, fd, do_map ) )
+		return -1; // Already told what's wrong
+	if ( !do_map )
+		return 0;
+
+	// Handle xattr storage (local, extents or btree)
+	if ( ( NULL == in->data ) || ( NULL == in->data->xattr_root ) )
+		// Note: restore_inode() already unpacks xattr local data,
+		//       this here is only for directory nodes.
+		build_xattr_map( in, &cold, data );
+		// Note 2: No check here. xattrs aren't that mission critical!
+
+	// We here? Fine!
+
+	return 0;
+}
+
+
 static xattr_t* free_xattr_chain( xattr_t* root ) {
 	if ( root ) {
 		xattr_t* curr = root;
 		xattr_t* next = curr->next;
 		while ( curr ) {
-			FREE_PTR( curr->name );
-			FREE_PTR( curr->value );
-			free( curr );
+			// Name and value belong to the arena of the inode
+			slab_free( SLAB_XATTR, curr );
 			curr = next;
 			if ( curr )
 				next = curr->next;
@@ -217,7 +282,8 @@ finish:
 
 
 // Returns the root of an unpacked xattr chain, or NULL if no chain was found
-xattr_t* unpack_xattr_data( uint8_t const* data, size_t data_len, bool log_error ) {
+xattr_t* unpack_xattr_data( arena_t** arena, uint8_t const* data, size_t data_len, bool log_error ) {
+	RETURN_NULL_IF_NULL( arena );
 	RETURN_NULL_IF_NULL( data );
 	RETURN_NULL_IF_ZERO( data_len );
 
@@ -283,27 +349,20 @@ xattr_t* unpack_xattr_data( uint8_t const* data, size_t data_len, bool log_error
 		// Allocate buffers for the name and value
 		// But add 1 byte, as xattr names are not NULL terminated,
 		// and values might, too, come without termination!
-		char* name = (char*)calloc( name_len + 1, 1 );
-		if ( NULL == name ) {
-			log_critical( "Unable to allocate %lu bytes for xattr name!", name_len + 1 );
+		char* name = (char*)arena_alloc( arena, name_len + 1 );
+		if ( NULL == name )
 			return root;
-		}
-		char* value = (char*)calloc( val_len + 1, 1 );
-		if ( NULL == value ) {
-			log_critical( "Unable to allocate %lu bytes for xattr value!", val_len + 1 );
-			FREE_PTR( name );
+		char* value = (char*)arena_alloc( arena, val_len + 1 );
+		if ( NULL == value )
 			return root;
-		}
 		memcpy( name,  data + offset + 3, name_len );
 		memcpy( value, data + val_start,  val_len  );
 
 		// Allocate the new xattr entry
-		next = calloc( 1, sizeof( xattr_t ) );
+		next = slab_alloc( SLAB_XATTR );
 		if ( NULL == next ) {
 			log_critical( "Unable to allocate %zu bytes for xattr entry!", sizeof( xattr_t ) );
 			log_info( "%s", " ==> Ignoring remaining extended attributes for this inode!" );
-			FREE_PTR( name );
-			FREE_PTR( value );
 			return root;
 		}
 
@@ -323,55 +382,180 @@ xattr_t* unpack_xattr_data( uint8_t const* data, size_t data_len, bool log_error
 }
 
 
+uint64_t xfs_calc_ino( uint32_t ag_num, uint64_t pos ) {
+	xfs_sb_t const* sb     = &superblocks[0];
+	uint64_t        ag_blk = ( pos / sb_block_size ) - ( ( uint64_t )ag_num * sb->ag_size );
+	uint64_t        slot   = ( pos % sb_block_size ) >> sb->log2_inode_size;
+
+	return ( ( uint64_t )ag_num << ( sb->log2_ag_size + sb->log2_inode_block ) )
+	     | ( ag_blk << sb->log2_inode_block )
+	     | slot;
+}
+
+
+void xfs_clear_in( xfs_in_t* in ) {
+	RETURN_VOID_IF_NULL( in );
+
+	// Remove data extents
+	xfs_ex_free( &in->d_exts );
+
+	if ( NULL == in->data )
+		return;
+
+	// shortcut
+	xfs_in_data_t* ldata = in->data; // [l]ocal data
+	in->data = NULL;
+
+	// Local data lives in the arena (Maybe possible in some future XFS version)
+	ldata->d_loc_data = NULL;
+
+	// Remove xattr extents
+	xfs_ex_free( &ldata->x_exts );
+
+	// Remove unpacked local xattr list
+	free_xattr_chain( ldata->xattr_root );
+
+	// Local data, xattr names and values all go at once
+	arena_free( &ldata->arena );
+
+	slab_free( SLAB_IN_DATA, ldata );
+}
+
+
+void xfs_decode_in_cold( xfs_in_cold_t* cold, uint8_t const* data ) {
+	RETURN_VOID_IF_NULL( cold );
+	RETURN_VOID_IF_NULL( data );
+
+	memset( cold, 0, sizeof( xfs_in_cold_t ) );
+
+	memcpy( cold->magic, data, 2 );
+	cold->type_mode       = get_flip16u( data,   2 ); // <-- (ZEROED on delete)
+	cold->version         = get_flip8u(  data,   4 );
+	cold->num_links_v1    = get_flip16u( data,   6 ); // <-- (ZEROED on delete)
+	cold->uid             = get_flip32u( data,   8 );
+	cold->gid             = get_flip32u( data,  12 );
+	cold->num_links_v2    = get_flip32u( data,  16 ); // <-- (ZEROED on delete)
+	cold->project_id_lo   = get_flip16u( data,  20 );
+	cold->project_id_hi   = get_flip16u( data,  22 );
+	cold->inc_on_flush    = get_flip16u( data,  30 );
+	cold->atime_ep        = get_flip32u( data,  32 );
+	cold->atime_ns        = get_flip32u( data,  36 );
+	cold->mtime_ep        = get_flip32u( data,  40 );
+	cold->mtime_ns        = get_flip32u( data,  44 );
+	cold->file_blocks     = get_flip64u( data,  64 ); // <-- (ZEROED on delete)
+	cold->ext_size_hint   = get_flip32u( data,  72 );
+	cold->ext_used        = get_flip32u( data,  76 ); // <-- (ZEROED on delete)
+	cold->num_xattr_exts  = get_flip16u( data,  80 ); // <-- (ZEROED on delete)
+	cold->xattr_off       = get_flip8u(  data,  82 ); // <-- (ZEROED on delete)
+	cold->xattr_type_flg  = get_flip8u(  data,  83 ); // <-- (FORCED 2 on delete)
+	cold->DMAPI_evnt_flg  = get_flip32u( data,  84 );
+	cold->DMAPI_state     = get_flip16u( data,  88 );
+	cold->flags           = get_flip32u( data,  90 );
+	cold->gen_number      = get_flip32u( data,  92 );
+	cold->nxt_unlnkd_ptr  = get_flip32u( data,  96 );
+	memcpy( cold->in_crc32, data + 100,  4 );
+	memcpy( cold->sb_UUID,  data + 160, 16 );
+	/* v3 inodes (v5 file system) have the following fields */
+	if ( cold->version > 2 ) {
+		cold->attr_changes    = get_flip64u( data, 104 );
+		cold->last_log_seq    = get_flip64u( data, 112 );
+		cold->ext_flags       = get_flip64u( data, 120 );
+		cold->cow_ext_size    = get_flip32u( data, 128 );
+		memcpy( cold->padding, data + 132, 12 );
+		cold->btime_ep        = get_flip32u( data, 144 );
+		cold->btime_ns        = get_flip32u( data, 148 );
+	}
+}
+
+
+void xfs_drop_in( xfs_in_t** in ) {
+	RETURN_VOID_IF_NULL( in );
+
+	if ( *in )
+		cat_del( ( *in )->inode_id );
+
+	xfs_free_in( in );
+}
+
+
 void xfs_free_in( xfs_in_t** in ) {
 	RETURN_VOID_IF_NULL( in );
 	if ( NULL == *in )
 		// Simply nothing to do
 		return;
 
-	// shortcut
-	xfs_in_t* lin = *in; // [l]ocal in
+	xfs_clear_in( *in );
 
-	// Remove data extent list
-	if ( lin->d_ext_root ) {
-		xfs_ex_t* curr    = lin->d_ext_root;
-		xfs_ex_t* next    = curr->next;
-		lin->d_ext_root = NULL;
-		while ( curr ) {
-			free( curr );
-			curr = next;
-			if ( curr )
-				next = curr->next;
-		}
-	}
+	slab_free( SLAB_INODE, *in );
+	*in = NULL;
+}
+
+
+int64_t xfs_get_in_time( uint8_t const* data, size_t offset, uint32_t* ns ) {
+	RETURN_ZERO_IF_NULL( data );
 
-	// Remove local data (Maybe possible in some future XFS version)
-	if ( lin->d_loc_data ) {
-		FREE_PTR( lin->d_loc_data );
+	if ( ( data[4] > 2 ) && ( get_flip64u( data, 120 ) & XFS_DIFLAG2_BIGTIME ) ) {
+		// The counter starts at the lowest legacy timestamp, -2^31 seconds
+		uint64_t bt = get_flip64u( data, offset );
+		if ( ns )
+			*ns = ( uint32_t )( bt % 1000000000ULL );
+		return ( int64_t )( bt / 1000000000ULL ) - 0x80000000LL;
 	}
 
-	// Remove xattr extent list
-	if ( lin->x_ext_root ) {
-		xfs_ex_t* curr    = lin->x_ext_root;
-		xfs_ex_t* next    = curr->next;
-		lin->x_ext_root = NULL;
-		while ( curr ) {
-			free( curr );
-			curr = next;
-			if ( curr )
-				next = curr->next;
-		}
+	if ( ns )
+		*ns = get_flip32u( data, offset + 4 );
+	return ( int32_t )get_flip32u( data, offset );
+}
+
+
+xfs_in_data_t* xfs_get_in_data( xfs_in_t* in ) {
+	RETURN_NULL_IF_NULL( in );
+
+	if ( NULL == in->data ) {
+		in->data = ( xfs_in_data_t* )slab_alloc( SLAB_IN_DATA );
+		if ( NULL == in->data )
+			log_critical( "Unable to allocate %zu bytes for inode data: %m %d",
+			              sizeof( xfs_in_data_t ), errno );
 	}
 
-	// Remove unpacked local xattr list
-	lin->xattr_root = free_xattr_chain( lin->xattr_root );
+	return in->data;
+}
+
+
+void xfs_init_in( xfs_in_t* in, uint32_t ag_num, uint64_t block, uint32_t offset ) {
+	RETURN_VOID_IF_NULL( in );
+
+	memset( in, 0, sizeof( xfs_in_t ) );
 
-	FREE_PTR( *in );
+	in->ag_num = ag_num;
+	in->pos    = ( block * sb_block_size ) + offset;
 }
 
 
-xfs_in_t* xfs_create_in( uint32_t ag_num, uint64_t block, uint32_t offset ) {
-	xfs_in_t* inode = ( xfs_in_t* )calloc( 1, sizeof( xfs_in_t ) );
+bool xfs_ino_pos( uint64_t ino, uint32_t* ag_num, uint64_t* pos ) {
+	RETURN_ZERO_IF_NULL( ag_num );
+	RETURN_ZERO_IF_NULL( pos );
+
+	xfs_sb_t const* sb      = &superblocks[0];
+	uint64_t        ag      = ino >> ( sb->log2_ag_size + sb->log2_inode_block );
+	uint64_t        ag_blk  = ( ino >> sb->log2_inode_block ) & ( ( 1ULL << sb->log2_ag_size ) - 1 );
+	uint64_t        slot    = ino & ( ( 1ULL << sb->log2_inode_block ) - 1 );
+	uint64_t        blk_pos = 0;
+
+	if ( !fsb_to_pos( ( ag << sb->log2_ag_size ) | ag_blk, 1, &blk_pos ) )
+		return false;
+
+	*ag_num = ag;
+	*pos    = blk_pos + ( slot << sb->log2_inode_size );
+
+	return true;
+}
+
+
+xfs_in_t* xfs_promote_in( xfs_in_t* in ) {
+	RETURN_NULL_IF_NULL( in );
+
+	xfs_in_t* inode = ( xfs_in_t* )slab_alloc( SLAB_INODE );
 
 	if ( NULL == inode ) {
 		log_critical( "Unable to allocate %zu bytes for inode structure: %m %d",
@@ -379,120 +563,69 @@ xfs_in_t* xfs_create_in( uint32_t ag_num, uint64_t block, uint32_t offset ) {
 		return NULL;
 	}
 
-	inode->ag_num = ag_num;
-	inode->block  = block;
-	inode->offset = offset;
-	inode->sb     = &superblocks[ag_num];
+	// The heap copy takes over the lists, so the scratch must forget them
+	memcpy( inode, in, sizeof( xfs_in_t ) );
+	in->d_exts = NULL;
+	in->data   = NULL;
+
+	// Whatever gets queued can be looked up by its number, a full catalog is no reason to drop it
+	cat_add( inode->inode_id, inode->ftype );
 
 	return inode;
 }
 
-int xfs_read_in( xfs_in_t* in, uint8_t const* data, int fd ) {
+
+int xfs_map_in( xfs_in_t* in, int fd ) {
 	RETURN_INT_IF_NULL( in );
-	RETURN_INT_IF_NULL( data );
 
-	// Copy and check magic first
-	memcpy( in->magic, data, 2 );
-	if ( memcmp( in->magic, XFS_IN_MAGIC, 2 ) ) {
-		log_error( "Wrong magic: 0x%02x%02x instead of 0x%02x%02x",
-		           in->magic[0], in->magic[1], XFS_IN_MAGIC[0], XFS_IN_MAGIC[1] );
+	if ( in->is_mapped )
+		return 0;
+
+	uint8_t         raw[IN_SIZE_MAX];
+	xfs_in_t        scratch;
+	xfs_sb_t const* sb = &superblocks[in->ag_num];
+
+	if ( ( sb->inode_size > IN_SIZE_MAX )
+	  || ( ( ssize_t )sb->inode_size != src_pread( fd, raw, sb->inode_size, in->pos, IO_PROBE ) ) ) {
+		log_error( "Unable to read inode %llu at 0x%08llx: %m [%d]", in->inode_id, in->pos, errno );
 		return -1;
 	}
 
-	// As the magic is correct, check whether this is a deleted inode or a directory
-	in->is_deleted   = is_deleted_inode( data ) > 0 ? true : false;
-	in->is_directory = is_directory_block(data) > 0 ? true : false;
-	if ( !(in->is_deleted || in->is_directory) )
-		// Uninteresting for us
+	// The raw inode is decoded again, so nothing the queued inode holds is touched on failure
+	memcpy( &scratch, in, sizeof( xfs_in_t ) );
+	scratch.d_exts = NULL;
+	scratch.data   = NULL;
+	if ( ( -1 == decode_in( &scratch, raw, fd, true ) ) || ( scratch.ftype != in->ftype ) ) {
+		log_warning( "Inode %llu changed since it was scanned, skipping it", in->inode_id );
+		xfs_clear_in( &scratch );
 		return -1;
-
-	// We need the version first, as some features need version v3
-	in->version = data[4];
-
-	// Copy the inode number, we might need it for error messages
-	if ( in->version > 2 )
-		in->inode_id = get_flip64u( data, 152 );
-	else
-		in->inode_id = 0;
-
-
-	// Copy CRC32 and UUID, then check the UUID
-	memcpy( in->in_crc32, data + 100,  4 );
-	memcpy( in->sb_UUID,  data + 160, 16 );
-	if ( ( in->version > 2 ) && memcmp( in->sb->UUID, in->sb_UUID, 16 ) ) {
-		char in_uuid_str[37] = { 0x0 };
-		char sb_uuid_str[37] = { 0x0 };
-		format_uuid_str( in_uuid_str, in->sb_UUID );
-		format_uuid_str( sb_uuid_str, in->sb->UUID );
-		log_error( "Inode %llu UUID mismatch:", in->inode_id );
-		log_error( "Device UUID: %s", sb_uuid_str );
-		log_error( "Inode UUID : %s", in_uuid_str );
-		return -1; // skip this!
 	}
 
-	// Now just copy/flip the data for recovery
-	in->type_mode       = get_flip16u( data,   2 ); // <-- (ZEROED on delete)
-	in->data_fork_type  = get_flip8u(  data,   5 ); // <-- (FORCED 2 on delete)
-	in->num_links_v1    = get_flip16u( data,   6 ); // <-- (ZEROED on delete)
-	in->num_links_v2    = get_flip32u( data,  16 ); // <-- (ZEROED on delete)
-	in->file_size       = get_flip64u( data,  56 ); // <-- (ZEROED on delete)
-	in->file_blocks     = get_flip64u( data,  64 ); // <-- (ZEROED on delete)
-	in->ext_used        = get_flip32u( data,  76 ); // <-- (ZEROED on delete)
-	in->num_xattr_exts  = get_flip16u( data,  80 ); // <-- (ZEROED on delete)
-	in->xattr_off       = get_flip8u(  data,  82 ); // <-- (ZEROED on delete)
-	in->xattr_type_flg  = get_flip8u(  data,  83 ); // <-- (FORCED 2 on delete)
+	xfs_clear_in( in );
+	in->d_exts    = scratch.d_exts;
+	in->data      = scratch.data;
+	in->file_size = scratch.file_size;
+	in->is_mapped = true;
 
-	// Try to recover data fork type, extents used/B-Tree root
-	// and where the extended attributes start, if they are local.
-	if ( in->is_deleted ) {
-		if ( -1 == restore_inode( in, in->sb->inode_size, data, fd ) )
-			// Completely fubar!
-			return -1;
-	} else
-		// So as this is a directory, note it down
-		in->ftype = FT_DIR;
+	return 0;
+}
 
-	// Now read the rest of the inode data
-	in->uid             = get_flip32u( data,   8 );
-	in->gid             = get_flip32u( data,  12 );
-	in->project_id_lo   = get_flip16u( data,  20 );
-	in->project_id_hi   = get_flip16u( data,  22 );
-	in->inc_on_flush    = get_flip16u( data,  30 );
-	in->atime_ep        = get_flip32u( data,  32 );
-	in->atime_ns        = get_flip32u( data,  36 );
-	in->mtime_ep        = get_flip32u( data,  40 );
-	in->mtime_ns        = get_flip32u( data,  44 );
-	in->ctime_ep        = get_flip32u( data,  48 );
-	in->ctime_ns        = get_flip32u( data,  52 );
-	in->ext_size_hint   = get_flip32u( data,  72 );
-	in->DMAPI_evnt_flg  = get_flip32u( data,  84 );
-	in->DMAPI_state     = get_flip16u( data,  88 );
-	in->flags           = get_flip32u( data,  90 );
-	in->gen_number      = get_flip32u( data,  92 );
-	in->nxt_unlnkd_ptr  = get_flip32u( data,  96 );
-	/* v3 inodes (v5 file system) have the following fields */
-	if (in->version > 2) {
-		in->attr_changes    = get_flip64u( data, 104 );
-		in->last_log_seq    = get_flip64u( data, 112 );
-		in->ext_flags       = get_flip64u( data, 120 );
-		in->cow_ext_size    = get_flip32u( data, 128 );
-		memcpy(in->padding, data + 132, 12);
-		in->btime_ep        = get_flip32u( data, 144 );
-		in->btime_ns        = get_flip32u( data, 148 );
-	}
 
-	// Handle file/directory storage (local, extents or btree)
-	if ( -1 == build_data_map( in, data ) )
-		return -1; // Already told what's wrong
+int xfs_read_in( xfs_in_t* in, uint8_t const* data, int fd ) {
+	RETURN_INT_IF_NULL( in );
+	RETURN_INT_IF_NULL( data );
 
-	// Handle xattr storage (local, extents or btree)
-	if ( NULL == in->xattr_root )
-		// Note: recover_inode() already unpacks xattr local data,
-		//       this here is only for directory nodes.
-		build_xattr_map( in, data );
-		// Note 2: No check here. xattrs aren't that mission critical!
+	// Images from the journal or a watcher can not be read again later, so only they are mapped now
+	bool do_map = in->is_logged || in->is_captured;
 
-	// We here? Fine!
+	if ( -1 == decode_in( in, data, fd, do_map ) )
+		return -1;
+
+	if ( do_map )
+		in->is_mapped = true;
+	else
+		// restore_inode() might have unpacked local xattrs already
+		xfs_clear_in( in );
 
 	return 0;
 }
@@ -6,6 +6,7 @@
 #include "directory.h"
 #include "extent.h"
 #include "file_type.h"
+#include "slab.h"
 #include "superblock.h"
 
 
@@ -14,6 +15,9 @@
 #include <stdint.h>
 
 
+#define XFS_DIFLAG2_BIGTIME 0x08 // di_flags2 (ext_flags): timestamps are 64 bit nanosecond counters
+
+
 /// @brief enum how data forks and extended attributes are stored
 typedef enum _store_type {
 	ST_DEV     = 0, //!< Special device file (data type only)
@@ -32,12 +36,25 @@ typedef struct _xattr {
 } xattr_t;
 
 
-/// @brief structure of an inode
-typedef struct _xfs_in {
+/// @brief What an inode owns besides its data extents, only allocated if needed
+typedef struct _xfs_in_data {
+	xfs_dir_t*    d_dir_root; //!< Directory structure if used as local short form dir
+	uint8_t*      d_loc_data; //!< Local data if the file is stored inside the inode
+	xfs_ex_vec_t* x_exts;     //!< xattr extents if used for extended attributes
+	xattr_t*      xattr_root; //!< Root element of the xattr chain
+	arena_t*      arena;      //!< Holds local data and xattr names and values
+} xfs_in_data_t;
+
+
+/** @brief The inode core fields that are not kept in the queued inode
+  *
+  * They are only needed while an inode is decoded, or when somebody wants
+  * to report them.
+**/
+typedef struct _xfs_in_cold {
 	char        magic[3];       //!< Bytes   0-  1 : Magic number
 	uint16_t    type_mode;      //!< Bytes   2-  3 : file type and permissions        (ZEROED on delete)
 	uint8_t     version;        //!< Byte    4     : Version (v5 file system uses v3 inodes)
-	uint8_t     data_fork_type; //!< Byte    5     : Data fork type flag              (FORCED 2 on delete)
 	uint16_t    num_links_v1;   //!< Bytes   6-  7 : v1 inode numlinks field (not v3) (ZEROED on delete)
 	uint32_t    uid;            //!< Bytes   8- 11 : File owner UID
 	uint32_t    gid;            //!< Bytes  12- 15 : File GID
@@ -51,10 +68,7 @@ typedef struct _xfs_in {
 	uint32_t    atime_ns;       //!< Bytes  36- 39 : atime nanoseconds
 	uint32_t    mtime_ep;       //!< Bytes  40- 43 : mtime epoch seconds
 	uint32_t    mtime_ns;       //!< Bytes  44- 47 : mtime nanoseconds
-	uint32_t    ctime_ep;       //!< Bytes  48- 51 : ctime epoch seconds
-	uint32_t    ctime_ns;       //!< Bytes  52- 55 : ctime nanoseconds
 
-	uint64_t    file_size;      //!< Bytes  56- 63 : File (data fork) size            (ZEROED on delete)
 	uint64_t    file_blocks;    //!< Bytes  64- 71 : Number of blocks in data fork    (ZEROED on delete)
 	uint32_t    ext_size_hint;  //!< Bytes  72- 75 : Extent size hint
 	uint32_t    ext_used;       //!< Bytes  76- 79 : Number of data extents used      (ZEROED on delete)
@@ -81,25 +95,32 @@ typedef struct _xfs_in {
 
 	uint32_t    btime_ep;       //!< Bytes 144-147 : btime epoch seconds
 	uint32_t    btime_ns;       //!< Bytes 148-151 : btime nanoseconds
-	uint64_t    inode_id;       //!< Bytes 152-159 : inode number of this inode
 
 	uint8_t     sb_UUID[16];    //!< Bytes 160-175 : UUID of the device, stored in the superblock
+} xfs_in_cold_t;
+
 
-	/* Data, directory and xattr information */
-	xfs_dir_t*  d_dir_root;     //!< Directory structure if used as local short form dir
-	xfs_ex_t*   d_ext_root;     //!< First data extent if used for file storage
-	uint8_t*    d_loc_data;     //!< Local data if the file is stored inside the inode
-	xfs_ex_t*   x_ext_root;     //!< First xattr extent if used for extended attributes
-	xattr_t*    xattr_root;     //!< Root element of the xattr chain
-
-	/* Some helper values for internal use */
-	uint32_t    ag_num;       //!< The allocation group number this inode belongs to
-	uint64_t    block;        //!< The absolute block in which the inode resides
-	e_file_type ftype;        //!< Detected file type
-	bool        is_deleted;   //!< True if this is a deleted inode
-	bool        is_directory; //!< True if this is sure to be a directory inode
-	uint32_t    offset;       //!< Offset inside the block
-	xfs_sb_t*   sb;           //!< pointer to the superblock for this allocation group
+/** @brief structure of a queued inode
+  *
+  * Millions of these wait in the queues, so this holds only what the
+  * analyzer and writer need, in one cache line. Everything else of the
+  * inode core is in xfs_in_cold_t.
+**/
+typedef struct _xfs_in {
+	uint64_t       pos;             //!< Byte position of the inode on the device
+	uint64_t       inode_id;        //!< Inode number, see xfs_calc_ino()
+	uint64_t       file_size;       //!< Bytes  56- 63 : File (data fork) size            (RECOVERED on delete)
+	uint64_t       lsn;             //!< LSN of the log record this was rebuilt from, or of the last update (v3 only)
+	uint32_t       ctime_ep;        //!< Bytes  48- 51 : ctime epoch seconds
+	uint32_t       ctime_ns;        //!< Bytes  52- 55 : ctime nanoseconds
+	uint32_t       ag_num;          //!< The allocation group number this inode belongs to
+	uint8_t        data_fork_type;  //!< Byte    5     : Data fork type flag              (RECOVERED on delete)
+	uint8_t        ftype;           //!< Detected file type, an e_file_type
+	bool           is_captured : 1; //!< True if this inode was captured by a watcher
+	bool           is_logged   : 1; //!< True if this inode was rebuilt from the journal
+	bool           is_mapped   : 1; //!< True if the data and xattr maps are built, see xfs_map_in()
+	xfs_ex_vec_t*  d_exts;          //!< Data extents if used for file storage
+	xfs_in_data_t* data;            //!< Everything else the inode owns, NULL if nothing
 } xfs_in_t;
 
 
@@ -119,12 +140,81 @@ bool is_xattr_head( uint8_t const* data, size_t data_size, uint16_t* x_size, uin
 
 /** @brief Unpack xattr data and create an xattr chain from the findings
   *
+  * Names and values are cut from @a arena, so they are freed with it.
+  *
+  * @param[in,out] arena  The arena of the inode the chain is for
   * @param[in] data  pointer to the data to analyze
   * @param[in] data_len size of the data to analyze
   * @param[in] log_error  If set to true, issue an error message if any check fails
   * @return A pointer to the root of an XATTR chain, or NULL on failure
 **/
-xattr_t* unpack_xattr_data( uint8_t const* data, size_t data_len, bool log_error );
+xattr_t* unpack_xattr_data( arena_t** arena, uint8_t const* data, size_t data_len, bool log_error );
+
+
+/** @brief Decode the cold fields of a raw inode core
+  *
+  * This is a plain copy of what is on the disk. Values that were recovered
+  * for a deleted inode are only in its xfs_in_t and its extent lists.
+  *
+  * @param[out] cold  The structure to fill
+  * @param[in]  data  The raw inode, at least 176 bytes
+**/
+void xfs_decode_in_cold( xfs_in_cold_t* cold, uint8_t const* data );
+
+
+/** @brief Decode a timestamp of a raw inode core
+  *
+  * Legacy timestamps are signed 32 bit seconds followed by the nanoseconds.
+  * v3 inodes with XFS_DIFLAG2_BIGTIME set store one 64 bit counter of
+  * nanoseconds since 1901-12-13 instead.
+  *
+  * @param[in]  data    The raw inode
+  * @param[in]  offset  Offset of the timestamp; 32 atime, 40 mtime, 48 ctime
+  * @param[out] ns      If not NULL, receives the nanoseconds
+  * @return The seconds since the Unix epoch.
+**/
+int64_t xfs_get_in_time( uint8_t const* data, size_t offset, uint32_t* ns );
+
+
+/** @brief Get the data part of an inode, creating it if needed
+  *
+  * @param[in,out] in  The inode
+  * @return A pointer to in->data, or NULL if it can not be allocated.
+**/
+xfs_in_data_t* xfs_get_in_data( xfs_in_t* in );
+
+
+/** @brief Compute the inode number from where the inode is on the device
+  *
+  * XFS numbers inodes by their place: The AG number, the block in the AG
+  * and the inode slot in that block, packed with sb->log2_ag_size and
+  * sb->log2_inode_block bits. This works for inodes of every version,
+  * deleted or not.
+  *
+  * @param[in] ag_num  The allocation group the inode is in
+  * @param[in] pos     The absolute byte position of the inode on the device
+  * @return The inode number.
+**/
+uint64_t xfs_calc_ino( uint32_t ag_num, uint64_t pos );
+
+
+/** @brief Free everything an inode structure owns, but not the structure itself
+  *
+  * Use this on scratch inodes on the stack, heap inodes are destroyed with
+  * xfs_free_in() or xfs_drop_in().
+  *
+  * @param[in,out] in  pointer to the inode structure to clear.
+**/
+void xfs_clear_in( xfs_in_t* in );
+
+
+/** @brief Destroy an inode from xfs_promote_in() that is dropped without being worked on
+  *
+  * Unlike xfs_free_in(), this also removes the inode from the inode catalog.
+  *
+  * @param[in,out] in  pointer to the struct pointer of the inode to drop. Sets *in to NULL.
+**/
+void xfs_drop_in( xfs_in_t** in );
 
 
 /** @brief Destroy xfs_in structures with this function
@@ -133,20 +223,71 @@ xattr_t* unpack_xattr_data( uint8_t const* data, size_t data_len, bool log_error
 void xfs_free_in( xfs_in_t** in );
 
 
-/** @brief Create an empty xfs_in_t structure
+/** @brief Initialize an existing xfs_in_t structure
+  *
+  * The structure is zeroed, so it must not own anything. Use xfs_clear_in()
+  * before re-using a scratch inode.
   *
-  * @param[in] ag_num  The allocation group number this inode belongs to
-  * @param[in] block   The absolute block number this inode resides in
-  * @param[in] offset  The offset of the inode inside its block
-  * @return A pointer to the allocated and initialized inode, or NULL on failure.
+  * @param[out] in      The inode structure to initialize
+  * @param[in]  ag_num  The allocation group number this inode belongs to
+  * @param[in]  block   The absolute block number this inode resides in
+  * @param[in]  offset  The offset of the inode inside its block
 **/
-xfs_in_t* xfs_create_in( uint32_t ag_num, uint64_t block, uint32_t offset );
+void xfs_init_in( xfs_in_t* in, uint32_t ag_num, uint64_t block, uint32_t offset );
+
+
+/** @brief Find an inode on the device by its number
+  *
+  * This is the reverse of xfs_calc_ino().
+  *
+  * @param[in]  ino     The inode number
+  * @param[out] ag_num  Receives the allocation group the inode is in
+  * @param[out] pos     Receives the absolute byte position of the inode on the device
+  * @return true on success, false if this file system can not have inode @a ino.
+**/
+bool xfs_ino_pos( uint64_t ino, uint32_t* ag_num, uint64_t* pos );
+
+
+/** @brief Build the data and xattr maps of a queued inode
+  *
+  * xfs_read_in() only classifies and checks inodes, most of them are
+  * filtered out or never written. The maps are built here, when the
+  * analyzer or writer needs them, by reading and decoding the raw inode
+  * at `in->pos` again. Nothing is done if `in->is_mapped` is already set.
+  *
+  * @param[in,out] in  The inode to map
+  * @param[in]     fd  File Descriptor for reading from the source device.
+  * @return 0 on success, -1 if the inode can not be read or changed since it was scanned.
+**/
+int xfs_map_in( xfs_in_t* in, int fd );
+
+
+/** @brief Move an accepted scratch inode onto the heap
+  *
+  * The new inode takes over everything @a in owns, so @a in is left with
+  * empty lists and can be re-initialized without clearing it first.
+  * The new inode is added to the inode catalog, so inodes that are
+  * dropped later must be destroyed with xfs_drop_in().
+  *
+  * @param[in,out] in  The scratch inode to promote
+  * @return A pointer to the new heap inode, or NULL on failure. In that case @a in still owns its data.
+**/
+xfs_in_t* xfs_promote_in( xfs_in_t* in );
 
 
 /** @brief read inode data from a data block
   *
   * There are no checks. The @a data block must have sb->inode_size bytes. Your responsibility!
   *
+  * Only deleted inodes and directories are accepted, unless `in->is_logged` or
+  * `in->is_captured` is set. Inode images rebuilt from the journal or
+  * captured by a watcher are accepted if they are live.
+  *
+  * Only the fields of xfs_in_t are kept. The data extent, local data and
+  * xattr maps are only checked, use xfs_map_in() to build them. Logged and
+  * captured images can not be read again, so their maps are built right
+  * away and `in->is_mapped` is set.
+  *
   * @param[out] in    The xfs_in inode structure to fill
   * @param[in]  data  Pointer to the data block to interpret.
   * @param[in]  fd    File Descriptor for reading from the source device.
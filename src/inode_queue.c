@@ -6,14 +6,28 @@
 #include "inode.h"
 #include "inode_queue.h"
 #include "log.h"
+#include "spill.h"
+#include "stats.h"
 #include "utils.h"
 
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <threads.h>
+#include <time.h>
 
 
-/// @brief Simple plain stupid xfs_in queue
+#define IN_CACHE_LINE 64
+#define IN_RING_SIZE  65536 // Slots per ring, must be a power of 2
+#define IN_RING_MASK  ( IN_RING_SIZE - 1 )
+#define IN_SPIN_TRIES 64    // Pop attempts before a consumer goes to sleep
+#define IN_STALL_MS   5000  // A blocked producer gives up after this long without any pop
+#define IN_WAIT_MS    100   // A blocked producer looks for pops this often
+
+
+/// @brief Simple plain stupid xfs_in queue, only used if a ring is full
 typedef struct _in_queue {
 	struct _xfs_in*   in;   //!< The inode this element is about
 	struct _in_queue* next; //!< next element in the queue
@@ -21,144 +35,561 @@ typedef struct _in_queue {
 } in_queue_t;
 
 
-/* To be thread safe we need a central mutex per queue.
- * Any operation must be solitude!
- */
-static mtx_t dir_queue_lock;
-static mtx_t file_queue_lock;
+/// @brief One slot of a ring. Its sequence tells whether it is free or filled in the current lap.
+typedef struct _in_slot {
+	atomic_size_t seq; //!< Equals the push position if free, the push position + 1 if filled
+	xfs_in_t*     in;  //!< The inode, if filled
+} in_slot_t;
+
+
+/** @brief Bounded multi-producer/multi-consumer ring of inodes
+  *
+  * Producers claim slots by advancing @a head, consumers by advancing
+  * @a tail, each with a single CAS. Both live on cache lines of their
+  * own, so producers and consumers do not invalidate each other.
+  *
+  * If the ring is full, pushes go to the overflow list, so nothing is
+  * ever lost. Consumers empty the ring first, then the overflow list.
+  * If spilling is set up, the file ring writes inodes to disk instead of
+  * growing the overflow list or blocking at the high watermark, and reads
+  * them back once ring and overflow list are empty.
+**/
+typedef struct _in_ring {
+	_Alignas( IN_CACHE_LINE ) atomic_size_t head;     //!< Next position to push to
+	_Alignas( IN_CACHE_LINE ) atomic_size_t tail;     //!< Next position to pop from
+	_Alignas( IN_CACHE_LINE ) atomic_uint   sleepers; //!< Consumers waiting in in_pop_wait()
+	atomic_uint                             blocked;  //!< Producers waiting in in_wait_room()
+	atomic_uint_fast64_t                    pops;     //!< Number of pops so far, tells whether consumers are alive
+	cnd_t                                   wakeup;   //!< Signaled on push if there are sleepers
+	cnd_t                                   room;     //!< Signaled on pop if the low watermark is reached
+	mtx_t                                   lock;     //!< Guards @a wakeup, @a room and the overflow list
+	atomic_size_t                           ovf_cnt;  //!< Number of elements in the overflow list
+	in_queue_t*                             ovf_head; //!< Overflow list head
+	in_queue_t*                             ovf_tail; //!< Overflow list tail
+	atomic_uint_fast64_t                    blk_cnt;  //!< Number of times producers blocked
+	atomic_uint_fast64_t                    blk_ns;   //!< Nanoseconds producers spent blocked
+	atomic_uint_fast64_t                    stalled;  //!< @a pops when consumers were found stalled, plus 1; 0 if not stalled
+	stat_t                                  stat;     //!< Contention of @a lock and the high-water mark
+	in_slot_t                               slots[IN_RING_SIZE];
+} in_ring_t;
+
+
+static in_ring_t            dir_ring;
+static in_ring_t            file_ring;
+static atomic_uint_fast64_t in_high = 0; //!< Producers block at this depth, 0 means never
+static atomic_uint_fast64_t in_low  = 0; //!< Blocked producers resume at this depth
+static once_flag            in_once = ONCE_FLAG_INIT;
+
+
+/// @internal Set up both rings, called once
+static void in_init( void ) {
+	in_ring_t* rings[2] = { &dir_ring, &file_ring };
+
+	for ( int r = 0; r < 2; ++r ) {
+		for ( size_t i = 0; i < IN_RING_SIZE; ++i )
+			atomic_init( &rings[r]->slots[i].seq, i );
+		atomic_init( &rings[r]->head,     0 );
+		atomic_init( &rings[r]->tail,     0 );
+		atomic_init( &rings[r]->sleepers, 0 );
+		atomic_init( &rings[r]->blocked,  0 );
+		atomic_init( &rings[r]->pops,     0 );
+		atomic_init( &rings[r]->ovf_cnt,  0 );
+		atomic_init( &rings[r]->blk_cnt,  0 );
+		atomic_init( &rings[r]->blk_ns,   0 );
+		atomic_init( &rings[r]->stalled,  0 );
+		rings[r]->stat.name = r ? "file queue" : "dir queue";
+		if ( ( thrd_success != mtx_init( &rings[r]->lock, mtx_plain ) )
+		  || ( thrd_success != cnd_init( &rings[r]->wakeup ) )
+		  || ( thrd_success != cnd_init( &rings[r]->room ) ) )
+			log_critical( "Unable to initialize the %s queue locks!", r ? "file" : "directory" );
+	}
+}
 
 
-/* We need to know both queues head and tail */
-static in_queue_t* dir_in_head  = NULL;
-static in_queue_t* dir_in_tail  = NULL;
-static in_queue_t* file_in_head = NULL;
-static in_queue_t* file_in_tail = NULL;
+/// @internal Number of inodes of @a ring spilled to disk, only the file ring spills
+static uint64_t in_spilled( in_ring_t* ring ) {
+	return ring == &file_ring ? spill_count() : 0;
+}
 
 
-/// @brief internal in_queue_t creator. Returns -1 on calloc failure.
-static int create_in_elem( in_queue_t** elem, xfs_in_t* in ) {
-	in_queue_t* new_elem = calloc( 1, sizeof( struct _in_queue ) );
+/// @internal Number of elements in a ring, its overflow list and on disk, might be off by the pushes in flight
+static uint64_t in_depth( in_ring_t* ring ) {
+	size_t head = atomic_load( &ring->head );
+	size_t tail = atomic_load( &ring->tail );
 
-	if ( new_elem ) {
-		new_elem->in = in;
-		*elem = new_elem;
-		return 0;
+	return ( head > tail ? head - tail : 0 ) + atomic_load( &ring->ovf_cnt ) + in_spilled( ring );
+}
+
+
+/// @internal Absolute TIME_UTC point @a ms milliseconds from now, for cnd_timedwait()
+static struct timespec in_deadline( uint32_t ms ) {
+	struct timespec until;
+
+	timespec_get( &until, TIME_UTC );
+	until.tv_sec  += ms / 1000;
+	until.tv_nsec += ( ms % 1000 ) * 1000000L;
+	if ( until.tv_nsec >= 1000000000L ) {
+		until.tv_sec  += 1;
+		until.tv_nsec -= 1000000000L;
 	}
 
-	log_critical( "Unable to allocate %zu bytes for in_queue_t element!", sizeof( struct _in_queue ) );
-	return -1;
+	return until;
 }
 
 
-void in_clear( void ) {
-	xfs_in_t* elem = NULL;
+/** @internal Block a producer until the ring is down to the low watermark
+  *
+  * If no consumer pops anything for IN_STALL_MS, the wait is given up and
+  * the ring is marked as stalled, so nobody waits again before the next pop.
+  * Otherwise a placeholder analyzer or writer would hang the scan forever.
+**/
+static void in_wait_room( in_ring_t* ring ) {
+	uint64_t stalled = atomic_load( &ring->stalled );
+	uint64_t pops    = atomic_load( &ring->pops );
+
+	if ( stalled && ( ( stalled - 1 ) == pops ) )
+		return;
+
+	uint64_t start     = stat_now_ns();
+	uint64_t last_seen = start;
+
+	stat_lock( &ring->stat, &ring->lock );
+	atomic_fetch_add( &ring->blocked, 1 );
+	while ( atomic_load( &in_high ) && ( in_depth( ring ) > atomic_load( &in_low ) ) ) {
+		struct timespec until = in_deadline( IN_WAIT_MS );
+		cnd_timedwait( &ring->room, &ring->lock, &until );
+
+		uint64_t now = stat_now_ns();
+		if ( pops != atomic_load( &ring->pops ) ) {
+			pops      = atomic_load( &ring->pops );
+			last_seen = now;
+		} else if ( ( now - last_seen ) > ( IN_STALL_MS * 1000000ULL ) ) {
+			if ( 0 == atomic_exchange( &ring->stalled, pops + 1 ) )
+				log_warning( "Nothing consumes the %s queue, letting it grow past %lu",
+				             ring == &dir_ring ? "directory" : "file", atomic_load( &in_high ) );
+			break;
+		}
+	}
+	atomic_fetch_sub( &ring->blocked, 1 );
+	mtx_unlock( &ring->lock );
 
-	// Directory queue
-	do {
-		elem = dir_in_pop();
-		xfs_free_in( &elem );
-	} while ( elem );
+	atomic_fetch_add( &ring->blk_ns, stat_now_ns() - start );
+	atomic_fetch_add( &ring->blk_cnt, 1 );
+}
 
-	// File queue
-	do {
-		elem = file_in_pop();
-		xfs_free_in( &elem );
-	} while ( elem );
+
+/// @internal Count @a count pops, and let blocked producers go on at the low watermark
+static void in_popped( in_ring_t* ring, size_t count ) {
+	atomic_fetch_add( &ring->pops, count );
+
+	if ( atomic_load( &ring->blocked ) && ( in_depth( ring ) <= atomic_load( &in_low ) ) ) {
+		stat_lock( &ring->stat, &ring->lock );
+		cnd_broadcast( &ring->room );
+		mtx_unlock( &ring->lock );
+	}
 }
 
 
-xfs_in_t* dir_in_pop( void ) {
-	in_queue_t* elem   = NULL;
-	xfs_in_t*   result = NULL;
+/** @internal Push up to @a count inodes into the ring, returns how many fit
+  *
+  * One CAS claims the whole run of slots. The last slot being free means
+  * all consumers of the previous lap have claimed theirs, so a slot before
+  * it that is still in use is freed within a few instructions.
+**/
+static size_t ring_push( in_ring_t* ring, xfs_in_t** ins, size_t count ) {
+	size_t pos = atomic_load_explicit( &ring->head, memory_order_relaxed );
+
+	for ( ;; ) {
+		size_t tail = atomic_load_explicit( &ring->tail, memory_order_acquire );
+
+		if ( tail > pos ) {
+			// pos is outdated
+			pos = atomic_load_explicit( &ring->head, memory_order_relaxed );
+			continue;
+		}
+
+		size_t n = IN_RING_SIZE - ( pos - tail );
+		if ( n > count )
+			n = count;
+		if ( 0 == n )
+			return 0;
+
+		in_slot_t* last = &ring->slots[( pos + n - 1 ) & IN_RING_MASK];
+		size_t     seq  = atomic_load_explicit( &last->seq, memory_order_acquire );
+		intptr_t   dif  = ( intptr_t )seq - ( intptr_t )( pos + n - 1 );
+
+		if ( 0 == dif ) {
+			if ( atomic_compare_exchange_weak_explicit( &ring->head, &pos, pos + n,
+			                                            memory_order_relaxed, memory_order_relaxed ) ) {
+				count = n;
+				break;
+			}
+		} else if ( dif < 0 ) {
+			// The last slot is still filled from the last lap, try a shorter run
+			if ( 1 == n )
+				return 0;
+			count = n / 2;
+		} else
+			pos = atomic_load_explicit( &ring->head, memory_order_relaxed );
+	}
+
+	for ( size_t i = 0; i < count; ++i ) {
+		in_slot_t* slot = &ring->slots[( pos + i ) & IN_RING_MASK];
 
-	mtx_lock( &dir_queue_lock );
-	if ( dir_in_head ) {
-		elem        = dir_in_head;
-		dir_in_head = elem->next;
-		if ( NULL == dir_in_head )
-			// Was last element
-			dir_in_tail = NULL;
+		while ( atomic_load_explicit( &slot->seq, memory_order_acquire ) != ( pos + i ) )
+			thrd_yield();
+		slot->in = ins[i];
+		atomic_store_explicit( &slot->seq, pos + i + 1, memory_order_release );
+		ins[i] = NULL;
 	}
-	mtx_unlock( &dir_queue_lock );
 
-	if ( elem ) {
-		result = TAKE_PTR( elem->in );
-		RELEASE( elem );
-		FREE_PTR( elem );
+	return count;
+}
+
+
+/** @internal Pop up to @a max_cnt inodes from the ring, returns how many were taken
+  *
+  * Like ring_push(), one CAS claims the whole run, and slots before the
+  * last filled one are waited for if their producer is not done, yet.
+**/
+static size_t ring_pop( in_ring_t* ring, xfs_in_t** out, size_t max_cnt ) {
+	size_t pos = atomic_load_explicit( &ring->tail, memory_order_relaxed );
+
+	for ( ;; ) {
+		size_t head = atomic_load_explicit( &ring->head, memory_order_acquire );
+
+		if ( head <= pos )
+			return 0;
+
+		size_t n = head - pos;
+		if ( n > max_cnt )
+			n = max_cnt;
+
+		in_slot_t* last = &ring->slots[( pos + n - 1 ) & IN_RING_MASK];
+		size_t     seq  = atomic_load_explicit( &last->seq, memory_order_acquire );
+		intptr_t   dif  = ( intptr_t )seq - ( intptr_t )( pos + n );
+
+		if ( 0 == dif ) {
+			if ( atomic_compare_exchange_weak_explicit( &ring->tail, &pos, pos + n,
+			                                            memory_order_relaxed, memory_order_relaxed ) ) {
+				max_cnt = n;
+				break;
+			}
+		} else if ( dif < 0 ) {
+			// Not filled, yet, try a shorter run
+			if ( 1 == n )
+				return 0;
+			max_cnt = n / 2;
+		} else
+			pos = atomic_load_explicit( &ring->tail, memory_order_relaxed );
 	}
 
-	return result;
+	for ( size_t i = 0; i < max_cnt; ++i ) {
+		in_slot_t* slot = &ring->slots[( pos + i ) & IN_RING_MASK];
+
+		while ( atomic_load_explicit( &slot->seq, memory_order_acquire ) != ( pos + i + 1 ) )
+			thrd_yield();
+		out[i] = slot->in;
+		atomic_store_explicit( &slot->seq, pos + i + IN_RING_SIZE, memory_order_release );
+	}
+
+	return max_cnt;
 }
 
 
-int dir_in_push( xfs_in_t* in ) {
-	RETURN_INT_IF_NULL( in );
+/// @internal Pop up to @a max_cnt from the ring, then the overflow list, then the disk, returns how many
+static size_t in_pop( in_ring_t* ring, xfs_in_t** out, size_t max_cnt ) {
+	call_once( &in_once, in_init );
 
-	in_queue_t* elem = NULL;
+	size_t cnt = 0;
 
-	if ( -1 == create_in_elem( &elem, in ) )
-		return -1;
+	while ( cnt < max_cnt ) {
+		size_t n = ring_pop( ring, out + cnt, ( max_cnt - cnt ) > IN_BATCH_MAX ? IN_BATCH_MAX : max_cnt - cnt );
+		if ( 0 == n )
+			break;
+		cnt += n;
+	}
 
-	mtx_lock( &dir_queue_lock );
-	if ( dir_in_tail ) {
-		dir_in_tail->next = elem;
-		elem->prev        = dir_in_tail;
-		dir_in_tail       = elem;
-	} else {
-		// First element
-		dir_in_head = elem;
-		dir_in_tail = elem;
+	if ( ( cnt < max_cnt ) && atomic_load( &ring->ovf_cnt ) ) {
+		in_queue_t* elem = NULL;
+
+		stat_lock( &ring->stat, &ring->lock );
+		while ( ( cnt < max_cnt ) && ring->ovf_head ) {
+			elem           = ring->ovf_head;
+			ring->ovf_head = elem->next;
+			if ( NULL == ring->ovf_head )
+				// Was last element
+				ring->ovf_tail = NULL;
+			atomic_fetch_sub( &ring->ovf_cnt, 1 );
+			out[cnt++] = TAKE_PTR( elem->in );
+			RELEASE( elem );
+			FREE_PTR( elem );
+		}
+		mtx_unlock( &ring->lock );
 	}
-	mtx_unlock( &dir_queue_lock );
 
-	return 0;
+	while ( ( cnt < max_cnt ) && in_spilled( ring ) ) {
+		xfs_in_t* in = spill_read();
+		if ( NULL == in )
+			break;
+		out[cnt++] = in;
+	}
+
+	if ( cnt )
+		in_popped( ring, cnt );
+
+	return cnt;
 }
 
 
-xfs_in_t* file_in_pop( void ) {
-	in_queue_t* elem   = NULL;
-	xfs_in_t*   result = NULL;
+/// @internal Pop up to @a max_cnt, and if the queue is empty, wait up to @a timeout_ms for a push
+static size_t in_pop_wait( in_ring_t* ring, xfs_in_t** out, size_t max_cnt, uint32_t timeout_ms ) {
+	size_t result = 0;
 
-	mtx_lock( &file_queue_lock );
-	if ( file_in_head ) {
-		elem         = file_in_head;
-		file_in_head = elem->next;
-		if ( NULL == file_in_head )
-			// Was last element
-			file_in_tail = NULL;
+	// Elements usually come in bursts, so a short spin saves the sleep
+	for ( int i = 0; ( 0 == result ) && ( i < IN_SPIN_TRIES ); ++i ) {
+		result = in_pop( ring, out, max_cnt );
+		if ( 0 == result )
+			thrd_yield();
 	}
-	mtx_unlock( &file_queue_lock );
+	if ( result || ( 0 == timeout_ms ) )
+		return result;
+
+	struct timespec until = in_deadline( timeout_ms );
 
-	if ( elem ) {
-		result = TAKE_PTR( elem->in );
-		RELEASE( elem );
-		FREE_PTR( elem );
+	// Announce the sleep before looking again, so a pusher either is seen or sees us.
+	atomic_fetch_add( &ring->sleepers, 1 );
+
+	while ( 0 == ( result = in_pop( ring, out, max_cnt ) ) ) {
+		int r = thrd_success;
+
+		// Look under the lock, so a push can not signal between the look and the wait.
+		stat_lock( &ring->stat, &ring->lock );
+		if ( ( atomic_load( &ring->head ) == atomic_load( &ring->tail ) )
+		  && ( 0 == atomic_load( &ring->ovf_cnt ) )
+		  && ( 0 == in_spilled( ring ) ) )
+			r = cnd_timedwait( &ring->wakeup, &ring->lock, &until );
+		mtx_unlock( &ring->lock );
+
+		if ( thrd_success != r ) {
+			result = in_pop( ring, out, max_cnt );
+			break;
+		}
 	}
 
+	atomic_fetch_sub( &ring->sleepers, 1 );
+
 	return result;
 }
 
 
-int file_in_push( xfs_in_t* in ) {
-	RETURN_INT_IF_NULL( in );
+/// @internal Append inodes to the overflow list under one lock, returns -1 if out of memory
+static int ovf_push( in_ring_t* ring, xfs_in_t** ins, size_t count ) {
+	in_queue_t* head = NULL;
+	in_queue_t* tail = NULL;
+	size_t      cnt  = 0;
+
+	// Build the chain outside the lock
+	for ( size_t i = 0; i < count; ++i ) {
+		if ( NULL == ins[i] )
+			continue;
+
+		in_queue_t* elem = calloc( 1, sizeof( struct _in_queue ) );
+		if ( NULL == elem ) {
+			log_critical( "Unable to allocate %zu bytes for in_queue_t element!", sizeof( struct _in_queue ) );
+			// Hand the inodes back, the caller still owns them
+			while ( head ) {
+				elem = head->next;
+				FREE_PTR( head );
+				head = elem;
+			}
+			return -1;
+		}
+		elem->in = ins[i];
+		elem->prev = tail;
+		if ( tail )
+			tail->next = elem;
+		else
+			head = elem;
+		tail = elem;
+		++cnt;
+	}
 
-	in_queue_t* elem = NULL;
+	if ( 0 == cnt )
+		return 0;
+
+	// Nothing can fail now, so the inodes are handed over
+	for ( size_t i = 0; i < count; ++i )
+		ins[i] = NULL;
+
+	stat_lock( &ring->stat, &ring->lock );
+	if ( ring->ovf_tail ) {
+		ring->ovf_tail->next = head;
+		head->prev           = ring->ovf_tail;
+	} else
+		// First elements
+		ring->ovf_head = head;
+	ring->ovf_tail = tail;
+	atomic_fetch_add( &ring->ovf_cnt, cnt );
+	mtx_unlock( &ring->lock );
+
+	return 0;
+}
 
-	if ( -1 == create_in_elem( &elem, in ) )
-		return -1;
 
-	mtx_lock( &file_queue_lock );
-	if ( file_in_tail ) {
-		file_in_tail->next = elem;
-		elem->prev        = file_in_tail;
-		file_in_tail       = elem;
-	} else {
-		// First element
-		file_in_head = elem;
-		file_in_tail = elem;
+/** @internal Push inodes into the ring, to disk, or the overflow list if the ring is full
+  *
+  * The watermark is looked at once per IN_BATCH_MAX inodes, and sleepers
+  * are woken once per call. Pushed inodes are set to NULL in @a ins, so
+  * on error the caller knows which ones it still owns.
+**/
+static int in_push( in_ring_t* ring, xfs_in_t** ins, size_t count ) {
+	call_once( &in_once, in_init );
+
+	bool can_spill = ( ring == &file_ring ) && spill_is_open();
+	int  res       = 0;
+
+	for ( size_t done = 0; ( 0 == res ) && ( done < count ); done += IN_BATCH_MAX ) {
+		xfs_in_t** batch   = ins + done;
+		size_t     cnt     = ( count - done ) > IN_BATCH_MAX ? IN_BATCH_MAX : count - done;
+		uint64_t   depth   = in_depth( ring ) + cnt;
+		uint64_t   high    = atomic_load( &in_high );
+		bool       is_high = high && ( depth > high );
+		size_t     first   = 0;
+
+		stat_depth( &ring->stat, depth );
+
+		// Spilling keeps the memory bounded without blocking the scanners
+		if ( can_spill && is_high ) {
+			for ( size_t i = 0; i < cnt; ++i ) {
+				if ( batch[i] )
+					spill_write( &batch[i] );
+			}
+		}
+
+		// Skip what went to disk already
+		while ( ( first < cnt ) && ( NULL == batch[first] ) )
+			++first;
+		if ( first == cnt )
+			continue;
+
+		if ( is_high )
+			in_wait_room( ring );
+
+		first += ring_push( ring, batch + first, cnt - first );
+
+		for ( size_t i = first; can_spill && ( i < cnt ); ++i ) {
+			if ( batch[i] )
+				spill_write( &batch[i] );
+		}
+
+		res = ovf_push( ring, batch + first, cnt - first );
 	}
-	mtx_unlock( &file_queue_lock );
 
-	return 0;
+	// Only take the lock if somebody sleeps. The fence pairs with the sleeper's announcement.
+	atomic_thread_fence( memory_order_seq_cst );
+	if ( atomic_load( &ring->sleepers ) ) {
+		stat_lock( &ring->stat, &ring->lock );
+		if ( count > 1 )
+			cnd_broadcast( &ring->wakeup );
+		else
+			cnd_signal( &ring->wakeup );
+		mtx_unlock( &ring->lock );
+	}
+
+	return res;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void in_get_stats( in_stats_t* stats ) {
+	RETURN_VOID_IF_NULL( stats );
+	call_once( &in_once, in_init );
+
+	stats->dir_depth   = in_depth( &dir_ring );
+	stats->file_depth  = in_depth( &file_ring );
+	stats->blocked_cnt = atomic_load( &dir_ring.blk_cnt ) + atomic_load( &file_ring.blk_cnt );
+	stats->blocked_ms  = ( atomic_load( &dir_ring.blk_ns ) + atomic_load( &file_ring.blk_ns ) ) / 1000000ULL;
+	stats->spilled     = spill_count();
+}
+
+
+void in_set_watermarks( uint64_t high, uint64_t low ) {
+	call_once( &in_once, in_init );
+
+	atomic_store( &in_low,  low < high ? low : ( high - ( high / 4 ) ) );
+	atomic_store( &in_high, high );
+
+	// Whoever waits has to look again
+	in_ring_t* rings[2] = { &dir_ring, &file_ring };
+	for ( int r = 0; r < 2; ++r ) {
+		stat_lock( &rings[r]->stat, &rings[r]->lock );
+		cnd_broadcast( &rings[r]->room );
+		mtx_unlock( &rings[r]->lock );
+	}
+}
+
+
+void in_clear( void ) {
+	xfs_in_t* elem = NULL;
+
+	// Directory queue
+	while ( NULL != ( elem = dir_in_pop() ) )
+		xfs_free_in( &elem );
+
+	// File queue
+	while ( NULL != ( elem = file_in_pop() ) )
+		xfs_free_in( &elem );
+}
+
+
+xfs_in_t* dir_in_pop( void ) {
+	xfs_in_t* in = NULL;
+	in_pop( &dir_ring, &in, 1 );
+	return in;
+}
+
+
+size_t dir_in_pop_batch( xfs_in_t** out, size_t max_cnt, uint32_t timeout_ms ) {
+	RETURN_ZERO_IF_NULL( out );
+	return in_pop_wait( &dir_ring, out, max_cnt, timeout_ms );
+}
+
+
+int dir_in_push( xfs_in_t* in ) {
+	RETURN_INT_IF_NULL( in );
+	return in_push( &dir_ring, &in, 1 );
+}
+
+
+int dir_in_push_batch( xfs_in_t** ins, size_t count ) {
+	RETURN_INT_IF_NULL( ins );
+	return in_push( &dir_ring, ins, count );
+}
+
+
+xfs_in_t* file_in_pop( void ) {
+	xfs_in_t* in = NULL;
+	in_pop( &file_ring, &in, 1 );
+	return in;
 }
 
+
+size_t file_in_pop_batch( xfs_in_t** out, size_t max_cnt, uint32_t timeout_ms ) {
+	RETURN_ZERO_IF_NULL( out );
+	return in_pop_wait( &file_ring, out, max_cnt, timeout_ms );
+}
+
+
+int file_in_push( xfs_in_t* in ) {
+	RETURN_INT_IF_NULL( in );
+	return in_push( &file_ring, &in, 1 );
+}
+
+
+int file_in_push_batch( xfs_in_t** ins, size_t count ) {
+	RETURN_INT_IF_NULL( ins );
+	return in_push( &file_ring, ins, count );
+}
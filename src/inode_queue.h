@@ -6,6 +6,22 @@
 #include "inode.h"
 
 
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* There are two queues, one for directory inodes and one for file inodes.
+ * Both are lock-free multi-producer multi-consumer rings of IN_RING_SIZE
+ * slots. A push to a full ring goes to an overflow list instead, which
+ * consumers only visit once the ring is empty. So the order is only FIFO
+ * until a ring overflows.
+ */
+
+
+/// Largest run of inodes moved with one synchronization, bigger batches are split
+#define IN_BATCH_MAX 256
+
+
 /** @brief clear the queue
   *
   * All elements are cleared and freed!
@@ -13,6 +29,39 @@
 void in_clear( void );
 
 
+/// @brief Depth and backpressure figures of both queues
+typedef struct _in_stats {
+	uint64_t blocked_cnt; //!< Number of times a producer had to wait for room
+	uint64_t blocked_ms;  //!< Milliseconds producers spent waiting for room
+	uint64_t dir_depth;   //!< Elements in the directory queue
+	uint64_t file_depth;  //!< Elements in the file queue, including those spilled
+	uint64_t spilled;     //!< Elements of the file queue spilled to disk
+} in_stats_t;
+
+
+/** @brief get the depth and backpressure figures of both queues
+  * @param[out] stats  Receives the figures
+**/
+void in_get_stats( in_stats_t* stats );
+
+
+/** @brief set the watermarks both queues are held between
+  *
+  * A push onto a queue holding @a high or more elements blocks until
+  * consumers have brought it down to @a low. If nothing is popped for a
+  * few seconds, the producer gives up waiting and the queue grows, until
+  * the next pop shows that consumers are alive again. If spilling is set
+  * up, file inodes go to disk instead of blocking.
+  *
+  * Setting @a high to 0 turns backpressure off and releases all waiting
+  * producers.
+  *
+  * @param[in] high  Depth at which producers block, 0 for no limit
+  * @param[in] low   Depth at which they go on; if not below @a high, 3/4 of @a high
+**/
+void in_set_watermarks( uint64_t high, uint64_t low );
+
+
 /** @brief pop an element from the directory inode queue (aka remove head)
   *
   * Note: This also removes the element from the queue.
@@ -22,6 +71,22 @@ void in_clear( void );
 xfs_in_t* dir_in_pop( void );
 
 
+/** @brief pop up to @a max_cnt elements from the directory inode queue at once
+  *
+  * Runs of up to IN_BATCH_MAX elements are claimed from the ring with one
+  * atomic operation. If the queue is empty, the caller spins a little, then
+  * sleeps until an element is pushed or @a timeout_ms has passed. Consumers
+  * should use a short timeout and check whether they are told to stop in
+  * between.
+  *
+  * @param[out] out         Receives the popped elements
+  * @param[in]  max_cnt     Room in @a out
+  * @param[in]  timeout_ms  Milliseconds to wait at most, 0 to only spin
+  * @return The number of elements written into @a out
+**/
+size_t dir_in_pop_batch( xfs_in_t** out, size_t max_cnt, uint32_t timeout_ms );
+
+
 /** @brief push an element onto the directory inode queue (aka push_back)
   * @param[in] Pointer to the element to push
   * return 0 on success, -1 if the new queue element could not be created.
@@ -29,6 +94,20 @@ xfs_in_t* dir_in_pop( void );
 int dir_in_push( xfs_in_t* in );
 
 
+/** @brief push several elements onto the directory inode queue at once
+  *
+  * Runs of up to IN_BATCH_MAX elements are pushed with one atomic operation,
+  * one look at the watermarks and at most one wakeup of sleeping consumers.
+  * Every element that was pushed is set to NULL in @a ins, so on error the
+  * caller still owns the ones left.
+  *
+  * @param[in,out] ins    The elements to push
+  * @param[in]     count  Number of elements in @a ins
+  * @return 0 on success, -1 if a new queue element could not be created.
+**/
+int dir_in_push_batch( xfs_in_t** ins, size_t count );
+
+
 /** @brief pop an element from the file inode queue (aka remove head)
   *
   * Note: This also removes the element from the queue.
@@ -38,6 +117,18 @@ int dir_in_push( xfs_in_t* in );
 xfs_in_t* file_in_pop( void );
 
 
+/** @brief pop up to @a max_cnt elements from the file inode queue at once
+  *
+  * See dir_in_pop_batch().
+  *
+  * @param[out] out         Receives the popped elements
+  * @param[in]  max_cnt     Room in @a out
+  * @param[in]  timeout_ms  Milliseconds to wait at most, 0 to only spin
+  * @return The number of elements written into @a out
+**/
+size_t file_in_pop_batch( xfs_in_t** out, size_t max_cnt, uint32_t timeout_ms );
+
+
 /** @brief push an element onto the file inode queue (aka push_back)
   * @param[in] Pointer to the element to push
   * return 0 on success, -1 if the new queue element could not be created.
@@ -45,4 +136,15 @@ xfs_in_t* file_in_pop( void );
 int file_in_push( xfs_in_t* in );
 
 
+/** @brief push several elements onto the file inode queue at once
+  *
+  * See dir_in_push_batch().
+  *
+  * @param[in,out] ins    The elements to push
+  * @param[in]     count  Number of elements in @a ins
+  * @return 0 on success, -1 if a new queue element could not be created.
+**/
+int file_in_push_batch( xfs_in_t** ins, size_t count );
+
+
 #endif // PWX_XFS_UNDELETE_SRC_INODE_QUEUE_H_INCLUDED
@@ -0,0 +1,729 @@
+/*******************************************************************************
+ * journal.c : Scanner for the XFS log, recovering logged inode images
+ ******************************************************************************/
+
+
+#include "backend.h"
+#include "catalog.h"
+#include "device.h"
+#include "file_type.h"
+#include "filter.h"
+#include "forensics.h"
+#include "globals.h"
+#include "inode.h"
+#include "inode_queue.h"
+#include "journal.h"
+#include "log.h"
+#include "topk.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Geometry of the log
+#define LOG_BB_SIZE     512                                // Records are aligned to basic blocks
+#define LOG_CYCLE_SIZE  32768                              // Bytes covered by one record header
+#define LOG_CYCLE_BBS   ( LOG_CYCLE_SIZE / LOG_BB_SIZE )   // Cycle data entries per record header
+#define LOG_MAX_RECORD  262144                             // Largest possible record data size
+#define LOG_WINDOW      ( 4 * LOG_MAX_RECORD )             // Bytes read from the log at once
+
+// Magic values
+#define LOG_HEADER_MAGIC 0xfeedbabe
+#define LOG_LI_INODE     0x123b
+#define LOG_LI_BUF       0x123c
+
+// Log operation header flags telling that a region is split over two records
+#define LOG_OP_CONTINUE  0x04
+#define LOG_OP_WAS_CONT  0x08
+
+// Sizes of the logged inode core, shorter than the on-disk core of v1/v2 inodes
+#define LOG_CORE_V2      96
+#define LOG_CORE_V3      176
+
+// Which parts of an inode are logged in an inode log item
+#define LOG_ILOG_CORE    0x001
+#define LOG_ILOG_DDATA   0x002
+#define LOG_ILOG_DEXT    0x004
+#define LOG_ILOG_DBROOT  0x008
+#define LOG_ILOG_ADATA   0x040
+#define LOG_ILOG_AEXT    0x080
+#define LOG_ILOG_ABROOT  0x100
+#define LOG_ILOG_DFORK   ( LOG_ILOG_DDATA | LOG_ILOG_DEXT | LOG_ILOG_DBROOT )
+#define LOG_ILOG_AFORK   ( LOG_ILOG_ADATA | LOG_ILOG_AEXT | LOG_ILOG_ABROOT )
+
+
+/// @brief One field of a logged inode core. These are stored in the byte order of the logging host.
+typedef struct _log_core_field {
+	uint8_t offset; //!< Offset of the field inside the core
+	uint8_t length; //!< Length of the field; 2, 4 and 8 byte fields are swapped if needed
+} log_core_field_t;
+
+
+/// @brief The layout of the logged core is the same as the on-disk core, see xfs_in_t
+static log_core_field_t const core_fields[] = {
+	{   0,  2 }, {   2,  2 }, {   4,  1 }, {   5,  1 }, {   6,  2 }, {   8,  4 }, {  12,  4 },
+	{  16,  4 }, {  20,  2 }, {  22,  2 }, {  24,  6 }, {  30,  2 }, {  32,  4 }, {  36,  4 },
+	{  40,  4 }, {  44,  4 }, {  48,  4 }, {  52,  4 }, {  56,  8 }, {  64,  8 }, {  72,  4 },
+	{  76,  4 }, {  80,  2 }, {  82,  1 }, {  83,  1 }, {  84,  4 }, {  88,  2 }, {  90,  2 },
+	{  92,  4 }, {  96,  4 }, { 100,  4 }, { 104,  8 }, { 112,  8 }, { 120,  8 }, { 128,  4 },
+	{ 132, 12 }, { 144,  4 }, { 148,  4 }, { 152,  8 }, { 160, 16 }
+};
+#define CORE_FIELD_COUNT ( sizeof( core_fields ) / sizeof( core_fields[0] ) )
+
+
+/// @brief A rebuilt inode image, waiting for the log scan to finish
+typedef struct _log_image {
+	uint64_t ino;      //!< Inode number as noted in the log item. 0 marks an empty slot.
+	uint64_t lsn;      //!< LSN of the record the image was found in
+	uint64_t position; //!< Absolute byte position of the inode on the source device
+	bool     is_live;  //!< True if the logged core still had a file mode
+	uint8_t* image;    //!< The rebuilt on-disk inode image (inode_size bytes)
+} log_image_t;
+
+
+/// @brief The directory a logged directory block belongs to
+typedef struct _log_owner {
+	uint64_t ino; //!< Inode number of the directory, from the block header
+	uint64_t lsn; //!< LSN of the record the block was found in
+} log_owner_t;
+
+
+/// @brief The state of the scan, so the helpers do not need a dozen arguments
+typedef struct _log_scan {
+	uint64_t     dir_blocks;  //!< Number of logged directory blocks found
+	uint64_t     img_count;   //!< Number of used slots in `images`
+	uint64_t     img_size;    //!< Number of slots in `images` (always a power of 2)
+	log_image_t* images;      //!< Open addressing hash table of rebuilt images
+	uint64_t     inode_items; //!< Number of complete inode log items found
+	uint16_t     inode_size;  //!< Size of one inode on the source device
+	uint64_t     own_count;   //!< Number of used slots in `owners`
+	uint64_t     own_size;    //!< Number of slots in `owners`
+	log_owner_t* owners;      //!< Owners of logged directory blocks, unsorted and with duplicates
+	uint64_t     records;     //!< Number of valid log records found
+} log_scan_t;
+
+
+/// @brief A log item whose regions are still being collected
+typedef struct _log_item {
+	uint8_t const* format;     //!< The format structure that started the item
+	uint32_t       format_len; //!< Length of the format structure
+	uint16_t       type;       //!< LOG_LI_INODE or LOG_LI_BUF
+	uint32_t       wanted;     //!< Number of regions following the format structure
+	uint32_t       found;      //!< Number of regions collected so far
+	uint8_t const* region[3];  //!< The first three regions are all we need
+	uint32_t       reg_len[3]; //!< Lengths of the collected regions
+} log_item_t;
+
+
+// Values in log item format structures are stored in the byte order of the logging host.
+static uint16_t get_log16( uint8_t const* buf, size_t off, bool is_be ) {
+	uint16_t v;
+	memcpy( &v, buf + off, 2 );
+	return is_be ? flip16( v ) : v;
+}
+static uint32_t get_log32( uint8_t const* buf, size_t off, bool is_be ) {
+	uint32_t v;
+	memcpy( &v, buf + off, 4 );
+	return is_be ? flip32( v ) : v;
+}
+static uint64_t get_log64( uint8_t const* buf, size_t off, bool is_be ) {
+	uint64_t v;
+	memcpy( &v, buf + off, 8 );
+	return is_be ? flip64( v ) : v;
+}
+
+
+/// @internal Copy @a len bytes from @a src to @a dst, reversing their order if @a swap is true
+static void copy_field( uint8_t* dst, uint8_t const* src, size_t len, bool swap ) {
+	for ( size_t i = 0; i < len; ++i )
+		dst[i] = swap ? src[len - 1 - i] : src[i];
+}
+
+
+/// @internal Insert @a img into the table, or replace the one there if @a img is more useful
+static int store_image( log_scan_t* scan, log_image_t* img ) {
+	// Grow the table at a load factor of 50%
+	if ( ( scan->img_count + 1 ) * 2 > scan->img_size ) {
+		uint64_t     new_size   = scan->img_size ? scan->img_size * 2 : 1024;
+		log_image_t* new_images = calloc( new_size, sizeof( log_image_t ) );
+		if ( NULL == new_images ) {
+			log_critical( "Unable to allocate %zu bytes for log image table: %m [%d]",
+			              new_size * sizeof( log_image_t ), errno );
+			return -1;
+		}
+		for ( uint64_t i = 0; i < scan->img_size; ++i ) {
+			if ( 0 == scan->images[i].ino )
+				continue;
+			uint64_t j = scan->images[i].ino & ( new_size - 1 );
+			while ( new_images[j].ino )
+				j = ( j + 1 ) & ( new_size - 1 );
+			new_images[j] = scan->images[i];
+		}
+		FREE_PTR( scan->images );
+		scan->images   = new_images;
+		scan->img_size = new_size;
+	}
+
+	uint64_t j = img->ino & ( scan->img_size - 1 );
+	while ( scan->images[j].ino && ( scan->images[j].ino != img->ino ) )
+		j = ( j + 1 ) & ( scan->img_size - 1 );
+
+	log_image_t* old = &scan->images[j];
+
+	if ( 0 == old->ino ) {
+		*old = *img;
+		img->image = NULL;
+		scan->img_count++;
+		return 0;
+	}
+
+	/* Live images carry the full data fork, which is worth more than a newer
+	 * image of an inode that has already been freed. */
+	if ( ( img->is_live && !old->is_live )
+	  || ( ( img->is_live == old->is_live ) && ( img->lsn > old->lsn ) ) ) {
+		FREE_PTR( old->image );
+		*old = *img;
+		img->image = NULL;
+	} else {
+		FREE_PTR( img->image );
+	}
+
+	return 0;
+}
+
+
+/// @internal Rebuild the on-disk image of an inode log item and store it
+static int handle_inode_item( log_scan_t* scan, log_item_t* item, uint64_t lsn ) {
+	uint8_t const* fmt   = item->format;
+	bool           is_be = LOG_LI_INODE != get_log16( fmt, 0, false );
+
+	uint32_t fields = get_log32( fmt, 4, is_be );
+	uint16_t asize  = get_log16( fmt, 8, is_be );
+	uint16_t dsize  = get_log16( fmt, 10, is_be );
+	uint64_t ino;
+	int64_t  blkno;
+	int32_t  boffset;
+
+	if ( !( fields & LOG_ILOG_CORE ) )
+		// Without the core there is nothing to rebuild
+		return 0;
+
+	// There are two variants of the format structure, with and without padding before ilf_ino
+	if ( item->format_len >= 56 ) {
+		ino     = get_log64( fmt, 16, is_be );
+		blkno   = ( int64_t )get_log64( fmt, 40, is_be );
+		boffset = ( int32_t )get_log32( fmt, 52, is_be );
+	} else if ( item->format_len >= 52 ) {
+		ino     = get_log64( fmt, 12, is_be );
+		blkno   = ( int64_t )get_log64( fmt, 36, is_be );
+		boffset = ( int32_t )get_log32( fmt, 48, is_be );
+	} else
+		return 0;
+
+	uint64_t position = ( uint64_t )blkno * LOG_BB_SIZE + ( uint64_t )boffset;
+	if ( ( 0 == ino ) || ( blkno < 0 ) || ( boffset < 0 ) || ( position >= full_disk_size ) )
+		return 0;
+
+	// The core has its own byte order marker: the magic
+	uint8_t const* core     = item->region[0];
+	uint32_t       core_len = item->reg_len[0];
+	bool           core_be;
+
+	if ( core_len < 5 )
+		return 0;
+	if ( ( XFS_IN_MAGIC[0] == core[0] ) && ( XFS_IN_MAGIC[1] == core[1] ) )
+		core_be = true;
+	else if ( ( XFS_IN_MAGIC[1] == core[0] ) && ( XFS_IN_MAGIC[0] == core[1] ) )
+		core_be = false;
+	else
+		return 0;
+
+	// The logged v1/v2 core stops before di_next_unlinked, the missing bytes stay zero
+	size_t start = core[4] > 2 ? DATA_START_V3 : DATA_START_V1;
+	if ( ( core_len < ( core[4] > 2 ? LOG_CORE_V3 : LOG_CORE_V2 ) ) || ( start >= scan->inode_size ) )
+		return 0;
+
+	log_image_t img = { .ino = ino, .lsn = lsn, .position = position };
+	img.image = calloc( scan->inode_size, 1 );
+	if ( NULL == img.image ) {
+		log_critical( "Unable to allocate %hu bytes for inode image: %m [%d]", scan->inode_size, errno );
+		return -1;
+	}
+
+	// Copy the core into on-disk (big endian) byte order
+	for ( size_t i = 0; i < CORE_FIELD_COUNT; ++i ) {
+		log_core_field_t const* f = &core_fields[i];
+		if ( ( ( size_t )( f->offset + f->length ) > start ) || ( ( size_t )( f->offset + f->length ) > core_len ) )
+			break;
+		copy_field( img.image + f->offset, core + f->offset, f->length,
+		            !core_be && ( 2 == f->length || 4 == f->length || 8 == f->length ) );
+	}
+
+	/* The forks are logged in their on-disk format already. The only exception
+	 * are B+Tree roots, which are logged in their in-memory format. Those are
+	 * left out, as the image would be misleading. */
+	uint32_t next_reg = 1;
+	uint8_t  forkoff  = img.image[82];
+	size_t   d_end    = forkoff ? start + ( forkoff * 8 ) : scan->inode_size;
+
+	if ( d_end > scan->inode_size )
+		d_end = scan->inode_size;
+
+	if ( ( fields & LOG_ILOG_DFORK ) && dsize && ( next_reg < item->found ) ) {
+		if ( !( fields & LOG_ILOG_DBROOT ) ) {
+			size_t len = item->reg_len[next_reg];
+			if ( len > d_end - start )
+				len = d_end - start;
+			memcpy( img.image + start, item->region[next_reg], len );
+		}
+		++next_reg;
+	}
+
+	if ( forkoff && ( d_end < scan->inode_size ) && ( fields & LOG_ILOG_AFORK ) && asize
+	  && ( next_reg < item->found ) && !( fields & LOG_ILOG_ABROOT ) ) {
+		size_t len = item->reg_len[next_reg];
+		if ( len > scan->inode_size - d_end )
+			len = scan->inode_size - d_end;
+		memcpy( img.image + d_end, item->region[next_reg], len );
+	}
+
+	img.is_live = img.image[2] || img.image[3];
+	scan->inode_items++;
+
+	return store_image( scan, &img );
+}
+
+
+/** @internal Count logged directory blocks, and note down the directories owning them
+  *
+  * The logged block contents are not handed on. The analyzer only reads
+  * directories through their inodes, so the owners are queued instead and
+  * their blocks are read from the device as they are now.
+**/
+static int handle_buf_item( log_scan_t* scan, log_item_t* item, uint64_t lsn ) {
+	/* The first region holds the first dirty chunk of the buffer. If that is
+	 * the start of the block, a directory block header can be seen there. */
+	if ( !item->found || ( item->reg_len[0] < 4 )
+	  || !memcmp( item->region[0], XFS_IN_MAGIC, 2 )
+	  || !is_directory_block( item->region[0] ) )
+		return 0;
+
+	scan->dir_blocks++;
+
+	/* Only the data block headers of v5 file systems name their directory.
+	 * The owner is at byte 40, behind the UUID of the file system. */
+	uint8_t const* hdr = item->region[0];
+	if ( ( item->reg_len[0] < 48 )
+	  || ( memcmp( hdr, XFS_DB_MAGIC, 4 ) && memcmp( hdr, XFS_DD_MAGIC, 4 ) )
+	  || ( memcmp( hdr + 24, superblocks[0].UUID, 16 ) && memcmp( hdr + 24, superblocks[0].inco_UUID, 16 ) ) )
+		return 0;
+
+	if ( scan->own_count == scan->own_size ) {
+		uint64_t     new_size   = scan->own_size ? scan->own_size * 2 : 256;
+		log_owner_t* new_owners = realloc( scan->owners, new_size * sizeof( log_owner_t ) );
+		if ( NULL == new_owners ) {
+			log_critical( "Unable to allocate %zu bytes for directory owners: %m [%d]",
+			              new_size * sizeof( log_owner_t ), errno );
+			return -1;
+		}
+		scan->owners   = new_owners;
+		scan->own_size = new_size;
+	}
+
+	scan->owners[scan->own_count].ino = get_flip64u( hdr, 40 );
+	scan->owners[scan->own_count].lsn = lsn;
+	scan->own_count++;
+
+	return 0;
+}
+
+
+/// @internal Check a record header, return the full record size including headers, or 0 if invalid
+static size_t check_record_header( uint8_t const* hdr, uint32_t* hdr_bbs ) {
+	uint32_t h_version = get_flip32u( hdr,   8 );
+	uint32_t h_len     = get_flip32u( hdr,  12 );
+	uint32_t h_numops  = get_flip32u( hdr,  40 );
+	uint32_t h_size    = get_flip32u( hdr, 320 );
+
+	if ( ( 0 == h_len ) || ( h_len > LOG_MAX_RECORD ) || ( 0 == h_numops )
+	  || !( h_version & 0x3 ) || memcmp( hdr + 304, superblocks[0].UUID, 16 ) )
+		return 0;
+
+	// Version 2 logs with large record buffers have extended headers
+	*hdr_bbs = 1;
+	if ( ( h_version & 0x2 ) && ( h_size > LOG_CYCLE_SIZE ) )
+		*hdr_bbs = ( h_size / LOG_CYCLE_SIZE ) + ( h_size % LOG_CYCLE_SIZE ? 1 : 0 );
+
+	return ( *hdr_bbs * LOG_BB_SIZE ) + ( ( h_len + LOG_BB_SIZE - 1 ) / LOG_BB_SIZE ) * LOG_BB_SIZE;
+}
+
+
+/// @internal Restore the cycle-stamped words and walk all operations of one record
+static int parse_record( log_scan_t* scan, uint8_t* hdr, uint32_t hdr_bbs ) {
+	uint32_t h_len    = get_flip32u( hdr,  12 );
+	uint64_t lsn      = get_flip64u( hdr,  16 );
+	uint32_t h_numops = get_flip32u( hdr,  40 );
+	uint8_t* data     = hdr + ( hdr_bbs * LOG_BB_SIZE );
+	uint32_t data_bbs = ( h_len + LOG_BB_SIZE - 1 ) / LOG_BB_SIZE;
+
+	scan->records++;
+
+	/* The first word of every basic block was replaced by the cycle number.
+	 * The original words are kept in the (extended) record headers. */
+	for ( uint32_t i = 0; i < data_bbs; ++i ) {
+		uint32_t hi = i / LOG_CYCLE_BBS;
+		uint32_t ci = i % LOG_CYCLE_BBS;
+		if ( hi >= hdr_bbs )
+			break;
+		memcpy( data + ( i * LOG_BB_SIZE ),
+		        hi ? hdr + ( hi * LOG_BB_SIZE ) + 4 + ( ci * 4 ) : hdr + 44 + ( ci * 4 ), 4 );
+	}
+
+	log_item_t item = { .wanted = 0 };
+	uint32_t   pos  = 0;
+
+	for ( uint32_t op = 0; ( op < h_numops ) && ( pos + 12 <= h_len ); ++op ) {
+		uint32_t       oh_len  = get_flip32u( data, pos + 4 );
+		uint8_t        flags   = data[pos + 9];
+		uint8_t const* payload = data + pos + 12;
+
+		if ( oh_len > h_len - pos - 12 )
+			break; // Garbage
+		pos += 12 + oh_len;
+
+		// Split regions are ignored, and so is the item they belong to.
+		if ( flags & ( LOG_OP_CONTINUE | LOG_OP_WAS_CONT ) ) {
+			item.wanted = 0;
+			continue;
+		}
+
+		// Is this a region of the current item?
+		if ( item.wanted ) {
+			if ( item.found < 3 ) {
+				item.region[item.found]  = payload;
+				item.reg_len[item.found] = oh_len;
+			}
+			if ( ++item.found == item.wanted ) {
+				if ( LOG_LI_INODE == item.type ) {
+					if ( -1 == handle_inode_item( scan, &item, lsn ) )
+						return -1;
+				} else if ( -1 == handle_buf_item( scan, &item, lsn ) )
+					return -1;
+				item.wanted = 0;
+			}
+			continue;
+		}
+
+		// Otherwise it might start a new item
+		if ( oh_len < 4 )
+			continue;
+
+		uint16_t type  = get_log16( payload, 0, false );
+		bool     is_be = false;
+		if ( ( LOG_LI_INODE != type ) && ( LOG_LI_BUF != type ) ) {
+			type  = flip16( type );
+			is_be = true;
+		}
+		if ( ( LOG_LI_INODE != type ) && ( LOG_LI_BUF != type ) )
+			continue;
+
+		uint16_t size = get_log16( payload, 2, is_be );
+		if ( size < 2 )
+			continue; // Nothing logged but the format
+
+		item.format     = payload;
+		item.format_len = oh_len;
+		item.type       = type;
+		item.wanted     = size - 1;
+		item.found      = 0;
+	}
+
+	return 0;
+}
+
+
+/// @internal Push all stored images through xfs_read_in() onto the queues
+static int queue_images( log_scan_t* scan, int fd, uint64_t* dirs, uint64_t* files, uint64_t* alive ) {
+	uint8_t* current = malloc( scan->inode_size );
+
+	if ( NULL == current ) {
+		log_critical( "Unable to allocate %hu bytes for inode buffer!", scan->inode_size );
+		return -1;
+	}
+
+	for ( uint64_t i = 0; i < scan->img_size; ++i ) {
+		log_image_t* img = &scan->images[i];
+
+		if ( 0 == img->ino )
+			continue;
+
+		/* A live image of an inode that is still alive on disk with the same
+		 * generation number is just a file nobody deleted. */
+		if ( img->is_live
+		  && ( scan->inode_size == src_pread( fd, current, scan->inode_size, img->position, IO_PROBE ) )
+		  && !memcmp( current, XFS_IN_MAGIC, 2 ) && ( current[2] || current[3] )
+		  && !memcmp( current + 92, img->image + 92, 4 ) ) {
+			( *alive )++;
+			continue;
+		}
+
+		uint64_t  block  = img->position / sb_block_size;
+		uint32_t  ag_num = block / superblocks[0].ag_size;
+		uint32_t  offset = img->position % sb_block_size;
+
+		if ( ag_num >= sb_ag_count )
+			continue;
+
+		xfs_in_t  scratch;
+		xfs_init_in( &scratch, ag_num, block, offset );
+		scratch.is_logged = true;
+		scratch.lsn       = img->lsn;
+
+		/* Everything not queued is of no interest. Directories are always needed to
+		 * rebuild paths, deleted ones are only known after decoding. */
+		if ( ( -1 == xfs_read_in( &scratch, img->image, fd ) )
+		  || ( ( FT_DIR != scratch.ftype )
+		    && ( ( FT_FILE != scratch.ftype ) || !filter_match( &superblocks[0], img->image ) ) ) ) {
+			xfs_clear_in( &scratch );
+			continue;
+		}
+
+		xfs_in_t* inode = xfs_promote_in( &scratch );
+		if ( NULL == inode ) {
+			xfs_clear_in( &scratch );
+			FREE_PTR( current );
+			return -1;
+		}
+
+		if ( 0 == inode->inode_id )
+			inode->inode_id = img->ino;
+
+		int r = 0;
+		if ( FT_DIR == inode->ftype ) {
+			r = dir_in_push( inode );
+			( *dirs )++;
+		} else if ( topk_is_set() ) {
+			// The heap owns the inode now, and might have freed it already
+			r     = topk_offer( inode );
+			inode = NULL;
+			( *files )++;
+		} else {
+			r = file_in_push( inode );
+			( *files )++;
+		}
+
+		if ( -1 == r ) {
+			xfs_drop_in( &inode );
+			log_critical( "Inode queue broken? [%d] Breaking off work!", r );
+			FREE_PTR( current );
+			return -1;
+		}
+	}
+
+	FREE_PTR( current );
+	return 0;
+}
+
+
+/// @internal qsort() helper ordering directory owners by inode number
+static int cmp_owner( void const* a, void const* b ) {
+	uint64_t ino_a = ( ( log_owner_t const* )a )->ino;
+	uint64_t ino_b = ( ( log_owner_t const* )b )->ino;
+
+	return ( ino_a > ino_b ) - ( ino_a < ino_b );
+}
+
+
+/// @internal Queue the directories owning logged directory blocks, unless they are queued already
+static int queue_owners( log_scan_t* scan, int fd, uint64_t* dirs ) {
+	if ( 0 == scan->own_count )
+		return 0;
+
+	uint8_t* current = malloc( scan->inode_size );
+
+	if ( NULL == current ) {
+		log_critical( "Unable to allocate %hu bytes for inode buffer!", scan->inode_size );
+		return -1;
+	}
+
+	qsort( scan->owners, scan->own_count, sizeof( log_owner_t ), cmp_owner );
+
+	for ( uint64_t i = 0; i < scan->own_count; ++i ) {
+		uint64_t ino    = scan->owners[i].ino;
+		uint64_t lsn    = scan->owners[i].lsn;
+		uint32_t ag_num = 0;
+		uint64_t pos    = 0;
+
+		// A directory changed in many transactions is in here many times, the newest LSN wins
+		while ( ( ( i + 1 ) < scan->own_count ) && ( ino == scan->owners[i + 1].ino ) ) {
+			if ( scan->owners[++i].lsn > lsn )
+				lsn = scan->owners[i].lsn;
+		}
+
+		// The inode images of the log come first, their cores are better than what is on disk
+		if ( cat_find( ino ) || !xfs_ino_pos( ino, &ag_num, &pos ) )
+			continue;
+
+		if ( scan->inode_size != src_pread( fd, current, scan->inode_size, pos, IO_PROBE ) ) {
+			log_error( "Unable to read directory inode %llu at 0x%08llx: %m [%d]", ino, pos, errno );
+			continue;
+		}
+
+		xfs_in_t scratch;
+		xfs_init_in( &scratch, ag_num, pos / sb_block_size, pos % sb_block_size );
+		scratch.is_logged = true;
+		scratch.lsn       = lsn;
+
+		// The inode might have been re-used for something else by now
+		if ( ( -1 == xfs_read_in( &scratch, current, fd ) ) || ( FT_DIR != scratch.ftype ) ) {
+			xfs_clear_in( &scratch );
+			continue;
+		}
+
+		xfs_in_t* inode = xfs_promote_in( &scratch );
+		if ( NULL == inode ) {
+			xfs_clear_in( &scratch );
+			FREE_PTR( current );
+			return -1;
+		}
+
+		if ( -1 == dir_in_push( inode ) ) {
+			xfs_drop_in( &inode );
+			log_critical( "%s", "Inode queue broken? Breaking off work!" );
+			FREE_PTR( current );
+			return -1;
+		}
+		( *dirs )++;
+	}
+
+	FREE_PTR( current );
+	return 0;
+}
+
+
+int scan_journal( char const* device, char const* log_device ) {
+	RETURN_INT_IF_NULL( device );
+
+	xfs_sb_t*  sb        = &superblocks[0];
+	uint64_t   log_size  = ( uint64_t )sb->journal_count * sb_block_size;
+	uint64_t   log_start = 0;
+	uint8_t*   buf       = NULL;
+	int        fd        = -1;
+	int        log_fd    = -1;
+	int        res       = -1;
+	log_scan_t scan      = { .inode_size = sb->inode_size };
+
+	if ( NULL == log_device ) {
+		if ( 0 == sb->journal_start ) {
+			log_critical( "%s has an external log, please name the log device!", device );
+			return -1;
+		}
+		// The journal start is a file system block number: AG number and AG block combined
+		if ( !fsb_to_pos( sb->journal_start, sb->journal_count, &log_start ) ) {
+			log_critical( "The log at block %llu is not inside the file system!", sb->journal_start );
+			return -1;
+		}
+	}
+
+	log_info( "Scanning %s log: %s at 0x%llx",
+	          log_device ? "external" : "internal", get_human_size( log_size ), log_start );
+
+	buf = malloc( LOG_WINDOW );
+	if ( NULL == buf ) {
+		log_critical( "Unable to allocate %d bytes for log buffer!", LOG_WINDOW );
+		return -1;
+	}
+
+	fd = src_open( device, O_NOFOLLOW );
+	if ( -1 == fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		goto cleanup;
+	}
+	if ( log_device ) {
+		log_fd = open( log_device, O_RDONLY | O_NOFOLLOW );
+		if ( -1 == log_fd ) {
+			log_error( "Can not open %s for reading: %m [%d]", log_device, errno );
+			goto cleanup;
+		}
+	} else
+		log_fd = fd;
+
+	/// === Walk the log, record by record ===
+	/// ======================================
+	uint64_t pos = 0;
+	while ( pos + LOG_BB_SIZE <= log_size ) {
+		size_t  win_len = ( log_size - pos ) > LOG_WINDOW ? LOG_WINDOW : ( size_t )( log_size - pos );
+		ssize_t got     = log_device
+		                ? pread( log_fd, buf, win_len, log_start + pos )
+		                : src_pread( fd, buf, win_len, log_start + pos, IO_JOURNAL );
+
+		if ( got < LOG_BB_SIZE ) {
+			log_error( "Read error in log at 0x%llx: %m [%d]", log_start + pos, errno );
+			goto cleanup;
+		}
+
+		size_t bb = 0;
+		while ( bb + LOG_BB_SIZE <= ( size_t )got ) {
+			uint8_t* hdr     = buf + bb;
+			uint32_t hdr_bbs = 1;
+			size_t   rec_len = 0;
+
+			if ( LOG_HEADER_MAGIC == get_flip32u( hdr, 0 ) )
+				rec_len = check_record_header( hdr, &hdr_bbs );
+
+			if ( 0 == rec_len ) {
+				bb += LOG_BB_SIZE;
+				continue;
+			}
+
+			if ( bb + rec_len > ( size_t )got ) {
+				if ( bb )
+					break; // Re-read the window starting at this record
+				// The record wraps around the end of the log. Skip it.
+				bb += LOG_BB_SIZE;
+				continue;
+			}
+
+			if ( -1 == parse_record( &scan, hdr, hdr_bbs ) )
+				goto cleanup;
+			bb += rec_len;
+		}
+
+		pos += bb;
+	}
+
+	/// === Queue what has been found ===
+	/// =================================
+	uint64_t dirs = 0, files = 0, alive = 0, owners = 0;
+	if ( ( -1 == queue_images( &scan, fd, &dirs, &files, &alive ) )
+	  || ( -1 == queue_owners( &scan, fd, &owners ) ) )
+		goto cleanup;
+
+	log_info( "Log records found  : %llu", scan.records );
+	log_info( "Inode images found : %llu (%llu inodes)", scan.inode_items, scan.img_count );
+	log_info( " ==> Still alive   : %llu", alive );
+	log_info( " ==> Queued        : %llu directories, %llu files", dirs, files );
+	log_info( "Directory blocks   : %llu", scan.dir_blocks );
+	log_info( " ==> Queued        : %llu directories owning them", owners );
+
+	res = 0;
+
+cleanup:
+	for ( uint64_t i = 0; i < scan.img_size; ++i ) {
+		FREE_PTR( scan.images[i].image );
+	}
+	FREE_PTR( scan.images );
+	FREE_PTR( scan.owners );
+	if ( ( log_fd > -1 ) && ( log_fd != fd ) )
+		close( log_fd );
+	if ( fd > -1 )
+		close( fd );
+	FREE_PTR( buf );
+
+	return res;
+}
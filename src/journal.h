@@ -0,0 +1,36 @@
+#ifndef PWX_XFS_UNDELETE_SRC_JOURNAL_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_JOURNAL_H_INCLUDED 1
+#pragma once
+
+
+#include <stdint.h>
+
+
+/** @brief Scan the XFS journal (log) for logged inode and directory images
+  *
+  * The internal log is located through the `journal_start` and
+  * `journal_count` values of the primary superblock. If @a log_device is
+  * not NULL, the log is read from that external log device instead,
+  * starting at its very first byte.
+  *
+  * Every log record found is parsed, and all complete inode log items are
+  * rebuilt into on-disk inode images. For every inode only the most useful
+  * image is kept (live images over deleted ones, then the highest LSN).
+  * Images of inodes that are still alive on disk are dropped. The rest is
+  * fed through xfs_read_in() and pushed onto the inode queues, stamped with
+  * the LSN of the log record it was found in.
+  *
+  * Logged directory blocks are counted. On v5 file systems their headers
+  * name the directory they belong to. Those directories are queued, too,
+  * unless an image of theirs already was. Their cores are read from the
+  * device, and they are stamped with the newest LSN one of their blocks
+  * was logged with.
+  *
+  * @param[in] device      Path to the source device
+  * @param[in] log_device  Path to an external log device, or NULL for the internal log
+  * @return 0 on success, -1 on failure.
+**/
+int scan_journal( char const* device, char const* log_device );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_JOURNAL_H_INCLUDED
@@ -4,6 +4,7 @@
 
 
 #include "log.h"
+#include "stats.h"
 
 
 #include <errno.h>
@@ -15,7 +16,8 @@
 
 
 // Protect the writing of log messages, so we can have multiple threads quabbling
-static mtx_t output_lock;
+static mtx_t  output_lock;
+static stat_t output_stat = STAT_INIT( "log output" );
 
 
 // Each thread gets their own buffer and message string, so we can fill them without locking
@@ -26,9 +28,9 @@ thread_local static size_t message_size = 0;
 
 
 // Progress lines are fixed (sorry) and need some info
-#define     progress_len  93
+#define     progress_len  121
 static char progress_line[progress_len] = { 0x0 };
-#define     progress_blnk "                                                                                             "
+#define     progress_blnk "                                                                                                                        "
 //                         123456789012345678901234567890123456789012345678901234567890123456789012345678900123456789012
 //                                  1         2         3         4         5         6         7         8          0
 // Demo:                   "[12/12] 1234567890/1234567890 sec (123.45%); 123456789/123456789 found; 123456789 restored"
@@ -138,7 +140,7 @@ static void log_direct_out( char const* time, log_level_t level, char const* loc
 	}
 	strncat( message, buffer, text_len );
 
-	mtx_lock( &output_lock );
+	stat_lock( &output_stat, &output_lock );
 	FILE* target = level > LOG_WARNING ? stderr : stdout;
 	if ( have_progress ) {
 		fprintf( target, "\r%s\r", progress_blnk );
@@ -165,7 +167,7 @@ void show_progress( char const* fmt, ... ) {
 		             text_len, progress_len - 1 );
 
 	// Lock, we do not want to be disturbed, now.
-	mtx_lock( &output_lock );
+	stat_lock( &output_stat, &output_lock );
 
 	if ( have_progress )
 		fprintf( stdout, "\r%s\r", progress_blnk );
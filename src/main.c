@@ -4,13 +4,27 @@
 
 
 #include "analyzer.h"
+#include "backend.h"
+#include "batch.h"
+#include "btree.h"
+#include "catalog.h"
 #include "device.h"
+#include "dist.h"
+#include "filter.h"
 #include "globals.h"
+#include "hunter.h"
 #include "inode_queue.h"
+#include "journal.h"
 #include "log.h"
 #include "scanner.h"
+#include "slab.h"
+#include "spill.h"
+#include "stats.h"
 #include "thrd_ctrl.h"
+#include "topk.h"
+#include "trace.h"
 #include "utils.h"
+#include "watch.h"
 #include "writer.h"
 
 
@@ -28,9 +42,28 @@
 
 
 int main( int argc, char const* argv[] ) {
+	char*           batch_file   = NULL;
+	batch_limits_t  batch_limits = { .max_jobs = 1, .per_disk = 1, .mem_total = 0, .thr_total = 0 };
+	char*           capture_dir  = NULL;
+	uint16_t        coord_port   = 0;
 	char*           device_path  = NULL;
+	bool            hunt_mode    = false;
+	bool            hunt_trunc   = false;
+	bool            journal_mode = false;
+	char*           log_device   = NULL;
+	bool            newest_lsn   = false;
+	uint32_t        newest_n     = 0;
 	char*           output_dir   = NULL;
+	uint64_t        queue_high   = 0;
+	uint64_t        queue_low    = 0;
+	char*           replay_file  = NULL;
 	int             res          = EXIT_SUCCESS;
+	char*           spill_dir    = NULL;
+	uint32_t        thread_cap   = 0;
+	char*           trace_path   = NULL;
+	char*           watch_dir    = NULL;
+	uint32_t        watch_secs   = 30;
+	char*           worker_addr  = NULL;
 
 	/// === Parse command line options. ===
 	/// ===================================
@@ -42,24 +75,304 @@ int main( int argc, char const* argv[] ) {
 				fprintf( stderr, "ERROR: -s option needs a block number!\n" );
 				return EXIT_FAILURE;
 			}
+		} else if ( 0 == strcmp( "-b", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( batch_file );
+				batch_file = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: -b option needs a job list file!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-C", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( capture_dir );
+				capture_dir = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: -C option needs a capture store directory!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-D", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				batch_limits.per_disk = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -D option needs a number of jobs!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-I", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				watch_secs = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -I option needs a number of seconds!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-J", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				batch_limits.max_jobs = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -J option needs a number of jobs!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-M", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				batch_limits.mem_total = strtoull( argv[++i], NULL, 10 ) * 1024 * 1024;
+			else {
+				fprintf( stderr, "ERROR: -M option needs a size in MiB!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-S", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				coord_port = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -S option needs a port number!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-T", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				batch_limits.thr_total = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -T option needs a number of threads!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-t", argv[i] ) ) {
+			if ( ( i + 1 ) < argc )
+				thread_cap = strtoul( argv[++i], NULL, 10 );
+			else {
+				fprintf( stderr, "ERROR: -t option needs a number of threads!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-Q", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				char* rest = NULL;
+				queue_high = strtoull( argv[++i], &rest, 10 );
+				queue_low  = ( ':' == *rest ) ? strtoull( rest + 1, NULL, 10 ) : 0;
+			} else {
+				fprintf( stderr, "ERROR: -Q option needs a high watermark!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-W", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( watch_dir );
+				watch_dir = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: -W option needs a capture store directory!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-w", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( worker_addr );
+				worker_addr = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: -w option needs a coordinator address!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-H", argv[i] ) )
+			hunt_mode = true;
+		else if ( 0 == strcmp( "--truncated", argv[i] ) )
+			hunt_trunc = true;
+		else if ( 0 == strcmp( "-j", argv[i] ) )
+			journal_mode = true;
+		else if ( 0 == strcmp( "-l", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( log_device );
+				log_device   = strdup( argv[++i] );
+				journal_mode = true;
+			} else {
+				fprintf( stderr, "ERROR: -l option needs a log device!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "-o", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				char const* arg  = argv[++i];
+				char*       rest = NULL;
+
+				errno      = 0;
+				src_offset = strtoull( arg, &rest, 10 );
+				// strtoull() silently negates "-1", and stops at the first non-digit
+				if ( ( '-' == arg[0] ) || ( rest == arg ) || *rest || ( ERANGE == errno ) ) {
+					fprintf( stderr, "ERROR: -o option needs a byte offset, not \"%s\"!\n", arg );
+					return EXIT_FAILURE;
+				}
+			} else {
+				fprintf( stderr, "ERROR: -o option needs a byte offset!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( ( 0 == strcmp( "--trace", argv[i] ) ) || ( 0 == strcmp( "--replay", argv[i] ) ) ) {
+			if ( ( i + 1 ) < argc ) {
+				char** dest = ( 0 == strcmp( "--trace", argv[i] ) ) ? &trace_path : &replay_file;
+				FREE_PTR( *dest );
+				*dest = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: %s option needs a trace file!\n", argv[i] );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "--spill", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				FREE_PTR( spill_dir );
+				spill_dir = strdup( argv[++i] );
+			} else {
+				fprintf( stderr, "ERROR: --spill option needs a directory!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "--simulate", argv[i] ) ) {
+			if ( ( i + 1 ) < argc ) {
+				if ( -1 == sim_set_model( argv[++i] ) )
+					return EXIT_FAILURE;
+			} else {
+				fprintf( stderr, "ERROR: --simulate option needs a device model!\n" );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strcmp( "--calibrate", argv[i] ) )
+			src_calibrate = true;
+		else if ( ( 0 == strcmp( "--newest", argv[i] ) ) || ( 0 == strcmp( "--newest-lsn", argv[i] ) ) ) {
+			if ( ( i + 1 ) < argc ) {
+				newest_lsn = ( 0 == strcmp( "--newest-lsn", argv[i] ) );
+				newest_n   = strtoul( argv[++i], NULL, 10 );
+			} else {
+				fprintf( stderr, "ERROR: %s option needs a number of files!\n", argv[i] );
+				return EXIT_FAILURE;
+			}
+		} else if ( 0 == strncmp( "--", argv[i], 2 ) ) {
+			int r = filter_add( argv[i], ( ( i + 1 ) < argc ) ? argv[i + 1] : NULL );
+			if ( 1 == r )
+				++i;
+			else {
+				if ( 0 == r )
+					fprintf( stderr, "ERROR: Unknown option %s!\n", argv[i] );
+				return EXIT_FAILURE;
+			}
 		} else if ( device_path )
 			output_dir = strdup( argv[i] );
 		else
 			device_path = strdup( argv[i] );
 	}
 
+	/// === In batch mode, this process only supervises the workers ===
+	/// ===============================================================
+	if ( batch_file ) {
+		EXEC_OR_FAIL( run_batch( batch_file, &batch_limits ) );
+		goto cleanup;
+	}
+
+	/// === Keep the inode queues between their watermarks ===
+	/// ======================================================
+	if ( queue_high )
+		in_set_watermarks( queue_high, queue_low );
+
+	/// === In hunt mode, search the device for file systems first ===
+	/// ==============================================================
+	if ( hunt_mode && device_path ) {
+		uint64_t first = 0;
+		int      found = hunt_filesystems( device_path, &first, hunt_trunc );
+
+		if ( ( found < 1 ) || !output_dir ) {
+			EXEC_OR_FAIL( found );
+			goto cleanup;
+		}
+
+		if ( found > 1 )
+			log_warning( "%d file systems found, using the first. Use -o to select another.", found );
+		src_offset = first;
+	}
+
+	/// === In replay mode, only re-issue the reads of a trace ===
+	/// =========================================================
+	if ( replay_file && device_path ) {
+		EXEC_OR_FAIL( trace_replay( replay_file, device_path ) );
+		goto cleanup;
+	}
+
+	/// === Let the file queue overflow to disk if wanted ===
+	/// =====================================================
+	if ( spill_dir )
+		EXEC_OR_FAIL( spill_open( spill_dir ) );
+
+	/// === Record all reads from the source device if wanted ===
+	/// =========================================================
+	if ( trace_path && device_path )
+		EXEC_OR_FAIL( trace_start( trace_path ) );
+
+	/// === In watch mode, capture freed inodes until told to stop ===
+	/// =============================================================
+	if ( watch_dir && device_path ) {
+		EXEC_OR_FAIL( set_source_device( device_path, false ) );
+		EXEC_OR_FAIL( scan_superblocks() );
+		EXEC_OR_FAIL( run_watch( device_path, watch_dir, watch_secs ) );
+		goto cleanup;
+	}
+
+	/// === As a worker, scan whatever the coordinator hands out ===
+	/// ===========================================================
+	if ( worker_addr && device_path ) {
+		EXEC_OR_FAIL( set_source_device( device_path, true ) );
+		EXEC_OR_FAIL( scan_superblocks() );
+		EXEC_OR_FAIL( run_worker( device_path, worker_addr ) );
+		goto cleanup;
+	}
+
 	if ( output_dir ) {
 		log_info( " -> Scanning device  : %s",  device_path );
+		if ( src_offset )
+			log_info( " -> at byte offset   : %llu", src_offset );
+		if ( filter_is_set() )
+			log_info( " -> filtered by      : %s", "the given filter options" );
+		if ( newest_n )
+			log_info( " -> newest files only: %u by %s", newest_n, newest_lsn ? "LSN" : "ctime" );
 		log_info( " -> into directory   : %s",  output_dir );
-		log_info( " -> starting at block: %zu", start_block );
+		if ( coord_port )
+			log_info( " -> by workers on port: %u", coord_port );
+		else if ( capture_dir )
+			log_info( " -> from captures in : %s", capture_dir );
+		else if ( journal_mode )
+			log_info( " -> from the log on  : %s", log_device ? log_device : device_path );
+		else
+			log_info( " -> starting at block: %zu", start_block );
 	} else {
-		fprintf( stdout, "Usage: %s [-s start block] <device> <output dir>\n", argv[0] );
+		fprintf( stdout, "Usage: %s [-s start block] [-j] [-l log device] [-H] [-o offset] <device> <output dir>\n", argv[0] );
+		fprintf( stdout, "  -s <block>  : Start scanning at the given block\n" );
+		fprintf( stdout, "  -H          : Hunt the device for XFS file systems; without output dir, only list them\n" );
+		fprintf( stdout, "  --truncated : With -H, also accept file systems that are cut off at the end of the device\n" );
+		fprintf( stdout, "  -o <offset> : Byte offset of the file system on the device\n" );
+		fprintf( stdout, "  -j          : Scan the journal only, not the full device\n" );
+		fprintf( stdout, "  -l <device> : Use this external log device (implies -j)\n" );
+		fprintf( stdout, "  -t <number> : Do not use more than this many threads\n" );
+		fprintf( stdout, "  -Q <hi[:lo]>: Block scanners while a queue holds <hi> inodes, until it is down to <lo>\n" );
+		fprintf( stdout, "  --spill <dir>      : Write queued file inodes into <dir> instead of blocking at <hi>\n" );
+		fprintf( stdout, "  --calibrate : Measure the source device and remember how to read it best\n" );
+		fprintf( stdout, "  --simulate <model> : Read the image as if it was on a simulated hdd, ssd, nvme or net disk\n" );
+		fprintf( stdout, "  --trace <file>     : Record every read from the source device into <file>\n" );
+		fprintf( stdout, "Replay mode: %s --replay <trace> [-o offset] [--simulate <model>] <device>\n", argv[0] );
+		fprintf( stdout, "  --replay <file>    : Re-issue the reads recorded with --trace against <device>\n" );
+		fprintf( stdout, "Filters, only deleted inodes matching all of them are recovered:\n" );
+		fprintf( stdout, "  --uid <id> / --gid <id>         : Owned by this user / group\n" );
+		fprintf( stdout, "  --ctime-from/--ctime-to <time>  : Changed in this window\n" );
+		fprintf( stdout, "  --mtime-from/--mtime-to <time>  : Modified in this window\n" );
+		fprintf( stdout, "  --project <id>                  : Belonging to this project\n" );
+		fprintf( stdout, "  --inode-version <v>             : With this inode version\n" );
+		fprintf( stdout, "  --min-extents <n>               : With at least this many data extents\n" );
+		fprintf( stdout, "  A <time> is in seconds since the epoch, or relative like -7d, -12h\n" );
+		fprintf( stdout, "  --newest <n>                    : Only recover the <n> most recently deleted files\n" );
+		fprintf( stdout, "  --newest-lsn <n>                : Like --newest, but rank by log sequence number\n" );
+		fprintf( stdout, "Watch mode: %s -W <store dir> [-I seconds] <device>\n", argv[0] );
+		fprintf( stdout, "  -W <dir>    : Capture freed inodes into <dir> until interrupted\n" );
+		fprintf( stdout, "  -I <number> : Seconds between two watch cycles (default 30)\n" );
+		fprintf( stdout, "  -C <dir>    : Recover from the captures in <dir> instead of scanning\n" );
+		fprintf( stdout, "Distributed mode: %s -S <port> <device> <output dir>\n", argv[0] );
+		fprintf( stdout, "                  %s -w <host:port> [filters] <device>\n", argv[0] );
+		fprintf( stdout, "  -S <port>   : Coordinate workers connecting to <port>, they do the scanning\n" );
+		fprintf( stdout, "  -w <addr>   : Work for the coordinator at <host:port> on this view of the device\n" );
+		fprintf( stdout, "Batch mode: %s -b <job list> [-J jobs] [-D jobs] [-M MiB] [-T threads]\n", argv[0] );
+		fprintf( stdout, "  -b <file>   : Recover all \"<device> <output dir>\" pairs listed in <file>\n" );
+		fprintf( stdout, "  -J <number> : Recover this many volumes at once (default 1)\n" );
+		fprintf( stdout, "  -D <number> : Read this many volumes at once from one physical disk (default 1)\n" );
+		fprintf( stdout, "  -M <MiB>    : Total memory budget for all workers\n" );
+		fprintf( stdout, "                A worker that exceeds its share is stopped, its output dir is renamed to <output dir>.partial\n" );
+		fprintf( stdout, "  -T <number> : Total thread budget for all workers\n" );
 		return res;
 	}
 
 	/// === Set the source device, remount ro and check whether it is an SSD ===
 	/// ========================================================================
-	EXEC_OR_FAIL( set_source_device( device_path ) );
+	EXEC_OR_FAIL( set_source_device( device_path, true ) );
 
 	/// === Create the target path and check whether its device is an SSD ===
 	/// =====================================================================
@@ -69,6 +382,11 @@ int main( int argc, char const* argv[] ) {
 	/// =============================================================
 	EXEC_OR_FAIL( scan_superblocks() )
 
+	/// === In newest-N mode, file inodes are held back in a bounded heap ===
+	/// =====================================================================
+	if ( newest_n )
+		EXEC_OR_FAIL( topk_init( newest_n, newest_lsn ) )
+
 	/// ===  ----------------------
 	/// ===  --- Main Work Loop ---
 	/// ===  ----------------------
@@ -95,26 +413,71 @@ int main( int argc, char const* argv[] ) {
 	src_is_ssd = false;
 	tgt_is_ssd = false;
 #endif // defined
-	uint32_t max_threads = src_is_ssd ? ( 2 * sb_ag_count ) + ( tgt_is_ssd ? sb_ag_count : 1 ) : 1;
-	uint32_t current_ag  = 0; // Needed for single threaded reading operation
+	/* With a thread cap, or a source device with a shallow queue, the AGs are
+	 * scanned in groups. The analyzers and writers started with the first group
+	 * keep working for all later groups. */
+	uint32_t ag_group    = sb_ag_count;
+	if ( src_is_ssd && ( dev_max_readers( &src_profile ) < ag_group ) ) {
+		ag_group = dev_max_readers( &src_profile );
+		log_info( "%s takes %u readers at once", device_path, ag_group );
+	}
+	if ( thread_cap && src_is_ssd && ( ( thread_cap / ( tgt_is_ssd ? 3 : 2 ) ) < ag_group ) ) {
+		ag_group = thread_cap / ( tgt_is_ssd ? 3 : 2 );
+		if ( ag_group < 1 )
+			ag_group = 1;
+	}
+	uint32_t max_threads = src_is_ssd ? ( 2 * ag_group ) + ( tgt_is_ssd ? ag_group : 1 ) : 1;
+	uint32_t current_ag  = 0; // Needed for single threaded and grouped reading operation
 
 	SET_OR_FAIL( analyze_data = create_analyze_data( sb_ag_count, device_path ) );
 	SET_OR_FAIL( scan_data    = create_scanner_data( sb_ag_count, device_path ) );
 	SET_OR_FAIL( write_data   = create_writer_data(  sb_ag_count, device_path ) );
 
+	/// === In journal, capture and coordinator mode the full disk scan is replaced ===
+	/// ==============================================================================
+	if ( journal_mode || capture_dir || coord_port ) {
+		if ( coord_port ) {
+			EXEC_OR_FAIL( run_coordinator( device_path, coord_port ) );
+		} else if ( capture_dir ) {
+			EXEC_OR_FAIL( load_captures( device_path, capture_dir ) );
+		} else {
+			EXEC_OR_FAIL( scan_journal( device_path, log_device ) );
+		}
+
+		// Nothing else comes in, so the main work loop is skipped
+		ag_scanned = sb_ag_count;
+		EXEC_OR_FAIL( topk_flush() );
+		unshackle_analyzers();
+		unshackle_writers();
+
+		EXEC_OR_FAIL( start_analyzer( &analyze_data[0] ) );
+		wakeup_threads( true );
+		monitor_threads( max_threads, false );
+		join_analyzers( true );
+
+		EXEC_OR_FAIL( start_writer( &write_data[0] ) );
+		wakeup_threads( true );
+		monitor_threads( max_threads, false );
+		join_writers( true );
+	}
+
 	while ( ag_scanned < sb_ag_count ) {
 		// ---------------------------------------------------------------------
 		// --- 1) Start one scanner total or one scanner and analyzer per ag ---
 		// ---------------------------------------------------------------------
 		if ( src_is_ssd ) {
-			for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
-				EXEC_OR_FAIL( start_analyzer( &analyze_data[i] ) );
-				EXEC_OR_FAIL( start_scanner(  &scan_data[i] ) );
-				if ( tgt_is_ssd || ( 0 == i ) ) {
-					// If tgt is rotational, only one writer thread is allowed.
-					EXEC_OR_FAIL( start_writer( &write_data[i] ) );
+			uint32_t last_ag = ( current_ag + ag_group ) < sb_ag_count ? current_ag + ag_group : sb_ag_count;
+			for ( uint32_t i = current_ag; i < last_ag; ++i ) {
+				if ( i < ag_group ) {
+					EXEC_OR_FAIL( start_analyzer( &analyze_data[i] ) );
+					if ( tgt_is_ssd || ( 0 == i ) ) {
+						// If tgt is rotational, only one writer thread is allowed.
+						EXEC_OR_FAIL( start_writer( &write_data[i] ) );
+					}
 				}
+				EXEC_OR_FAIL( start_scanner( &scan_data[i] ) );
 			}
+			current_ag = last_ag;
 		} else
 			EXEC_OR_FAIL( start_scanner( &scan_data[current_ag] ) );
 
@@ -133,12 +496,20 @@ int main( int argc, char const* argv[] ) {
 		// ------------------------------------------------------
 		join_scanners( true, &ag_scanned );
 
-		// If the scanners are fully done now, tell the analyzers that no new
+		// If the scanners are fully done now, tell the analyzers and writers that no new
 		// data is coming. Directory information still missing is lost.
-		if ( ag_scanned >= sb_ag_count )
+		// In newest-N mode, this is the point where the survivors are known.
+		if ( ag_scanned >= sb_ag_count ) {
+			EXEC_OR_FAIL( topk_flush() );
 			unshackle_analyzers();
+			unshackle_writers();
+		}
 
 		if ( src_is_ssd ) {
+			// The analyzers and writers wait for the next group, if any.
+			if ( ag_scanned < sb_ag_count )
+				continue;
+
 			// ------------------------------------------
 			// --- 5) Monitor the remaining thread(s) ---
 			// ------------------------------------------
@@ -189,10 +560,26 @@ cleanup:
 		// Sledge Hammer on error.
 		end_threads();
 
+	stat_log( true );
+	trace_stop();
+	sim_report();
+	topk_free();
+	spill_close();
 	in_clear();
 	free_devices();
+	bt_cache_release();
+	cat_free();
+	slab_release();
+	FREE_PTR( batch_file );
+	FREE_PTR( capture_dir );
 	FREE_PTR( device_path );
+	FREE_PTR( log_device );
 	FREE_PTR( output_dir );
+	FREE_PTR( replay_file );
+	FREE_PTR( spill_dir );
+	FREE_PTR( trace_path );
+	FREE_PTR( watch_dir );
+	FREE_PTR( worker_addr );
 
 	return res;
 } /* main() */
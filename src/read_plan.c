@@ -0,0 +1,133 @@
+/*******************************************************************************
+ * read_plan.c : Turn the extents of a file into few large reads
+ ******************************************************************************/
+
+
+#include "device.h"
+#include "globals.h"
+#include "log.h"
+#include "read_plan.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/// @internal Append a step, or grow the last one if the new one continues it
+static void plan_add( read_plan_t* plan, e_plan_kind kind, uint64_t offset, uint64_t pos, uint64_t length ) {
+	plan_op_t* last = plan->count ? &plan->ops[plan->count - 1] : NULL;
+
+	if ( PLAN_READ == kind )
+		plan->read_bytes += length;
+	else if ( PLAN_HOLE == kind )
+		plan->hole_bytes += length;
+
+	if ( last && ( kind == last->kind ) && ( offset == ( last->offset + last->length ) )
+	  && ( ( PLAN_READ != kind ) || ( pos == ( last->pos + last->length ) ) ) ) {
+		last->length += length;
+		return;
+	}
+
+	plan_op_t* op = &plan->ops[plan->count++];
+	op->offset = offset;
+	op->pos    = PLAN_READ == kind ? pos : 0;
+	op->length = length;
+	op->kind   = kind;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+read_plan_t* plan_create( xfs_ex_vec_t const* vec, uint64_t file_size ) {
+	uint32_t      count  = vec ? vec->count : 0;
+	size_t        size   = sizeof( read_plan_t ) + ( ( ( 2 * ( size_t )count ) + 1 ) * sizeof( plan_op_t ) );
+	read_plan_t*  plan   = malloc( size ); // Every extent needs at most a hole in front of it
+	xfs_ex_vec_t* exts   = NULL;
+	uint8_t*      fields = NULL;
+	uint64_t      cursor = 0; // Where the plan ends so far
+
+	if ( NULL == plan ) {
+		log_critical( "Unable to allocate %zu bytes for a read plan: %m [%d]", size, errno );
+		return NULL;
+	}
+	memset( plan, 0, sizeof( read_plan_t ) );
+
+	// Work on a sorted and merged copy, unpacked into one array per field
+	if ( count && ( NULL != ( exts = xfs_ex_create( vec->packed, count ) ) ) ) {
+		xfs_sort_ex_by_offset( exts );
+		count  = xfs_ex_merge( exts );
+		fields = malloc( ( size_t )count * ( sizeof( uint64_t ) * 2 + sizeof( uint32_t ) + 1 ) );
+	}
+	if ( count && ( NULL == fields ) ) {
+		if ( exts )
+			log_critical( "Unable to allocate the fields of %u extents: %m [%d]", count, errno );
+		xfs_ex_free( &exts );
+		FREE_PTR( plan );
+		return NULL;
+	}
+
+	uint64_t* offset   = ( uint64_t* )fields;
+	uint64_t* block    = offset + count;
+	uint32_t* length   = ( uint32_t* )( block + count );
+	uint8_t*  prealloc = ( uint8_t* )( length + count );
+
+	if ( count )
+		xfs_read_ex_bulk( exts->packed, count, offset, block, length, prealloc );
+
+	for ( uint32_t i = 0; i < count; ++i ) {
+		uint64_t pos = 0;
+
+		// Garbage from deleted inodes must neither overflow nor point outside the file system
+		if ( ( offset[i] > ( ( UINT64_MAX / sb_block_size ) - length[i] ) )
+		  || !fsb_to_pos( block[i], length[i], &pos ) ) {
+			++plan->broken;
+			continue;
+		}
+
+		uint64_t off = offset[i] * sb_block_size;
+		uint64_t len = ( uint64_t )length[i] * sb_block_size;
+
+		// The extents are sorted, so only the part behind the cursor is new
+		if ( off < cursor ) {
+			++plan->overlaps;
+			if ( ( off + len ) <= cursor )
+				continue;
+			pos += cursor - off;
+			len -= cursor - off;
+			off  = cursor;
+		}
+
+		if ( file_size && ( off >= file_size ) )
+			break;
+		if ( file_size && ( ( off + len ) > file_size ) )
+			len = file_size - off;
+
+		if ( off > cursor )
+			plan_add( plan, PLAN_HOLE, cursor, 0, off - cursor );
+		plan_add( plan, prealloc[i] ? PLAN_ZERO : PLAN_READ, off, pos, len );
+		cursor = off + len;
+	}
+
+	// Whatever is left up to the file size was never mapped
+	if ( file_size > cursor )
+		plan_add( plan, PLAN_HOLE, cursor, 0, file_size - cursor );
+	plan->file_size = file_size ? file_size : cursor;
+
+	if ( plan->overlaps || plan->broken ) {
+		log_debug( "Read plan: %u overlapping and %u broken extents", plan->overlaps, plan->broken );
+	}
+
+	xfs_ex_free( &exts );
+	FREE_PTR( fields );
+
+	return plan;
+}
+
+
+void plan_free( read_plan_t** plan ) {
+	RETURN_VOID_IF_NULL( plan );
+	FREE_PTR( *plan );
+}
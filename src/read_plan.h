@@ -0,0 +1,68 @@
+#ifndef PWX_XFS_UNDELETE_SRC_READ_PLAN_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_READ_PLAN_H_INCLUDED 1
+#pragma once
+
+
+#include "extent.h"
+
+
+#include <stdint.h>
+
+
+/// @brief What a step of a read plan does
+typedef enum _plan_kind {
+	PLAN_READ = 0, //!< Copy the bytes from the device
+	PLAN_HOLE,     //!< Nothing is mapped here, the file has a hole
+	PLAN_ZERO      //!< Preallocated but never written, the file reads zeros
+} e_plan_kind;
+
+
+/// @brief One step of a read plan
+typedef struct _plan_op {
+	uint64_t offset; //!< Byte offset in the file
+	uint64_t pos;    //!< Byte position on the device, only used by PLAN_READ
+	uint64_t length; //!< Number of bytes
+	uint8_t  kind;   //!< One of e_plan_kind
+} plan_op_t;
+
+
+/** @brief How to restore one file, in file order
+  *
+  * The steps cover the file from offset 0 to @a file_size without gaps,
+  * and neighbouring steps of the same kind are merged. So the writer
+  * issues one large read per physically contiguous run.
+**/
+typedef struct _read_plan {
+	uint64_t  file_size;  //!< Bytes the restored file gets
+	uint64_t  read_bytes; //!< Bytes of all PLAN_READ steps
+	uint64_t  hole_bytes; //!< Bytes of all PLAN_HOLE steps
+	uint32_t  overlaps;   //!< Extents that were cut or dropped, because an earlier one covers them
+	uint32_t  broken;     //!< Extents pointing outside the file system, planned as holes
+	uint32_t  count;      //!< Number of steps in @a ops
+	uint32_t  padding;    //!< Keeps @a ops 8 byte aligned
+	plan_op_t ops[];      //!< The steps
+} read_plan_t;
+
+
+/** @brief Build the read plan of a file from its extents
+  *
+  * The extents are sorted by logical offset and merged where they are
+  * physically contiguous. Where an extent overlaps one before it, the
+  * earlier one wins. Gaps become holes. Everything at or beyond
+  * @a file_size is cut off. If @a file_size is 0, as it is for many
+  * deleted inodes, the file ends with its last extent.
+  *
+  * @param[in] vec        The extents of the file, left as they are
+  * @param[in] file_size  The size of the file in bytes, or 0 if unknown
+  * @return A new plan, or NULL if out of memory.
+**/
+read_plan_t* plan_create( xfs_ex_vec_t const* vec, uint64_t file_size );
+
+
+/** @brief Free a read plan
+  * @param[in,out] plan  The plan to free, *plan is set to NULL
+**/
+void plan_free( read_plan_t** plan );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_READ_PLAN_H_INCLUDED
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ * record.c : Queue raw inode records found outside of the scanner
+ ******************************************************************************/
+
+
+#include "file_type.h"
+#include "filter.h"
+#include "globals.h"
+#include "inode.h"
+#include "inode_queue.h"
+#include "log.h"
+#include "record.h"
+#include "topk.h"
+#include "utils.h"
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int record_queue_inode( uint32_t ag_num, uint64_t position, uint8_t const* data, int fd,
+                        bool is_captured, uint64_t* dirs, uint64_t* files ) {
+	RETURN_INT_IF_NULL( data );
+	RETURN_INT_IF_VLEV( sb_ag_count, ag_num );
+
+	xfs_in_t scratch;
+	xfs_init_in( &scratch, ag_num, position / sb_block_size, position % sb_block_size );
+	scratch.is_captured = is_captured;
+
+	// Directories are always needed to rebuild paths, deleted ones are only known after decoding
+	if ( ( -1 == xfs_read_in( &scratch, data, fd ) )
+	  || ( ( FT_DIR != scratch.ftype )
+	    && ( ( FT_FILE != scratch.ftype ) || !filter_match( &superblocks[ag_num], data ) ) ) ) {
+		xfs_clear_in( &scratch );
+		return 0;
+	}
+
+	xfs_in_t* inode = xfs_promote_in( &scratch );
+	if ( NULL == inode ) {
+		xfs_clear_in( &scratch );
+		return -1;
+	}
+
+	int r = 0;
+	if ( FT_DIR == inode->ftype ) {
+		r = dir_in_push( inode );
+		if ( dirs )
+			++( *dirs );
+	} else if ( topk_is_set() ) {
+		// The heap owns the inode now, and might have freed it already
+		r     = topk_offer( inode );
+		inode = NULL;
+		if ( files )
+			++( *files );
+	} else {
+		r = file_in_push( inode );
+		if ( files )
+			++( *files );
+	}
+
+	if ( -1 == r ) {
+		xfs_drop_in( &inode );
+		log_critical( "Inode queue broken? [%d] Breaking off work!", r );
+		return -1;
+	}
+
+	return 0;
+}
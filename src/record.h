@@ -0,0 +1,30 @@
+#ifndef PWX_XFS_UNDELETE_SRC_RECORD_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_RECORD_H_INCLUDED 1
+#pragma once
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** @brief Decode a raw inode record and put it onto the inode queues
+  *
+  * Raw inode cores that were found elsewhere, by a watcher or by a
+  * distributed worker, all go through here. Directories are always
+  * queued. Everything else must pass the filters, and goes into the
+  * newest-N heap if that is active.
+  *
+  * @param[in]     ag_num       AG the inode resides in
+  * @param[in]     position     Absolute byte position of the inode in the file system
+  * @param[in]     data         The raw inode core, sb->inode_size bytes
+  * @param[in]     fd           File descriptor of the source device for reading extents
+  * @param[in]     is_captured  If true, live inodes are accepted (see xfs_read_in())
+  * @param[in,out] dirs         Counter increased if a directory was queued
+  * @param[in,out] files        Counter increased if a file was queued
+  * @return 0 on success, including rejected records, -1 on failure.
+**/
+int record_queue_inode( uint32_t ag_num, uint64_t position, uint8_t const* data, int fd,
+                        bool is_captured, uint64_t* dirs, uint64_t* files );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_RECORD_H_INCLUDED
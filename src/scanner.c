@@ -3,13 +3,16 @@
  ******************************************************************************/
 
 
+#include "backend.h"
 #include "file_type.h"
+#include "filter.h"
 #include "forensics.h"
 #include "globals.h"
 #include "inode.h"
 #include "inode_queue.h"
 #include "log.h"
 #include "scanner.h"
+#include "topk.h"
 #include "utils.h"
 
 
@@ -30,15 +33,19 @@ static int init_scan_data( scan_data_t* scan_data, uint32_t thrd_num, char const
 	RETURN_INT_IF_VLEV( sb_ag_count, ag_num );
 
 	scan_data->ag_num       = ag_num;
+	scan_data->blk_count    = 0;
+	scan_data->blk_first    = 0;
 	scan_data->device       = dev_str;
 	scan_data->do_start     = false;
 	scan_data->do_stop      = false;
 	scan_data->frwrd_dirent = 0;
 	scan_data->frwrd_inodes = 0;
 	scan_data->is_finished  = false;
-	scan_data->is_running   = true;
+	scan_data->is_running   = false;
 	scan_data->sb_data      = sb_data;
 	scan_data->sec_scanned  = 0;
+	scan_data->sink         = NULL;
+	scan_data->sink_ctx     = NULL;
 	scan_data->thread_num   = thrd_num;
 
 	return 0;
@@ -57,13 +64,13 @@ static int file_extent_found = 0;
 static void debug_perform_dump( xfs_in_t* inode, uint8_t* buf ) {
 	static char dump_name[PATH_MAX] = { 0x0 };
 	snprintf( dump_name, PATH_MAX - 1, "ag_%02u-blk_%010zu-off_%04zu-%s.dmp",
-		  inode->ag_num, inode->block, inode->offset,
+		  inode->ag_num, inode->pos / sb_block_size, inode->pos % sb_block_size,
 		  FT_DIR == inode->ftype ? "dirent" :
 		  FT_FILE == inode->ftype ? "file": "other");
 
 	int fd = open( dump_name, O_WRONLY | O_CREAT | O_TRUNC);
 	if ( -1 < fd ) {
-		write(fd, buf, inode->sb->inode_size);
+		write(fd, buf, superblocks[inode->ag_num].inode_size);
 		close(fd);
 	} // No logging on errors, please. If it works, it works.
 }
@@ -97,6 +104,24 @@ static int debug_dump_inode( xfs_in_t* inode, uint8_t* buf ) {
 #endif // DEBUG
 
 
+/// @internal Push the inodes gathered so far, they are freed if the queue is broken
+static int flush_batch( xfs_in_t** batch, size_t* count, bool is_dir ) {
+	int r = 0;
+
+	if ( *count ) {
+		r = is_dir ? dir_in_push_batch( batch, *count ) : file_in_push_batch( batch, *count );
+		if ( -1 == r ) {
+			for ( size_t i = 0; i < *count; ++i )
+				xfs_drop_in( &batch[i] );
+			log_critical( "Inode queue broken? [%d] Breaking off work!", r );
+		}
+		*count = 0;
+	}
+
+	return r;
+}
+
+
 scan_data_t* create_scanner_data( uint32_t ar_size, char const* dev_str ) {
 	RETURN_NULL_IF_ZERO( ar_size );
 	RETURN_NULL_IF_NULL( dev_str );
@@ -130,10 +155,14 @@ void free_scanner_data( scan_data_t** data ) {
 int scanner( void* scan_data ) {
 	RETURN_INT_IF_NULL( scan_data );
 
-	uint8_t*     buf  = NULL;
-	scan_data_t* data = ( scan_data_t* )scan_data;
-	int          fd   = -1;
-	int          res  = -1;
+	uint8_t*     buf      = NULL;
+	scan_data_t* data     = ( scan_data_t* )scan_data;
+	xfs_in_t*    dir_batch[IN_BATCH_MAX];
+	size_t       dir_cnt  = 0;
+	int          fd       = -1;
+	xfs_in_t*    file_batch[IN_BATCH_MAX];
+	size_t       file_cnt = 0;
+	int          res      = -1;
 
 
 	// Sleep until signaled to start
@@ -149,15 +178,20 @@ int scanner( void* scan_data ) {
 		goto cleanup;
 	data->is_running = true;
 
-	// First we need a buffer:
-	buf = malloc( sb_block_size );
+	// Stay on the NUMA node the device is attached to, if there are several
+	dev_bind_thread( &src_profile );
+
+	// First we need a buffer, large enough for one read window:
+	size_t wnd_bytes = dev_read_size( &src_profile, sb_block_size );
+	size_t wnd_blks  = wnd_bytes / sb_block_size;
+	buf = malloc( wnd_bytes );
 	if ( NULL == buf ) {
-		log_critical( "Unable to allocate %lu bytes for block buffer!", sb_block_size );
+		log_critical( "Unable to allocate %zu bytes for read window!", wnd_bytes );
 		goto cleanup;
 	}
 
 	// Let's open the device, then.
-	fd  = open( data->device, O_RDONLY | O_NOFOLLOW );
+	fd  = src_open( data->device, O_NOFOLLOW );
 	if ( -1 == fd ) {
 		log_error( "[Thread %lu] Can not open %s for reading: %m [%d]",
 		           data->thread_num, data->device, errno );
@@ -168,8 +202,11 @@ int scanner( void* scan_data ) {
 	size_t start_at = data->ag_num * data->sb_data->ag_size;
 	size_t stop_at  = start_at + data->sb_data->ag_size;
 
-	// Skip blocks if start_block was set:
-	if ( start_block )
+	// Skip blocks if start_block was set, or scan just a stripe if told so:
+	if ( data->blk_count ) {
+		start_at = data->blk_first;
+		stop_at  = start_at + data->blk_count;
+	} else if ( start_block )
 		start_at = start_block;
 	/* Note: This will cause the full loop to be skipped if the start block lies
 	 *       in a higher allocation group. But it is easier to skip right now
@@ -180,24 +217,43 @@ int scanner( void* scan_data ) {
 	/// ==========================
 	/// === Main Scanning Loop ===
 	/// ==========================
+	uint8_t* blk;             // Pointer to the current block inside the window
 	int      read_errors = 0; // Allow up to three consecutive read errors
 	uint8_t* buf_p;           // Pointer into the buffer for inode searching
 	off_t    offset;          // Offset of buf_p inside the block
+	xfs_in_t scratch;         // Candidates are decoded in here before they are accepted
+	size_t   wnd_end     = 0; // First block after the current window
+	bool     wnd_ok      = false;
+	size_t   wnd_start   = 0; // First block of the current window
 
 	for ( size_t cur = start_at; ( false == data->do_stop ) && ( cur < stop_at ); ++cur ) {
-		// reset buffer first, in case we don't read a full block for whatever reasons
-		memset( buf, 0, sb_block_size );
-
-		if ( -1 == pread( fd, buf, sb_block_size, cur * sb_block_size ) ) {
-			log_error( "Read error on AG %u / sector %zu: %m [%d]",
-			           data->ag_num, cur, errno );
-			if ( ++read_errors > 3 ) {
-				log_critical( "Three read errors in a row on AG %u, breaking off!",
-				              data->ag_num );
+		// Read the next window once the current one is used up, handing on what the last one held
+		if ( cur >= wnd_end ) {
+			if ( flush_batch( dir_batch, &dir_cnt, true ) || flush_batch( file_batch, &file_cnt, false ) )
 				goto cleanup;
-			}
-			continue;
-		} // End of encountering a read error
+			wnd_start = cur;
+			wnd_end   = ( ( stop_at - cur ) < wnd_blks ) ? stop_at : cur + wnd_blks;
+			wnd_bytes = ( wnd_end - wnd_start ) * sb_block_size;
+			wnd_ok    = ( ssize_t )wnd_bytes == src_pread( fd, buf, wnd_bytes, cur * sb_block_size, IO_SCAN );
+		}
+		blk = buf + ( ( cur - wnd_start ) * sb_block_size );
+
+		// A failed or short window is read again block by block, so a bad sector costs only its block.
+		if ( !wnd_ok ) {
+			// reset block first, in case we don't read a full block for whatever reasons
+			memset( blk, 0, sb_block_size );
+
+			if ( -1 == src_pread( fd, blk, sb_block_size, cur * sb_block_size, IO_SCAN ) ) {
+				log_error( "Read error on AG %u / sector %zu: %m [%d]",
+				           data->ag_num, cur, errno );
+				if ( ++read_errors > 3 ) {
+					log_critical( "Three read errors in a row on AG %u, breaking off!",
+					              data->ag_num );
+					goto cleanup;
+				}
+				continue;
+			} // End of encountering a read error
+		}
 
 		// Reset read error counter, only consecutive errors lead to a break off
 		read_errors = 0;
@@ -208,46 +264,83 @@ int scanner( void* scan_data ) {
 
 		// Now go through the block and see whether there are inodes inside
 		while ( ( false == data->do_stop ) && ( offset < sb_block_size ) ) {
-			buf_p = buf + offset;
-
+			buf_p = blk + offset;
+
+			/* Deleted inodes and live directories are decoded. Directories are
+			 * always kept, they are needed to rebuild the paths. Deleted files
+			 * must pass the filters and the top-k floor. A deleted directory
+			 * is only recognized while decoding, so deleted inodes failing
+			 * those are still decoded, and only kept if they are directories. */
+			bool is_deleted = is_deleted_inode( buf_p );
 			if ( is_valid_inode( data->sb_data, buf_p )
-			  && (is_deleted_inode( buf_p ) || is_directory_block( buf_p ) ) ) {
-
-				xfs_in_t* inode = xfs_create_in( data->ag_num, cur, offset );
-				if ( NULL == inode )
-					goto cleanup;
+			  && ( is_deleted || is_directory_block( buf_p ) ) ) {
+				bool passes = !is_deleted
+				           || ( filter_match( data->sb_data, buf_p ) && topk_would_keep( buf_p ) );
+
+				/* Most candidates are rejected, so they are decoded into the scratch
+				 * inode first. Only accepted ones are moved onto the heap. */
+				xfs_init_in( &scratch, data->ag_num, cur, offset );
+
+				bool is_good = ( 0 == xfs_read_in( &scratch, buf_p, fd ) )
+				            && ( ( FT_DIR == scratch.ftype ) || ( passes && ( FT_FILE == scratch.ftype ) ) );
+
+				if ( is_good && data->sink ) {
+					// The raw inode is handed on, whoever receives it decodes it again.
+					bool is_dir = FT_DIR == scratch.ftype;
+					xfs_clear_in( &scratch );
+					if ( -1 == data->sink( data->sink_ctx, data->ag_num,
+					                       ( cur * sb_block_size ) + offset, buf_p ) )
+						goto cleanup;
+					if ( is_dir )
+						data->frwrd_dirent++;
+					else
+						data->frwrd_inodes++;
+				} else if ( is_good ) {
+					xfs_in_t* inode = xfs_promote_in( &scratch );
+					int       r     = 0;
 
-				if ( 0 == xfs_read_in( inode, buf_p, fd ) ) {
-					int r = 1;
+					if ( NULL == inode ) {
+						xfs_clear_in( &scratch );
+						goto cleanup;
+					}
 
-					// That inode is good, so push or unshift it.
+					/* That inode is good, so gather it for this window. Inodes come
+					 * in clusters, so whole batches are pushed at once. */
 					if ( FT_DIR == inode->ftype ) {
-						r = dir_in_push( inode );
+						dir_batch[dir_cnt++] = inode;
+						if ( IN_BATCH_MAX == dir_cnt )
+							r = flush_batch( dir_batch, &dir_cnt, true );
 						data->frwrd_dirent++;
-					} else if ( FT_FILE == inode->ftype ) {
-						r = file_in_push( inode );
+					} else if ( topk_is_set() ) {
+						// The heap owns the inode now, and might have freed it already
+						r     = topk_offer( inode );
+						inode = NULL;
+						if ( -1 == r )
+							log_critical( "Inode queue broken? [%d] Breaking off work!", r );
+						data->frwrd_inodes++;
+					} else {
+						file_batch[file_cnt++] = inode;
+						if ( IN_BATCH_MAX == file_cnt )
+							r = flush_batch( file_batch, &file_cnt, false );
 						data->frwrd_inodes++;
-					} else
-						// Other types are irrelevant at this time
-						xfs_free_in( &inode );
+					}
 
-					// Paranoia check against oom
-					if ( -1 == r ) {
-						log_critical( "Inode queue broken? [%d] Breaking off work!", r );
+					// Paranoia check against oom, a broken batch is freed already
+					if ( -1 == r )
 						goto cleanup;
-					}
 
 /// Only scan until enough inodes are dumped.
 #if defined(PWX_DEBUG)
 					// Note: debug_dump_inode returns -1 if enough inodes have been
 					//       Dumped. We don't fail here, just end work early.
-					if ( (0 == r) && (-1 == debug_dump_inode(inode, buf)) ) {
+					if ( inode && (0 == r) && (-1 == debug_dump_inode(inode, blk)) ) {
 						res = 0;
 						goto cleanup;
 					}
 #endif // DEBUG
-				}
-				// No else, would be nothing of interest. Errors have been logged already
+				} else
+					// Nothing of interest. Errors have been logged already
+					xfs_clear_in( &scratch );
 			} // End of having found an inode of interest
 
 			offset += data->sb_data->inode_size;
@@ -261,6 +354,11 @@ int scanner( void* scan_data ) {
 	res = 0;
 
 cleanup:
+	// Whatever the last window found is handed on, even if the scan broke off
+	if ( -1 == flush_batch( dir_batch, &dir_cnt, true ) )
+		res = -1;
+	if ( -1 == flush_batch( file_batch, &file_cnt, false ) )
+		res = -1;
 	if ( fd > -1 )
 		close( fd );
 	FREE_PTR( buf );
@@ -10,9 +10,21 @@
 #include <threads.h>
 
 
+/** @brief Receiver of accepted candidates instead of the inode queues
+  * @param[in] ctx       The `sink_ctx` of the scan data
+  * @param[in] ag_num    AG the inode resides in
+  * @param[in] position  Absolute byte position of the inode
+  * @param[in] data      The raw inode core
+  * @return 0 on success, -1 on error, which makes the scanner break off.
+**/
+typedef int ( *scan_sink_t )( void* ctx, uint32_t ag_num, uint64_t position, uint8_t const* data );
+
+
 /// @brief Thread control struct
 typedef struct _scan_data {
 	uint32_t            ag_num;       //!< Number of the Allocation Group this thread shall handle
+	uint64_t            blk_count;    //!< If not zero, scan only this many blocks from blk_first on
+	uint64_t            blk_first;    //!< First absolute block to scan if blk_count is set
 	char const*         device;       //!< Pointer to the device string. No copy, is never changed.
 	_Atomic( bool )     do_start;     //!< Initialized with false, set to true when the thread may run.
 	_Atomic( bool )     do_stop;      //!< Initialized with false, set to true when the thread shall break off
@@ -23,6 +35,8 @@ typedef struct _scan_data {
 	xfs_sb_t*           sb_data;      //!< The Superblock data this thread shall handle
 	_Atomic( uint64_t ) sec_scanned;  //!< Increased by the thread, questioned by main
 	mtx_t               sleep_lock;   //!< Used for conditional sleeping until signaled
+	scan_sink_t         sink;         //!< If set, accepted candidates go here instead of the queues
+	void*               sink_ctx;     //!< Context handed to the sink
 	int32_t             thread_num;   //!< Number of the thread for logging
 	cnd_t               wakeup_call;  //!< Used by the main thread to signal the thread to continue
 } scan_data_t;
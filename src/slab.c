@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * slab.c : Per-thread slab caches for fixed size structures and arenas
+ ******************************************************************************/
+
+
+#include "directory.h"
+#include "inode.h"
+#include "log.h"
+#include "slab.h"
+#include "stats.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+
+#define SLAB_ALIGN 16                // Structures are aligned like malloc() would
+#define SLAB_BATCH 64                // Structures moved between a thread cache and the pool at once
+#define SLAB_CHUNK ( 64 * 1024 )     // Bytes the pool of a type grows by
+
+
+/// @brief A free structure, linked through its first bytes
+typedef struct _slab_obj {
+	struct _slab_obj* next;
+} slab_obj_t;
+
+
+/// @brief Header of a chunk, the structures follow at SLAB_ALIGN
+typedef struct _slab_chunk {
+	_Alignas( SLAB_ALIGN ) struct _slab_chunk* next;
+} slab_chunk_t;
+
+
+/// @brief The shared pool of one type
+typedef struct _slab_pool {
+	size_t        size;      //!< Structure size, rounded up to SLAB_ALIGN on first use
+	slab_obj_t*   free;      //!< Free structures in no thread cache
+	slab_chunk_t* chunks;    //!< All chunks of this type
+	size_t        chunk_cnt; //!< Number of chunks
+	mtx_t         lock;      //!< Guards all of the above
+	stat_t        stat;      //!< Contention of @a lock
+} slab_pool_t;
+
+
+/// @brief The free structures of one type a thread keeps for itself
+typedef struct _slab_cache {
+	slab_obj_t* head;  //!< First free structure
+	uint32_t    count; //!< Number of free structures
+} slab_cache_t;
+
+
+static slab_pool_t slab_pools[SLAB_TYPES] = {
+	{ .size = ARENA_BLOCK,             .stat = STAT_INIT( "slab arena" )   },
+	{ .size = sizeof( xfs_entry_t ),   .stat = STAT_INIT( "slab entry" )   },
+	{ .size = sizeof( xfs_in_t ),      .stat = STAT_INIT( "slab inode" )   },
+	{ .size = sizeof( xfs_in_data_t ), .stat = STAT_INIT( "slab in data" ) },
+	{ .size = sizeof( xattr_t ),       .stat = STAT_INIT( "slab xattr" )   }
+};
+static tss_t                       slab_key;
+static once_flag                   slab_once      = ONCE_FLAG_INIT;
+static _Thread_local slab_cache_t  slab_cache[SLAB_TYPES];
+static _Thread_local bool          slab_has_cache = false;
+
+
+/// @internal Hand the first @a count structures of a thread cache back to the pool
+static void slab_flush( e_slab_type type, slab_cache_t* cache, uint32_t count ) {
+	slab_pool_t* pool = &slab_pools[type];
+	slab_obj_t*  head = cache->head;
+	slab_obj_t*  tail = head;
+
+	if ( ( NULL == head ) || ( 0 == count ) )
+		return;
+
+	for ( uint32_t i = 1; ( i < count ) && tail->next; ++i, --cache->count )
+		tail = tail->next;
+	cache->head = tail->next;
+	--cache->count;
+
+	stat_lock( &pool->stat, &pool->lock );
+	tail->next = pool->free;
+	pool->free = head;
+	mtx_unlock( &pool->lock );
+}
+
+
+/// @internal Called on thread exit, so the structures of dead threads can be used again
+static void slab_thread_done( void* arg ) {
+	slab_cache_t* cache = ( slab_cache_t* )arg;
+
+	for ( int t = 0; t < SLAB_TYPES; ++t )
+		slab_flush( t, &cache[t], cache[t].count );
+}
+
+
+/// @internal Set up the pools, called once
+static void slab_init( void ) {
+	for ( int t = 0; t < SLAB_TYPES; ++t ) {
+		slab_pools[t].size = ( slab_pools[t].size + SLAB_ALIGN - 1 ) & ~( size_t )( SLAB_ALIGN - 1 );
+		if ( thrd_success != mtx_init( &slab_pools[t].lock, mtx_plain ) )
+			log_critical( "Unable to initialize the lock of %s!", slab_pools[t].stat.name );
+	}
+	if ( thrd_success != tss_create( &slab_key, slab_thread_done ) )
+		log_critical( "%s", "Unable to create the slab thread key!" );
+}
+
+
+/// @internal Make sure the pools are set up and the caches of this thread are flushed on exit
+static void slab_use( void ) {
+	call_once( &slab_once, slab_init );
+
+	if ( !slab_has_cache ) {
+		tss_set( slab_key, slab_cache );
+		slab_has_cache = true;
+	}
+}
+
+
+/// @internal Fill an empty thread cache from the pool, growing it if needed
+static int slab_refill( e_slab_type type, slab_cache_t* cache ) {
+	slab_pool_t* pool = &slab_pools[type];
+
+	slab_use();
+
+	// Take a batch from the pool
+	stat_lock( &pool->stat, &pool->lock );
+	while ( pool->free && ( cache->count < SLAB_BATCH ) ) {
+		slab_obj_t* obj = pool->free;
+		pool->free  = obj->next;
+		obj->next   = cache->head;
+		cache->head = obj;
+		++cache->count;
+	}
+	mtx_unlock( &pool->lock );
+
+	if ( cache->count )
+		return 0;
+
+	// The pool is empty, so it grows by a chunk, which goes to this thread first
+	slab_chunk_t* chunk = malloc( SLAB_CHUNK );
+	if ( NULL == chunk ) {
+		log_critical( "Unable to allocate %d bytes for %s: %m [%d]", SLAB_CHUNK, pool->stat.name, errno );
+		return -1;
+	}
+
+	uint8_t* first = ( uint8_t* )chunk + sizeof( slab_chunk_t );
+	size_t   count = ( SLAB_CHUNK - sizeof( slab_chunk_t ) ) / pool->size;
+	for ( size_t i = count; i > 0; --i ) {
+		slab_obj_t* obj = ( slab_obj_t* )( first + ( ( i - 1 ) * pool->size ) );
+		obj->next   = cache->head;
+		cache->head = obj;
+		++cache->count;
+	}
+
+	stat_lock( &pool->stat, &pool->lock );
+	chunk->next  = pool->chunks;
+	pool->chunks = chunk;
+	++pool->chunk_cnt;
+	mtx_unlock( &pool->lock );
+
+	return 0;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void* arena_alloc( arena_t** arena, size_t size ) {
+	RETURN_NULL_IF_NULL( arena );
+
+	size_t   need  = ( size + 7 ) & ~( size_t )7;
+	size_t   avail = ARENA_BLOCK - sizeof( arena_t );
+	arena_t* blk   = *arena;
+
+	if ( ( NULL == blk ) || ( ( blk->size - blk->used ) < need ) ) {
+		if ( need > avail )
+			blk = malloc( sizeof( arena_t ) + need );
+		else
+			blk = slab_alloc( SLAB_ARENA );
+
+		if ( NULL == blk ) {
+			log_critical( "Unable to allocate %zu bytes for arena block!", sizeof( arena_t ) + need );
+			return NULL;
+		}
+
+		blk->size = need > avail ? need : avail;
+		blk->used = 0;
+
+		// An oversized block is used up at once, so the current block stays in front
+		if ( *arena && ( need > avail ) ) {
+			blk->next        = ( *arena )->next;
+			( *arena )->next = blk;
+		} else {
+			blk->next = *arena;
+			*arena    = blk;
+		}
+	}
+
+	void* mem = blk->data + blk->used;
+	blk->used += need;
+	memset( mem, 0, size );
+
+	return mem;
+}
+
+
+void arena_free( arena_t** arena ) {
+	RETURN_VOID_IF_NULL( arena );
+
+	arena_t* blk = *arena;
+	*arena = NULL;
+
+	while ( blk ) {
+		arena_t* next = blk->next;
+		if ( blk->size > ( ARENA_BLOCK - sizeof( arena_t ) ) )
+			free( blk );
+		else
+			slab_free( SLAB_ARENA, blk );
+		blk = next;
+	}
+}
+
+
+void* slab_alloc( e_slab_type type ) {
+	slab_cache_t* cache = &slab_cache[type];
+
+	if ( ( NULL == cache->head ) && ( -1 == slab_refill( type, cache ) ) )
+		return NULL;
+
+	slab_obj_t* obj = cache->head;
+	cache->head = obj->next;
+	--cache->count;
+
+	memset( obj, 0, slab_pools[type].size );
+
+	return obj;
+}
+
+
+void slab_free( e_slab_type type, void* obj ) {
+	if ( NULL == obj )
+		return;
+
+	slab_cache_t* cache = &slab_cache[type];
+	slab_obj_t*   sobj  = ( slab_obj_t* )obj;
+
+	if ( !slab_has_cache )
+		slab_use();
+
+	sobj->next  = cache->head;
+	cache->head = sobj;
+
+	// Consumers free what producers allocate, so their caches must not grow forever
+	if ( ++cache->count >= ( 2 * SLAB_BATCH ) )
+		slab_flush( type, cache, SLAB_BATCH );
+}
+
+
+void slab_release( void ) {
+	call_once( &slab_once, slab_init );
+
+	for ( int t = 0; t < SLAB_TYPES; ++t ) {
+		slab_pool_t* pool = &slab_pools[t];
+
+		mtx_lock( &pool->lock );
+		if ( pool->chunk_cnt ) {
+			log_debug( "%s: %zu chunks, %zu KiB", pool->stat.name, pool->chunk_cnt,
+			           pool->chunk_cnt * SLAB_CHUNK / 1024 );
+		}
+		while ( pool->chunks ) {
+			slab_chunk_t* next = pool->chunks->next;
+			FREE_PTR( pool->chunks );
+			pool->chunks = next;
+		}
+		pool->chunk_cnt = 0;
+		pool->free      = NULL;
+		mtx_unlock( &pool->lock );
+
+		slab_cache[t].head  = NULL;
+		slab_cache[t].count = 0;
+	}
+}
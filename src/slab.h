@@ -0,0 +1,80 @@
+#ifndef PWX_XFS_UNDELETE_SRC_SLAB_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_SLAB_H_INCLUDED 1
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define ARENA_BLOCK 512 // Size of a standard arena block, including its header
+
+
+/// @brief The fixed size structures that have a slab of their own
+typedef enum _slab_type {
+	SLAB_ARENA = 0, //!< Standard arena blocks of ARENA_BLOCK bytes
+	SLAB_ENTRY,     //!< xfs_entry_t
+	SLAB_INODE,     //!< xfs_in_t
+	SLAB_IN_DATA,   //!< xfs_in_data_t
+	SLAB_XATTR,     //!< xattr_t
+	SLAB_TYPES      //!< Number of slabs, must be last
+} e_slab_type;
+
+
+/** @brief Region of variable sized data that is freed all at once
+  *
+  * An arena is a chain of blocks, the newest first. Allocations are cut
+  * from the newest block, and only arena_free() gives memory back.
+**/
+typedef struct _arena {
+	struct _arena* next;   //!< Next older block
+	size_t         size;   //!< Usable bytes in @a data
+	size_t         used;   //!< Bytes handed out from @a data
+	uint8_t        data[]; //!< The memory handed out
+} arena_t;
+
+
+/** @brief Get @a size zeroed bytes from an arena
+  *
+  * @param[in,out] arena  The arena, a new one is started if *arena is NULL
+  * @param[in]     size   Number of bytes needed
+  * @return Pointer to the memory, aligned to 8 bytes, or NULL if out of memory.
+**/
+void* arena_alloc( arena_t** arena, size_t size );
+
+
+/** @brief Free all blocks of an arena at once
+  * @param[in,out] arena  The arena to free, *arena is set to NULL
+**/
+void arena_free( arena_t** arena );
+
+
+/** @brief Get one zeroed structure of the given type
+  *
+  * Every thread has a cache of free structures per type. It is refilled
+  * from, and spilled back to, the shared pool in batches, so only one in
+  * many calls takes a lock. The pool grows in chunks that are never
+  * handed back before slab_release(), so long runs do not fragment.
+  *
+  * @param[in] type  The structure type
+  * @return Pointer to the structure, or NULL if out of memory.
+**/
+void* slab_alloc( e_slab_type type );
+
+
+/** @brief Return a structure from slab_alloc() to the cache of the calling thread
+  * @param[in] type  The structure type, must be the one used with slab_alloc()
+  * @param[in] obj   The structure, NULL is ignored
+**/
+void slab_free( e_slab_type type, void* obj );
+
+
+/** @brief Free all pools
+  *
+  * Everything ever returned by slab_alloc() becomes invalid, so only call
+  * this when all threads are gone and all inodes are freed.
+**/
+void slab_release( void );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_SLAB_H_INCLUDED
@@ -0,0 +1,409 @@
+/*******************************************************************************
+ * spill.c : Disk backed overflow of the inode queues
+ ******************************************************************************/
+
+
+#include "globals.h"
+#include "log.h"
+#include "slab.h"
+#include "spill.h"
+#include "stats.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <unistd.h>
+
+
+#define SPILL_REC_MAGIC "XUSR"
+#define SPILL_SEG_SIZE  ( 64 * 1024 * 1024 ) // Start a new segment after this many bytes
+
+
+/// @brief Header of one spilled inode, followed by @a rec_len bytes
+typedef struct _spill_rec_hdr {
+	char     magic[4];  //!< SPILL_REC_MAGIC
+	uint32_t ext_cnt;   //!< Packed data extents following the inode structure
+	uint32_t xext_cnt;  //!< Packed xattr extents following the data extents
+	uint32_t xattr_cnt; //!< Extended attributes following the xattr extents
+	uint32_t loc_len;   //!< Bytes of local data following the extended attributes
+	uint32_t rec_len;   //!< Bytes following this header, all of the above
+} spill_rec_hdr_t;
+
+
+/// @brief Header of one spilled extended attribute, followed by name and value
+typedef struct _spill_xattr {
+	uint8_t  flags;     //!< xattr flags
+	uint8_t  padding;   //!< Must be zero
+	uint16_t name_len;  //!< Bytes of the name, without termination
+	uint32_t value_len; //!< Bytes of the value, without termination
+} spill_xattr_t;
+
+
+static char         spill_dir[PATH_MAX] = { 0x0 };
+static mtx_t        spill_lock;
+static stat_t       spill_stat   = STAT_INIT( "spill" );
+static atomic_ulong spill_cnt    = 0;     //!< Inodes on disk
+static uint32_t     spill_first  = 0;     //!< Number of the oldest segment not fully read
+static uint32_t     spill_last   = 0;     //!< Number of the segment being written
+static FILE*        spill_rd     = NULL;  //!< Oldest segment, being read back
+static uint32_t*    spill_segs   = NULL;  //!< Inodes not read back yet, per segment number
+static uint32_t     spill_seg_sz = 0;     //!< Number of counters @a spill_segs has room for
+static FILE*        spill_wr     = NULL;  //!< Newest segment, being written
+static uint64_t     spill_wr_len = 0;     //!< Bytes written into @a spill_wr
+
+
+/// @internal Build the path of segment number @a seg
+static void seg_path( char* path, uint32_t seg ) {
+	snprintf( path, PATH_MAX, "%s/spill-%d-%u.xus", spill_dir, ( int )getpid(), seg );
+}
+
+
+/// @internal Close the segment being written, so it can be read back
+static void seal_segment( void ) {
+	if ( spill_wr ) {
+		fclose( spill_wr );
+		spill_wr = NULL;
+		++spill_last;
+	}
+	spill_wr_len = 0;
+}
+
+
+/// @internal Drop what is left of the segment being read, so its inodes are no longer counted
+static void drop_segment( void ) {
+	atomic_fetch_sub( &spill_cnt, spill_segs[spill_first] );
+	spill_segs[spill_first] = 0;
+}
+
+
+/// @internal Make room for the counter of segment @a seg, returns 0 on success, -1 on error
+static int grow_segments( uint32_t seg ) {
+	if ( seg < spill_seg_sz )
+		return 0;
+
+	uint32_t  size  = spill_seg_sz ? spill_seg_sz * 2 : 64;
+	uint32_t* segs  = NULL;
+
+	while ( size <= seg )
+		size *= 2;
+	segs = realloc( spill_segs, size * sizeof( uint32_t ) );
+	if ( NULL == segs ) {
+		log_critical( "Unable to allocate %u spill segment counters: %m [%d]", size, errno );
+		return -1;
+	}
+	memset( segs + spill_seg_sz, 0, ( size - spill_seg_sz ) * sizeof( uint32_t ) );
+	spill_segs   = segs;
+	spill_seg_sz = size;
+
+	return 0;
+}
+
+
+/// @internal Count and size the parts of an inode, returns false if it can not be spilled
+static bool size_inode( xfs_in_t const* in, spill_rec_hdr_t* hdr ) {
+	xfs_in_data_t const* in_data = in->data;
+
+	if ( in_data && in_data->d_dir_root )
+		return false;
+
+	memset( hdr, 0, sizeof( spill_rec_hdr_t ) );
+	memcpy( hdr->magic, SPILL_REC_MAGIC, 4 );
+	hdr->rec_len = sizeof( xfs_in_t );
+
+	hdr->ext_cnt  = in->d_exts ? in->d_exts->count : 0;
+	hdr->rec_len += hdr->ext_cnt * XFS_EX_SIZE;
+	if ( NULL == in_data )
+		return true;
+
+	hdr->xext_cnt = in_data->x_exts ? in_data->x_exts->count : 0;
+	hdr->rec_len += hdr->xext_cnt * XFS_EX_SIZE;
+	for ( xattr_t const* xa = in_data->xattr_root; xa; xa = xa->next, ++hdr->xattr_cnt )
+		hdr->rec_len += sizeof( spill_xattr_t )
+		              + ( xa->name  ? strlen( xa->name  ) : 0 )
+		              + ( xa->value ? strlen( xa->value ) : 0 );
+	if ( in_data->d_loc_data ) {
+		hdr->loc_len  = in->file_size;
+		hdr->rec_len += hdr->loc_len;
+	}
+
+	return true;
+}
+
+
+/// @internal Write the packed extents of a vector, returns 0 on success, -1 on error
+static int write_extents( xfs_ex_vec_t const* vec ) {
+	if ( vec && vec->count && ( 1 != fwrite( vec->packed, ( size_t )vec->count * XFS_EX_SIZE, 1, spill_wr ) ) )
+		return -1;
+	return 0;
+}
+
+
+/// @internal Read @a count packed extents into a new vector, returns NULL on error
+static xfs_ex_vec_t* read_extents( uint32_t count ) {
+	xfs_ex_vec_t* vec = xfs_ex_create( NULL, count );
+
+	if ( vec && ( 1 != fread( vec->packed, ( size_t )count * XFS_EX_SIZE, 1, spill_rd ) ) )
+		xfs_ex_free( &vec );
+
+	return vec;
+}
+
+
+/// @internal Read the rest of a record behind @a hdr into a new inode
+static xfs_in_t* read_inode( spill_rec_hdr_t const* hdr ) {
+	xfs_in_t* in = slab_alloc( SLAB_INODE );
+
+	if ( NULL == in ) {
+		log_critical( "Unable to allocate %zu bytes for inode structure: %m [%d]", sizeof( xfs_in_t ), errno );
+		return NULL;
+	}
+
+	if ( 1 != fread( in, sizeof( xfs_in_t ), 1, spill_rd ) ) {
+		slab_free( SLAB_INODE, in );
+		return NULL;
+	}
+
+	// The pointers are from the writing run and meaningless now
+	in->d_exts = NULL;
+	in->data   = NULL;
+
+	bool           is_ok   = ( in->ag_num < sb_ag_count );
+	xfs_in_data_t* in_data = NULL;
+
+	if ( is_ok && hdr->ext_cnt )
+		is_ok = NULL != ( in->d_exts = read_extents( hdr->ext_cnt ) );
+	if ( is_ok && ( hdr->xext_cnt || hdr->xattr_cnt || hdr->loc_len ) )
+		is_ok = NULL != ( in_data = xfs_get_in_data( in ) );
+	if ( is_ok && hdr->xext_cnt )
+		is_ok = NULL != ( in_data->x_exts = read_extents( hdr->xext_cnt ) );
+
+	xattr_t* curr = NULL;
+	for ( uint32_t i = 0; is_ok && ( i < hdr->xattr_cnt ); ++i ) {
+		spill_xattr_t sxa;
+		xattr_t*      next = slab_alloc( SLAB_XATTR );
+
+		is_ok = ( NULL != next ) && ( 1 == fread( &sxa, sizeof( sxa ), 1, spill_rd ) );
+		if ( is_ok ) {
+			next->flags = sxa.flags;
+			next->name  = arena_alloc( &in_data->arena, sxa.name_len  + 1 );
+			next->value = arena_alloc( &in_data->arena, sxa.value_len + 1 );
+			is_ok = next->name && next->value
+			     && ( !sxa.name_len  || ( 1 == fread( next->name,  sxa.name_len,  1, spill_rd ) ) )
+			     && ( !sxa.value_len || ( 1 == fread( next->value, sxa.value_len, 1, spill_rd ) ) );
+		}
+		if ( next ) {
+			// Chain it in even if broken, xfs_free_in() cleans up.
+			if ( curr )
+				curr->next = next;
+			else
+				in_data->xattr_root = next;
+			curr = next;
+		}
+	}
+
+	if ( is_ok && hdr->loc_len ) {
+		in_data->d_loc_data = arena_alloc( &in_data->arena, hdr->loc_len );
+		is_ok = in_data->d_loc_data && ( 1 == fread( in_data->d_loc_data, hdr->loc_len, 1, spill_rd ) );
+	}
+
+	if ( !is_ok ) {
+		log_error( "Broken spilled inode %llu, dropping it", in->inode_id );
+		xfs_drop_in( &in );
+	}
+
+	return in;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void spill_close( void ) {
+	char path[PATH_MAX] = { 0x0 };
+
+	if ( !spill_dir[0] )
+		return;
+
+	stat_lock( &spill_stat, &spill_lock );
+	if ( spill_rd ) {
+		fclose( spill_rd );
+		spill_rd = NULL;
+	}
+	if ( spill_wr ) {
+		fclose( spill_wr );
+		spill_wr = NULL;
+	}
+	for ( uint32_t seg = spill_first; seg <= spill_last; ++seg ) {
+		seg_path( path, seg );
+		unlink( path );
+	}
+	if ( spill_cnt ) {
+		log_debug( "Dropped %lu spilled inodes", ( unsigned long )spill_cnt );
+	}
+	FREE_PTR( spill_segs );
+	spill_seg_sz = 0;
+	spill_cnt    = 0;
+	spill_dir[0] = 0x0;
+	mtx_unlock( &spill_lock );
+
+	mtx_destroy( &spill_lock );
+}
+
+
+uint64_t spill_count( void ) {
+	return atomic_load( &spill_cnt );
+}
+
+
+bool spill_is_open( void ) {
+	return 0x0 != spill_dir[0];
+}
+
+
+int spill_open( char const* dir ) {
+	RETURN_INT_IF_NULL( dir );
+
+	if ( mkdirs( dir ) ) {
+		log_error( "Can not create spill directory %s: %m [%d]", dir, errno );
+		return -1;
+	}
+
+	if ( thrd_success != mtx_init( &spill_lock, mtx_plain ) ) {
+		log_critical( "Unable to initialize the spill lock: %m [%d]", errno );
+		return -1;
+	}
+
+	snprintf( spill_dir, PATH_MAX, "%s", dir );
+	spill_first = 0;
+	spill_last  = 0;
+	log_info( "Spilling queued inodes into %s if needed", dir );
+
+	return 0;
+}
+
+
+xfs_in_t* spill_read( void ) {
+	char             path[PATH_MAX] = { 0x0 };
+	spill_rec_hdr_t  hdr;
+	xfs_in_t*        in             = NULL;
+
+	if ( !spill_dir[0] || !atomic_load( &spill_cnt ) )
+		return NULL;
+
+	stat_lock( &spill_stat, &spill_lock );
+	while ( ( NULL == in ) && atomic_load( &spill_cnt ) ) {
+		if ( NULL == spill_rd ) {
+			// The consumers caught up with the writer, so the segment being written is sealed early
+			if ( spill_first == spill_last )
+				seal_segment();
+			seg_path( path, spill_first );
+			spill_rd = fopen( path, "rb" );
+			if ( NULL == spill_rd ) {
+				log_error( "Can not read spill segment %s, dropping %u inodes: %m [%d]",
+				           path, spill_segs[spill_first], errno );
+				drop_segment();
+				++spill_first;
+				continue;
+			}
+		}
+
+		// A segment is done once all inodes counted for it are read, whatever follows is a broken record
+		if ( 0 == spill_segs[spill_first] ) {
+			fclose( spill_rd );
+			spill_rd = NULL;
+			seg_path( path, spill_first++ );
+			unlink( path );
+			continue;
+		}
+
+		if ( ( 1 != fread( &hdr, sizeof( hdr ), 1, spill_rd ) )
+		  || memcmp( hdr.magic, SPILL_REC_MAGIC, 4 ) ) {
+			log_error( "Spill segment %u is corrupt, dropping the last %u inodes of it",
+			           spill_first, spill_segs[spill_first] );
+			drop_segment();
+			continue;
+		}
+
+		in = read_inode( &hdr );
+		spill_segs[spill_first]--;
+		atomic_fetch_sub( &spill_cnt, 1 );
+	}
+	mtx_unlock( &spill_lock );
+
+	return in;
+}
+
+
+int spill_write( xfs_in_t** in ) {
+	RETURN_INT_IF_NULL( in );
+	RETURN_INT_IF_NULL( *in );
+
+	char            path[PATH_MAX] = { 0x0 };
+	spill_rec_hdr_t hdr;
+	xfs_in_t const* lin            = *in;
+	int             res            = -1;
+
+	if ( !spill_dir[0] || !size_inode( lin, &hdr ) )
+		return 0;
+
+	stat_lock( &spill_stat, &spill_lock );
+
+	if ( spill_wr_len > SPILL_SEG_SIZE )
+		seal_segment();
+	if ( NULL == spill_wr ) {
+		if ( -1 == grow_segments( spill_last ) )
+			goto unlock;
+		seg_path( path, spill_last );
+		spill_wr = fopen( path, "wb" );
+		if ( NULL == spill_wr ) {
+			log_error( "Can not create spill segment %s: %m [%d]", path, errno );
+			goto unlock;
+		}
+	}
+
+	// The pointers are written, too, but never used when read back.
+	if ( ( 1 != fwrite( &hdr, sizeof( hdr ), 1, spill_wr ) )
+	  || ( 1 != fwrite( lin, sizeof( xfs_in_t ), 1, spill_wr ) )
+	  || write_extents( lin->d_exts )
+	  || ( lin->data && write_extents( lin->data->x_exts ) ) )
+		goto write_error;
+
+	for ( xattr_t const* xa = lin->data ? lin->data->xattr_root : NULL; xa; xa = xa->next ) {
+		spill_xattr_t sxa = {
+			.flags     = xa->flags,
+			.name_len  = xa->name  ? strlen( xa->name  ) : 0,
+			.value_len = xa->value ? strlen( xa->value ) : 0
+		};
+		if ( ( 1 != fwrite( &sxa, sizeof( sxa ), 1, spill_wr ) )
+		  || ( sxa.name_len  && ( 1 != fwrite( xa->name,  sxa.name_len,  1, spill_wr ) ) )
+		  || ( sxa.value_len && ( 1 != fwrite( xa->value, sxa.value_len, 1, spill_wr ) ) ) )
+			goto write_error;
+	}
+
+	if ( hdr.loc_len && ( 1 != fwrite( lin->data->d_loc_data, hdr.loc_len, 1, spill_wr ) ) )
+		goto write_error;
+
+	spill_wr_len += sizeof( hdr ) + hdr.rec_len;
+	spill_segs[spill_last]++;
+	atomic_fetch_add( &spill_cnt, 1 );
+	xfs_free_in( in );
+	res = 1;
+	goto unlock;
+
+write_error:
+	// The half written record is not counted, so the reader stops in front of it.
+	// Sealing makes sure the next write does not truncate the records before it.
+	log_error( "Writing spill segment %u failed: %m [%d]", spill_last, errno );
+	seal_segment();
+
+unlock:
+	mtx_unlock( &spill_lock );
+
+	return res;
+}
@@ -0,0 +1,61 @@
+#ifndef PWX_XFS_UNDELETE_SRC_SPILL_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_SPILL_H_INCLUDED 1
+#pragma once
+
+
+#include "inode.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** @brief Remove all spill segments and stop spilling
+  *
+  * Inodes still spilled are lost, so call this after the queues are done.
+**/
+void spill_close( void );
+
+
+/// @brief Return the number of inodes currently spilled to disk
+uint64_t spill_count( void );
+
+
+/// @brief Return true if a spill directory is set up
+bool spill_is_open( void );
+
+
+/** @brief Set up spilling of queued inodes into segment files in @a dir
+  *
+  * Segments are named spill-<pid>-<number>.xus and hold up to SPILL_SEG_SIZE
+  * bytes each. They are written sequentially, and read back in the same
+  * order once the queue consumers catch up. A segment that was read back
+  * completely is removed.
+  *
+  * @param[in] dir  Directory for the segments, is created if needed
+  * @return 0 on success, -1 on failure.
+**/
+int spill_open( char const* dir );
+
+
+/** @brief Read back the oldest spilled inode
+  *
+  * @return A new inode structure, or NULL if nothing is spilled or reading failed.
+**/
+xfs_in_t* spill_read( void );
+
+
+/** @brief Serialize an inode into the current spill segment
+  *
+  * The record holds the decoded inode fields, including its location and
+  * what restore_inode() found out, followed by the data and xattr extents,
+  * the extended attributes and any local data. Inodes with a directory
+  * structure are not spilled.
+  *
+  * @param[in,out] in  The inode to spill, it is freed and set to NULL if spilled
+  * @return 1 if spilled, 0 if the inode can not be spilled, -1 on error.
+**/
+int spill_write( xfs_in_t** in );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_SPILL_H_INCLUDED
@@ -0,0 +1,155 @@
+/*******************************************************************************
+ * stats.c : Lock and queue contention figures
+ ******************************************************************************/
+
+
+#include "log.h"
+#include "stats.h"
+#include "utils.h"
+
+
+#include <stdio.h>
+#include <time.h>
+
+
+/* Stats are only ever added, so the list can be walked without a lock.
+ * A lock would be taken while the stat's own lock is held, and logging
+ * the report takes the log lock, which is a stat itself. */
+static _Atomic( stat_t* )    stat_head = NULL;
+static _Thread_local uint32_t stat_tick = 0;
+
+
+/// @internal Put @a st into the report list, if it is not there, yet
+static void stat_list( stat_t* st ) {
+	if ( atomic_exchange( &st->listed, true ) )
+		return;
+
+	st->next = atomic_load( &stat_head );
+	while ( !atomic_compare_exchange_weak( &stat_head, &st->next, st ) ) { }
+}
+
+
+/// @internal Upper bound in microseconds of the bucket holding the @a pct percentile of timed waits
+static uint64_t stat_percentile( stat_t const* st, uint64_t sampled, uint32_t pct ) {
+	uint64_t seen = 0;
+	uint64_t want = ( ( sampled * pct ) + 99 ) / 100;
+
+	for ( uint32_t b = 0; b < STAT_BUCKETS; ++b ) {
+		seen += atomic_load( &st->hist[b] );
+		if ( seen >= want )
+			return 1ULL << b;
+	}
+
+	return 1ULL << ( STAT_BUCKETS - 1 );
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void stat_depth( stat_t* st, uint64_t depth ) {
+	RETURN_VOID_IF_NULL( st );
+
+	uint64_t max = atomic_load_explicit( &st->depth_max, memory_order_relaxed );
+
+	if ( max >= depth )
+		return;
+
+	stat_list( st );
+	while ( ( max < depth )
+	     && !atomic_compare_exchange_weak_explicit( &st->depth_max, &max, depth,
+	                                                memory_order_relaxed, memory_order_relaxed ) ) { }
+}
+
+
+void stat_lock( stat_t* st, mtx_t* lock ) {
+	if ( thrd_success == mtx_trylock( lock ) ) {
+		atomic_fetch_add_explicit( &st->taken, 1, memory_order_relaxed );
+		if ( !atomic_load_explicit( &st->listed, memory_order_relaxed ) )
+			stat_list( st );
+		return;
+	}
+
+	if ( 0 != ( ++stat_tick % STAT_SAMPLE ) ) {
+		mtx_lock( lock );
+		atomic_fetch_add_explicit( &st->taken,     1, memory_order_relaxed );
+		atomic_fetch_add_explicit( &st->contended, 1, memory_order_relaxed );
+		return;
+	}
+
+	uint64_t start = stat_now_ns();
+	mtx_lock( lock );
+	uint64_t waited = stat_now_ns() - start;
+
+	// Bucket n holds waits below 2^n microseconds
+	uint32_t bucket = 0;
+	for ( uint64_t us = waited / 1000; us && ( bucket < ( STAT_BUCKETS - 1 ) ); us >>= 1 )
+		++bucket;
+
+	atomic_fetch_add_explicit( &st->taken,        1,      memory_order_relaxed );
+	atomic_fetch_add_explicit( &st->contended,    1,      memory_order_relaxed );
+	atomic_fetch_add_explicit( &st->sampled,      1,      memory_order_relaxed );
+	atomic_fetch_add_explicit( &st->wait_ns,      waited, memory_order_relaxed );
+	atomic_fetch_add_explicit( &st->hist[bucket], 1,      memory_order_relaxed );
+	if ( !atomic_load_explicit( &st->listed, memory_order_relaxed ) )
+		stat_list( st );
+}
+
+
+void stat_log( bool full ) {
+	char   line[256] = { 0x0 };
+	size_t len       = 0;
+
+	for ( stat_t* st = atomic_load( &stat_head ); st; st = st->next ) {
+		uint64_t taken     = atomic_load( &st->taken );
+		uint64_t contended = atomic_load( &st->contended );
+		uint64_t sampled   = atomic_load( &st->sampled );
+		uint64_t wait_ns   = atomic_load( &st->wait_ns );
+		uint64_t depth_max = atomic_load( &st->depth_max );
+		double   rate      = taken ? ( double )contended / ( double )taken * 100. : 0.;
+
+		if ( !full ) {
+			if ( taken && ( len < sizeof( line ) ) )
+				len += snprintf( line + len, sizeof( line ) - len, "%s%s %.2f%%",
+				                 len ? ", " : "", st->name, rate );
+			continue;
+		}
+
+		// Locks nobody had to wait for are not worth a report
+		if ( !contended && !depth_max )
+			continue;
+
+		// The average of the timed waits stands in for all of them
+		double avg_us = sampled ? ( double )wait_ns / ( double )sampled / 1000. : 0.;
+		if ( contended )
+			log_info( "%-12s: taken %lu, contended %lu (%.2f%%), ~%.1f ms waited, avg %.1f us, p50 < %lu us, p99 < %lu us",
+			          st->name, taken, contended, rate, avg_us * ( double )contended / 1000., avg_us,
+			          sampled ? stat_percentile( st, sampled, 50 ) : 0,
+			          sampled ? stat_percentile( st, sampled, 99 ) : 0 );
+		if ( depth_max )
+			log_info( "%-12s: high-water mark %lu", st->name, depth_max );
+
+		if ( sampled ) {
+			len = 0;
+			for ( uint32_t b = 0; ( b < STAT_BUCKETS ) && ( len < sizeof( line ) ); ++b ) {
+				uint64_t cnt = atomic_load( &st->hist[b] );
+				if ( cnt && ( b < ( STAT_BUCKETS - 1 ) ) )
+					len += snprintf( line + len, sizeof( line ) - len, " <%luus:%lu", 1UL << b, cnt );
+				else if ( cnt )
+					len += snprintf( line + len, sizeof( line ) - len, " >=%luus:%lu", 1UL << ( b - 1 ), cnt );
+			}
+			log_info( "%-12s: waits%s", st->name, line );
+			len = 0;
+		}
+	}
+
+	if ( len )
+		log_info( "Lock contention: %s", line );
+}
+
+
+uint64_t stat_now_ns( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ( ( uint64_t )ts.tv_sec * 1000000000ULL ) + ts.tv_nsec;
+}
@@ -0,0 +1,72 @@
+#ifndef PWX_XFS_UNDELETE_SRC_STATS_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_STATS_H_INCLUDED 1
+#pragma once
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+
+#define STAT_BUCKETS 16 // Wait histogram buckets, bucket n counts waits below 2^n microseconds
+#define STAT_SAMPLE  8  // Only every n-th contended wait of a thread is timed
+
+
+/** @brief Contention figures of one lock or queue
+  *
+  * Define these with static storage, using STAT_INIT(), and take the lock
+  * with stat_lock(). A stat shows up in the reports once it was used.
+**/
+typedef struct _stat {
+	char const*          name;               //!< Shown in the reports
+	atomic_bool          listed;             //!< Set once the stat is in the report list
+	atomic_uint_fast64_t taken;              //!< Times the lock was taken
+	atomic_uint_fast64_t contended;          //!< Times the lock was held by another thread
+	atomic_uint_fast64_t sampled;            //!< Contended waits that were timed
+	atomic_uint_fast64_t wait_ns;            //!< Nanoseconds of all timed waits
+	atomic_uint_fast64_t hist[STAT_BUCKETS]; //!< Timed waits by duration
+	atomic_uint_fast64_t depth_max;          //!< Highest depth seen, for queues
+	struct _stat*        next;               //!< Next stat in the report list
+} stat_t;
+
+
+/// @brief Static initializer for a stat_t named @a name_
+#define STAT_INIT( name_ ) { .name = ( name_ ) }
+
+
+/** @brief Remember a queue depth, if it is the highest so far
+  *
+  * @param[in,out] st     The stat of the queue
+  * @param[in]     depth  Elements in the queue
+**/
+void stat_depth( stat_t* st, uint64_t depth );
+
+
+/** @brief Take @a lock and count whether somebody else had it
+  *
+  * An uncontended lock costs one mtx_trylock() and a counter. If the lock
+  * is held, every STAT_SAMPLE-th wait of the calling thread is timed, so
+  * the clock stays out of the hot path.
+  *
+  * @param[in,out] st    The stat of the lock
+  * @param[in]     lock  The lock to take
+**/
+void stat_lock( stat_t* st, mtx_t* lock );
+
+
+/** @brief Log the figures of all stats used so far
+  *
+  * @param[in] full  If false, one line with the contention rate of each
+  *                  lock. If true, a report per lock with the wait
+  *                  histogram, percentiles and the queue high-water mark,
+  *                  leaving out locks that were never contended.
+**/
+void stat_log( bool full );
+
+
+/// @brief Monotonic time in nanoseconds
+uint64_t stat_now_ns( void );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_STATS_H_INCLUDED
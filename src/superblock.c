@@ -3,7 +3,7 @@
  ******************************************************************************/
 
 
-#include "device.h"
+#include "backend.h"
 #include "globals.h"
 #include "log.h"
 #include "superblock.h"
@@ -25,15 +25,7 @@ int xfs_read_sb( xfs_sb_t* sb, int fd, uint32_t ag_num, uint32_t ag_size, uint32
 
 	log_debug( "Reading AG %u at 0x%08x ...", ag_num, offset );
 
-	off_t   pos      = lseek( fd, offset, SEEK_SET );
-
-	if ( offset != pos ) {
-		log_critical( "Could not seek to 0x%08x, ended up at 0x%08x!", offset, pos );
-		log_critical( "%m [%d]", errno );
-		return -1;
-	}
-
-	res = read( fd, buf, 271 );
+	res = src_pread( fd, buf, 271, offset, IO_SUPERBLOCK );
 
 	if ( -1 == res ) {
 		log_critical( "Can not read 271 bytes from 0x%08x : %m [%d]", offset, errno );
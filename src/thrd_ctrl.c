@@ -4,9 +4,12 @@
 
 
 #include "analyzer.h"
+#include "catalog.h"
 #include "globals.h"
+#include "inode_queue.h"
 #include "log.h"
 #include "scanner.h"
+#include "stats.h"
 #include "thrd_ctrl.h"
 #include "utils.h"
 #include "writer.h"
@@ -29,12 +32,13 @@ static int create_threads_array() {
 		/* The maximum number of threads is 3 * sb_ag_count, and we can just create that array.
 		 * It would be an enormous undertaking to optimize this array size, and still get the
 		 * numbers of the threads right everywhere. It is much simpler to create the full array,
-		 * which will have a size of 12 in most cases anyway.
+		 * which will have a size of 13 in most cases anyway.
+		 * Thread numbers start at 1, so the array needs one more slot than there are threads.
 		 */
-		threads = ( thrd_t* )calloc( sb_ag_count * 3, sizeof( thrd_t ) );
+		threads = ( thrd_t* )calloc( ( sb_ag_count * 3 ) + 1, sizeof( thrd_t ) );
 		if ( NULL == threads ) {
 			log_critical( "Unable to allocate %zu bytes for threads array! %m [%d]",
-			              sizeof( thrd_t ) * sb_ag_count, errno );
+			              sizeof( thrd_t ) * ( ( sb_ag_count * 3 ) + 1 ), errno );
 			return -1;
 		}
 	}
@@ -97,7 +101,8 @@ void cleanup_threads( void ) {
 
 void end_threads( void ) {
 
-	/// 1) Wake them all up
+	/// 1) Wake them all up, blocked scanners included
+	in_set_watermarks( 0, 0 );
 	wakeup_threads( false );
 
 	/// 2) Join all running threads
@@ -260,21 +265,29 @@ void monitor_threads( uint32_t max_threads, bool end_with_scanners ) {
 	uint64_t frwrd_dirent      = 0;
 	uint64_t frwrd_inodes      = 0;
 	bool     is_scanning       = true;
+	in_stats_t queues          = { 0 };
 	uint32_t running           = threads_running( &is_scanning );
 	uint64_t sec_scanned       = 0;
 	struct timespec sleep_time = { .tv_nsec = 500000000 };
+	uint32_t ticks             = 0;
 	uint64_t undeleted         = 0;
 
 	while ( running && ( is_scanning || !end_with_scanners ) ) {
+		// Every ten seconds, tell how contended the locks are
+		if ( 0 == ( ++ticks % 20 ) )
+			stat_log( false );
+
 		get_analyzer_stats( &analyzed,    &found_dirent, &found_files  );
 		get_scanner_stats(  &sec_scanned, &frwrd_dirent, &frwrd_inodes );
 		get_writer_stats(   &undeleted );
+		in_get_stats(       &queues );
 
 		show_progress( "[% 2lu/ 2%lu] % 10llu/% 10llu sec (%6.2f%%);"
-		               " % 9llu/% 9llu found; % 9llu restored",
+		               " % 9llu/% 9llu found; % 9llu restored; queued % 8llu/% 8llu",
 		               running, max_threads, sec_scanned, full_disk_blocks,
 		               ( double )sec_scanned / ( double )full_disk_blocks * 100.,
-		               found_files, frwrd_inodes, undeleted);
+		               found_files, frwrd_inodes, undeleted,
+		               queues.dir_depth, queues.file_depth );
 
 		// Let's sleep for half a second
 		thrd_sleep( &sleep_time, NULL );
@@ -283,12 +296,24 @@ void monitor_threads( uint32_t max_threads, bool end_with_scanners ) {
 	}
 
 	// When all are finished, log the result out:
+	get_analyzer_stats( &analyzed,    &found_dirent, &found_files  );
+	get_scanner_stats(  &sec_scanned, &frwrd_dirent, &frwrd_inodes );
+	get_writer_stats(   &undeleted );
 	log_info( "Scanned % 10llu/% 10llu sectors (%6.2f%%)",
 	          sec_scanned, full_disk_blocks,
 		( double )sec_scanned / ( double )full_disk_blocks * 100.);
-	log_info( "Found   % 10llu/% 10llu directory entries", found_dirent, frwrd_dirent);
-	log_info( "Found   % 10llu/% 10llu file inodes", found_files, frwrd_dirent);
+	log_info( "Read    % 10llu/% 10llu directories", found_dirent, frwrd_dirent);
+	log_info( "Named   % 10llu/% 10llu file inodes", found_files, frwrd_inodes);
+	log_info( "Known   % 10llu inodes in the catalog", cat_count() );
 	log_info( "Total   % 10llu files restored", undeleted);
+
+	in_get_stats( &queues );
+	log_info( "Queued  % 10llu directories, % 10llu files", queues.dir_depth, queues.file_depth );
+	if ( queues.spilled )
+		log_info( "Spilled % 10llu files still on disk", queues.spilled );
+	if ( queues.blocked_cnt )
+		log_info( "Blocked % 10llu times on full queues, %llu.%03llu s in total",
+		          queues.blocked_cnt, queues.blocked_ms / 1000, queues.blocked_ms % 1000 );
 }
 
 uint32_t scanner_running( void ) {
@@ -312,10 +337,13 @@ int start_analyzer( analyze_data_t* data ) {
 	if ( -1 == res )
 		return res;
 
+	// Counted as running right away, like scanners, so monitor_threads() waits for it
+	data->is_running = true;
 	res = thrd_create( &threads[data->thread_num], analyzer, data );
 	if ( thrd_success != res ) {
 		log_critical( "Creation of analyzer thread %u failed! %s",
 		              data->thread_num, get_thrd_err( res ) );
+		data->is_running = false;
 		return -1;
 	}
 
@@ -330,10 +358,15 @@ int start_scanner( scan_data_t* data ) {
 	if ( -1 == res )
 		return -1;
 
+	/* The scanner is counted as running right away. Otherwise monitor_threads()
+	 * might find nothing running before the thread got to work. Scanners that
+	 * are never started, like in journal mode, must not count as running. */
+	data->is_running = true;
 	res = thrd_create( &threads[data->thread_num], scanner, data );
 	if ( thrd_success != res ) {
 		log_critical( "Creation of scanner thread %u failed! %s",
 		              data->thread_num, get_thrd_err( res ) );
+		data->is_running = false;
 		return -1;
 	}
 
@@ -348,10 +381,13 @@ int start_writer( write_data_t* data ) {
 	if ( -1 == res )
 		return -1;
 
+	// Counted as running right away, like scanners, so monitor_threads() waits for it
+	data->is_running = true;
 	res = thrd_create( &threads[data->thread_num], writer, data );
 	if ( thrd_success != res ) {
 		log_critical( "Creation of writer thread %u failed! %s",
 		              data->thread_num, get_thrd_err( res ) );
+		data->is_running = false;
 		return -1;
 	}
 
@@ -368,31 +404,48 @@ void unshackle_analyzers( void ) {
 }
 
 
+void unshackle_writers( void ) {
+	if ( write_data ) {
+		for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
+			write_data[i].is_shackled = false;
+		}
+	}
+}
+
+
 void wakeup_threads( bool do_work ) {
+	/* The flags must be set under the sleep lock. Otherwise a thread that has
+	 * just checked them, but not yet started waiting, misses the signal. */
 	if ( analyze_data ) {
 		for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
 			if ( analyze_data[i].thread_num > -1 ) {
+				mtx_lock( &analyze_data[i].sleep_lock );
 				analyze_data[i].do_stop  = !do_work;
 				analyze_data[i].do_start =  do_work;
 				cnd_signal( &analyze_data[i].wakeup_call );
+				mtx_unlock( &analyze_data[i].sleep_lock );
 			}
 		}
 	}
 	if ( scan_data ) {
 		for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
 			if ( scan_data[i].thread_num > -1 ) {
+				mtx_lock( &scan_data[i].sleep_lock );
 				scan_data[i].do_stop  = !do_work;
 				scan_data[i].do_start =  do_work;
 				cnd_signal( &scan_data[i].wakeup_call );
+				mtx_unlock( &scan_data[i].sleep_lock );
 			}
 		}
 	}
 	if ( write_data ) {
 		for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
 			if ( write_data[i].thread_num > -1 ) {
+				mtx_lock( &write_data[i].sleep_lock );
 				write_data[i].do_stop  = !do_work;
 				write_data[i].do_start =  do_work;
 				cnd_signal( &write_data[i].wakeup_call );
+				mtx_unlock( &write_data[i].sleep_lock );
 			}
 		}
 	}
@@ -129,6 +129,10 @@ int start_writer( write_data_t* data );
 void unshackle_analyzers( void );
 
 
+/// @brief notify all writer threads that no more file inodes will be found.
+void unshackle_writers( void );
+
+
 /** @brief convenience function to wake up all present threads at once
   *
   * @param[in] do_work  Set to true if the threads are allowed to work, false to make them end themselves.
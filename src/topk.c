@@ -0,0 +1,229 @@
+/*******************************************************************************
+ * topk.c : Bounded min-heap that keeps only the N most recent deletions
+ ******************************************************************************/
+
+
+#include "inode.h"
+#include "inode_queue.h"
+#include "log.h"
+#include "stats.h"
+#include "topk.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+
+/// @brief One entry of the heap
+typedef struct _topk_entry {
+	uint64_t  key; //!< ctime (seconds in the high, nanoseconds in the low half) or LSN
+	xfs_in_t* in;  //!< The inode
+} topk_entry_t;
+
+
+static bool          topk_by_lsn = false;
+static uint32_t      topk_count  = 0;
+static atomic_ullong topk_floor  = 0;     //!< Key of the heap minimum, only valid once the heap is full
+static atomic_bool   topk_full   = false; //!< Set once topk_floor is valid
+static topk_entry_t* topk_heap   = NULL;
+static uint32_t      topk_k      = 0;
+static mtx_t         topk_lock;
+static stat_t        topk_stat   = STAT_INIT( "top-k heap" );
+
+
+/// @internal get the key of an inode structure
+static uint64_t get_key( xfs_in_t const* in ) {
+	if ( topk_by_lsn )
+		return in->lsn;
+	return ( ( uint64_t )in->ctime_ep << 32 ) | in->ctime_ns;
+}
+
+
+/// @internal get the key from raw inode data
+static uint64_t get_raw_key( uint8_t const* data ) {
+	if ( topk_by_lsn )
+		// Only v3 inodes have an LSN, older ones always rank lowest
+		return data[4] > 2 ? get_flip64u( data, 112 ) : 0;
+	// Must match get_key(), so bigtime ctimes are decoded the same way
+	uint32_t ns = 0;
+	uint32_t ep = ( uint32_t )xfs_get_in_time( data, 48, &ns );
+	return ( ( uint64_t )ep << 32 ) | ns;
+}
+
+
+/// @internal Restore the heap property downwards from @a pos
+static void sift_down( uint32_t pos ) {
+	for (;;) {
+		uint32_t smallest = pos;
+		uint32_t left     = ( 2 * pos ) + 1;
+		uint32_t right    = left + 1;
+
+		if ( ( left < topk_count ) && ( topk_heap[left].key < topk_heap[smallest].key ) )
+			smallest = left;
+		if ( ( right < topk_count ) && ( topk_heap[right].key < topk_heap[smallest].key ) )
+			smallest = right;
+		if ( smallest == pos )
+			return;
+
+		topk_entry_t tmp    = topk_heap[pos];
+		topk_heap[pos]      = topk_heap[smallest];
+		topk_heap[smallest] = tmp;
+		pos                 = smallest;
+	}
+}
+
+
+/// @internal Restore the heap property upwards from @a pos
+static void sift_up( uint32_t pos ) {
+	while ( pos ) {
+		uint32_t parent = ( pos - 1 ) / 2;
+		if ( topk_heap[parent].key <= topk_heap[pos].key )
+			return;
+
+		topk_entry_t tmp  = topk_heap[pos];
+		topk_heap[pos]    = topk_heap[parent];
+		topk_heap[parent] = tmp;
+		pos               = parent;
+	}
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void topk_free( void ) {
+	if ( NULL == topk_heap )
+		return;
+
+	for ( uint32_t i = 0; i < topk_count; ++i ) {
+		xfs_drop_in( &topk_heap[i].in );
+	}
+	FREE_PTR( topk_heap );
+	mtx_destroy( &topk_lock );
+	topk_count = 0;
+	topk_k     = 0;
+	atomic_store( &topk_full, false );
+}
+
+
+int topk_flush( void ) {
+	if ( NULL == topk_heap )
+		return 0;
+
+	xfs_in_t** ins = NULL;
+	uint32_t   cnt = 0;
+	int        res = 0;
+
+	stat_lock( &topk_stat, &topk_lock );
+
+	log_info( "Keeping the %u newest of the deleted files found", topk_count );
+
+	// Take the inodes out of the heap, the queue is fed without holding the lock
+	if ( topk_count && ( NULL == ( ins = malloc( topk_count * sizeof( xfs_in_t* ) ) ) ) ) {
+		mtx_unlock( &topk_lock );
+		log_critical( "Unable to allocate %zu bytes for the newest files! %m [%d]",
+		              topk_count * sizeof( xfs_in_t* ), errno );
+		return -1;
+	}
+	for ( cnt = 0; cnt < topk_count; ++cnt ) {
+		ins[cnt] = TAKE_PTR( topk_heap[cnt].in );
+	}
+	topk_count = 0;
+	atomic_store( &topk_full, false );
+
+	mtx_unlock( &topk_lock );
+
+	if ( cnt && ( -1 == file_in_push_batch( ins, cnt ) ) ) {
+		log_critical( "%s", "Inode queue broken? Breaking off work!" );
+		// Whatever was not pushed is still ours
+		for ( uint32_t i = 0; i < cnt; ++i )
+			xfs_drop_in( &ins[i] );
+		res = -1;
+	}
+	FREE_PTR( ins );
+
+	return res;
+}
+
+
+int topk_init( uint32_t k, bool by_lsn ) {
+	if ( 0 == k ) {
+		log_error( "%s", "The number of files to keep must be at least 1" );
+		return -1;
+	}
+
+	topk_heap = ( topk_entry_t* )calloc( k, sizeof( topk_entry_t ) );
+	if ( NULL == topk_heap ) {
+		log_critical( "Unable to allocate %zu bytes for the newest files heap! %m [%d]",
+		              k * sizeof( topk_entry_t ), errno );
+		return -1;
+	}
+
+	if ( thrd_success != mtx_init( &topk_lock, mtx_plain ) ) {
+		log_critical( "%s", "Unable to initialize the newest files heap lock!" );
+		FREE_PTR( topk_heap );
+		return -1;
+	}
+
+	topk_by_lsn = by_lsn;
+	topk_k      = k;
+
+	return 0;
+}
+
+
+bool topk_is_set( void ) {
+	return topk_k > 0;
+}
+
+
+int topk_offer( xfs_in_t* in ) {
+	RETURN_INT_IF_NULL( in );
+
+	uint64_t  key     = get_key( in );
+	xfs_in_t* evicted = NULL;
+
+	stat_lock( &topk_stat, &topk_lock );
+
+	if ( topk_count < topk_k ) {
+		topk_heap[topk_count].key = key;
+		topk_heap[topk_count].in  = in;
+		sift_up( topk_count++ );
+	} else if ( key > topk_heap[0].key ) {
+		evicted          = topk_heap[0].in;
+		topk_heap[0].key = key;
+		topk_heap[0].in  = in;
+		sift_down( 0 );
+	} else
+		evicted = in;
+
+	// Let topk_would_keep() compare without the lock
+	if ( topk_count >= topk_k ) {
+		atomic_store_explicit( &topk_floor, topk_heap[0].key, memory_order_relaxed );
+		atomic_store_explicit( &topk_full, true, memory_order_release );
+	}
+
+	mtx_unlock( &topk_lock );
+
+	// Freeing is done outside the lock, the heap does not need it any more
+	xfs_drop_in( &evicted );
+
+	return 0;
+}
+
+
+bool topk_would_keep( uint8_t const* data ) {
+	if ( 0 == topk_k )
+		return true;
+
+	// The floor only ever rises, so a stale one lets too much through, which
+	// topk_offer() sorts out, but never drops anything that would be kept.
+	if ( !atomic_load_explicit( &topk_full, memory_order_acquire ) )
+		return true;
+
+	return get_raw_key( data ) > atomic_load_explicit( &topk_floor, memory_order_relaxed );
+}
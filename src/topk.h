@@ -0,0 +1,64 @@
+#ifndef PWX_XFS_UNDELETE_SRC_TOPK_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_TOPK_H_INCLUDED 1
+#pragma once
+
+
+#include "inode.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/** @brief Free the heap and all inodes still held in it
+**/
+void topk_free( void );
+
+
+/** @brief Move all surviving inodes onto the file inode queue
+  *
+  * This must be called once all scanners have finished, and before the
+  * analyzers are unshackled.
+  *
+  * @return 0 on success, -1 on failure.
+**/
+int topk_flush( void );
+
+
+/** @brief Initialize the newest-N mode
+  *
+  * @param[in] k       Number of file inodes to keep
+  * @param[in] by_lsn  If true, rank by log sequence number instead of ctime
+  * @return 0 on success, -1 on failure.
+**/
+int topk_init( uint32_t k, bool by_lsn );
+
+
+/// @return true if the newest-N mode is active
+bool topk_is_set( void );
+
+
+/** @brief Offer a file inode to the heap
+  *
+  * The heap takes ownership of @a in. If @a in is older than everything
+  * in a full heap, it is freed right away. Otherwise the oldest inode in
+  * the heap is evicted and freed.
+  *
+  * @param[in] in  The inode to offer
+  * @return 0 on success, -1 on failure.
+**/
+int topk_offer( xfs_in_t* in );
+
+
+/** @brief Check on the raw inode data whether it has a chance to be kept
+  *
+  * This allows the scanner to skip candidates that are too old before
+  * anything is decoded or allocated.
+  *
+  * @param[in] data  Pointer to the raw inode data
+  * @return true if the inode would currently be kept, false otherwise.
+**/
+bool topk_would_keep( uint8_t const* data );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_TOPK_H_INCLUDED
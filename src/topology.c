@@ -0,0 +1,260 @@
+/*******************************************************************************
+ * topology.c : Resolve block device stacks through sysfs into device profiles
+ ******************************************************************************/
+
+
+#include "log.h"
+#include "topology.h"
+#include "utils.h"
+
+
+#include <dirent.h>
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+
+#define DEV_READ_DEFAULT  ( 1024 * 1024 )      // Read size if the device reports no optimal I/O size
+#define DEV_READ_MAX      ( 16 * 1024 * 1024 ) // Never read more than this at once
+#define DEV_SLOTS_READER  16                   // Queue slots per reader thread
+#define DEV_STACK_DEPTH   8                    // dm on md on partitions... More is a loop.
+
+
+/// @internal Read a numeric sysfs attribute, returns 0 on success, -1 on error
+static int read_sys_long( char const* dir, char const* attr, long* value ) {
+	char path[PATH_MAX] = { 0x0 };
+	int  res            = -1;
+
+	snprintf( path, PATH_MAX, "%s/%s", dir, attr );
+
+	FILE* f = fopen( path, "r" );
+	if ( f ) {
+		if ( 1 == fscanf( f, "%ld", value ) )
+			res = 0;
+		fclose( f );
+	}
+
+	return res;
+}
+
+
+/// @internal Read a string sysfs attribute, returns 0 if a non-empty value was read, -1 otherwise
+static int read_sys_str( char const* dir, char const* attr, char* value, size_t size ) {
+	char path[PATH_MAX] = { 0x0 };
+	int  res            = -1;
+
+	snprintf( path, PATH_MAX, "%s/%s", dir, attr );
+
+	FILE* f = fopen( path, "r" );
+	if ( f ) {
+		if ( fgets( value, size, f ) ) {
+			value[strcspn( value, "\r\n" )] = 0x0;
+			res = value[0] ? 0 : -1;
+		}
+		fclose( f );
+	}
+
+	return res;
+}
+
+
+/// @internal Find a stable identity of the top device
+static void get_ident( char const* sys_dir, char const* disk_dir, dev_profile_t* profile ) {
+	static char const* attrs[] = { "wwid", "device/wwid", "serial", "device/serial", "dm/uuid", "md/uuid", NULL };
+	char id[96]   = { 0x0 };
+	long part     = 0;
+	bool is_found = false;
+
+	for ( int i = 0; !is_found && attrs[i]; ++i ) {
+		is_found = !read_sys_str( sys_dir,  attrs[i], id, sizeof( id ) )
+		        || !read_sys_str( disk_dir, attrs[i], id, sizeof( id ) );
+	}
+
+	if ( !is_found )
+		snprintf( profile->ident, sizeof( profile->ident ), "%s", profile->name );
+	else if ( !read_sys_long( sys_dir, "partition", &part ) )
+		snprintf( profile->ident, sizeof( profile->ident ), "%s-p%ld", id, part );
+	else
+		snprintf( profile->ident, sizeof( profile->ident ), "%s", id );
+}
+
+
+/** @internal Walk one device of the stack and everything below it
+  *
+  * @return The queue depth of this device, which for stacked devices is
+  *         the sum of their members.
+**/
+static uint32_t walk_device( char const* sys_dir, dev_profile_t* profile, uint32_t depth ) {
+	char disk_dir[PATH_MAX] = { 0x0 };
+	char path[PATH_MAX]     = { 0x0 };
+	long value              = 0;
+
+	if ( depth >= DEV_STACK_DEPTH ) {
+		log_warning( "Device stack below %s is too deep, ignoring the rest", profile->name );
+		return 0;
+	}
+
+	// A partition has no queue of its own, that is on its parent, the disk.
+	snprintf( disk_dir, PATH_MAX, "%s", sys_dir );
+	snprintf( path, PATH_MAX, "%s/partition", sys_dir );
+	if ( exists( path, 'f' ) )
+		dirname( disk_dir );
+
+	// Logical blocks are as large as the largest in the stack
+	if ( !read_sys_long( disk_dir, "queue/logical_block_size", &value ) && ( value > profile->logical_block ) )
+		profile->logical_block = value;
+
+	// Only the top device knows the stripe geometry of what is below it, and who it is
+	if ( 0 == depth ) {
+		if ( !read_sys_long( disk_dir, "queue/optimal_io_size", &value ) )
+			profile->optimal_io = value;
+		get_ident( sys_dir, disk_dir, profile );
+	}
+
+	// Stacked devices (dm, md) list their members in slaves/
+	uint32_t       members_depth = 0;
+	uint32_t       slaves_count  = 0;
+	struct dirent* ent           = NULL;
+	DIR*           slaves        = NULL;
+
+	snprintf( path, PATH_MAX, "%s/slaves", sys_dir );
+	slaves = opendir( path );
+	while ( slaves && ( NULL != ( ent = readdir( slaves ) ) ) ) {
+		char member[PATH_MAX] = { 0x0 };
+
+		if ( '.' == ent->d_name[0] )
+			continue;
+
+		snprintf( path, PATH_MAX, "/sys/class/block/%s", ent->d_name );
+		if ( NULL == realpath( path, member ) )
+			continue;
+
+		members_depth += walk_device( member, profile, depth + 1 );
+		++slaves_count;
+	}
+	if ( slaves )
+		closedir( slaves );
+
+	if ( slaves_count )
+		return members_depth ? members_depth
+		       : ( !read_sys_long( disk_dir, "queue/nr_requests", &value ) ? ( uint32_t )value : 0 );
+
+	// This is a physical device, so it tells whether it rotates and where it is attached.
+	if ( !read_sys_long( disk_dir, "queue/rotational", &value ) && value )
+		profile->rotational = true;
+
+	if ( ( profile->numa_node < 0 )
+	  && ( !read_sys_long( disk_dir, "device/numa_node", &value )
+	    || !read_sys_long( disk_dir, "device/device/numa_node", &value ) ) )
+		profile->numa_node = value;
+
+	return !read_sys_long( disk_dir, "queue/nr_requests", &value ) ? ( uint32_t )value : 0;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+void dev_bind_thread( dev_profile_t const* profile ) {
+	RETURN_VOID_IF_NULL( profile );
+
+	// With just one node, there is nothing to gain.
+	if ( ( profile->numa_node < 0 ) || !exists( "/sys/devices/system/node/node1", 'd' ) )
+		return;
+
+	char  path[64]  = { 0x0 };
+	char  list[256] = { 0x0 };
+	FILE* f         = NULL;
+
+	snprintf( path, sizeof( path ), "/sys/devices/system/node/node%d/cpulist", profile->numa_node );
+	f = fopen( path, "r" );
+	if ( NULL == f )
+		return;
+	if ( NULL == fgets( list, sizeof( list ), f ) ) {
+		fclose( f );
+		return;
+	}
+	fclose( f );
+
+	// The list looks like "0-3,8-11"
+	cpu_set_t cpus;
+	char*     save = NULL;
+	CPU_ZERO( &cpus );
+	for ( char* tok = strtok_r( list, ",\n", &save ); tok; tok = strtok_r( NULL, ",\n", &save ) ) {
+		long  from = strtol( tok, &tok, 10 );
+		long  to   = ( '-' == *tok ) ? strtol( tok + 1, NULL, 10 ) : from;
+		for ( long cpu = from; ( cpu <= to ) && ( cpu < CPU_SETSIZE ); ++cpu )
+			CPU_SET( cpu, &cpus );
+	}
+
+	if ( CPU_COUNT( &cpus ) && sched_setaffinity( 0, sizeof( cpu_set_t ), &cpus ) ) {
+		log_debug( "Unable to bind thread to NUMA node %d: %m [%d]", profile->numa_node, errno );
+	}
+}
+
+
+uint32_t dev_max_readers( dev_profile_t const* profile ) {
+	if ( profile && profile->cal_readers )
+		return profile->cal_readers;
+	if ( ( NULL == profile ) || !profile->is_known || profile->rotational )
+		return 1;
+
+	uint32_t readers = profile->nr_requests / DEV_SLOTS_READER;
+
+	return readers < 2 ? 2 : readers;
+}
+
+
+uint32_t dev_read_size( dev_profile_t const* profile, uint32_t block_size ) {
+	uint32_t size = DEV_READ_DEFAULT;
+
+	if ( profile && profile->cal_read_size )
+		size = profile->cal_read_size;
+	else if ( profile && profile->optimal_io )
+		size = profile->optimal_io;
+
+	if ( size > DEV_READ_MAX )
+		size = DEV_READ_MAX;
+	if ( block_size )
+		size = ( ( size + block_size - 1 ) / block_size ) * block_size;
+
+	return size;
+}
+
+
+int get_dev_profile( char const* path, dev_profile_t* profile ) {
+	RETURN_INT_IF_NULL( path );
+	RETURN_INT_IF_NULL( profile );
+
+	char        sys_path[PATH_MAX] = { 0x0 };
+	char        real[PATH_MAX]     = { 0x0 };
+	struct stat st;
+
+	memset( profile, 0, sizeof( dev_profile_t ) );
+	profile->numa_node = -1;
+
+	if ( stat( path, &st ) ) {
+		log_error( "Can not stat %s: %m [%d]", path, errno );
+		return -1;
+	}
+
+	dev_t dev = S_ISBLK( st.st_mode ) ? st.st_rdev : st.st_dev;
+	snprintf( sys_path, PATH_MAX, "/sys/dev/block/%u:%u", major( dev ), minor( dev ) );
+
+	if ( NULL == realpath( sys_path, real ) ) {
+		log_error( "Can not resolve %s for %s: %m [%d]", sys_path, path, errno );
+		return -1;
+	}
+
+	snprintf( profile->name, sizeof( profile->name ), "%s", strrchr( real, '/' ) + 1 );
+	profile->nr_requests = walk_device( real, profile, 0 );
+	profile->is_known    = true;
+
+	return 0;
+}
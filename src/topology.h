@@ -0,0 +1,73 @@
+#ifndef PWX_XFS_UNDELETE_SRC_TOPOLOGY_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_TOPOLOGY_H_INCLUDED 1
+#pragma once
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/// @brief What sysfs, and maybe a calibration run, tell about the block device stack below a path
+typedef struct _dev_profile {
+	uint32_t cal_read_size; //!< Read size found by calibration, 0 if not calibrated
+	uint32_t cal_readers;   //!< Number of readers found by calibration, 0 if not calibrated
+	char     ident[128];    //!< WWID, serial or UUID of the top device, plus the partition number
+	bool     is_known;      //!< True if the device could be resolved through sysfs
+	uint32_t logical_block; //!< Largest logical block size in the stack, in bytes
+	char     name[32];      //!< Kernel name of the top device, like "nvme0n1" or "dm-3"
+	uint32_t nr_requests;   //!< Queue depth; for stacked devices without a queue, the sum of their members
+	int32_t  numa_node;     //!< NUMA node the (first) physical device is attached to, -1 if unknown
+	uint32_t optimal_io;    //!< Optimal I/O size of the top device in bytes, 0 if not reported
+	bool     rotational;    //!< True if any physical device in the stack rotates
+} dev_profile_t;
+
+
+/** @brief Bind the calling thread to the CPUs of the NUMA node of a device
+  *
+  * Nothing happens if the NUMA node is unknown or the system has only one.
+  *
+  * @param[in] profile  The profile of the device the thread works on
+**/
+void dev_bind_thread( dev_profile_t const* profile );
+
+
+/** @brief Get the number of threads that should read from a device at once
+  *
+  * @param[in] profile  The profile of the device
+  * @return The calibrated number if there is one. Otherwise 1 for rotational or
+  *         unknown devices, and one per 16 queue slots, at least 2.
+**/
+uint32_t dev_max_readers( dev_profile_t const* profile );
+
+
+/** @brief Get the number of bytes one read request should cover
+  *
+  * This is the calibrated read size if there is one, then the optimal I/O
+  * size if the device reports one, DEV_READ_DEFAULT otherwise. It is always
+  * a multiple of @a block_size and at most DEV_READ_MAX.
+  *
+  * @param[in] profile     The profile of the device
+  * @param[in] block_size  The file system block size
+  * @return The number of bytes to read at once.
+**/
+uint32_t dev_read_size( dev_profile_t const* profile, uint32_t block_size );
+
+
+/** @brief Build the profile of the block device stack a path lives on
+  *
+  * For block devices the device itself is resolved, for everything else
+  * (image files, directories) the device holding it. The device number is
+  * looked up in /sys/dev/block, so partitions, NVMe namespaces, device
+  * mapper and md devices all work. Stacked devices are followed through
+  * their slaves/ directories down to the physical devices.
+  *
+  * If the device reports no WWID, serial or UUID, its name is used as @a ident.
+  *
+  * @param[in]  path     The path to resolve
+  * @param[out] profile  Receives the profile
+  * @return 0 on success, -1 if the device could not be resolved.
+**/
+int get_dev_profile( char const* path, dev_profile_t* profile );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_TOPOLOGY_H_INCLUDED
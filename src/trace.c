@@ -0,0 +1,329 @@
+/*******************************************************************************
+ * trace.c : Record reads from the source device and replay them
+ ******************************************************************************/
+
+
+#include "globals.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define TRACE_MAGIC   "XUTR"
+#define TRACE_VERSION 1
+
+
+/// @brief Header of a trace file
+typedef struct _trace_file_hdr {
+	char     magic[4];   //!< TRACE_MAGIC
+	uint32_t version;    //!< TRACE_VERSION
+	uint64_t src_offset; //!< Offset of the file system on the traced device
+	int64_t  when;       //!< Seconds since the epoch the trace was started
+} trace_file_hdr_t;
+
+
+/// @brief One traced read
+typedef struct _trace_rec {
+	uint64_t offset;   //!< Byte offset relative to the start of the file system
+	uint64_t start_us; //!< Microseconds since the trace was started
+	uint32_t len;      //!< Number of bytes requested
+	int32_t  result;   //!< Number of bytes read, or -errno
+	uint32_t lat_us;   //!< Microseconds the read took
+	uint16_t thread;   //!< Number of the reading thread, counted from 0 in order of the first read
+	uint8_t  purpose;  //!< One of e_io_purpose
+	uint8_t  padding;  //!< Must be zero
+} trace_rec_t;
+
+
+/// @brief What one replay thread needs and finds out
+typedef struct _trace_player {
+	uint64_t           bytes[IO_PURPOSES];   //!< Bytes read per purpose
+	uint64_t           count;                //!< Number of records in @a recs
+	uint64_t           errors;               //!< Reads that failed, but had not in the recorded run
+	int                fd;                   //!< The device to read from
+	uint64_t           lat_ns[IO_PURPOSES];  //!< Summed up replayed latency per purpose
+	uint32_t           max_len;              //!< Largest read of this thread
+	uint64_t           reads[IO_PURPOSES];   //!< Reads per purpose
+	trace_rec_t const* recs;                 //!< The records of this thread, in recorded order
+	uint64_t           rec_lat[IO_PURPOSES]; //!< Summed up recorded latency per purpose in microseconds
+} trace_player_t;
+
+
+static char const* purpose_names[IO_PURPOSES] = {
+	"other", "superblock", "scan", "probe", "journal", "watch", "restore"
+};
+
+
+static uint64_t             trace_count  = 0;
+static FILE*                trace_file   = NULL;
+static mtx_t                trace_lock;
+static stat_t               trace_stat   = STAT_INIT( "trace" );
+static atomic_uint_fast16_t trace_next   = 0;
+static atomic_bool          trace_on     = false;
+static uint64_t             trace_t0     = 0;
+static _Thread_local int32_t trace_thread = -1;
+
+
+/// @internal Issue the reads of one recorded thread
+static int trace_player( void* arg ) {
+	trace_player_t* pl  = ( trace_player_t* )arg;
+	uint8_t*        buf = malloc( pl->max_len ? pl->max_len : 1 );
+
+	if ( NULL == buf ) {
+		log_critical( "Unable to allocate %u bytes for replaying!", pl->max_len );
+		return -1;
+	}
+
+	for ( uint64_t i = 0; i < pl->count; ++i ) {
+		trace_rec_t const* rec     = &pl->recs[i];
+		uint8_t            purpose = rec->purpose < IO_PURPOSES ? rec->purpose : IO_OTHER;
+		uint64_t           start   = stat_now_ns();
+		ssize_t            res     = src_pread( pl->fd, buf, rec->len, rec->offset, purpose );
+
+		pl->lat_ns[purpose]  += stat_now_ns() - start;
+		pl->rec_lat[purpose] += rec->lat_us;
+		pl->reads[purpose]++;
+		if ( res > 0 )
+			pl->bytes[purpose] += res;
+		else if ( rec->result > 0 )
+			pl->errors++;
+	}
+
+	FREE_PTR( buf );
+
+	return 0;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+bool trace_is_active( void ) {
+	return atomic_load( &trace_on );
+}
+
+
+void trace_record( off_t offset, size_t len, ssize_t result, e_io_purpose purpose, uint64_t start ) {
+	uint64_t end = stat_now_ns();
+
+	if ( trace_thread < 0 )
+		trace_thread = atomic_fetch_add( &trace_next, 1 );
+
+	trace_rec_t rec = {
+		.offset   = offset,
+		.start_us = ( start - trace_t0 ) / 1000,
+		.len      = len,
+		.result   = result < 0 ? -errno : ( int32_t )result,
+		.lat_us   = ( end - start ) / 1000,
+		.thread   = trace_thread,
+		.purpose  = purpose,
+		.padding  = 0
+	};
+
+	stat_lock( &trace_stat, &trace_lock );
+	if ( trace_file && ( 1 != fwrite( &rec, sizeof( rec ), 1, trace_file ) ) ) {
+		log_error( "Writing the I/O trace failed, tracing stopped: %m [%d]", errno );
+		atomic_store( &trace_on, false );
+	} else
+		++trace_count;
+	mtx_unlock( &trace_lock );
+}
+
+
+int trace_replay( char const* trace_path, char const* device ) {
+	RETURN_INT_IF_NULL( trace_path );
+	RETURN_INT_IF_NULL( device );
+
+	trace_file_hdr_t hdr;
+	trace_rec_t*     recs    = NULL;
+	trace_rec_t*     parted  = NULL;
+	trace_player_t*  players = NULL;
+	thrd_t*          threads = NULL;
+	uint64_t         count   = 0;
+	uint64_t         size    = 0;
+	uint32_t         started = 0;
+	uint32_t         thr_cnt = 0;
+	int              fd      = -1;
+	int              res     = -1;
+	FILE*            f       = fopen( trace_path, "rb" );
+
+	if ( NULL == f ) {
+		log_error( "Can not open trace %s: %m [%d]", trace_path, errno );
+		return -1;
+	}
+
+	if ( ( 1 != fread( &hdr, sizeof( hdr ), 1, f ) )
+	  || memcmp( hdr.magic, TRACE_MAGIC, 4 )
+	  || ( TRACE_VERSION != hdr.version ) ) {
+		log_error( "%s is not an I/O trace of this version", trace_path );
+		fclose( f );
+		return -1;
+	}
+
+	// Load all records, the trace is played by several threads at once
+	for ( ;; ) {
+		if ( count == size ) {
+			size = size ? size * 2 : 4096;
+			trace_rec_t* grown = realloc( recs, size * sizeof( trace_rec_t ) );
+			if ( NULL == grown ) {
+				log_critical( "Unable to allocate %lu trace records!", size );
+				fclose( f );
+				goto cleanup;
+			}
+			recs = grown;
+		}
+		if ( 1 != fread( &recs[count], sizeof( trace_rec_t ), 1, f ) )
+			break;
+		if ( recs[count].thread >= thr_cnt )
+			thr_cnt = recs[count].thread + 1;
+		++count;
+	}
+	fclose( f );
+
+	if ( 0 == count ) {
+		log_warning( "%s holds no reads", trace_path );
+		res = 0;
+		goto cleanup;
+	}
+	if ( hdr.src_offset != src_offset )
+		log_warning( "The trace was recorded at offset %lu, replaying at %lu", hdr.src_offset, src_offset );
+
+	fd = src_open( device, O_NOFOLLOW );
+	if ( -1 == fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		goto cleanup;
+	}
+
+	players = calloc( thr_cnt, sizeof( trace_player_t ) );
+	threads = calloc( thr_cnt, sizeof( thrd_t ) );
+	if ( ( NULL == players ) || ( NULL == threads ) ) {
+		log_critical( "Unable to allocate %u replay threads!", thr_cnt );
+		goto cleanup;
+	}
+
+	// Partition the records by thread, so every player only walks its own
+	parted = malloc( count * sizeof( trace_rec_t ) );
+	if ( NULL == parted ) {
+		log_critical( "Unable to allocate %lu trace records!", count );
+		goto cleanup;
+	}
+	for ( uint64_t i = 0; i < count; ++i ) {
+		players[recs[i].thread].count++;
+		if ( recs[i].len > players[recs[i].thread].max_len )
+			players[recs[i].thread].max_len = recs[i].len;
+	}
+	for ( uint64_t i = 0, first = 0; i < thr_cnt; ++i ) {
+		players[i].recs   = parted + first;
+		first            += players[i].count;
+		players[i].count  = 0;
+	}
+	for ( uint64_t i = 0; i < count; ++i ) {
+		trace_player_t* pl = &players[recs[i].thread];
+		parted[( pl->recs - parted ) + pl->count++] = recs[i];
+	}
+
+	log_info( "Replaying %lu reads of %u thread(s) from %s", count, thr_cnt, trace_path );
+
+	uint64_t t0 = stat_now_ns();
+	for ( uint32_t i = 0; i < thr_cnt; ++i, ++started ) {
+		players[i].fd = fd;
+		if ( thrd_success != thrd_create( &threads[i], trace_player, &players[i] ) ) {
+			log_critical( "Unable to start replay thread %u: %m [%d]", i, errno );
+			break;
+		}
+	}
+	for ( uint32_t i = 0; i < started; ++i )
+		thrd_join( threads[i], NULL );
+	uint64_t elapsed = stat_now_ns() - t0;
+
+	// Sum up and report
+	for ( int p = 0; p < IO_PURPOSES; ++p ) {
+		uint64_t bytes = 0, lat_ns = 0, reads = 0, rec_lat = 0;
+
+		for ( uint32_t i = 0; i < started; ++i ) {
+			bytes   += players[i].bytes[p];
+			lat_ns  += players[i].lat_ns[p];
+			reads   += players[i].reads[p];
+			rec_lat += players[i].rec_lat[p];
+		}
+
+		if ( reads )
+			log_info( "%-10s: %8lu reads, %s, %8.1f us average (recorded %8.1f us)",
+			          purpose_names[p], reads, get_human_size( bytes ),
+			          ( double )lat_ns / 1000. / ( double )reads, ( double )rec_lat / ( double )reads );
+	}
+	for ( uint32_t i = 0; i < started; ++i ) {
+		if ( players[i].errors )
+			log_warning( "Thread %u: %lu reads failed that had succeeded when recorded", i, players[i].errors );
+	}
+	log_info( "Replay took %.3f s", ( double )elapsed / 1e9 );
+
+	res = started == thr_cnt ? 0 : -1;
+
+cleanup:
+	if ( fd > -1 )
+		close( fd );
+	FREE_PTR( players );
+	FREE_PTR( parted );
+	FREE_PTR( recs );
+	FREE_PTR( threads );
+
+	return res;
+}
+
+
+int trace_start( char const* path ) {
+	RETURN_INT_IF_NULL( path );
+
+	trace_file_hdr_t hdr = { .version = TRACE_VERSION, .src_offset = src_offset, .when = time( NULL ) };
+	memcpy( hdr.magic, TRACE_MAGIC, 4 );
+
+	if ( thrd_success != mtx_init( &trace_lock, mtx_plain ) ) {
+		log_critical( "Unable to initialize the trace lock: %m [%d]", errno );
+		return -1;
+	}
+
+	trace_file = fopen( path, "wb" );
+	if ( ( NULL == trace_file ) || ( 1 != fwrite( &hdr, sizeof( hdr ), 1, trace_file ) ) ) {
+		log_error( "Can not write trace %s: %m [%d]", path, errno );
+		if ( trace_file )
+			fclose( trace_file );
+		trace_file = NULL;
+		mtx_destroy( &trace_lock );
+		return -1;
+	}
+
+	trace_t0 = stat_now_ns();
+	atomic_store( &trace_on, true );
+	log_info( "Tracing reads into %s", path );
+
+	return 0;
+}
+
+
+void trace_stop( void ) {
+	if ( NULL == trace_file )
+		return;
+
+	atomic_store( &trace_on, false );
+
+	stat_lock( &trace_stat, &trace_lock );
+	fclose( trace_file );
+	trace_file = NULL;
+	mtx_unlock( &trace_lock );
+	mtx_destroy( &trace_lock );
+
+	log_info( "Traced %lu reads", trace_count );
+}
@@ -0,0 +1,62 @@
+#ifndef PWX_XFS_UNDELETE_SRC_TRACE_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_TRACE_H_INCLUDED 1
+#pragma once
+
+
+#include "backend.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+
+/// @brief Return true if reads from the source device are recorded
+bool trace_is_active( void );
+
+
+/** @brief Record one read from the source device
+  *
+  * This is called by src_pread() for every read while tracing is active.
+  *
+  * @param[in] offset   Byte offset relative to the start of the file system
+  * @param[in] len      Number of bytes requested
+  * @param[in] result   What the read returned
+  * @param[in] purpose  Why the read was done
+  * @param[in] start    stat_now_ns() before the read was issued
+**/
+void trace_record( off_t offset, size_t len, ssize_t result, e_io_purpose purpose, uint64_t start );
+
+
+/** @brief Replay the reads of a trace against a device or image
+  *
+  * Every thread of the recorded run gets a thread of its own, which issues
+  * the reads of its original in the recorded order, as fast as it can. All
+  * reads go through src_pread(), so a simulated backend can be used.
+  * Count, size and latency per purpose are logged, next to the latency
+  * that was recorded.
+  *
+  * @param[in] trace_path  Path of the trace file
+  * @param[in] device      Path to the device or image to read from
+  * @return 0 on success, -1 on failure.
+**/
+int trace_replay( char const* trace_path, char const* device );
+
+
+/** @brief Start recording all reads from the source device
+  *
+  * Every read is recorded with offset, size, result, purpose, a small
+  * thread number, its start time and its latency. Records have a fixed
+  * size of 32 bytes and are written in host byte order.
+  *
+  * @param[in] path  Path of the trace file, is truncated if it exists
+  * @return 0 on success, -1 on failure.
+**/
+int trace_start( char const* path );
+
+
+/// @brief Stop recording and close the trace file, if tracing is active
+void trace_stop( void );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_TRACE_H_INCLUDED
@@ -0,0 +1,661 @@
+/*******************************************************************************
+ * watch.c : Watch a live file system and capture freed inodes in time
+ ******************************************************************************/
+
+
+#include "backend.h"
+#include "device.h"
+#include "forensics.h"
+#include "globals.h"
+#include "log.h"
+#include "record.h"
+#include "utils.h"
+#include "watch.h"
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// AGI layout
+#define AGI_MAGIC         "XAGI"
+#define AGI_ROOT          20  // Bytes 20-23 : Root block of the inode B+tree
+#define AGI_LEVEL         24  // Bytes 24-27 : Levels of the inode B+tree
+#define AGI_UNLINKED      40  // Bytes 40-295 : Heads of the 64 unlinked buckets
+#define AGI_UNLINKED_CNT  64
+#define AGI_FREE_ROOT     328 // Bytes 328-331 : Root block of the free inode B+tree (v5 only)
+#define AGI_FREE_LEVEL    332 // Bytes 332-335 : Levels of the free inode B+tree (v5 only)
+#define AGI_MIN_SIZE      336
+
+// Inode B+tree layout
+#define IBT_HDR_V4        16  // Short form B+tree block header size
+#define IBT_HDR_V5        56  // Short form B+tree block header size with CRC
+#define IBT_REC_SIZE      16  // startino(4) + holemask/count/freecount(4) + free mask(8)
+#define IBT_MAX_LEVEL     8   // More is corruption
+#define IBT_NULL_AGINO    0xffffffff
+
+// Various limits
+#define WATCH_CHAIN_MAX   1024 // Maximum unlinked bucket chain length to follow
+#define WATCH_DIR_BLKS    16   // Maximum number of blocks per extent checked for directory data
+#define WATCH_PEND_TRIES  10   // Cycles a freed inode is retried until its core is written back
+#define XFS_SB_SPINODES   0x02 // Sparse inode chunks feature (rw_inco_flags)
+
+// Capture store
+#define CAPTURE_FILE      "captures.xuc"
+#define CAPTURE_MAGIC     "XUCS"
+#define CAPTURE_REC_MAGIC "XUCR"
+#define CAPTURE_VERSION   1
+
+
+/// @brief enum of the kinds of captured data
+typedef enum _capture_type {
+	CT_INODE  = 1, //!< An inode core
+	CT_DIRBLK = 2  //!< A directory block
+} e_capture_type;
+
+
+/// @brief enum of the reasons why something was captured
+typedef enum _capture_reason {
+	CR_FREED    = 1, //!< The inode became free
+	CR_UNLINKED = 2, //!< The inode showed up in an unlinked bucket
+	CR_DIRDATA  = 3  //!< The block is directory data of a captured inode
+} e_capture_reason;
+
+
+/// @brief Header of the capture store file
+typedef struct _capture_file_hdr {
+	char     magic[4]; //!< CAPTURE_MAGIC
+	uint32_t version;  //!< CAPTURE_VERSION
+	uint8_t  UUID[16]; //!< UUID of the watched file system
+} capture_file_hdr_t;
+
+
+/// @brief Header of one capture record, followed by @a len bytes of data
+typedef struct _capture_rec_hdr {
+	char     magic[4]; //!< CAPTURE_REC_MAGIC
+	uint8_t  type;     //!< One of e_capture_type
+	uint8_t  reason;   //!< One of e_capture_reason
+	uint16_t padding;  //!< Must be zero
+	uint32_t len;      //!< Number of bytes following
+	uint32_t ag_num;   //!< AG the data resides in
+	uint64_t position; //!< Absolute byte position in the file system
+	int64_t  when;     //!< Seconds since the epoch of the capture
+} capture_rec_hdr_t;
+
+
+/// @brief A sorted set of AG relative inode numbers
+typedef struct _ino_set {
+	uint32_t* ino;   //!< The inode numbers
+	uint8_t*  tries; //!< Cycles each inode was retried, only used by the pending sets
+	uint32_t  count; //!< Number of inode numbers in the set
+	uint32_t  size;  //!< Number of inode numbers the set can hold
+} ino_set_t;
+
+
+/// @brief Everything one watch cycle needs
+typedef struct _watch_ctx {
+	uint8_t*   blk_buf;    //!< Aligned buffer for one block
+	uint64_t   blk_pos;    //!< Position of the block in @a blk_buf, UINT64_MAX if none
+	uint8_t*   dir_buf;    //!< Aligned buffer for checking directory blocks
+	int        fd;         //!< File descriptor of the source device
+	ino_set_t* free_now;   //!< Free inodes per AG found in this cycle
+	ino_set_t* free_prev;  //!< Free inodes per AG found in the previous cycle
+	ino_set_t* pend_now;   //!< Freed inodes per AG to retry in the next cycle
+	ino_set_t* pend_prev;  //!< Freed inodes per AG to retry in this cycle
+	uint64_t   captured;   //!< Number of records written in total
+	FILE*      store;      //!< The capture store
+	ino_set_t* unl_now;    //!< Unlinked inodes per AG found in this cycle
+	ino_set_t* unl_prev;   //!< Unlinked inodes per AG found in the previous cycle
+	bool       is_v5;      //!< True on v5 file systems
+	bool       sparse;     //!< True if sparse inode chunks are enabled
+} watch_ctx_t;
+
+
+static volatile sig_atomic_t watch_stop = 0;
+
+
+/// @internal Signal handler to end watching
+static void on_stop_signal( int sig ) {
+	( void )sig;
+	watch_stop = 1;
+}
+
+
+/// @internal Append @a ino to @a set
+static int set_add( ino_set_t* set, uint32_t ino ) {
+	if ( set->count == set->size ) {
+		uint32_t  new_size = set->size ? set->size * 2 : 1024;
+		uint32_t* new_ino  = realloc( set->ino, new_size * sizeof( uint32_t ) );
+		if ( NULL == new_ino ) {
+			log_critical( "Unable to allocate %zu bytes for inode set! %m [%d]",
+			              new_size * sizeof( uint32_t ), errno );
+			return -1;
+		}
+		set->ino  = new_ino;
+		set->size = new_size;
+	}
+	set->ino[set->count++] = ino;
+	return 0;
+}
+
+
+/// @internal Append @a ino, which was retried @a tries times, to the pending @a set
+static int pend_add( ino_set_t* set, uint32_t ino, uint8_t tries ) {
+	uint32_t old_size = set->size;
+
+	if ( -1 == set_add( set, ino ) )
+		return -1;
+
+	if ( ( NULL == set->tries ) || ( old_size != set->size ) ) {
+		uint8_t* new_tries = realloc( set->tries, set->size );
+		if ( NULL == new_tries ) {
+			log_critical( "Unable to allocate %u bytes for pending inodes! %m [%d]", set->size, errno );
+			set->count--;
+			return -1;
+		}
+		set->tries = new_tries;
+	}
+	set->tries[set->count - 1] = tries;
+
+	return 0;
+}
+
+
+/// @internal sort helper for the unlinked sets, which are not walked in order
+static int cmp_ino( void const* a, void const* b ) {
+	uint32_t l = *( uint32_t const* )a;
+	uint32_t r = *( uint32_t const* )b;
+	return ( l > r ) - ( l < r );
+}
+
+
+/// @internal return true if the sorted @a set contains @a ino
+static bool set_has( ino_set_t const* set, uint32_t ino ) {
+	return NULL != bsearch( &ino, set->ino, set->count, sizeof( uint32_t ), cmp_ino );
+}
+
+
+/// @internal Read one block of an AG, keeping the last one cached
+static uint8_t const* read_ag_block( watch_ctx_t* ctx, uint32_t ag_num, uint64_t ag_blk ) {
+	uint64_t pos = ( ag_num * full_ag_bytes ) + ( ag_blk * sb_block_size );
+
+	if ( pos == ctx->blk_pos )
+		return ctx->blk_buf;
+
+	if ( ( ag_blk >= superblocks[ag_num].ag_size )
+	  || ( ( ssize_t )sb_block_size != src_pread( ctx->fd, ctx->blk_buf, sb_block_size, pos, IO_WATCH ) ) ) {
+		log_error( "Unable to read AG %u block %llu: %m [%d]", ag_num, ag_blk, errno );
+		ctx->blk_pos = UINT64_MAX;
+		return NULL;
+	}
+
+	ctx->blk_pos = pos;
+	return ctx->blk_buf;
+}
+
+
+/// @internal Append one record to the capture store
+static int store_record( watch_ctx_t* ctx, uint8_t type, uint8_t reason, uint32_t ag_num,
+                         uint64_t position, uint8_t const* data, uint32_t len ) {
+	capture_rec_hdr_t hdr = {
+		.type     = type,
+		.reason   = reason,
+		.padding  = 0,
+		.len      = len,
+		.ag_num   = ag_num,
+		.position = position,
+		.when     = ( int64_t )time( NULL )
+	};
+	memcpy( hdr.magic, CAPTURE_REC_MAGIC, 4 );
+
+	if ( ( 1 != fwrite( &hdr, sizeof( hdr ), 1, ctx->store ) )
+	  || ( 1 != fwrite( data, len, 1, ctx->store ) ) ) {
+		log_critical( "Unable to write to the capture store: %m [%d]", errno );
+		return -1;
+	}
+
+	ctx->captured++;
+	return 0;
+}
+
+
+/// @internal Capture the directory blocks the data fork extents of an inode core point to
+static int capture_dir_blocks( watch_ctx_t* ctx, uint8_t const* core ) {
+	xfs_sb_t const* sb    = &superblocks[0];
+	size_t          start = core[4] > 2 ? DATA_START_V3 : DATA_START_V1;
+
+	// The extent count is zeroed on delete, but the records stay.
+	for ( size_t pos = start; ( pos + 16 ) <= sb->inode_size; pos += 16 ) {
+		if ( is_data_empty( core + pos, 16 ) )
+			break;
+
+		uint64_t l0      = get_flip64u( core, pos );
+		uint64_t l1      = get_flip64u( core, pos + 8 );
+		uint64_t fs_blk  = ( ( l0 & 0x1ff ) << 43 ) | ( l1 >> 21 );
+		uint32_t len     = l1 & 0x1fffff;
+		uint32_t ag_num  = fs_blk >> sb->log2_ag_size;
+		uint64_t ex_pos  = 0;
+
+		if ( !fsb_to_pos( fs_blk, len, &ex_pos ) )
+			break; // Not an extent record
+
+		if ( len > WATCH_DIR_BLKS )
+			len = WATCH_DIR_BLKS;
+
+		for ( uint32_t i = 0; i < len; ++i ) {
+			uint64_t abs_pos = ex_pos + ( ( uint64_t )i * sb_block_size );
+
+			if ( ( ssize_t )sb_block_size != src_pread( ctx->fd, ctx->dir_buf, sb_block_size, abs_pos, IO_WATCH ) )
+				break;
+			if ( !is_directory_block( ctx->dir_buf ) )
+				break;
+			if ( -1 == store_record( ctx, CT_DIRBLK, CR_DIRDATA, ag_num, abs_pos, ctx->dir_buf, sb_block_size ) )
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/// @internal Capture one inode core, plus its directory blocks, returns 1 if captured, 0 if not, -1 on error
+static int capture_inode( watch_ctx_t* ctx, uint32_t ag_num, uint32_t agino, uint8_t reason ) {
+	xfs_sb_t const* sb     = &superblocks[ag_num];
+	uint64_t        ag_blk = agino >> sb->log2_inode_block;
+	uint32_t        offset = ( agino & ( ( 1U << sb->log2_inode_block ) - 1 ) ) * sb->inode_size;
+	uint8_t const*  blk    = read_ag_block( ctx, ag_num, ag_blk );
+	uint8_t         core[sb->inode_size];
+
+	if ( NULL == blk )
+		return 0; // Already logged, and not fatal for a watcher
+
+	memcpy( core, blk + offset, sb->inode_size );
+
+	if ( memcmp( core, XFS_IN_MAGIC, 2 ) )
+		return 0;
+
+	// A freed inode that still has a mode was not written back since it was freed, and that
+	// core is the best copy there is. Without a mode, it either was never used, or the freed
+	// core is not written back yet. The caller tries again in the next cycle.
+	if ( ( CR_FREED == reason ) && !get_flip16u( core, 2 ) && !is_deleted_inode( core ) )
+		return 0;
+
+	uint64_t position = ( ag_num * full_ag_bytes ) + ( ag_blk * sb_block_size ) + offset;
+	if ( ( -1 == store_record( ctx, CT_INODE, reason, ag_num, position, core, sb->inode_size ) )
+	  || ( -1 == capture_dir_blocks( ctx, core ) ) )
+		return -1;
+
+	return 1;
+}
+
+
+/// @internal Walk an inode B+tree and collect all free inodes
+static int walk_inobt( watch_ctx_t* ctx, uint32_t ag_num, uint32_t ag_blk, uint32_t level, ino_set_t* set ) {
+	if ( level >= IBT_MAX_LEVEL ) {
+		log_error( "Inode B+tree of AG %u is too deep, ignoring it", ag_num );
+		return 0;
+	}
+
+	uint8_t const* blk = read_ag_block( ctx, ag_num, ag_blk );
+	if ( NULL == blk )
+		return 0;
+
+	uint32_t hdr_size = ctx->is_v5 ? IBT_HDR_V5 : IBT_HDR_V4;
+	uint16_t blk_lvl  = get_flip16u( blk, 4 );
+	uint16_t num_recs = get_flip16u( blk, 6 );
+
+	if ( memcmp( blk, "IAB", 3 ) && memcmp( blk, "FIB", 3 ) ) {
+		log_error( "AG %u block %u is no inode B+tree block", ag_num, ag_blk );
+		return 0;
+	}
+
+	if ( blk_lvl ) {
+		// Node block: Keys first, then the pointers after the maximum number of keys
+		uint32_t max_recs = ( sb_block_size - hdr_size ) / 8;
+		uint32_t ptrs[max_recs];
+
+		if ( num_recs > max_recs )
+			num_recs = max_recs;
+
+		// The block buffer is re-used while descending, so copy the pointers out first.
+		for ( uint32_t i = 0; i < num_recs; ++i )
+			ptrs[i] = get_flip32u( blk, hdr_size + ( max_recs * 4 ) + ( i * 4 ) );
+
+		for ( uint32_t i = 0; i < num_recs; ++i ) {
+			if ( -1 == walk_inobt( ctx, ag_num, ptrs[i], level + 1, set ) )
+				return -1;
+		}
+		return 0;
+	}
+
+	// Leaf block
+	if ( ( hdr_size + ( ( size_t )num_recs * IBT_REC_SIZE ) ) > sb_block_size )
+		num_recs = ( sb_block_size - hdr_size ) / IBT_REC_SIZE;
+
+	for ( uint32_t i = 0; i < num_recs; ++i ) {
+		uint8_t const* rec      = blk + hdr_size + ( i * IBT_REC_SIZE );
+		uint32_t       startino = get_flip32u( rec, 0 );
+		uint16_t       holemask = ctx->sparse ? get_flip16u( rec, 4 ) : 0;
+		uint64_t       free_msk = get_flip64u( rec, 8 );
+
+		for ( uint32_t j = 0; j < 64; ++j ) {
+			// Each holemask bit covers four inodes that do not exist
+			if ( ( free_msk & ( 1ULL << j ) ) && !( holemask & ( 1U << ( j / 4 ) ) ) ) {
+				if ( -1 == set_add( set, startino + j ) )
+					return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/// @internal Run one cycle on one AG
+static int watch_ag( watch_ctx_t* ctx, uint32_t ag_num, bool is_first ) {
+	xfs_sb_t const* sb     = &superblocks[ag_num];
+	ino_set_t*      f_now  = &ctx->free_now[ag_num];
+	ino_set_t*      f_prev = &ctx->free_prev[ag_num];
+	ino_set_t*      u_now  = &ctx->unl_now[ag_num];
+	ino_set_t*      u_prev = &ctx->unl_prev[ag_num];
+	ino_set_t*      p_now  = &ctx->pend_now[ag_num];
+	ino_set_t*      p_prev = &ctx->pend_prev[ag_num];
+	uint8_t         agi[AGI_MIN_SIZE];
+
+	f_now->count = 0;
+	u_now->count = 0;
+	p_now->count = 0;
+	ctx->blk_pos = UINT64_MAX; // Everything might have changed since the last cycle
+
+	// The AGI is the third sector of the AG. It is within the first block, which is read anyway.
+	uint8_t const* blk = read_ag_block( ctx, ag_num, ( 2 * sb->sector_size ) / sb_block_size );
+	if ( NULL == blk )
+		return 0;
+	memcpy( agi, blk + ( ( 2 * sb->sector_size ) % sb_block_size ), AGI_MIN_SIZE );
+	ctx->blk_pos = UINT64_MAX; // The AGI changes all the time, never use it cached.
+
+	if ( memcmp( agi, AGI_MAGIC, 4 ) ) {
+		log_error( "AG %u has no valid AGI", ag_num );
+		return 0;
+	}
+
+	// --- Collect the free inodes, preferably from the much smaller finobt ---
+	uint32_t root  = get_flip32u( agi, AGI_ROOT );
+	uint32_t level = get_flip32u( agi, AGI_LEVEL );
+	if ( ctx->is_v5 && get_flip32u( agi, AGI_FREE_ROOT ) ) {
+		root  = get_flip32u( agi, AGI_FREE_ROOT );
+		level = get_flip32u( agi, AGI_FREE_LEVEL );
+	}
+	if ( level && ( -1 == walk_inobt( ctx, ag_num, root, 0, f_now ) ) )
+		return -1;
+
+	// --- Collect the unlinked inodes ---
+	for ( uint32_t b = 0; b < AGI_UNLINKED_CNT; ++b ) {
+		uint32_t agino = get_flip32u( agi, AGI_UNLINKED + ( b * 4 ) );
+
+		for ( uint32_t n = 0; ( IBT_NULL_AGINO != agino ) && ( n < WATCH_CHAIN_MAX ); ++n ) {
+			uint64_t       ag_blk = agino >> sb->log2_inode_block;
+			uint32_t       offset = ( agino & ( ( 1U << sb->log2_inode_block ) - 1 ) ) * sb->inode_size;
+			uint8_t const* in_blk = read_ag_block( ctx, ag_num, ag_blk );
+
+			if ( ( NULL == in_blk ) || ( -1 == set_add( u_now, agino ) ) )
+				break;
+			agino = get_flip32u( in_blk, offset + 96 ); // next unlinked pointer
+		}
+	}
+	qsort( u_now->ino, u_now->count, sizeof( uint32_t ), cmp_ino );
+
+	// --- Capture what is new ---
+	for ( uint32_t i = 0; i < u_now->count; ++i ) {
+		if ( !set_has( u_prev, u_now->ino[i] )
+		  && ( -1 == capture_inode( ctx, ag_num, u_now->ino[i], CR_UNLINKED ) ) )
+			return -1;
+	}
+
+	if ( !is_first ) {
+		// Retry what was not ready, unless it got used again in between
+		for ( uint32_t i = 0; i < p_prev->count; ++i ) {
+			if ( !set_has( f_now, p_prev->ino[i] ) )
+				continue;
+
+			int res = capture_inode( ctx, ag_num, p_prev->ino[i], CR_FREED );
+			if ( ( -1 == res )
+			  || ( !res && ( ( p_prev->tries[i] + 1 ) < WATCH_PEND_TRIES )
+			    && ( -1 == pend_add( p_now, p_prev->ino[i], p_prev->tries[i] + 1 ) ) ) )
+				return -1;
+		}
+
+		for ( uint32_t i = 0; i < f_now->count; ++i ) {
+			if ( set_has( f_prev, f_now->ino[i] ) )
+				continue;
+
+			int res = capture_inode( ctx, ag_num, f_now->ino[i], CR_FREED );
+			if ( ( -1 == res ) || ( !res && ( -1 == pend_add( p_now, f_now->ino[i], 0 ) ) ) )
+				return -1;
+		}
+	}
+
+	// This cycle is the next ones previous
+	ino_set_t tmp = *f_prev;
+	*f_prev       = *f_now;
+	*f_now        = tmp;
+	tmp           = *u_prev;
+	*u_prev       = *u_now;
+	*u_now        = tmp;
+	tmp           = *p_prev;
+	*p_prev       = *p_now;
+	*p_now        = tmp;
+
+	return 0;
+}
+
+
+/// @internal Open the capture store, creating it if needed
+static FILE* open_store( char const* store_dir, char const* mode ) {
+	char path[PATH_MAX] = { 0x0 };
+
+	snprintf( path, PATH_MAX, "%s/%s", store_dir, CAPTURE_FILE );
+
+	FILE* store = fopen( path, mode );
+	if ( NULL == store )
+		log_critical( "Can not open %s: %m [%d]", path, errno );
+
+	return store;
+}
+
+
+// ========================================
+// --- Public functions implementations ---
+// ========================================
+int load_captures( char const* device, char const* store_dir ) {
+	RETURN_INT_IF_NULL( device );
+	RETURN_INT_IF_NULL( store_dir );
+
+	capture_file_hdr_t fhdr;
+	capture_rec_hdr_t  rhdr;
+	uint8_t*           data   = NULL;
+	uint64_t           dirs   = 0, files = 0, dirblks = 0, inodes = 0;
+	int                fd     = -1;
+	int                res    = -1;
+	FILE*              store  = open_store( store_dir, "rb" );
+
+	if ( NULL == store )
+		return -1;
+
+	if ( ( 1 != fread( &fhdr, sizeof( fhdr ), 1, store ) )
+	  || memcmp( fhdr.magic, CAPTURE_MAGIC, 4 )
+	  || ( CAPTURE_VERSION != fhdr.version ) ) {
+		log_critical( "%s holds no valid capture store", store_dir );
+		goto cleanup;
+	}
+	if ( memcmp( fhdr.UUID, superblocks[0].UUID, 16 ) ) {
+		log_critical( "The captures in %s belong to a different file system", store_dir );
+		goto cleanup;
+	}
+
+	fd = src_open( device, O_NOFOLLOW );
+	if ( -1 == fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		goto cleanup;
+	}
+
+	data = malloc( sb_block_size > superblocks[0].inode_size ? sb_block_size : superblocks[0].inode_size );
+	if ( NULL == data ) {
+		log_critical( "Unable to allocate %u bytes for capture buffer!", sb_block_size );
+		goto cleanup;
+	}
+
+	while ( 1 == fread( &rhdr, sizeof( rhdr ), 1, store ) ) {
+		if ( memcmp( rhdr.magic, CAPTURE_REC_MAGIC, 4 )
+		  || ( rhdr.len > sb_block_size ) || ( rhdr.ag_num >= sb_ag_count )
+		  || ( 1 != fread( data, rhdr.len, 1, store ) ) ) {
+			log_error( "Capture store in %s is corrupt, stopping after %llu inodes", store_dir, inodes );
+			break;
+		}
+
+		if ( CT_DIRBLK == rhdr.type ) {
+			++dirblks;
+			continue;
+		}
+		if ( ( CT_INODE != rhdr.type ) || ( rhdr.len != superblocks[0].inode_size ) )
+			continue;
+		++inodes;
+
+		if ( -1 == record_queue_inode( rhdr.ag_num, rhdr.position, data, fd, true, &dirs, &files ) )
+			goto cleanup;
+	}
+
+	log_info( "Captured inodes    : %llu", inodes );
+	log_info( " ==> Queued        : %llu directories, %llu files", dirs, files );
+	log_info( "Directory blocks   : %llu", dirblks );
+
+	res = 0;
+
+cleanup:
+	if ( fd > -1 )
+		close( fd );
+	fclose( store );
+	FREE_PTR( data );
+
+	return res;
+}
+
+
+int run_watch( char const* device, char const* store_dir, uint32_t interval ) {
+	RETURN_INT_IF_NULL( device );
+	RETURN_INT_IF_NULL( store_dir );
+
+	xfs_sb_t const*  sb  = &superblocks[0];
+	watch_ctx_t      ctx = { .blk_pos = UINT64_MAX, .fd = -1 };
+	int              res = -1;
+	struct sigaction act = { .sa_handler = on_stop_signal };
+
+	ctx.is_v5  = 5 == ( sb->fs_version & 0x0f );
+	ctx.sparse = ctx.is_v5 && ( sb->rw_inco_flags & XFS_SB_SPINODES );
+
+	if ( mkdirs( store_dir ) )
+		return -1;
+
+	// --- Open the store, and write its header if it is new ---
+	ctx.store = open_store( store_dir, "ab" );
+	if ( NULL == ctx.store )
+		return -1;
+	if ( 0 == ftell( ctx.store ) ) {
+		capture_file_hdr_t fhdr = { .version = CAPTURE_VERSION };
+		memcpy( fhdr.magic, CAPTURE_MAGIC, 4 );
+		memcpy( fhdr.UUID, sb->UUID, 16 );
+		if ( 1 != fwrite( &fhdr, sizeof( fhdr ), 1, ctx.store ) ) {
+			log_critical( "Unable to write to the capture store: %m [%d]", errno );
+			goto cleanup;
+		}
+	}
+
+	// --- Open the device, bypassing the page cache if possible ---
+	ctx.fd = src_open( device, O_NOFOLLOW | O_DIRECT );
+	if ( -1 == ctx.fd ) {
+		log_warning( "Can not open %s with O_DIRECT, using the page cache", device );
+		ctx.fd = src_open( device, O_NOFOLLOW );
+	}
+	if ( -1 == ctx.fd ) {
+		log_error( "Can not open %s for reading: %m [%d]", device, errno );
+		goto cleanup;
+	}
+
+	if ( posix_memalign( ( void** )&ctx.blk_buf, 4096, sb_block_size )
+	  || posix_memalign( ( void** )&ctx.dir_buf, 4096, sb_block_size ) ) {
+		log_critical( "Unable to allocate %u bytes for block buffers!", sb_block_size );
+		goto cleanup;
+	}
+
+	ctx.free_now  = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	ctx.free_prev = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	ctx.unl_now   = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	ctx.unl_prev  = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	ctx.pend_now  = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	ctx.pend_prev = calloc( sb_ag_count, sizeof( ino_set_t ) );
+	if ( !ctx.free_now || !ctx.free_prev || !ctx.unl_now || !ctx.unl_prev || !ctx.pend_now || !ctx.pend_prev ) {
+		log_critical( "Unable to allocate inode sets for %u AGs! %m [%d]", sb_ag_count, errno );
+		goto cleanup;
+	}
+
+	sigaction( SIGINT,  &act, NULL );
+	sigaction( SIGTERM, &act, NULL );
+
+	log_info( "Watching %s every %u seconds, captures go to %s", device, interval, store_dir );
+
+	/// === Main Watch Loop ===
+	/// =======================
+	for ( uint64_t cycle = 0; !watch_stop; ++cycle ) {
+		uint64_t before = ctx.captured;
+
+		for ( uint32_t i = 0; ( i < sb_ag_count ) && !watch_stop; ++i ) {
+			if ( -1 == watch_ag( &ctx, i, 0 == cycle ) )
+				goto cleanup;
+		}
+		fflush( ctx.store );
+
+		if ( ctx.captured > before )
+			log_status( "Cycle %llu: %llu new captures, %llu in total",
+			            cycle, ctx.captured - before, ctx.captured );
+
+		for ( uint32_t s = 0; ( s < interval ) && !watch_stop; ++s )
+			sleep( 1 );
+	}
+
+	log_info( "Watch ended, %llu records captured", ctx.captured );
+	res = 0;
+
+cleanup:
+	if ( ctx.free_now && ctx.free_prev && ctx.unl_now && ctx.unl_prev && ctx.pend_now && ctx.pend_prev ) {
+		for ( uint32_t i = 0; i < sb_ag_count; ++i ) {
+			FREE_PTR( ctx.free_now[i].ino );
+			FREE_PTR( ctx.free_prev[i].ino );
+			FREE_PTR( ctx.unl_now[i].ino );
+			FREE_PTR( ctx.unl_prev[i].ino );
+			FREE_PTR( ctx.pend_now[i].ino );
+			FREE_PTR( ctx.pend_now[i].tries );
+			FREE_PTR( ctx.pend_prev[i].ino );
+			FREE_PTR( ctx.pend_prev[i].tries );
+		}
+	}
+	FREE_PTR( ctx.free_now );
+	FREE_PTR( ctx.free_prev );
+	FREE_PTR( ctx.unl_now );
+	FREE_PTR( ctx.unl_prev );
+	FREE_PTR( ctx.pend_now );
+	FREE_PTR( ctx.pend_prev );
+	FREE_PTR( ctx.blk_buf );
+	FREE_PTR( ctx.dir_buf );
+	if ( ctx.fd > -1 )
+		close( ctx.fd );
+	fclose( ctx.store );
+
+	return res;
+}
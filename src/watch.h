@@ -0,0 +1,46 @@
+#ifndef PWX_XFS_UNDELETE_SRC_WATCH_H_INCLUDED
+#define PWX_XFS_UNDELETE_SRC_WATCH_H_INCLUDED 1
+#pragma once
+
+
+#include <stdint.h>
+
+
+/** @brief Load the captures of a watch store into the inode queues
+  *
+  * Every captured inode core is fed through xfs_read_in() and pushed
+  * onto the inode queues. Captured directory blocks are counted and
+  * reported.
+  *
+  * @param[in] device     Path to the source device, needed for reading extents
+  * @param[in] store_dir  Directory holding the capture store
+  * @return 0 on success, -1 on failure.
+**/
+int load_captures( char const* device, char const* store_dir );
+
+
+/** @brief Watch the source device for deletions and capture freed inodes
+  *
+  * This runs until SIGINT or SIGTERM is received. Every @a interval
+  * seconds the AGI of every AG is read. Its free inode B+tree (or the
+  * inode B+tree if there is no finobt) is walked to build the set of free
+  * inodes. The set is compared against the previous one, and the cores of
+  * newly freed inodes are appended to the capture store. The same is done
+  * for inodes newly found in the unlinked buckets. Directory blocks
+  * referenced by the data fork of a captured inode are captured, too.
+  *
+  * All reads use O_DIRECT if possible, so the page cache of a busy
+  * server is not polluted. The device is *not* remounted read-only.
+  *
+  * The first cycle only records the free set and captures nothing but
+  * the unlinked inodes.
+  *
+  * @param[in] device     Path to the source device
+  * @param[in] store_dir  Directory to hold the capture store, is created if needed
+  * @param[in] interval   Seconds to wait between two cycles
+  * @return 0 on success, -1 on failure.
+**/
+int run_watch( char const* device, char const* store_dir, uint32_t interval );
+
+
+#endif // PWX_XFS_UNDELETE_SRC_WATCH_H_INCLUDED
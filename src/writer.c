@@ -3,18 +3,31 @@
  ******************************************************************************/
 
 
+#include "backend.h"
+#include "device.h"
 #include "globals.h"
+#include "inode_queue.h"
 #include "log.h"
+#include "read_plan.h"
 #include "superblock.h"
+#include "thrd_ctrl.h"
+#include "utils.h"
 #include "writer.h"
 
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 
+#define WRITE_BATCH   32                // File inodes taken off the queue at once
+#define WRITE_BUF     ( 1024 * 1024 )   // Largest single read of a restored file
+#define WRITE_WAIT_MS 100               // Time to wait for inodes before looking at the scanners again
+
+
 static int init_write_data( write_data_t* write_data, uint32_t thrd_num, char const* dev_str,
                             xfs_sb_t* sb_data, uint32_t ag_num ) {
 	RETURN_INT_IF_NULL( write_data );
@@ -27,6 +40,7 @@ static int init_write_data( write_data_t* write_data, uint32_t thrd_num, char co
 	write_data->do_stop     = false;
 	write_data->is_finished = false;
 	write_data->is_running  = false;
+	write_data->is_shackled = true;
 	write_data->sb_data     = sb_data;
 	write_data->thread_num  = thrd_num;
 	write_data->undeleted   = 0;
@@ -35,6 +49,88 @@ static int init_write_data( write_data_t* write_data, uint32_t thrd_num, char co
 }
 
 
+/// @internal Copy all PLAN_READ steps of @a plan from @a fd into @a out, holes are left sparse
+static int write_plan( read_plan_t const* plan, int fd, int out, uint8_t* buf, uint64_t ino ) {
+	for ( uint32_t i = 0; i < plan->count; ++i ) {
+		plan_op_t const* op = &plan->ops[i];
+
+		if ( PLAN_READ != op->kind )
+			continue;
+
+		for ( uint64_t done = 0; done < op->length; ) {
+			size_t  len = ( op->length - done ) > WRITE_BUF ? WRITE_BUF : op->length - done;
+			ssize_t got = src_pread( fd, buf, len, op->pos + done, IO_RESTORE );
+
+			if ( got < 1 ) {
+				log_error( "Inode %llu: Unable to read %zu bytes at 0x%08llx: %m [%d]",
+				           ino, len, op->pos + done, errno );
+				return -1;
+			}
+			if ( got != pwrite( out, buf, got, op->offset + done ) ) {
+				log_error( "Inode %llu: Unable to write %zd bytes at %llu: %m [%d]",
+				           ino, got, op->offset + done, errno );
+				return -1;
+			}
+			done += got;
+		}
+	}
+
+	return 0;
+}
+
+
+/// @internal Restore file inode @a in into the target directory, named by its inode number
+static int restore_file( xfs_in_t* in, int fd, uint8_t* buf ) {
+	char         path[PATH_MAX] = { 0x0 };
+	read_plan_t* plan           = NULL;
+	int          out            = -1;
+	int          res            = -1;
+
+	// The maps were not built while scanning, failures are logged already
+	if ( -1 == xfs_map_in( in, fd ) )
+		return -1;
+
+	snprintf( path, PATH_MAX, "%s/%llu", get_target_path(), ( unsigned long long )in->inode_id );
+	out = open( path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600 );
+	if ( -1 == out ) {
+		log_error( "Unable to create %s: %m [%d]", path, errno );
+		return -1;
+	}
+
+	if ( ST_LOCAL == in->data_fork_type ) {
+		// Small files live in the inode itself
+		uint8_t const* loc = in->data ? in->data->d_loc_data : NULL;
+		if ( loc && in->file_size && ( ( ssize_t )in->file_size != write( out, loc, in->file_size ) ) ) {
+			log_error( "Unable to write %llu bytes into %s: %m [%d]", in->file_size, path, errno );
+			goto cleanup;
+		}
+		res = 0;
+		goto cleanup;
+	}
+
+	// Everything else is read with as few and as large reads as possible
+	plan = plan_create( in->d_exts, in->file_size );
+	if ( ( NULL == plan ) || ( -1 == write_plan( plan, fd, out, buf, in->inode_id ) ) )
+		goto cleanup;
+
+	// Holes at the end are not written, so the file needs its size set
+	if ( -1 == ftruncate( out, plan->file_size ) ) {
+		log_error( "Unable to resize %s to %llu bytes: %m [%d]", path, plan->file_size, errno );
+		goto cleanup;
+	}
+
+	res = 0;
+
+cleanup:
+	plan_free( &plan );
+	close( out );
+	if ( -1 == res )
+		unlink( path );
+
+	return res;
+}
+
+
 write_data_t* create_writer_data( uint32_t ar_size, char const* dev_str ) {
 	RETURN_NULL_IF_ZERO( ar_size );
 	RETURN_NULL_IF_NULL( dev_str );
@@ -68,10 +164,11 @@ void free_writer_data( write_data_t** data ) {
 int writer( void* write_data ) {
 	RETURN_INT_IF_NULL( write_data );
 
-	uint8_t*     buf  = NULL;
+	xfs_in_t*     batch[WRITE_BATCH];
+	uint8_t*      buf  = NULL;
 	write_data_t* data = ( write_data_t* )write_data;
-	int          fd   = -1;
-	int          res  = -1;
+	int           fd   = -1;
+	int           res  = -1;
 
 
 	// Sleep until signaled to start
@@ -88,20 +185,36 @@ int writer( void* write_data ) {
 	data->is_running = true;
 
 	// First we need a buffer:
-	buf = malloc( sb_block_size );
+	buf = malloc( WRITE_BUF );
 	if ( NULL == buf ) {
-		log_critical( "Unable to allocate %lu bytes for block buffer!", sb_block_size );
+		log_critical( "Unable to allocate %d bytes for the read buffer!", WRITE_BUF );
 		goto cleanup;
 	}
 
 	// Let's open the device, then.
-	fd  = open( data->device, O_RDONLY | O_NOFOLLOW );
+	fd  = src_open( data->device, O_NOFOLLOW );
 	if ( -1 == fd ) {
 		log_error( "[Thread %lu] Can not open %s for reading: %m [%d]",
 		           data->thread_num, data->device, errno );
 		goto cleanup;
 	}
 
+	/* On rotational sources, the writer restores what the last scan found. Otherwise
+	 * it waits for more, until the scanners of all AG groups are finished. */
+	while ( !data->do_stop ) {
+		bool   is_last = ( ( false == data->is_shackled ) || !src_is_ssd ) && ( 0 == scanner_running() );
+		size_t count   = file_in_pop_batch( batch, WRITE_BATCH, WRITE_WAIT_MS );
+
+		if ( ( 0 == count ) && is_last )
+			break;
+
+		for ( size_t i = 0; i < count; ++i ) {
+			if ( !data->do_stop && ( 0 == restore_file( batch[i], fd, buf ) ) )
+				++data->undeleted;
+			xfs_free_in( &batch[i] );
+		}
+	}
+
 	// We are here? All is well, then
 	res = 0;
 
@@ -18,6 +18,7 @@ typedef struct _write_data {
 	_Atomic( bool )     do_stop;     //!< Initialized with false, set to true when the thread shall break off
 	_Atomic( bool )     is_finished; //!< Initialized with false, set to true when the thread is finished.
 	_Atomic( bool )     is_running;   //!< Set to true when woken up, and to false when stopping
+	_Atomic( bool )     is_shackled; //!< Wait for more file inodes, scanners aren't finished.
 	xfs_sb_t*           sb_data;     //!< The Superblock data this thread shall handle
 	mtx_t               sleep_lock;  //!< Used for conditional sleeping until signaled
 	int32_t             thread_num;  //!< Number of the thread for logging
@@ -0,0 +1,35 @@
+#ifndef PWX_XFS_UNDELETE_TESTS_CHECK_H_INCLUDED
+#define PWX_XFS_UNDELETE_TESTS_CHECK_H_INCLUDED 1
+#pragma once
+
+
+/* Minimal harness for the checks run by `make check`.
+ * Every check program is linked against all modules but main.o, and
+ * returns EXIT_FAILURE if any of its CHECK()s failed.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+static int check_failed = 0; //!< Number of failed CHECK()s in this program
+
+
+/// @brief Count and report @a cond if it does not hold, then go on
+#define CHECK( cond ) do {                                                 \
+	if ( !( cond ) ) {                                                 \
+		fprintf( stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond ); \
+		++check_failed;                                            \
+	}                                                                  \
+} while ( 0 )
+
+
+/// @brief Report the outcome of the check program, use as the last statement of main()
+#define CHECK_DONE( name ) do {                                            \
+	fprintf( stdout, "[%s] %s\n", check_failed ? "FAIL" : " OK ", name ); \
+	return check_failed ? EXIT_FAILURE : EXIT_SUCCESS;                 \
+} while ( 0 )
+
+
+#endif // PWX_XFS_UNDELETE_TESTS_CHECK_H_INCLUDED
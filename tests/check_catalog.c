@@ -0,0 +1,96 @@
+/*******************************************************************************
+ * check_catalog.c : Adding, finding and removing inodes in the inode catalog
+ ******************************************************************************/
+
+
+#include "check.h"
+
+#include "catalog.h"
+#include "file_type.h"
+#include "globals.h"
+
+
+#include <threads.h>
+
+
+#define CAT_AG_COUNT  4      // 2 bits of AG number
+#define CAT_LOG2_AG   16     // 16 bits of block number in the AG
+#define CAT_LOG2_INB  3      // 3 bits of inode slot, 21 bits per inode number
+#define CAT_INO_LIMIT ( 1ULL << ( 2 + CAT_LOG2_AG + CAT_LOG2_INB ) )
+#define CAT_THREADS   4      // Threads adding the same inodes at once
+#define CAT_SHARED    50000  // Inodes every thread adds
+#define CAT_STRIDE    37     // Spread the shared inodes over many leaves
+
+
+static int adder( void* arg ) {
+	int res = 0;
+
+	( void )arg;
+	for ( uint64_t i = 0; i < CAT_SHARED; ++i )
+		res |= cat_add( i * CAT_STRIDE, FT_FILE );
+
+	return res;
+}
+
+
+int main( void ) {
+	xfs_sb_t sb = { .log2_ag_size = CAT_LOG2_AG, .log2_inode_block = CAT_LOG2_INB };
+
+	// The catalog sizes itself from the primary superblock on first use
+	superblocks = &sb;
+	sb_ag_count = CAT_AG_COUNT;
+
+	// 1) Single inodes in the first leaf, a far one, and the last possible
+	CHECK( 0 == cat_find( 128 ) );
+	CHECK( 0 == cat_add( 128, FT_DIR ) );
+	CHECK( 0 == cat_add( 129, FT_FILE ) );
+	CHECK( 0 == cat_add( 1000000, FT_SYM ) );
+	CHECK( 0 == cat_add( CAT_INO_LIMIT - 1, FT_FILE ) );
+	CHECK( 4 == cat_count() );
+	CHECK( FT_DIR  == cat_find( 128 ) );
+	CHECK( FT_FILE == cat_find( 129 ) );
+	CHECK( FT_SYM  == cat_find( 1000000 ) );
+	CHECK( FT_FILE == cat_find( CAT_INO_LIMIT - 1 ) );
+	CHECK( 0 == cat_find( 130 ) );
+	CHECK( 0 == cat_find( 1000001 ) );
+
+	// 2) Adding again changes the type, but does not count twice
+	CHECK( 0 == cat_add( 129, FT_DIR ) );
+	CHECK( 4 == cat_count() );
+	CHECK( FT_DIR == cat_find( 129 ) );
+
+	// 3) Removing, also of inodes that are not there
+	cat_del( 129 );
+	cat_del( 130 );
+	cat_del( CAT_INO_LIMIT + 1 );
+	CHECK( 3 == cat_count() );
+	CHECK( 0 == cat_find( 129 ) );
+	CHECK( FT_DIR == cat_find( 128 ) );
+
+	// 4) Inode numbers the file system can not have are refused
+	CHECK( -1 == cat_add( CAT_INO_LIMIT, FT_FILE ) );
+	CHECK( 0 == cat_find( CAT_INO_LIMIT ) );
+	CHECK( 3 == cat_count() );
+
+	// 5) Threads racing to add the same inodes count each one once
+	cat_free();
+	CHECK( 0 == cat_count() );
+	CHECK( 0 == cat_find( 128 ) );
+
+	thrd_t thr[CAT_THREADS];
+	int    res;
+	for ( size_t i = 0; i < CAT_THREADS; ++i )
+		CHECK( thrd_success == thrd_create( &thr[i], adder, NULL ) );
+	for ( size_t i = 0; i < CAT_THREADS; ++i ) {
+		thrd_join( thr[i], &res );
+		CHECK( 0 == res );
+	}
+	CHECK( CAT_SHARED == cat_count() );
+	CHECK( FT_FILE == cat_find( ( CAT_SHARED - 1 ) * CAT_STRIDE ) );
+	CHECK( 0 == cat_find( CAT_STRIDE + 1 ) );
+
+	cat_free();
+	superblocks = NULL;
+
+	CHECK_DONE( "inode catalog" );
+}
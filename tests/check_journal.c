@@ -0,0 +1,227 @@
+/*******************************************************************************
+ * check_journal.c : Rebuilding inodes from the log of a small fixture image
+ ******************************************************************************/
+
+
+#include "check.h"
+
+#include "device.h"
+#include "file_type.h"
+#include "globals.h"
+#include "inode_queue.h"
+#include "journal.h"
+#include "slab.h"
+
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* The fixture is a v4 file system of 2 AGs with 1000 blocks of 4 KiB each,
+ * 512 byte inodes and an internal log of 100 blocks at block 500. */
+#define FIX_BS        4096
+#define FIX_AG_BLOCKS 1000
+#define FIX_AG_COUNT  2
+#define FIX_LOG_BLOCK 500
+#define FIX_LOG_LEN   100
+#define FIX_IN_BLOCK  8              // Block of the inode chunk in AG0
+#define FIX_LSN       ( 1ULL << 32 ) // Cycle 1, block 0
+#define FIX_CTIME     1700000400
+
+#define LOG_BB        512 // Log basic block
+#define LOG_OP_HDR    12  // Bytes of a log operation header
+#define LOG_ILF_SIZE  56  // Bytes of an inode log format item
+#define LOG_CORE_V2   96  // Bytes a v1/v2 inode core is logged with
+
+
+static uint8_t const fix_uuid[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+
+/// @internal Store @a n bytes of @a val big endian, as on disk
+static void put_be( uint8_t* p, uint64_t val, int n ) {
+	for ( int i = n - 1; i >= 0; --i, val >>= 8 )
+		p[i] = val & 0xff;
+}
+
+
+/// @internal Store @a n bytes of @a val little endian, as logged on x86
+static void put_le( uint8_t* p, uint64_t val, int n ) {
+	for ( int i = 0; i < n; ++i, val >>= 8 )
+		p[i] = val & 0xff;
+}
+
+
+/// @internal Pack an extent of @a len blocks at @a fsb, file offset 0
+static void put_ext( uint8_t* p, uint64_t fsb, uint32_t len ) {
+	put_be( p,     fsb >> 43, 8 );
+	put_be( p + 8, ( ( fsb & ( ( 1ULL << 43 ) - 1 ) ) << 21 ) | len, 8 );
+}
+
+
+/** @internal Append one operation of @a len bytes to the log @a data at @a *used
+  * @return A pointer to the payload to fill.
+**/
+static uint8_t* add_op( uint8_t* data, size_t* used, uint32_t len ) {
+	uint8_t* op = data + *used;
+
+	put_be( op,     1,    4 ); // Transaction ID
+	put_be( op + 4, len,  4 );
+	op[8] = 0x69;              // XFS_TRANSACTION
+	*used += LOG_OP_HDR + len;
+
+	return op + LOG_OP_HDR;
+}
+
+
+/// @internal Log inode @a ino with a short v2 core and one data extent at @a fsb
+static void log_inode( uint8_t* data, size_t* used, uint64_t ino, uint64_t fsb ) {
+	uint8_t* ilf = add_op( data, used, LOG_ILF_SIZE );
+	uint64_t pos = ( FIX_IN_BLOCK * FIX_BS ) + ( ( ino & 7 ) * 512 );
+
+	put_le( ilf,      0x123b, 2 ); // XFS_LI_INODE
+	put_le( ilf +  2, 3,      2 ); // format, core and data fork
+	put_le( ilf +  4, 0x5,    4 ); // XFS_ILOG_CORE | XFS_ILOG_DEXT
+	put_le( ilf + 10, 16,     2 ); // One extent
+	put_le( ilf + 16, ino,    8 );
+	put_le( ilf + 40, pos / LOG_BB, 8 );
+	put_le( ilf + 48, 512,    4 );
+
+	uint8_t* core = add_op( data, used, LOG_CORE_V2 );
+	put_le( core,      0x494e, 2 ); // Inode magic, in host order
+	put_le( core +  2, 0x81a4, 2 ); // Regular file, 0644
+	core[4] = 2;                    // Version
+	core[5] = 2;                    // Extents
+	put_le( core + 16, 1,         4 );
+	put_le( core + 48, FIX_CTIME, 4 );
+	put_le( core + 56, FIX_BS,    8 );
+	put_le( core + 64, 1,         8 );
+	put_le( core + 76, 1,         4 );
+	core[83] = 2;
+
+	put_ext( add_op( data, used, 16 ), fsb, 1 );
+}
+
+
+/** @internal Write the fixture into @a fd
+  *
+  * Inode 66 is alive on disk, inode 67 is not there. The log holds one
+  * record with images of both, as a 96 byte v2 core each, like x86 logs
+  * them. So only 67 must be rebuilt, with its extent at block 30.
+**/
+static int write_fixture( int fd ) {
+	uint8_t buf[FIX_BS];
+	size_t  used = 0;
+
+	if ( ftruncate( fd, ( off_t )FIX_BS * FIX_AG_BLOCKS * FIX_AG_COUNT ) )
+		return -1;
+
+	for ( uint32_t ag = 0; ag < FIX_AG_COUNT; ++ag ) {
+		memset( buf, 0, LOG_BB );
+		memcpy( buf, "XFSB", 4 );
+		put_be( buf +   4, FIX_BS,                       4 );
+		put_be( buf +   8, FIX_AG_BLOCKS * FIX_AG_COUNT, 8 );
+		memcpy( buf +  32, fix_uuid, 16 );
+		put_be( buf +  48, FIX_LOG_BLOCK,                8 );
+		put_be( buf +  84, FIX_AG_BLOCKS,                4 );
+		put_be( buf +  88, FIX_AG_COUNT,                 4 );
+		put_be( buf +  96, FIX_LOG_LEN,                  4 );
+		put_be( buf + 100, 4,                            2 );
+		put_be( buf + 102, 512,                          2 );
+		put_be( buf + 104, 512,                          2 );
+		put_be( buf + 106, FIX_BS / 512,                 2 );
+		memcpy( buf + 120, ( uint8_t[] ){ 12, 9, 9, 3, 10 }, 5 );
+		if ( LOG_BB != pwrite( fd, buf, LOG_BB, ( off_t )ag * FIX_AG_BLOCKS * FIX_BS ) )
+			return -1;
+	}
+
+	// Inode 66 on disk, alive, generation 0
+	memset( buf, 0, 512 );
+	memcpy( buf, "IN", 2 );
+	put_be( buf +  2, 0x81a4, 2 );
+	buf[4] = 2;
+	buf[5] = 2;
+	put_be( buf + 16, 1, 4 );
+	put_ext( buf + 100, 31, 1 );
+	if ( 512 != pwrite( fd, buf, 512, ( FIX_IN_BLOCK * FIX_BS ) + 1024 ) )
+		return -1;
+
+	// Data of the logged inode 67
+	for ( size_t i = 0; i < FIX_BS; i += 8 )
+		memcpy( buf + i, "logged!\n", 8 );
+	if ( FIX_BS != pwrite( fd, buf, FIX_BS, 30 * FIX_BS ) )
+		return -1;
+
+	/* The log record: a header basic block, followed by the operations.
+	 * The first four bytes of every data block are replaced by the cycle
+	 * number, their content is kept in the header. */
+	uint8_t  rec[LOG_BB * 3] = { 0x0 };
+	uint8_t* hdr             = rec;
+	uint8_t* data            = rec + LOG_BB;
+
+	log_inode( data, &used, 66, 31 );
+	log_inode( data, &used, 67, 30 );
+
+	size_t h_len = ( used + LOG_BB - 1 ) / LOG_BB * LOG_BB;
+	put_be( hdr,      0xfeedbabe, 4 );
+	put_be( hdr +  4, 1,          4 ); // Cycle
+	put_be( hdr +  8, 2,          4 ); // Version
+	put_be( hdr + 12, used,       4 );
+	put_be( hdr + 16, FIX_LSN,    8 );
+	put_be( hdr + 40, 6,          4 ); // Operations
+	for ( size_t i = 0; i < h_len / LOG_BB; ++i ) {
+		memcpy( hdr + 44 + ( 4 * i ), data + ( i * LOG_BB ), 4 );
+		put_be( data + ( i * LOG_BB ), 1, 4 );
+	}
+	memcpy( hdr + 304, fix_uuid, 16 );
+	put_be( hdr + 320, 32768, 4 ); // Log buffer size
+
+	if ( ( ssize_t )( LOG_BB + h_len ) != pwrite( fd, rec, LOG_BB + h_len, FIX_LOG_BLOCK * FIX_BS ) )
+		return -1;
+
+	return 0;
+}
+
+
+int main( void ) {
+	char      path[] = "/tmp/xfs_undelete_journal_XXXXXX";
+	int       fd     = mkstemp( path );
+	xfs_in_t* out[IN_BATCH_MAX];
+	xfs_ex_t  ex;
+
+	if ( ( -1 == fd ) || write_fixture( fd ) ) {
+		perror( "Writing the fixture" );
+		if ( fd > -1 )
+			unlink( path );
+		return EXIT_FAILURE;
+	}
+	close( fd );
+
+	CHECK( 0 == set_source_device( path, false ) );
+	CHECK( 0 == scan_superblocks() );
+	CHECK( FIX_LOG_BLOCK == superblocks[0].journal_start );
+
+	// Only the inode that is gone from the disk comes out, with what its short core had
+	CHECK( 0 == scan_journal( path, NULL ) );
+	CHECK( NULL == dir_in_pop() );
+	CHECK( 1 == file_in_pop_batch( out, IN_BATCH_MAX, 0 ) );
+
+	xfs_in_t* in = out[0];
+	CHECK( 67 == in->inode_id );
+	CHECK( FT_FILE == in->ftype );
+	CHECK( in->is_logged && in->is_mapped );
+	CHECK( FIX_LSN == in->lsn );
+	CHECK( FIX_CTIME == in->ctime_ep );
+	CHECK( FIX_BS == in->file_size );
+	CHECK( in->d_exts && ( 1 == in->d_exts->count ) );
+	CHECK( in->d_exts && !xfs_ex_at( in->d_exts, 0, &ex ) && ( 30 == ex.block ) && ( 1 == ex.length ) );
+	xfs_free_in( &in );
+	CHECK( NULL == file_in_pop() );
+
+	in_clear();
+	free_devices();
+	slab_release();
+	unlink( path );
+
+	CHECK_DONE( "journal parser" );
+}
@@ -0,0 +1,146 @@
+/*******************************************************************************
+ * check_ring.c : Order, overflow and concurrency of the inode queues
+ ******************************************************************************/
+
+
+#include "check.h"
+
+#include "inode_queue.h"
+#include "slab.h"
+
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <threads.h>
+
+
+#define RING_FIFO_CNT  1000   // Fits into the ring, so the order is kept
+#define RING_OVER_CNT  200000 // More than the ring holds, the rest overflows
+#define RING_THREADS   4      // Producers, and as many consumers
+#define RING_PER_PROD  50000  // Inodes every producer pushes
+#define RING_PUSH_RUN  100    // Inodes pushed at once by a producer
+
+
+static atomic_uchar ring_seen[RING_OVER_CNT]; //!< How often every inode id was popped
+static atomic_bool  ring_pushed = false;      //!< Set once all producers are done
+
+
+/// @internal Create a queue element with the given id
+static xfs_in_t* make_in( uint64_t id ) {
+	xfs_in_t* in = slab_alloc( SLAB_INODE );
+	if ( in )
+		in->inode_id = id;
+	return in;
+}
+
+
+/// @internal Count the ids of @a cnt popped inodes and free them
+static void count_popped( xfs_in_t** out, size_t cnt ) {
+	for ( size_t i = 0; i < cnt; ++i ) {
+		if ( out[i]->inode_id < RING_OVER_CNT )
+			atomic_fetch_add( &ring_seen[out[i]->inode_id], 1 );
+		xfs_free_in( &out[i] );
+	}
+}
+
+
+/// @internal Return true if every id below @a cnt was popped exactly once
+static bool all_seen_once( uint64_t cnt ) {
+	bool res = true;
+	for ( uint64_t i = 0; i < cnt; ++i ) {
+		if ( 1 != atomic_load( &ring_seen[i] ) )
+			res = false;
+		atomic_store( &ring_seen[i], 0 );
+	}
+	return res;
+}
+
+
+static int producer( void* arg ) {
+	uint64_t  first = ( uintptr_t )arg * RING_PER_PROD;
+	xfs_in_t* run[RING_PUSH_RUN];
+
+	for ( uint64_t id = first; id < first + RING_PER_PROD; id += RING_PUSH_RUN ) {
+		for ( size_t i = 0; i < RING_PUSH_RUN; ++i )
+			run[i] = make_in( id + i );
+		if ( dir_in_push_batch( run, RING_PUSH_RUN ) )
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int consumer( void* arg ) {
+	xfs_in_t* out[IN_BATCH_MAX];
+	size_t    cnt;
+
+	( void )arg;
+	while ( true ) {
+		bool done = atomic_load( &ring_pushed ); // Before the pop, or the last pushes may be missed
+		cnt       = dir_in_pop_batch( out, IN_BATCH_MAX, 10 );
+		if ( !cnt && done )
+			break;
+		count_popped( out, cnt );
+	}
+
+	return 0;
+}
+
+
+int main( void ) {
+	xfs_in_t*  out[IN_BATCH_MAX];
+	in_stats_t stats;
+	size_t     cnt;
+	size_t     got = 0;
+
+	// 1) Single elements come out in the order they went in
+	for ( uint64_t i = 0; i < RING_FIFO_CNT; ++i )
+		CHECK( 0 == file_in_push( make_in( i ) ) );
+	while ( ( cnt = file_in_pop_batch( out, IN_BATCH_MAX, 0 ) ) ) {
+		for ( size_t i = 0; i < cnt; ++i ) {
+			CHECK( out[i]->inode_id == got + i );
+			xfs_free_in( &out[i] );
+		}
+		got += cnt;
+	}
+	CHECK( RING_FIFO_CNT == got );
+	CHECK( NULL == file_in_pop() );
+
+	// 2) Nothing is lost if the ring overflows
+	for ( uint64_t i = 0; i < RING_OVER_CNT; ++i )
+		CHECK( 0 == file_in_push( make_in( i ) ) );
+	in_get_stats( &stats );
+	CHECK( RING_OVER_CNT == stats.file_depth );
+	CHECK( 0 == stats.dir_depth );
+	while ( ( cnt = file_in_pop_batch( out, IN_BATCH_MAX, 0 ) ) )
+		count_popped( out, cnt );
+	CHECK( all_seen_once( RING_OVER_CNT ) );
+	in_get_stats( &stats );
+	CHECK( 0 == stats.file_depth );
+
+	// 3) Concurrent producers and consumers hand over every element exactly once
+	thrd_t prod[RING_THREADS];
+	thrd_t cons[RING_THREADS];
+	int    res;
+
+	for ( uintptr_t i = 0; i < RING_THREADS; ++i ) {
+		CHECK( thrd_success == thrd_create( &cons[i], consumer, NULL ) );
+		CHECK( thrd_success == thrd_create( &prod[i], producer, ( void* )i ) );
+	}
+	for ( size_t i = 0; i < RING_THREADS; ++i ) {
+		thrd_join( prod[i], &res );
+		CHECK( 0 == res );
+	}
+	atomic_store( &ring_pushed, true );
+	for ( size_t i = 0; i < RING_THREADS; ++i )
+		thrd_join( cons[i], NULL );
+	CHECK( all_seen_once( RING_THREADS * RING_PER_PROD ) );
+	CHECK( NULL == dir_in_pop() );
+
+	in_clear();
+	slab_release();
+
+	CHECK_DONE( "inode queue rings" );
+}
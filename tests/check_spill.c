@@ -0,0 +1,217 @@
+/*******************************************************************************
+ * check_spill.c : Round trip of inodes through the spill segments
+ ******************************************************************************/
+
+
+#include "check.h"
+
+#include "file_type.h"
+#include "globals.h"
+#include "slab.h"
+#include "spill.h"
+
+
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SPILL_FIRST  3        // Inodes spilled before the first read
+#define SPILL_TOTAL  1000     // Inodes spilled in total
+#define SPILL_LOCAL  "hello, spill!"
+
+
+/// @internal Add a copy of @a str to the arena of @a in_data
+static char* arena_str( xfs_in_data_t* in_data, char const* str ) {
+	char* copy = arena_alloc( &in_data->arena, strlen( str ) + 1 );
+	if ( copy )
+		strcpy( copy, str );
+	return copy;
+}
+
+
+/// @internal Create a vector of @a count extents, the first at @a block
+static xfs_ex_vec_t* make_exts( uint32_t count, uint64_t block ) {
+	xfs_ex_vec_t* vec = xfs_ex_create( NULL, count );
+
+	for ( uint32_t i = 0; vec && ( i < count ); ++i ) {
+		xfs_ex_t ex = { .is_prealloc = i & 1, .offset = i * 8, .block = block + ( i * 100 ), .length = i + 1 };
+		xfs_write_ex( vec->packed + ( i * XFS_EX_SIZE ), &ex );
+	}
+
+	return vec;
+}
+
+
+/** @internal Create inode number @a id
+  * Odd inodes have local data, even ones have data and xattr extents and two xattrs.
+**/
+static xfs_in_t* make_in( uint64_t id ) {
+	xfs_in_t*      in      = slab_alloc( SLAB_INODE );
+	xfs_in_data_t* in_data = in ? xfs_get_in_data( in ) : NULL;
+
+	if ( NULL == in_data )
+		return in;
+
+	in->inode_id  = id;
+	in->ag_num    = id & 1;
+	in->pos       = id * 512;
+	in->ctime_ep  = 1700000000 + id;
+	in->ftype     = FT_FILE;
+	in->is_mapped = true;
+
+	if ( id & 1 ) {
+		in->file_size       = strlen( SPILL_LOCAL );
+		in_data->d_loc_data = ( uint8_t* )arena_str( in_data, SPILL_LOCAL );
+		return in;
+	}
+
+	in->file_size   = 8192 + id;
+	in->d_exts      = make_exts( 1 + ( id % 5 ), id );
+	in_data->x_exts = make_exts( 1, id + 7 );
+
+	xattr_t* first  = slab_alloc( SLAB_XATTR );
+	xattr_t* second = slab_alloc( SLAB_XATTR );
+	first->flags    = 0x2;
+	first->name     = arena_str( in_data, "user.origin" );
+	first->value    = arena_str( in_data, "check_spill" );
+	first->next     = second;
+	second->name    = arena_str( in_data, "trusted.empty" );
+	second->value   = arena_str( in_data, "" );
+	in_data->xattr_root = first;
+
+	return in;
+}
+
+
+/// @internal Return true if the extents of @a vec are those of make_exts( count, block )
+static bool exts_match( xfs_ex_vec_t const* vec, uint32_t count, uint64_t block ) {
+	xfs_ex_t ex;
+
+	if ( ( NULL == vec ) || ( count != vec->count ) )
+		return false;
+	for ( uint32_t i = 0; i < count; ++i ) {
+		if ( xfs_ex_at( vec, i, &ex )
+		  || ( ex.is_prealloc != ( i & 1 ) ) || ( ex.offset != i * 8 )
+		  || ( ex.block != block + ( i * 100 ) ) || ( ex.length != i + 1 ) )
+			return false;
+	}
+
+	return true;
+}
+
+
+/// @internal Check that @a in came back as make_in( @a id ) created it, and free it
+static void check_in( xfs_in_t* in, uint64_t id ) {
+	CHECK( NULL != in );
+	if ( NULL == in )
+		return;
+
+	CHECK( id == in->inode_id );
+	CHECK( ( id & 1 ) == in->ag_num );
+	CHECK( id * 512 == in->pos );
+	CHECK( 1700000000 + id == in->ctime_ep );
+	CHECK( FT_FILE == in->ftype );
+	CHECK( in->is_mapped );
+	CHECK( NULL != in->data );
+
+	if ( NULL == in->data ) {
+		xfs_free_in( &in );
+		return;
+	}
+
+	if ( id & 1 ) {
+		CHECK( strlen( SPILL_LOCAL ) == in->file_size );
+		CHECK( in->data->d_loc_data && !memcmp( in->data->d_loc_data, SPILL_LOCAL, strlen( SPILL_LOCAL ) ) );
+		CHECK( NULL == in->d_exts );
+		CHECK( NULL == in->data->xattr_root );
+	} else {
+		xattr_t const* xa = in->data->xattr_root;
+
+		CHECK( 8192 + id == in->file_size );
+		CHECK( NULL == in->data->d_loc_data );
+		CHECK( exts_match( in->d_exts, 1 + ( id % 5 ), id ) );
+		CHECK( exts_match( in->data->x_exts, 1, id + 7 ) );
+		CHECK( xa && ( 0x2 == xa->flags ) && !strcmp( xa->name, "user.origin" ) && !strcmp( xa->value, "check_spill" ) );
+		xa = xa ? xa->next : NULL;
+		CHECK( xa && !xa->flags && !strcmp( xa->name, "trusted.empty" ) && !strcmp( xa->value, "" ) );
+		CHECK( xa && !xa->next );
+	}
+
+	xfs_free_in( &in );
+}
+
+
+/// @internal Return the number of entries in @a path, besides "." and ".."
+static int count_files( char const* path ) {
+	DIR*           dir = opendir( path );
+	struct dirent* ent;
+	int            cnt = 0;
+
+	if ( NULL == dir )
+		return -1;
+	while ( ( ent = readdir( dir ) ) ) {
+		if ( strcmp( ent->d_name, "." ) && strcmp( ent->d_name, ".." ) )
+			++cnt;
+	}
+	closedir( dir );
+
+	return cnt;
+}
+
+
+int main( void ) {
+	char      dir[] = "/tmp/xfs_undelete_spill_XXXXXX";
+	xfs_sb_t  sb    = { .log2_ag_size = 16, .log2_inode_block = 3 };
+	xfs_in_t* in    = NULL;
+	uint64_t  next  = 0;
+
+	// Spilled inodes are checked against the AG count, dropped ones leave the catalog
+	superblocks = &sb;
+	sb_ag_count = 2;
+
+	if ( NULL == mkdtemp( dir ) ) {
+		perror( "mkdtemp" );
+		return EXIT_FAILURE;
+	}
+
+	// 1) Nothing is spilled without a spill directory
+	in = make_in( 0 );
+	CHECK( !spill_is_open() );
+	CHECK( 0 == spill_write( &in ) );
+	CHECK( NULL != in );
+	xfs_free_in( &in );
+
+	// 2) Write a few, read one back, so the segment is sealed while there are inodes left
+	CHECK( 0 == spill_open( dir ) );
+	CHECK( spill_is_open() );
+	for ( uint64_t id = 0; id < SPILL_FIRST; ++id ) {
+		in = make_in( id );
+		CHECK( 1 == spill_write( &in ) );
+		CHECK( NULL == in );
+	}
+	CHECK( SPILL_FIRST == spill_count() );
+	check_in( spill_read(), next++ );
+
+	// 3) The rest goes into a new segment and comes back in order behind the first
+	for ( uint64_t id = SPILL_FIRST; id < SPILL_TOTAL; ++id ) {
+		in = make_in( id );
+		CHECK( 1 == spill_write( &in ) );
+	}
+	CHECK( SPILL_TOTAL - 1 == spill_count() );
+	while ( ( in = spill_read() ) )
+		check_in( in, next++ );
+	CHECK( SPILL_TOTAL == next );
+	CHECK( 0 == spill_count() );
+
+	// 4) Closing removes all segments
+	spill_close();
+	CHECK( !spill_is_open() );
+	CHECK( 0 == count_files( dir ) );
+	rmdir( dir );
+
+	slab_release();
+	superblocks = NULL;
+
+	CHECK_DONE( "spill round trip" );
+}